@@ -81,8 +81,8 @@ struct Edecl {
         // compound stmt
         struct Edecl *body;
 
-        // switch/case/default/break stmt
-        char *label;
+        // case/default stmt
+        struct Block *block;
         struct Param *params;
         struct Edecl *next;
 };
@@ -103,9 +103,70 @@ struct Expr {
         struct Expr *rhs;
 };
 
+// clang-format off
+enum InsnKind {
+        I_RRR,   /* op rd,rs1,rs2 */
+        I_RRI,   /* op rd,rs1,imm */
+        I_RR,    /* op rd,rs1 */
+        I_LI,    /* li rd,imm */
+        I_BR,    /* op rs1,rs2,label */
+        I_J,     /* j label */
+        I_CALL,  /* call label; clobbers the caller-saved registers */
+        I_LABEL, /* label: */
+        I_RET    /* epilogue */
+};
+// clang-format on
+
+struct Insn {
+        enum InsnKind kind;
+        const char *op;
+        int rd, rs1, rs2; /* x0-x31 below NREGS, virtual registers from there on; -1 if unused */
+        int64_t imm;
+        char *label;
+};
+
+// clang-format off
+enum IrOp {
+        IR_LI, IR_MOV, IR_PARAM, IR_CALL, IR_PHI,
+        IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD, IR_AND, IR_OR, IR_XOR, IR_SHL, IR_SHR,
+        IR_LT, IR_GT, IR_LE, IR_GE, IR_EQ, IR_NE, IR_NOT, IR_COMPL,
+        IR_JMP, IR_BR, IR_RET /* terminators */
+};
+// clang-format on
+
+struct Ir {
+        enum IrOp op;
+        int dst, a, b; /* virtual registers, -1 if unused */
+        int64_t imm;   /* IR_LI value, IR_PARAM index, IR_PHI variable */
+        char *name;    /* IR_CALL callee */
+        int *args;     /* IR_CALL arguments; IR_PHI values, one per predecessor */
+        int nargs;
+        bool dead;     /* to be removed by sweep() */
+        struct Ir *next;
+};
+
+struct Block {
+        int id;
+        char *label;
+        struct Ir *head, *tail; /* tail is the terminator */
+        struct Block *succ[2];  /* IR_JMP: succ[0]; IR_BR: succ[0] if a != 0, succ[1] otherwise */
+        struct Block **preds;
+        int npreds;
+        bool reached;
+        struct Block *next; /* in layout order */
+
+        /* optimizer */
+        int index;                /* in reverse postorder */
+        struct Block *idom;       /* immediate dominator */
+        struct Block **kids;      /* blocks it immediately dominates */
+        int nkids;
+        struct Block **df;        /* dominance frontier */
+        int ndf;
+        bool executable, edge[2]; /* reached by sccp(), and along which successor edges */
+};
+
 /* GLOBALS */
-int LEN;    /* used in the scanning step to keep track of string length for identifiers and scon */
-int OFFSET; /* used to sum local var offsets during function definition parsing */
+int LEN; /* used in the scanning step to keep track of string length for identifiers and scon */
 #define TYPE_INT 0x0000000000000003  // 0000,0000,0011
 
 /* --------- HASH TABLE --------- */
@@ -116,7 +177,8 @@ struct KeyValuePair {
 
 struct Sym {
         int64_t value;
-        int offset;
+        int reg;           /* virtual register of the variable */
+        struct Edecl *fn;  /* function reg was numbered for */
 };
 
 #define TABLE_SIZE 4096
@@ -136,7 +198,6 @@ void insert(const char *key, int64_t value) {
         ht[index].key = key;
         struct Sym *sym = calloc(1, sizeof(struct Sym));
         sym->value = value;
-        sym->offset = 0;
         ht[index].sym = sym;
 }
 
@@ -179,22 +240,39 @@ struct Edecl *declaration(struct Token **token);
 struct Expr *binary(int k, struct Token **token);
 struct Expr *primary(struct Token **token);
 struct Edecl *stmt(struct Token **token);
-void cg_stmt(struct Edecl *lstmt);
-char *cg_expr(struct Expr *cond);
-char *nextr(void);
-void prevr(char *r);
+void ir_stmt(struct Edecl *lstmt);
+int ir_expr(struct Expr *cond);
+void ir_cond(struct Expr *cond, struct Block *t, struct Block *f);
+void ir_assign(int var, struct Expr *expr);
 int indexify(struct Token *token);
 struct Expr *asgn(struct Token **token);
-void assignoffsets(struct Edecl **decls);
 struct Expr *cond(struct Token **token);
 struct Expr *unary(struct Token **token);
 struct Expr *postfix(struct Token **token);
 int nexti(void);
-void assignlabelsAndgenjumps(struct Edecl *lstmt, char *rg1, char *label);
-void assigncontlabel(struct Edecl *lstmt, char *label);
 struct Edecl *function(struct Token **token);
 struct Param *params(struct Token **token);
-void cg_params(struct Param *params);
+void ir_params(struct Param *params);
+int newvreg(void);
+struct Block *newblock(void);
+void place(struct Block *b);
+struct Ir *ir(enum IrOp op, int dst, int a, int b);
+void terminate(enum IrOp op, int a, struct Block *succ0, struct Block *succ1);
+void linkcfg(void);
+void printIr(void);
+void optimize(void);
+void tossa(void);
+void fromssa(void);
+bool sccp(void);
+bool copyprop(void);
+bool gvn(void);
+bool dce(void);
+void lower(void);
+void lowerir(struct Ir *in, struct Block *b);
+void lowerbranch(struct Ir *in, struct Block *b);
+void tidyjumps(void);
+void regalloc(void);
+void emitfn(void);
 
 struct Token *newtoken(enum TokenKind kind, const char *lexeme) {
         struct Token *token = calloc(1, sizeof(struct Token));
@@ -451,7 +529,6 @@ struct Edecl *parse(struct Token *head) {
         struct Edecl *prog = calloc(1, sizeof(struct Edecl));
         struct Edecl *p = prog;
         while (current->kind != TEOF) {
-                OFFSET = -16; /* for return address and prev frame pointer */
                 p = p->next = function(&current);
         }
         return prog->next;
@@ -482,7 +559,6 @@ struct Param *params(struct Token **token) {
         struct Param *prms = calloc(1, sizeof(struct Param));
         struct Param *p = prms;
         while (current->kind != CPAR) {
-                OFFSET -= 8;
                 p = p->next = calloc(1, sizeof(struct Param));
                 p->type |= TYPE_INT;
                 consume(&current, INT);
@@ -491,8 +567,6 @@ struct Param *params(struct Token **token) {
                 if (current->kind == COMMA) consume(&current, COMMA);
 
                 insert(p->name, -100);
-                struct Sym *sym = get(p->name);
-                sym->offset = OFFSET;
         }
         *token = current;
         return prms->next;
@@ -514,8 +588,6 @@ struct Edecl *declaration(struct Token **token) {
                 consume(&current, ASGN);
                 ldecl->value = asgn(&current);
         }
-        OFFSET -= 8;
-
         int value = -100;
         if (ldecl->value != NULL && ldecl->value->kind == E_ICON) {
                 value = ldecl->value->value;
@@ -811,196 +883,237 @@ struct Expr *primary(struct Token **token) {
 }
 
 /* ----------------------------------------------------------------------------------------------------------- */
-/* ------------------------------------------------- CODEGEN ------------------------------------------------- */
+/* ---------------------------------------------------- IR --------------------------------------------------- */
 /* ----------------------------------------------------------------------------------------------------------- */
+/* a function is built into basic blocks of three-address instructions on virtual registers, one per local
+   variable and one per value an expression computes. control flow only leaves a block through its terminator,
+   so branches, loops, switch, goto, break and continue all become edges between blocks. lower() then turns
+   the blocks into RISC-V instructions, after optimize() has rewritten them at -O1 and up, regalloc() maps
+   the virtual registers to machine ones and emitfn() prints the function */
+#define NREGS 32 /* register numbers below are x0-x31, the ones from here on virtual */
+#define A0 10
+#define T5 30
+#define T6 31
+
+// clang-format off
+static const char *irname[] = {
+"li", "mov", "param", "call", "phi", "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "shr",
+"lt", "gt", "le", "ge", "eq", "ne", "not", "compl", "jmp", "br", "ret"};
+// clang-format on
+
+struct GotoLabel {
+        char *name;
+        struct Block *block;
+        struct GotoLabel *next;
+};
+
 static struct Edecl *current_fn;
-void codegen(struct Edecl *decl) {
+static struct Block *entry;
+static struct Block *cur;       /* block being built, NULL right after a terminator */
+static struct Block *lastblock; /* in layout order */
+static struct Block *breakto, *contto;
+static struct GotoLabel *gotolabels;
+static int nvregs;
+static int optlevel;
+
+void codegen(struct Edecl *decl, bool dumpir) {
         for (struct Edecl *d = decl; d; d = d->next) {
                 current_fn = d;
-                printf("  .globl %s\n", d->name);
-                printf("%s:\n", d->name);
+                nvregs = NREGS;
+                gotolabels = NULL;
+                entry = lastblock = cur = NULL;
+
+                place(newblock());
+                ir_params(d->params);
+                ir_stmt(d->body);
+                if (cur != NULL) { /* falling off the end returns 0, as main does */
+                        struct Ir *zero = ir(IR_LI, newvreg(), -1, -1);
+                        terminate(IR_RET, zero->dst, NULL, NULL);
+                }
+                linkcfg();
+                if (optlevel > 0) optimize();
 
-                // prologue
-                printf("  addi    sp,sp,-32\n"); /* allocate space on stack */
-                printf("  sd      ra,24(sp)\n"); /* save return address */
-                printf("  sd      s0,16(sp)\n"); /* save prev frame pointer */
-                printf("  addi    s0,sp,32\n");  /* adjust new frame pointer */
+                if (dumpir) {
+                        printIr();
+                        continue;
+                }
+                lower();
+                regalloc();
+                emitfn();
+        }
+}
 
-                cg_params(d->params);
+struct Block *newblock(void) {
+        struct Block *b = calloc(1, sizeof(struct Block));
+        b->id = nexti();
+        b->label = allocfstr(".L.%d", b->id);
+        return b;
+}
 
-                // body
-                assignoffsets(&d->body);
-                cg_stmt(d->body);
+/* continues building in b, placed after the blocks so far; falls through into it from an unfinished block */
+void place(struct Block *b) {
+        if (cur != NULL) terminate(IR_JMP, -1, b, NULL);
+        if (lastblock == NULL)
+                entry = b;
+        else
+                lastblock->next = b;
+        lastblock = cur = b;
+}
 
-                // epilogue
-                printf(".L.end.%s:\n", d->name);
-                printf("  ld      ra,24(sp)\n");
-                printf("  ld      s0,16(sp)\n");
-                printf("  addi    sp,sp,32\n");
-                printf("  jr      ra\n\n");
-        }
+struct Ir *ir(enum IrOp op, int dst, int a, int b) {
+        if (cur == NULL) place(newblock()); /* unreachable code, dropped by linkcfg() */
+        struct Ir *in = calloc(1, sizeof(struct Ir));
+        in->op = op;
+        in->dst = dst;
+        in->a = a;
+        in->b = b;
+        if (cur->tail == NULL)
+                cur->head = in;
+        else
+                cur->tail->next = in;
+        cur->tail = in;
+        return in;
 }
 
-void cg_params(struct Param *params) {
-        struct Param *p = params;
-        int pcnt = 0;
-        while (p) {
-                char *rg = nextr();
-                printf("  mv      %s,a%d\n", rg, pcnt);
-                struct Sym *sym = get(p->name);
-                printf("  sw      %s,%d(s0)\n", rg, sym->offset);
-                prevr(rg);
+void terminate(enum IrOp op, int a, struct Block *succ0, struct Block *succ1) {
+        ir(op, -1, a, -1);
+        cur->succ[0] = succ0;
+        cur->succ[1] = succ1;
+        cur = NULL;
+}
 
-                p = p->next;
-                pcnt++;
+int newvreg(void) { return nvregs++; }
+
+int symreg(const char *name) {
+        struct Sym *sym = get(name);
+        assert(sym != NULL);
+        if (sym->fn != current_fn) {
+                sym->fn = current_fn;
+                sym->reg = newvreg();
         }
+        return sym->reg;
 }
 
-void assignoffsets(struct Edecl **decls) {
-        // single declaration ('init' of 'for' stmt)
-        if ((*decls)->kind == DECL) {
-                struct Sym *sym = get((*decls)->name);
-                sym->offset = OFFSET;
-                OFFSET += 8;
-                return;
-        }
-        // 'compound' stmt
-        for (struct Edecl *current = (*decls)->body; current; current = current->next) {
-                if (current->kind != DECL) {
-                        if (current->then && current->then->kind == S_COMP)
-                                assignoffsets(&(current->then));
-                        if (current->then && current->then->kind == S_FOR)
-                                assignoffsets(&(current->then->init));
-                        continue;
-                }
-                struct Sym *sym = get(current->name);
-                sym->offset = OFFSET;
-                OFFSET += 8;
-        }
-}
-
-void assignlabelsAndgenjumps(struct Edecl *lstmt, char *rg1, char *label) {
-        for (struct Edecl *s = lstmt->body; s; s = s->next) {
-                int i = nexti();
-                if (s->kind == S_CASE) {
-                        s->label = allocfstr(".L.end.%d", i);
-                        char *rg2 = cg_expr(s->cond);
-                        printf("  xor     %s,%s,%s\n", rg2, rg1, rg2);
-                        printf("  beqz    %s,%s\n", rg2, s->label);
-                        prevr(rg2);
-                        if (s->then && s->then->kind == S_COMP)
-                                assignlabelsAndgenjumps(s->then, rg1, label);
-                } else if (s->kind == S_DEFAULT) {
-                        s->label = allocfstr(".L.end.%d", i);
-                        printf("  j %s\n", s->label);
-                        if (s->then && s->then->kind == S_COMP)
-                                assignlabelsAndgenjumps(s->then, rg1, label);
-                } else if (s->kind == S_BREAK) {
-                        s->label = copystr(label);
-                }
+struct Block *gotolabel(char *name) {
+        for (struct GotoLabel *l = gotolabels; l; l = l->next)
+                if (strcmp(l->name, name) == 0) return l->block;
+        struct GotoLabel *l = calloc(1, sizeof(struct GotoLabel));
+        l->name = name;
+        l->block = newblock();
+        l->next = gotolabels;
+        gotolabels = l;
+        return l->block;
+}
+
+void ir_params(struct Param *params) {
+        int pcnt = 0;
+        for (struct Param *p = params; p; p = p->next) {
+                assert(pcnt < 8);
+                ir(IR_PARAM, symreg(p->name), -1, -1)->imm = pcnt++;
         }
 }
 
-void assigncontlabel(struct Edecl *lstmt, char *label) {
-        if (lstmt->kind == S_CONTINUE) {
-                lstmt->label = copystr(label);
-        } else if (lstmt->kind == S_COMP) {
-                for (struct Edecl *s = lstmt->body; s; s = s->next) {
-                        assigncontlabel(s, label);
-                }
-        } else {
-                if (lstmt->then) assigncontlabel(lstmt->then, label);
+/* the compare-and-branch chain of a switch: every case and default of its body, nested switches aside, gets
+   a block to jump to */
+void ir_cases(struct Edecl *s, int rg1, struct Edecl **deflt) {
+        if (s == NULL || s->kind == S_SWITCH) return;
+        if (s->kind == S_CASE) {
+                s->block = newblock();
+                int rg2 = ir_expr(s->cond);
+                int rg = ir(IR_EQ, newvreg(), rg1, rg2)->dst;
+                struct Block *next = newblock();
+                terminate(IR_BR, rg, s->block, next);
+                place(next);
+        } else if (s->kind == S_DEFAULT) {
+                s->block = newblock();
+                *deflt = s;
+        } else if (s->kind == S_COMP) {
+                for (struct Edecl *d = s->body; d; d = d->next) ir_cases(d, rg1, deflt);
         }
+        ir_cases(s->then, rg1, deflt);
+        ir_cases(s->els, rg1, deflt);
 }
 
-void cg_stmt(struct Edecl *lstmt) {
+void ir_stmt(struct Edecl *lstmt) {
+        struct Block *oldbreak = breakto, *oldcont = contto;
         if (lstmt->kind == S_IF) {
-                int i = nexti();
-                char *rg = cg_expr(lstmt->cond);
-                printf("  beqz    %s,.L.end.%d\n", rg, i);
-                prevr(rg);
-                cg_stmt(lstmt->then);
-                printf(".L.end.%d:\n", i);
+                struct Block *then = newblock(), *end = newblock();
+                struct Block *els = lstmt->els != NULL ? newblock() : end;
+                ir_cond(lstmt->cond, then, els);
+                place(then);
+                ir_stmt(lstmt->then);
                 if (lstmt->els != NULL) {
-                        cg_stmt(lstmt->els);
+                        terminate(IR_JMP, -1, end, NULL);
+                        place(els);
+                        ir_stmt(lstmt->els);
                 }
+                place(end);
         } else if (lstmt->kind == S_SWITCH) {
-                char *rg1 = cg_expr(lstmt->cond);
-                int ii = nexti();
-                lstmt->label = allocfstr(".L.end.%d", ii);
-                assignlabelsAndgenjumps(lstmt->then, rg1, lstmt->label);
-                printf("  j %s\n", lstmt->label);
-                cg_stmt(lstmt->then);
-                printf("%s:\n", lstmt->label);
-                prevr(rg1);
+                int rg1 = ir_expr(lstmt->cond);
+                struct Edecl *deflt = NULL;
+                struct Block *end = newblock();
+                ir_cases(lstmt->then, rg1, &deflt);
+                terminate(IR_JMP, -1, deflt != NULL ? deflt->block : end, NULL);
+                breakto = end;
+                ir_stmt(lstmt->then);
+                place(end);
         } else if (lstmt->kind == S_CASE || lstmt->kind == S_DEFAULT) {
-                assert(lstmt->label != NULL);
-                printf("%s:\n", lstmt->label);
-                cg_stmt(lstmt->then);
+                assert(lstmt->block != NULL);
+                place(lstmt->block);
+                ir_stmt(lstmt->then);
         } else if (lstmt->kind == S_BREAK || lstmt->kind == S_CONTINUE) {
-                assert(lstmt->label != NULL);
-                printf("  j %s\n", lstmt->label);
+                struct Block *to = lstmt->kind == S_BREAK ? breakto : contto;
+                assert(to != NULL);
+                terminate(IR_JMP, -1, to, NULL);
         } else if (lstmt->kind == S_DO) {
-                int i = nexti();
-                printf(".Loop.%d:\n", i);
-                cg_stmt(lstmt->then);
-                char *rg = cg_expr(lstmt->cond);
-                printf("  beqz    %s,.L.end.%d\n", rg, i);
-                prevr(rg);
-                printf("  j .Loop.%d\n", i);
-                printf(".L.end.%d:\n", i);
+                struct Block *body = newblock(), *test = newblock(), *end = newblock();
+                place(body);
+                breakto = end;
+                contto = test;
+                ir_stmt(lstmt->then);
+                place(test);
+                ir_cond(lstmt->cond, body, end);
+                place(end);
         } else if (lstmt->kind == S_WHILE || lstmt->kind == S_FOR) {
-                char *contlabel = allocfstr(".L.end.%d", nexti());
-                assigncontlabel(lstmt->then, contlabel);
-
-                int i = nexti();
+                struct Block *test = newblock(), *body = newblock(), *end = newblock();
+                struct Block *step = lstmt->kind == S_FOR ? newblock() : test;
                 if (lstmt->kind == S_FOR) {
-                        if (lstmt->init->kind == DECL) {
-                                struct Sym *sym = get(lstmt->init->name);
-                                char *rg = cg_expr(lstmt->init->value);
-                                printf("  sw      %s,%d(s0)\n", rg, sym->offset);
-                                prevr(rg);
-                        } else
-                                cg_stmt(lstmt->init);
+                        if (lstmt->init->kind == DECL)
+                                ir_assign(symreg(lstmt->init->name), lstmt->init->value);
+                        else
+                                ir_stmt(lstmt->init);
                 }
-                printf(".Loop.%d:\n", i);
-                char *rg = cg_expr(lstmt->cond);
-                printf("  beqz    %s,.L.end.%d\n", rg, i);
-                prevr(rg);
-                cg_stmt(lstmt->then);
-                printf("%s:\n", contlabel);
+                place(test);
+                ir_cond(lstmt->cond, body, end);
+                place(body);
+                breakto = end;
+                contto = step;
+                ir_stmt(lstmt->then);
                 if (lstmt->kind == S_FOR) {
-                        char *rg = cg_expr(lstmt->inc);
-                        prevr(rg);
+                        place(step);
+                        ir_expr(lstmt->inc);
                 }
-                printf("  j .Loop.%d\n", i);
-                printf(".L.end.%d:\n", i);
+                terminate(IR_JMP, -1, test, NULL);
+                place(end);
         } else if (lstmt->kind == S_RETURN) {
-                char *rg = cg_expr(lstmt->value);
-                printf("  mv      a0,%s\n", rg);
-                printf("  j      .L.end.%s\n", current_fn->name);
-                prevr(rg);
+                int rg = ir_expr(lstmt->value);
+                terminate(IR_RET, rg, NULL, NULL);
         } else if (lstmt->kind == S_EXPR) {
-                char *rg = cg_expr(lstmt->value);
-                prevr(rg);
+                ir_expr(lstmt->value);
         } else if (lstmt->kind == S_GOTO) {
-                printf("  j %s\n", lstmt->cond->ident);
+                terminate(IR_JMP, -1, gotolabel(lstmt->cond->ident), NULL);
         } else if (lstmt->kind == S_LABEL) {
                 assert(lstmt->cond->ident != NULL);
-                printf("%s:\n", lstmt->cond->ident);
-                cg_stmt(lstmt->then);
+                place(gotolabel(lstmt->cond->ident));
+                ir_stmt(lstmt->then);
         } else if (lstmt->kind == S_COMP) {
                 struct Edecl *declOrStmt = lstmt->body;
                 while (declOrStmt != NULL) {
                         if (declOrStmt->kind == DECL) {
-                                if (declOrStmt->value != NULL) {
-                                        struct Sym *sym = get(declOrStmt->name);
-                                        char *rg = cg_expr(declOrStmt->value);
-                                        printf("  sw      %s,%d(s0)\n", rg, sym->offset);
-                                        prevr(rg);
-                                }
+                                if (declOrStmt->value != NULL)
+                                        ir_assign(symreg(declOrStmt->name), declOrStmt->value);
                         } else {
-                                cg_stmt(declOrStmt);
+                                ir_stmt(declOrStmt);
                         }
                         declOrStmt = declOrStmt->next;
                 }
@@ -1008,133 +1121,189 @@ void cg_stmt(struct Edecl *lstmt) {
                 ;
         } else
                 assert(0);
+        breakto = oldbreak;
+        contto = oldcont;
 }
 
-char *cg_expr(struct Expr *cond) {
-        static int paramindex;
-        char *rg = nextr();
+/* evaluates expr into var; an instruction computing a new value writes var instead of a temporary */
+void ir_assign(int var, struct Expr *expr) {
+        int rg = ir_expr(expr);
+        if (expr->kind != E_IDENT && expr->kind != E_ASGN && cur != NULL && cur->tail != NULL &&
+            cur->tail->dst == rg)
+                cur->tail->dst = var;
+        else
+                ir(IR_MOV, var, rg, -1);
+}
+
+enum IrOp irop(enum ExprKind kind) {
+        switch (kind) {
+                // clang-format off
+                case E_ADD: case E_PADD:        return IR_ADD;
+                case E_SUB: case E_PSUB:        return IR_SUB;
+                case E_MUL:                     return IR_MUL;
+                case E_DIV:                     return IR_DIV;
+                case E_MOD:                     return IR_MOD;
+                case E_BAND:                    return IR_AND;
+                case E_BOR:                     return IR_OR;
+                case E_XOR:                     return IR_XOR;
+                case E_LSH:                     return IR_SHL;
+                case E_RSH:                     return IR_SHR;
+                case E_LT:                      return IR_LT;
+                case E_GT:                      return IR_GT;
+                case E_LE:                      return IR_LE;
+                case E_GE:                      return IR_GE;
+                case E_EQ:                      return IR_EQ;
+                case E_NEQ:                     return IR_NE;
+                default: assert(0);
+                        // clang-format on
+        }
+}
+
+int ir_expr(struct Expr *cond) {
+        int rg;
         assert(cond != NULL);
 
         if (cond->kind == E_ICON) {
-                printf("  li      %s,%lu\n", rg, cond->value);
+                rg = newvreg();
+                ir(IR_LI, rg, -1, -1)->imm = cond->value;
         } else if (cond->kind == E_IDENT) {
-                struct Sym *sym = get(cond->ident);
-                printf("  lw      %s,%d(s0)\n", rg, sym->offset);
+                rg = symreg(cond->ident);
         } else if (cond->kind == E_ASGN) {
-                struct Sym *sym = get(cond->lhs->ident);
-                char *rhs = cg_expr(cond->rhs);
-                printf("  sw      %s,%d(s0)\n", rhs, sym->offset);
+                rg = symreg(cond->lhs->ident);
+                ir_assign(rg, cond->rhs);
                 if (cond->rhs->kind == E_PADD || cond->rhs->kind == E_PSUB) {
-                        int incr = -1;
-                        if (cond->rhs->kind == E_PSUB) incr = 1;
-                        printf("  addi     %s,%s,%d\n", rhs, rhs, incr);
+                        struct Ir *one = ir(IR_LI, newvreg(), -1, -1);
+                        one->imm = 1;
+                        enum IrOp op = cond->rhs->kind == E_PADD ? IR_SUB : IR_ADD;
+                        rg = ir(op, newvreg(), rg, one->dst)->dst;
                 }
-                // printf("  mv      %s,%s\n", rg, rhs);
-                prevr(rhs);
         } else if (cond->kind == E_COND) {
-                int i = nexti();
-                char *con = cg_expr(cond->lhs);
-                char *tcase = cg_expr(cond->rhs->lhs);
-                char *fcase = cg_expr(cond->rhs->rhs);
-                printf("  beqz    %s,.L.else.%d\n", con, i);
-                printf("  mv      %s,%s\n", rg, tcase);
-                printf("  j       .L.end.%d\n", i);
-                printf(".L.else.%d:\n", i);
-                printf("  mv      %s,%s\n", rg, fcase);
-                printf(".L.end.%d:\n", i);
-                prevr(con);
-                prevr(tcase);
-                prevr(fcase);
-        } else if (cond->kind == E_NOT) {
-                char *e = cg_expr(cond->lhs);
-                printf("  snez      %s,%s\n", rg, e);
-                printf("  xori      %s,%s,1\n", rg, rg); /* invert least significant bit */
-                prevr(e);
-        } else if (cond->kind == E_BCOMPL) {
-                char *e = cg_expr(cond->lhs);
-                printf("  not      %s,%s\n", rg, e);
-                prevr(e);
+                struct Block *tcase = newblock(), *fcase = newblock(), *end = newblock();
+                rg = newvreg();
+                ir_cond(cond->lhs, tcase, fcase);
+                place(tcase);
+                ir_assign(rg, cond->rhs->lhs);
+                terminate(IR_JMP, -1, end, NULL);
+                place(fcase);
+                ir_assign(rg, cond->rhs->rhs);
+                place(end);
+        } else if (cond->kind == E_LAND || cond->kind == E_LOR) {
+                struct Block *tcase = newblock(), *fcase = newblock(), *end = newblock();
+                rg = newvreg();
+                ir_cond(cond, tcase, fcase);
+                place(tcase);
+                ir(IR_LI, rg, -1, -1)->imm = 1;
+                terminate(IR_JMP, -1, end, NULL);
+                place(fcase);
+                ir(IR_LI, rg, -1, -1)->imm = 0;
+                place(end);
+        } else if (cond->kind == E_NOT || cond->kind == E_BCOMPL) {
+                int e = ir_expr(cond->lhs);
+                rg = ir(cond->kind == E_NOT ? IR_NOT : IR_COMPL, newvreg(), e, -1)->dst;
         } else if (cond->kind == E_FUNCALL) {
-                paramindex = 0;
-                char *rg1 = cg_expr(cond->rhs); /* load args to a0-... */
-                prevr(rg1);
-                printf("  call    %s\n", cond->lhs->ident);
-                printf("  mv      %s,a0\n", rg);
-        } else if (cond->kind == E_PARAMS) {
-                char *rg1 = cg_expr(cond->lhs);
-                printf("  mv      a%d,%s\n", paramindex++, rg1);
-                assert(paramindex < 8);
-                prevr(rg1);
-                if (cond->rhs != NULL) {
-                        char *rg1 = cg_expr(cond->rhs);
-                        prevr(rg1);
+                int *args = calloc(8, sizeof(int)), nargs = 0;
+                for (struct Expr *p = cond->rhs; p; p = p->rhs) {
+                        assert(p->kind == E_PARAMS && nargs < 8);
+                        args[nargs++] = ir_expr(p->lhs);
                 }
+                struct Ir *in = ir(IR_CALL, newvreg(), -1, -1);
+                in->name = cond->lhs->ident;
+                in->args = args;
+                in->nargs = nargs;
+                rg = in->dst;
         } else {
-                char *lhs = cg_expr(cond->lhs);
-                char *rhs = cg_expr(cond->rhs);
-                if (cond->kind == E_ADD || cond->kind == E_PADD) {
-                        printf("  add     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_SUB || cond->kind == E_PSUB) {
-                        printf("  sub     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_MUL) {
-                        printf("  mul     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_DIV) {
-                        printf("  div     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_MOD) {
-                        printf("  rem     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_GT) {
-                        printf("  slt     %s,%s,%s\n", rg, rhs, lhs);
-                } else if (cond->kind == E_LT) {
-                        printf("  slt     %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_LE) {
-                        printf("  slt     %s,%s,%s\n", rg, rhs, lhs);
-                        printf("  xori    %s,%s,1\n", rg, rg); /* invert least significant bit */
-                } else if (cond->kind == E_GE) {
-                        printf("  slt     %s,%s,%s\n", rg, lhs, rhs);
-                        printf("  xori    %s,%s,1\n", rg, rg);
-                } else if (cond->kind == E_EQ) {
-                        printf("  xor     %s,%s,%s\n", rg, lhs, rhs);
-                        printf("  sltiu   %s,%s,1\n", rg, rg);
-                } else if (cond->kind == E_NEQ) {
-                        printf("  xor     %s,%s,%s\n", rg, lhs, rhs);
-                        printf("  sltu    %s,x0,%s\n", rg, rg);
-                } else if (cond->kind == E_LOR || cond->kind == E_LAND || cond->kind == E_BOR ||
-                           cond->kind == E_BAND || cond->kind == E_XOR) {
-                        if (cond->kind == E_LOR || cond->kind == E_BOR)
-                                printf("  or      %s,%s,%s\n", rg, lhs, rhs);
-                        else if (cond->kind == E_XOR)
-                                printf("  xor      %s,%s,%s\n", rg, lhs, rhs);
-                        else
-                                printf("  and      %s,%s,%s\n", rg, lhs, rhs);
-                } else if (cond->kind == E_LSH || cond->kind == E_RSH) {
-                        if (cond->kind == E_LSH)
-                                printf("  sll      %s,%s,%s\n", rg, lhs, rhs);
-                        else
-                                printf("  srl      %s,%s,%s\n", rg, lhs, rhs);
-                } else
-                        assert(0);
-                prevr(lhs);
-                prevr(rhs);
+                int lhs = ir_expr(cond->lhs);
+                int rhs = ir_expr(cond->rhs);
+                rg = ir(irop(cond->kind), newvreg(), lhs, rhs)->dst;
         }
         return rg;
 }
 
-// clang-format off
-static char *registers[] = {
-"t0", "t1", "t2", "t3", "t4", "t5", "t6", 
-"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
-// clang-format on
-static int rgindex = 0;
-char *nextr(void) {
-        assert(rgindex < 14);
-        rgindex++;
-        return copystr(registers[rgindex]);
+/* ends the current block in branches to t if cond is nonzero and to f otherwise. && and || test their right
+   side only when the left one did not decide, in a block of its own, and ! swaps the targets */
+void ir_cond(struct Expr *cond, struct Block *t, struct Block *f) {
+        if (cond->kind == E_LAND || cond->kind == E_LOR) {
+                struct Block *rhs = newblock();
+                if (cond->kind == E_LAND)
+                        ir_cond(cond->lhs, rhs, f);
+                else
+                        ir_cond(cond->lhs, t, rhs);
+                place(rhs);
+                ir_cond(cond->rhs, t, f);
+        } else if (cond->kind == E_NOT) {
+                ir_cond(cond->lhs, f, t);
+        } else {
+                int rg = ir_expr(cond);
+                terminate(IR_BR, rg, t, f);
+        }
+}
+
+/* sends the edges into blocks that only jump on to the final target, drops the blocks nothing reaches any more
+   and records the predecessors of the others */
+void linkcfg(void) {
+        int n = 0;
+        for (struct Block *b = entry; b; b = b->next) {
+                b->reached = false;
+                n++;
+        }
+        for (struct Block *b = entry; b; b = b->next)
+                for (int i = 0; i < 2; i++)
+                        for (int hops = 0; b->succ[i] && hops < n; hops++) {
+                                struct Block *s = b->succ[i];
+                                if (s->head != s->tail || s->head->op != IR_JMP) break;
+                                b->succ[i] = s->succ[0];
+                        }
+        struct Block **stack = malloc(n * sizeof(struct Block *));
+        n = 0;
+        entry->reached = true;
+        stack[n++] = entry;
+        while (n > 0) {
+                struct Block *b = stack[--n];
+                for (int i = 0; i < 2; i++)
+                        if (b->succ[i] && !b->succ[i]->reached) {
+                                b->succ[i]->reached = true;
+                                stack[n++] = b->succ[i];
+                        }
+        }
+        free(stack);
+
+        for (struct Block *b = entry; b; b = b->next) {
+                while (b->next && !b->next->reached) b->next = b->next->next;
+                b->npreds = 0;
+        }
+        for (struct Block *b = entry; b; b = b->next)
+                for (int i = 0; i < 2; i++)
+                        if (b->succ[i]) b->succ[i]->npreds++;
+        for (struct Block *b = entry; b; b = b->next) {
+                b->preds = calloc(b->npreds, sizeof(struct Block *));
+                b->npreds = 0;
+        }
+        for (struct Block *b = entry; b; b = b->next)
+                for (int i = 0; i < 2; i++)
+                        if (b->succ[i]) b->succ[i]->preds[b->succ[i]->npreds++] = b;
 }
 
-void prevr(char *r) {
-        free(r);
-        rgindex--;
-        assert(rgindex >= 0);
+void printIr(void) {
+        printf("%s:\n", current_fn->name);
+        for (struct Block *b = entry; b; b = b->next) {
+                printf("%s:", b->label);
+                for (int i = 0; i < b->npreds; i++) printf("%s %s", i ? "," : "  ; preds", b->preds[i]->label);
+                printf("\n");
+                for (struct Ir *in = b->head; in; in = in->next) {
+                        printf("  ");
+                        if (in->dst >= 0) printf("v%d = ", in->dst - NREGS);
+                        printf("%s", irname[in->op]);
+                        if (in->op == IR_LI || in->op == IR_PARAM) printf(" %ld", (long)in->imm);
+                        if (in->op == IR_CALL) printf(" %s", in->name);
+                        for (int i = 0; i < in->nargs; i++) printf("%s v%d", i ? "," : "", in->args[i] - NREGS);
+                        if (in->a >= 0) printf(" v%d", in->a - NREGS);
+                        if (in->b >= 0) printf(", v%d", in->b - NREGS);
+                        if (in->op == IR_BR) printf(", %s, %s", b->succ[0]->label, b->succ[1]->label);
+                        if (in->op == IR_JMP) printf(" %s", b->succ[0]->label);
+                        printf("\n");
+                }
+        }
+        printf("\n");
 }
 
 static int count = 0;
@@ -1142,15 +1311,1530 @@ int nexti(void) {
         count++;
         return count;
 }
+
+/* ----------------------------------------------------------------------------------------------------------- */
+/* ------------------------------------------------- OPTIMIZER ----------------------------------------------- */
+/* ----------------------------------------------------------------------------------------------------------- */
+/* at -O1 and up the blocks of a function are put in SSA form: phis at the iterated dominance frontiers of the
+   definitions of each variable that lives across blocks, then every definition renamed along the dominator
+   tree (Cytron et al.). sparse conditional constant propagation (Wegman & Zadeck) folds what is constant and
+   drops the branch edges and blocks it never reached, copy propagation removes movs and phis of one value, and
+   dead code elimination whatever nothing needs. -O2 adds value numbering over the dominator tree and repeats
+   all of them until they change nothing. the phis then become copies at the end of the predecessors, on a
+   block of their own where the predecessor also branches elsewhere */
+static struct Block **rpo; /* blocks in reverse postorder */
+static int nblocks;
+static struct Ir **defs; /* the instruction defining each virtual register, in SSA form */
+static int *repl;        /* the register replacing each one, itself if none */
+static int *name;        /* current SSA name of each variable while renaming, -1 before its definition */
+static int *renamed;     /* undo log of name[], variable / previous name pairs */
+static int nrenamed;
+static int undef;        /* register for variables read before they are assigned, -1 until needed */
+
+void optimize(void) {
+        tossa();
+        for (bool changed = true; changed;) {
+                changed = sccp();
+                changed |= copyprop();
+                if (optlevel > 1) changed |= gvn();
+                changed |= dce();
+                if (optlevel < 2) break;
+        }
+        fromssa();
+        linkcfg();
+}
+
+/* the i-th register instruction reads: a, b and then its arguments; NULL if it has none there */
+int *operand(struct Ir *in, int i) {
+        int *r = i == 0 ? &in->a : i == 1 ? &in->b : i - 2 < in->nargs ? &in->args[i - 2] : NULL;
+        return r != NULL && *r >= 0 ? r : NULL;
+}
+
+struct Ir *newir(enum IrOp op, int dst, int a) {
+        struct Ir *in = calloc(1, sizeof(struct Ir));
+        in->op = op;
+        in->dst = dst;
+        in->a = a;
+        in->b = -1;
+        return in;
+}
+
+/* adds in to b right before its terminator */
+void insertbeforeterm(struct Block *b, struct Ir *in) {
+        in->next = b->tail;
+        if (b->head == b->tail) {
+                b->head = in;
+                return;
+        }
+        struct Ir *p = b->head;
+        while (p->next != b->tail) p = p->next;
+        p->next = in;
+}
+
+/* unlinks the instructions marked dead */
+void sweep(void) {
+        for (struct Block *b = entry; b; b = b->next) {
+                struct Ir **link = &b->head;
+                b->tail = NULL;
+                for (struct Ir *in = b->head; in; in = in->next)
+                        if (!in->dead) {
+                                *link = in;
+                                link = &in->next;
+                                b->tail = in;
+                        }
+                *link = NULL;
+        }
+}
+
+int find(int r) {
+        while (repl[r] != r) r = repl[r];
+        return r;
+}
+
+/* replaces every operand by what repl says and removes the instructions marked dead */
+void rewrite(void) {
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next)
+                        for (int i = 0; i < in->nargs + 2; i++) {
+                                int *r = operand(in, i);
+                                if (r) *r = find(*r);
+                        }
+        sweep();
+}
+
+void indexdefs(void) {
+        defs = realloc(defs, nvregs * sizeof(struct Ir *));
+        repl = realloc(repl, nvregs * sizeof(int));
+        for (int r = 0; r < nvregs; r++) {
+                defs[r] = NULL;
+                repl[r] = r;
+        }
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next)
+                        if (in->dst >= 0) defs[in->dst] = in;
+}
+
+/* takes the edge from p out of b, with the values its phis had for it */
+void removepred(struct Block *b, struct Block *p) {
+        int j = 0;
+        while (b->preds[j] != p) j++;
+        b->npreds--;
+        for (int k = j; k < b->npreds; k++) b->preds[k] = b->preds[k + 1];
+        for (struct Ir *in = b->head; in; in = in->next)
+                if (in->op == IR_PHI) {
+                        in->nargs--;
+                        for (int k = j; k < in->nargs; k++) in->args[k] = in->args[k + 1];
+                }
+}
+
+/* ------------------------------------------------- dominators */
+
+void postorder(struct Block *b, int *n) {
+        b->reached = true;
+        for (int i = 0; i < 2; i++)
+                if (b->succ[i] && !b->succ[i]->reached) postorder(b->succ[i], n);
+        rpo[(*n)++] = b;
+}
+
+struct Block *intersect(struct Block *x, struct Block *y) {
+        while (x != y) {
+                while (x->index > y->index) x = x->idom;
+                while (y->index > x->index) y = y->idom;
+        }
+        return x;
+}
+
+/* Cooper, Harvey & Kennedy, "A Simple, Fast Dominance Algorithm" */
+void dominators(void) {
+        nblocks = 0;
+        for (struct Block *b = entry; b; b = b->next) {
+                b->reached = false;
+                b->idom = NULL;
+                b->nkids = b->ndf = 0;
+                nblocks++;
+        }
+        rpo = realloc(rpo, nblocks * sizeof(struct Block *));
+        int n = 0;
+        postorder(entry, &n);
+        assert(n == nblocks);
+        for (int i = 0; i < n / 2; i++) {
+                struct Block *t = rpo[i];
+                rpo[i] = rpo[n - 1 - i];
+                rpo[n - 1 - i] = t;
+        }
+        for (int i = 0; i < n; i++) rpo[i]->index = i;
+
+        entry->idom = entry;
+        for (bool changed = true; changed;) {
+                changed = false;
+                for (int i = 1; i < n; i++) {
+                        struct Block *b = rpo[i], *d = NULL;
+                        for (int j = 0; j < b->npreds; j++)
+                                if (b->preds[j]->idom) d = d ? intersect(b->preds[j], d) : b->preds[j];
+                        if (b->idom != d) {
+                                b->idom = d;
+                                changed = true;
+                        }
+                }
+        }
+
+        for (int i = 0; i < n; i++) {
+                rpo[i]->kids = realloc(rpo[i]->kids, n * sizeof(struct Block *));
+                rpo[i]->df = realloc(rpo[i]->df, n * sizeof(struct Block *));
+        }
+        for (int i = 1; i < n; i++) rpo[i]->idom->kids[rpo[i]->idom->nkids++] = rpo[i];
+        for (int i = 0; i < n; i++) {
+                struct Block *b = rpo[i];
+                if (b->npreds < 2) continue;
+                for (int j = 0; j < b->npreds; j++)
+                        for (struct Block *r = b->preds[j]; r != b->idom; r = r->idom) {
+                                int k = 0;
+                                while (k < r->ndf && r->df[k] != b) k++;
+                                if (k == r->ndf) r->df[r->ndf++] = b;
+                        }
+        }
+}
+
+/* ------------------------------------------------- SSA */
+
+int currentname(int v) {
+        if (name[v] >= 0) return name[v];
+        if (undef < 0) { /* reading it is undefined behaviour; 0 will do */
+                struct Ir *zero = newir(IR_LI, undef = newvreg(), -1);
+                zero->next = entry->head;
+                entry->head = zero;
+        }
+        return undef;
+}
+
+void renameblock(struct Block *b) {
+        int mark = nrenamed;
+        for (struct Ir *in = b->head; in; in = in->next) {
+                if (in->op != IR_PHI)
+                        for (int i = 0; i < in->nargs + 2; i++) {
+                                int *r = operand(in, i);
+                                if (r) *r = currentname(*r);
+                        }
+                if (in->dst >= 0) {
+                        int v = in->dst;
+                        renamed[nrenamed++] = v;
+                        renamed[nrenamed++] = name[v];
+                        name[v] = in->dst = newvreg();
+                }
+        }
+        for (int i = 0; i < 2; i++) {
+                struct Block *s = b->succ[i];
+                if (s == NULL || (i == 1 && s == b->succ[0])) continue;
+                for (int j = 0; j < s->npreds; j++)
+                        if (s->preds[j] == b)
+                                for (struct Ir *in = s->head; in; in = in->next)
+                                        if (in->op == IR_PHI) in->args[j] = currentname(in->imm);
+        }
+        for (int i = 0; i < b->nkids; i++) renameblock(b->kids[i]);
+        for (; nrenamed > mark; nrenamed -= 2) name[renamed[nrenamed - 2]] = renamed[nrenamed - 1];
+}
+
+bool defines(struct Block *b, int v) {
+        for (struct Ir *in = b->head; in; in = in->next)
+                if (in->dst == v) return true;
+        return false;
+}
+
+void tossa(void) {
+        dominators();
+        int nvars = nvregs;
+
+        /* the variables read in some block before it assigns them, the only ones phis can be needed for */
+        bool *global = calloc(nvars, sizeof(bool));
+        int *assigned = calloc(nvars, sizeof(int));
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next) {
+                        for (int i = 0; i < in->nargs + 2; i++) {
+                                int *r = operand(in, i);
+                                if (r && assigned[*r] != b->index + 1) global[*r] = true;
+                        }
+                        if (in->dst >= 0) assigned[in->dst] = b->index + 1;
+                }
+
+        struct Block **work = malloc(nblocks * sizeof(struct Block *));
+        int *hasphi = calloc(nblocks, sizeof(int)), *queued = calloc(nblocks, sizeof(int));
+        for (int v = NREGS; v < nvars; v++) {
+                if (!global[v]) continue;
+                int n = 0;
+                for (struct Block *b = entry; b; b = b->next)
+                        if (defines(b, v)) {
+                                queued[b->index] = v;
+                                work[n++] = b;
+                        }
+                while (n > 0) {
+                        struct Block *b = work[--n];
+                        for (int k = 0; k < b->ndf; k++) {
+                                struct Block *d = b->df[k];
+                                if (hasphi[d->index] == v) continue;
+                                hasphi[d->index] = v;
+                                struct Ir *phi = newir(IR_PHI, v, -1);
+                                phi->imm = v;
+                                phi->nargs = d->npreds;
+                                phi->args = malloc(d->npreds * sizeof(int));
+                                phi->next = d->head;
+                                d->head = phi;
+                                if (queued[d->index] != v) {
+                                        queued[d->index] = v;
+                                        work[n++] = d;
+                                }
+                        }
+                }
+        }
+        free(global);
+        free(assigned);
+        free(work);
+        free(hasphi);
+        free(queued);
+
+        name = malloc(nvars * sizeof(int));
+        for (int v = 0; v < nvars; v++) name[v] = -1;
+        int ndefs = 0;
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next) ndefs++;
+        renamed = malloc(2 * ndefs * sizeof(int));
+        nrenamed = 0;
+        undef = -1;
+        renameblock(entry);
+        free(name);
+        free(renamed);
+}
+
+/* copies src[i] into dst[i] for all i at once at the end of b, through a temporary where they form a cycle */
+void parallelcopy(struct Block *b, int *dst, int *src, int n) {
+        while (n > 0) {
+                int k = 0;
+                for (; k < n; k++) {
+                        int j = 0;
+                        while (j < n && (j == k || src[j] != dst[k])) j++;
+                        if (j == n) break; /* nothing still reads dst[k] */
+                }
+                if (k == n) {
+                        int t = newvreg();
+                        insertbeforeterm(b, newir(IR_MOV, t, dst[0]));
+                        for (int j = 0; j < n; j++)
+                                if (src[j] == dst[0]) src[j] = t;
+                        continue;
+                }
+                insertbeforeterm(b, newir(IR_MOV, dst[k], src[k]));
+                n--;
+                dst[k] = dst[n];
+                src[k] = src[n];
+        }
+}
+
+void fromssa(void) {
+        struct Block *last = entry;
+        while (last->next) last = last->next;
+        for (struct Block *b = entry; b; b = b->next) {
+                int nphis = 0;
+                for (struct Ir *in = b->head; in; in = in->next)
+                        if (in->op == IR_PHI) nphis++;
+                if (nphis == 0) continue;
+                int *dst = malloc(nphis * sizeof(int)), *src = malloc(nphis * sizeof(int));
+                for (int j = 0; j < b->npreds; j++) {
+                        struct Block *p = b->preds[j];
+                        int k = 0;
+                        while (k < j && b->preds[k] != p) k++;
+                        if (k < j) continue; /* both edges of a branch, with the same values */
+                        if (p->succ[1] && p->succ[0] != p->succ[1]) { /* the copies get their own block */
+                                struct Block *e = newblock();
+                                e->head = e->tail = newir(IR_JMP, -1, -1);
+                                e->succ[0] = b;
+                                p->succ[p->succ[0] == b ? 0 : 1] = e;
+                                last = last->next = e;
+                                p = e;
+                        }
+                        int n = 0;
+                        for (struct Ir *in = b->head; in; in = in->next)
+                                if (in->op == IR_PHI && in->dst != in->args[j]) {
+                                        dst[n] = in->dst;
+                                        src[n++] = in->args[j];
+                                }
+                        parallelcopy(p, dst, src, n);
+                }
+                free(dst);
+                free(src);
+                for (struct Ir *in = b->head; in; in = in->next)
+                        if (in->op == IR_PHI) in->dead = true;
+        }
+        sweep();
+}
+
+/* ------------------------------------------------- constant propagation */
+
+enum { TOP, CONST, BOTTOM }; /* not known yet, one value, more than one */
+static int *lattice;
+static int64_t *constant;
+static struct Ir **users; /* the instructions reading register r, from firstuser[r] to firstuser[r + 1] */
+static struct Block **userblock;
+static int *firstuser;
+static struct Ir **ssawork; /* instructions whose operands went down the lattice */
+static struct Block **ssablock, **flowwork;
+static int nssawork, nflowwork;
+
+/* what op computes at run time, the W instructions working on the low 32 bits */
+int64_t fold(enum IrOp op, int64_t x, int64_t y) {
+        int32_t a = (int32_t)x, b = (int32_t)y;
+        switch (op) {
+                case IR_ADD: return (int32_t)((uint32_t)a + (uint32_t)b);
+                case IR_SUB: return (int32_t)((uint32_t)a - (uint32_t)b);
+                case IR_MUL: return (int32_t)((uint32_t)a * (uint32_t)b);
+                case IR_DIV: return b == 0 ? -1 : a == INT32_MIN && b == -1 ? a : a / b;
+                case IR_MOD: return b == 0 ? a : a == INT32_MIN && b == -1 ? 0 : a % b;
+                case IR_AND: return x & y;
+                case IR_OR: return x | y;
+                case IR_XOR: return x ^ y;
+                case IR_SHL: return (int32_t)((uint32_t)a << (b & 31));
+                case IR_SHR: return a >> (b & 31);
+                case IR_LT: return x < y;
+                case IR_GT: return x > y;
+                case IR_LE: return x <= y;
+                case IR_GE: return x >= y;
+                case IR_EQ: return x == y;
+                case IR_NE: return x != y;
+                case IR_NOT: return x == 0;
+                case IR_COMPL: return ~x;
+                default: assert(0);
+        }
+}
+
+void pushflow(struct Block *b, int i) {
+        if (b->edge[i]) return;
+        b->edge[i] = true;
+        flowwork[nflowwork++] = b->succ[i];
+}
+
+/* lowers the lattice value of v to its meet with (l, c), queueing the instructions reading v if it moved */
+void meet(int v, int l, int64_t c) {
+        if (l == TOP || lattice[v] == BOTTOM || (lattice[v] == l && (l == BOTTOM || constant[v] == c))) return;
+        if (lattice[v] == CONST) l = BOTTOM;
+        lattice[v] = l;
+        constant[v] = c;
+        for (int u = firstuser[v]; u < firstuser[v + 1]; u++) {
+                ssawork[nssawork] = users[u];
+                ssablock[nssawork++] = userblock[u];
+        }
+}
+
+/* the use lists, each register going down the lattice twice at most */
+void indexusers(void) {
+        firstuser = calloc(nvregs + 1, sizeof(int));
+        for (int pass = 0; pass < 2; pass++) {
+                for (struct Block *b = entry; b; b = b->next)
+                        for (struct Ir *in = b->head; in; in = in->next)
+                                for (int i = 0; i < in->nargs + 2; i++) {
+                                        int *r = operand(in, i);
+                                        if (r == NULL) continue;
+                                        if (pass == 0) {
+                                                firstuser[*r + 1]++;
+                                        } else {
+                                                users[firstuser[*r]] = in;
+                                                userblock[firstuser[*r]++] = b;
+                                        }
+                                }
+                if (pass == 0) {
+                        for (int r = 0; r < nvregs; r++) firstuser[r + 1] += firstuser[r];
+                        users = malloc(firstuser[nvregs] * sizeof(struct Ir *));
+                        userblock = malloc(firstuser[nvregs] * sizeof(struct Block *));
+                        ssawork = malloc(2 * firstuser[nvregs] * sizeof(struct Ir *));
+                        ssablock = malloc(2 * firstuser[nvregs] * sizeof(struct Block *));
+                }
+        }
+        for (int r = nvregs; r > 0; r--) firstuser[r] = firstuser[r - 1];
+        firstuser[0] = 0;
+}
+
+bool edgetaken(struct Block *p, struct Block *b) {
+        return (p->succ[0] == b && p->edge[0]) || (p->succ[1] == b && p->edge[1]);
+}
+
+void visit(struct Ir *in, struct Block *b) {
+        switch (in->op) {
+                case IR_JMP: pushflow(b, 0); return;
+                case IR_BR:
+                        if (lattice[in->a] == BOTTOM || (lattice[in->a] == CONST && constant[in->a] != 0)) pushflow(b, 0);
+                        if (lattice[in->a] == BOTTOM || (lattice[in->a] == CONST && constant[in->a] == 0)) pushflow(b, 1);
+                        return;
+                case IR_RET: return;
+                case IR_LI: meet(in->dst, CONST, in->imm); return;
+                case IR_MOV: meet(in->dst, lattice[in->a], constant[in->a]); return;
+                case IR_PARAM:
+                case IR_CALL: meet(in->dst, BOTTOM, 0); return;
+                case IR_PHI:
+                        for (int j = 0; j < in->nargs; j++)
+                                if (edgetaken(b->preds[j], b)) meet(in->dst, lattice[in->args[j]], constant[in->args[j]]);
+                        return;
+                default: break;
+        }
+        int l = lattice[in->a];
+        if (in->b >= 0 && lattice[in->b] != CONST) l = l == BOTTOM ? BOTTOM : lattice[in->b];
+        if (l == CONST)
+                meet(in->dst, CONST, fold(in->op, constant[in->a], in->b >= 0 ? constant[in->b] : 0));
+        else
+                meet(in->dst, l, 0);
+}
+
+/* replaces the registers found constant by li, the branches always going one way by jumps, and removes the
+   blocks never reached */
+bool sccp(void) {
+        lattice = calloc(nvregs, sizeof(int));
+        constant = calloc(nvregs, sizeof(int64_t));
+        int nedges = 1;
+        for (struct Block *b = entry; b; b = b->next) {
+                b->executable = b->edge[0] = b->edge[1] = false;
+                nedges += 2;
+        }
+        flowwork = malloc(nedges * sizeof(struct Block *));
+        nflowwork = nssawork = 0;
+        indexusers();
+        flowwork[nflowwork++] = entry;
+        while (nflowwork > 0 || nssawork > 0) {
+                if (nflowwork > 0) {
+                        struct Block *b = flowwork[--nflowwork];
+                        bool first = !b->executable;
+                        b->executable = true;
+                        for (struct Ir *in = b->head; in; in = in->next)
+                                if (in->op == IR_PHI || first) visit(in, b);
+                } else {
+                        nssawork--;
+                        if (ssablock[nssawork]->executable) visit(ssawork[nssawork], ssablock[nssawork]);
+                }
+        }
+
+        bool changed = false;
+        for (struct Block *b = entry; b; b = b->next) {
+                if (!b->executable) {
+                        for (int i = 0; i < 2; i++)
+                                if (b->succ[i] && b->succ[i]->executable) removepred(b->succ[i], b);
+                        changed = true;
+                        continue;
+                }
+                for (struct Ir *in = b->head; in; in = in->next)
+                        if (in->dst >= 0 && lattice[in->dst] == CONST && in->op != IR_LI && in->op != IR_CALL) {
+                                in->op = IR_LI;
+                                in->imm = constant[in->dst];
+                                in->a = in->b = -1;
+                                in->nargs = 0;
+                                changed = true;
+                        }
+                if (b->tail->op == IR_BR && b->edge[0] != b->edge[1]) {
+                        int taken = b->edge[0] ? 0 : 1;
+                        removepred(b->succ[1 - taken], b);
+                        b->tail->op = IR_JMP;
+                        b->tail->a = -1;
+                        b->succ[0] = b->succ[taken];
+                        b->succ[1] = NULL;
+                        changed = true;
+                }
+        }
+        for (struct Block *b = entry; b; b = b->next)
+                while (b->next && !b->next->executable) b->next = b->next->next;
+        free(lattice);
+        free(constant);
+        free(flowwork);
+        free(firstuser);
+        free(users);
+        free(userblock);
+        free(ssawork);
+        free(ssablock);
+        return changed;
+}
+
+/* ------------------------------------------------- copy propagation */
+
+/* the one value besides its own register a phi has, or -1 */
+int phivalue(struct Ir *phi) {
+        int v = -1;
+        for (int j = 0; j < phi->nargs; j++) {
+                int a = find(phi->args[j]);
+                if (a == phi->dst || a == v) continue;
+                if (v >= 0) return -1;
+                v = a;
+        }
+        return v;
+}
+
+bool copyprop(void) {
+        indexdefs();
+        bool changed = false;
+        for (bool again = true; again;) {
+                again = false;
+                for (struct Block *b = entry; b; b = b->next)
+                        for (struct Ir *in = b->head; in; in = in->next) {
+                                int v = in->op == IR_MOV ? find(in->a) : in->op == IR_PHI ? phivalue(in) : -1;
+                                if (in->dead || v < 0) continue;
+                                repl[in->dst] = v;
+                                in->dead = again = changed = true;
+                        }
+        }
+        rewrite();
+        return changed;
+}
+
+/* ------------------------------------------------- value numbering */
+
+struct Value {
+        enum IrOp op;
+        int a, b;
+        int64_t imm;
+        int reg;
+        int next; /* in its bucket */
+};
+
+#define NBUCKETS 256
+static struct Value *values;
+static int nvalues, capvalues;
+static int buckets[NBUCKETS];
+static int *vnum; /* the register a constant was first loaded into, for comparing values */
+
+unsigned hashvalue(enum IrOp op, int a, int b, int64_t imm) {
+        return ((unsigned)op * 31 + (unsigned)a * 17 + (unsigned)b * 7 + (unsigned)imm) % NBUCKETS;
+}
+
+bool commutes(enum IrOp op) {
+        return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR || op == IR_EQ ||
+               op == IR_NE;
+}
+
+/* in a scope per block of the dominator tree, so a value found again is one computed on every path there */
+bool gvnblock(struct Block *b) {
+        bool changed = false;
+        int mark = nvalues;
+        for (struct Ir *in = b->head; in; in = in->next) {
+                for (int i = 0; i < in->nargs + 2; i++) {
+                        int *r = operand(in, i);
+                        if (r) *r = find(*r);
+                }
+                if (in->op == IR_PHI) { /* the same values as an earlier phi of the block */
+                        for (struct Ir *p = b->head; p != in; p = p->next)
+                                if (p->op == IR_PHI && !p->dead &&
+                                    memcmp(p->args, in->args, in->nargs * sizeof(int)) == 0) {
+                                        repl[in->dst] = p->dst;
+                                        in->dead = changed = true;
+                                        break;
+                                }
+                        continue;
+                }
+                if (in->dst < 0 || in->op == IR_CALL || in->op == IR_PARAM || in->op == IR_MOV) continue;
+                int a = in->a >= 0 ? vnum[in->a] : -1, c = in->b >= 0 ? vnum[in->b] : -1;
+                if (commutes(in->op) && a > c) {
+                        a = in->b;
+                        c = in->a;
+                }
+                unsigned h = hashvalue(in->op, a, c, in->imm);
+                int k = buckets[h];
+                while (k >= 0 && !(values[k].op == in->op && values[k].a == a && values[k].b == c &&
+                                   values[k].imm == in->imm))
+                        k = values[k].next;
+                if (k >= 0 && in->op == IR_LI) { /* cheaper to load again than to keep in a register */
+                        vnum[in->dst] = values[k].reg;
+                        continue;
+                }
+                if (k >= 0) {
+                        repl[in->dst] = values[k].reg;
+                        in->dead = changed = true;
+                        continue;
+                }
+                if (nvalues == capvalues) {
+                        capvalues = 2 * capvalues + 16;
+                        values = realloc(values, capvalues * sizeof(struct Value));
+                }
+                values[nvalues] = (struct Value){in->op, a, c, in->imm, in->dst, buckets[h]};
+                buckets[h] = nvalues++;
+        }
+        for (int i = 0; i < b->nkids; i++) changed |= gvnblock(b->kids[i]);
+        while (nvalues > mark) {
+                nvalues--;
+                buckets[hashvalue(values[nvalues].op, values[nvalues].a, values[nvalues].b, values[nvalues].imm)] =
+                        values[nvalues].next;
+        }
+        return changed;
+}
+
+bool gvn(void) {
+        dominators();
+        indexdefs();
+        for (int h = 0; h < NBUCKETS; h++) buckets[h] = -1;
+        nvalues = 0;
+        vnum = malloc(nvregs * sizeof(int));
+        for (int r = 0; r < nvregs; r++) vnum[r] = r;
+        bool changed = gvnblock(entry);
+        free(vnum);
+        rewrite();
+        return changed;
+}
+
+/* ------------------------------------------------- dead code */
+
+/* whether the edge from p into b can go to b's successor instead: b does nothing but jump there, and if p
+   already is a predecessor of it, its phis take the same values from both */
+bool canbypass(struct Block *p, struct Block *b) {
+        if (b->head != b->tail || b->head->op != IR_JMP || b->succ[0] == b) return false;
+        struct Block *s = b->succ[0];
+        int from = 0, via = 0;
+        while (from < s->npreds && s->preds[from] != p) from++;
+        while (s->preds[via] != b) via++;
+        if (from == s->npreds) return true;
+        for (struct Ir *in = s->head; in; in = in->next)
+                if (in->op == IR_PHI && in->args[from] != in->args[via]) return false;
+        return true;
+}
+
+/* sends edges past the blocks that only jump on, as linkcfg() does but keeping the phis right, and turns the
+   branches going the same way on both edges into jumps */
+bool cleancfg(void) {
+        bool changed = false;
+        int n = 0;
+        for (struct Block *b = entry; b; b = b->next) n++;
+        for (struct Block *p = entry; p; p = p->next)
+                for (int i = 0, hops = 0; i < 2; i++) {
+                        struct Block *b = p->succ[i];
+                        if (b == NULL || !canbypass(p, b) || hops++ == n) continue; /* a loop of them never ends */
+                        struct Block *s = b->succ[0];
+                        int via = 0;
+                        while (s->preds[via] != b) via++;
+                        s->preds = realloc(s->preds, (s->npreds + 1) * sizeof(struct Block *));
+                        s->preds[s->npreds] = p;
+                        for (struct Ir *in = s->head; in; in = in->next)
+                                if (in->op == IR_PHI) {
+                                        in->args = realloc(in->args, (in->nargs + 1) * sizeof(int));
+                                        in->args[in->nargs++] = in->args[via];
+                                }
+                        s->npreds++;
+                        removepred(b, p);
+                        p->succ[i] = s;
+                        i--; /* s may only jump on as well */
+                        changed = true;
+                }
+        for (struct Block *b = entry; b; b = b->next) {
+                while (b->next && b->next->npreds == 0) {
+                        removepred(b->next->succ[0], b->next);
+                        b->next = b->next->next;
+                }
+                if (b->tail->op == IR_BR && b->succ[0] == b->succ[1]) {
+                        removepred(b->succ[1], b);
+                        b->tail->op = IR_JMP;
+                        b->tail->a = -1;
+                        b->succ[1] = NULL;
+                        changed = true;
+                }
+        }
+        return changed;
+}
+
+/* keeps the calls and terminators and whatever they read, directly or not */
+bool dce(void) {
+        bool changed = cleancfg();
+        indexdefs();
+        int n = 0;
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next) n++;
+        struct Ir **work = malloc(n * sizeof(struct Ir *));
+        n = 0;
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next) {
+                        in->dead = in->op != IR_CALL && in->dst >= 0;
+                        if (!in->dead) work[n++] = in;
+                }
+        while (n > 0) {
+                struct Ir *in = work[--n];
+                for (int i = 0; i < in->nargs + 2; i++) {
+                        int *r = operand(in, i);
+                        if (r && defs[*r] && defs[*r]->dead) {
+                                defs[*r]->dead = false;
+                                work[n++] = defs[*r];
+                        }
+                }
+        }
+        free(work);
+        for (struct Block *b = entry; b; b = b->next)
+                for (struct Ir *in = b->head; in; in = in->next) changed |= in->dead;
+        sweep();
+        return changed;
+}
+
+/* ----------------------------------------------------------------------------------------------------------- */
+/* ------------------------------------------------- LOWERING ------------------------------------------------ */
+/* ----------------------------------------------------------------------------------------------------------- */
+/* instruction selection: each IR instruction becomes one or a few RISC-V instructions on the same virtual
+   registers. values are ints, kept sign-extended from bit 31, hence the W forms. blocks are laid out in
+   order, so a jump to the next block is left out */
+// clang-format off
+static const char *xname[NREGS] = {
+"x0", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+static const char *rvop[] = {
+[IR_ADD] = "addw", [IR_SUB] = "subw", [IR_MUL] = "mulw", [IR_DIV] = "divw", [IR_MOD] = "remw",
+[IR_AND] = "and", [IR_OR] = "or", [IR_XOR] = "xor", [IR_SHL] = "sllw", [IR_SHR] = "sraw", [IR_LT] = "slt"};
+// clang-format on
+
+static char *current_end; /* label of the epilogue */
+static struct Insn *insns;
+static int ninsns;
+static struct Block **knownin; /* block in which a register was last loaded with li, NULL if not since */
+static int64_t *known;         /* the value it was loaded with */
+
+struct Insn *emit(enum InsnKind kind, const char *op, int rd, int rs1, int rs2) {
+        static int capacity;
+        if (ninsns == capacity) {
+                capacity = capacity ? 2 * capacity : 256;
+                insns = realloc(insns, capacity * sizeof(struct Insn));
+                assert(insns != NULL);
+        }
+        struct Insn *in = &insns[ninsns++];
+        in->kind = kind;
+        in->op = op;
+        in->rd = rd;
+        in->rs1 = rs1;
+        in->rs2 = rs2;
+        in->imm = 0;
+        in->label = NULL;
+        return in;
+}
+
+void emitlabel(char *label) { emit(I_LABEL, NULL, -1, -1, -1)->label = label; }
+void emitjump(char *label) { emit(I_J, "j", -1, -1, -1)->label = label; }
+void emitbranch(const char *op, int rs1, int rs2, char *label) { emit(I_BR, op, -1, rs1, rs2)->label = label; }
+
+void lower(void) {
+        current_end = malloc(strlen(current_fn->name) + 8);
+        sprintf(current_end, ".L.end.%s", current_fn->name);
+        ninsns = 0;
+
+        int nknown = nvregs;
+        knownin = calloc(nknown, sizeof(struct Block *));
+        known = calloc(nknown, sizeof(int64_t));
+        for (struct Block *b = entry; b; b = b->next) {
+                emitlabel(b->label);
+                for (struct Ir *in = b->head; in; in = in->next) {
+                        lowerir(in, b);
+                        if (in->dst < NREGS || in->dst >= nknown) continue;
+                        knownin[in->dst] = in->op == IR_LI ? b : NULL;
+                        known[in->dst] = in->imm;
+                }
+        }
+        free(knownin);
+        free(known);
+        emitlabel(current_end);
+        emit(I_RET, NULL, -1, -1, -1);
+        tidyjumps();
+}
+
+bool isjump(struct Insn *p) { return p->kind == I_J || p->kind == I_BR; }
+
+/* first instruction after label that is not a label itself */
+int landing(char *label) {
+        int i = 0;
+        while (insns[i].kind != I_LABEL || insns[i].label != label) i++;
+        while (insns[i].kind == I_LABEL) i++;
+        return i;
+}
+
+/* sends jumps to a jump on to where that one goes, drops the jumps to the next instruction, the code after a
+   jump up to the next label and the labels nothing jumps to, such as those of blocks only fallen into */
+void tidyjumps(void) {
+        bool *keep = malloc(ninsns * sizeof(bool));
+        for (bool changed = true; changed;) {
+                changed = false;
+                for (int i = 0; i < ninsns; i++)
+                        for (int hops = 0; isjump(&insns[i]) && hops < ninsns; hops++) {
+                                struct Insn *t = &insns[landing(insns[i].label)];
+                                if (t->kind != I_J || t->label == insns[i].label) break;
+                                insns[i].label = t->label;
+                        }
+                bool reachable = true;
+                for (int i = 0; i < ninsns; i++) {
+                        struct Insn *p = &insns[i];
+                        if (p->kind == I_LABEL) {
+                                keep[i] = p->label == current_end;
+                                for (int j = 0; j < ninsns && !keep[i]; j++)
+                                        keep[i] = isjump(&insns[j]) && insns[j].label == p->label;
+                                reachable |= keep[i];
+                                continue;
+                        }
+                        keep[i] = reachable;
+                        if (p->kind == I_J) {
+                                int j = i + 1;
+                                while (insns[j].kind == I_LABEL && insns[j].label != p->label) j++;
+                                keep[i] &= insns[j].kind != I_LABEL;
+                                reachable = false;
+                        }
+                }
+                int n = 0;
+                for (int i = 0; i < ninsns; i++)
+                        if (keep[i]) insns[n++] = insns[i];
+                changed = n < ninsns;
+                ninsns = n;
+        }
+        free(keep);
+}
+
+/* ------------------------------------------------- constant operands */
+
+/* whether r holds a constant c where b is being lowered */
+bool constof(int r, struct Block *b, int64_t *c) {
+        if (r < NREGS || knownin[r] != b) return false;
+        *c = known[r];
+        return true;
+}
+
+bool fits12(int64_t c) { return c >= -2048 && c < 2048; }
+
+/* k if c is 2^k, -1 otherwise */
+int log2of(uint64_t c) {
+        if (c == 0 || (c & (c - 1)) != 0) return -1;
+        int k = 0;
+        while (c >>= 1) k++;
+        return k;
+}
+
+int emitrri(const char *op, int rs, int64_t imm) {
+        int rd = newvreg();
+        emit(I_RRI, op, rd, rs, -1)->imm = imm;
+        return rd;
+}
+
+int emitrrr(const char *op, int rs1, int rs2) {
+        int rd = newvreg();
+        emit(I_RRR, op, rd, rs1, rs2);
+        return rd;
+}
+
+int emitli(int64_t imm) {
+        int rd = newvreg();
+        emit(I_LI, "li", rd, -1, -1)->imm = imm;
+        return rd;
+}
+
+/* rd = rs * c by shifts and adds when c has at most two nonzero digits in non-adjacent form (c = +-2^i +-2^j),
+   mulw otherwise. all of it wraps around at 32 bits as mulw does */
+void mulconst(int rd, int rs, int32_t c) {
+        uint64_t u = c < 0 ? -(int64_t)c : c;
+        int bit[2], digit[2], n = 0;
+        for (int i = 0; u != 0; i++, u >>= 1) {
+                if ((u & 1) == 0) continue;
+                if (n == 2) {
+                        emit(I_RRR, "mulw", rd, rs, emitli(c));
+                        return;
+                }
+                bit[n] = i;
+                digit[n] = (u & 3) == 1 ? 1 : -1;
+                u -= digit[n++];
+        }
+        if (n == 0) {
+                emit(I_LI, "li", rd, -1, -1)->imm = 0;
+                return;
+        }
+        int hi = bit[n - 1] ? emitrri("slliw", rs, bit[n - 1]) : rs;
+        if (n == 1) {
+                if (c < 0)
+                        emit(I_RRR, "subw", rd, 0, hi);
+                else
+                        emit(I_RR, "mv", rd, hi, -1);
+                return;
+        }
+        int lo = bit[0] ? emitrri("slliw", rs, bit[0]) : rs;
+        if (c > 0)
+                emit(I_RRR, digit[0] > 0 ? "addw" : "subw", rd, hi, lo);
+        else if (digit[0] < 0) /* -(2^i - 2^j) */
+                emit(I_RRR, "subw", rd, lo, hi);
+        else
+                emit(I_RRR, "subw", rd, 0, emitrrr("addw", hi, lo));
+}
+
+/* rs + 2^k - 1 if rs is negative, rs otherwise: shifting that right by k rounds towards zero like divw */
+int roundbias(int rs, int k) {
+        int sign = k == 1 ? rs : emitrri("sraiw", rs, 31);
+        return emitrrr("addw", rs, emitrri("srliw", sign, 32 - k));
+}
+
+/* magic number m and shift s for division by d, |d| >= 2: the quotient is the high half of m * n shifted right
+   by s, corrected by n when m got the other sign than d (Hacker's Delight, 10-1) */
+void magic(int32_t d, int32_t *m, int *s) {
+        const uint32_t two31 = 0x80000000u;
+        uint32_t ad = d < 0 ? -(uint32_t)d : (uint32_t)d;
+        uint32_t t = two31 + ((uint32_t)d >> 31);
+        uint32_t anc = t - 1 - t % ad;
+        uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+        uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+        uint32_t delta;
+        int p = 31;
+        do {
+                p++;
+                q1 *= 2;
+                r1 *= 2;
+                if (r1 >= anc) {
+                        q1++;
+                        r1 -= anc;
+                }
+                q2 *= 2;
+                r2 *= 2;
+                if (r2 >= ad) {
+                        q2++;
+                        r2 -= ad;
+                }
+                delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        *m = (int32_t)(q2 + 1);
+        if (d < 0) *m = -*m;
+        *s = p - 32;
+}
+
+/* rd = rs / c rounding towards zero, c != 0: negation, a biased arithmetic shift for powers of two, a multiply
+   by the magic number otherwise */
+void divconst(int rd, int rs, int32_t c) {
+        uint32_t ac = c < 0 ? -(uint32_t)c : (uint32_t)c;
+        int k = log2of(ac);
+        int q;
+        if (ac == 1) {
+                q = rs;
+        } else if (k > 0) {
+                q = emitrri("sraiw", roundbias(rs, k), k);
+        } else {
+                int32_t m;
+                int sh;
+                magic(c, &m, &sh);
+                int prod = emitrrr("mul", rs, emitli(m)); /* m * rs fits in 64 bits */
+                if ((c > 0 && m < 0) || (c < 0 && m > 0)) {
+                        q = emitrrr(c > 0 ? "addw" : "subw", emitrri("srai", prod, 32), rs);
+                        if (sh > 0) q = emitrri("sraiw", q, sh);
+                } else {
+                        q = emitrri("srai", prod, 32 + sh);
+                }
+                emit(I_RRR, "addw", rd, q, emitrri("srliw", q, 31)); /* + 1 if negative */
+                return;
+        }
+        if (c < 0)
+                emit(I_RRR, "subw", rd, 0, q);
+        else
+                emit(I_RR, "mv", rd, q, -1);
+}
+
+/* rd = rs % c with the sign of rs, c != 0: rs less rs rounded towards zero to a multiple of c */
+void modconst(int rd, int rs, int32_t c) {
+        uint32_t ac = c < 0 ? -(uint32_t)c : (uint32_t)c;
+        int k = log2of(ac);
+        if (ac == 1) {
+                emit(I_LI, "li", rd, -1, -1)->imm = 0;
+                return;
+        }
+        int multiple;
+        if (k > 0) {
+                int64_t mask = -((int64_t)1 << k);
+                int biased = roundbias(rs, k);
+                multiple = fits12(mask) ? emitrri("andi", biased, mask) : emitrrr("and", biased, emitli(mask));
+        } else {
+                int q = newvreg();
+                divconst(q, rs, c);
+                multiple = newvreg();
+                mulconst(multiple, q, c);
+        }
+        emit(I_RRR, "subw", rd, rs, multiple);
+}
+
+/* the forms with an immediate or strength-reduced sequences when an operand is a known constant; false if
+   there is nothing better than the plain instruction */
+bool lowerconst(struct Ir *in, struct Block *b) {
+        int64_t c;
+        bool right = constof(in->b, b, &c);
+        int x = in->a;
+        if (!right) {
+                bool commutes = in->op == IR_ADD || in->op == IR_MUL || in->op == IR_AND || in->op == IR_OR ||
+                                in->op == IR_XOR;
+                if (!commutes || !constof(in->a, b, &c)) return false;
+                x = in->b;
+        }
+        int32_t w = (int32_t)c; /* what the W instructions see of it */
+        switch (in->op) {
+                case IR_ADD:
+                case IR_SUB:
+                        if (in->op == IR_SUB) w = (int32_t)(0u - (uint32_t)w);
+                        if (!fits12(w)) return false;
+                        emit(I_RRI, "addiw", in->dst, x, -1)->imm = w;
+                        return true;
+                case IR_AND:
+                case IR_OR:
+                case IR_XOR:
+                        if (!fits12(c)) return false;
+                        emit(I_RRI, in->op == IR_AND ? "andi" : in->op == IR_OR ? "ori" : "xori", in->dst, x, -1)->imm = c;
+                        return true;
+                case IR_SHL:
+                case IR_SHR:
+                        emit(I_RRI, in->op == IR_SHL ? "slliw" : "sraiw", in->dst, x, -1)->imm = w & 31;
+                        return true;
+                case IR_LT:
+                        if (!fits12(c)) return false;
+                        emit(I_RRI, "slti", in->dst, x, -1)->imm = c;
+                        return true;
+                case IR_MUL: mulconst(in->dst, x, w); return true;
+                case IR_DIV:
+                case IR_MOD:
+                        if (w == 0) return false; /* whatever divw and remw do then */
+                        if (in->op == IR_DIV)
+                                divconst(in->dst, x, w);
+                        else
+                                modconst(in->dst, x, w);
+                        return true;
+                default: return false;
+        }
+}
+
+/* ------------------------------------------------- branches */
+
+/* the branch taken when the condition holds, on x and y, and the one taken when it does not */
+struct Cmp {
+        const char *on, *off;
+        bool swap; /* compares y with x */
+};
+
+// clang-format off
+static const struct Cmp cmps[] = {
+[IR_LT] = {"blt", "bge", false}, [IR_GT] = {"blt", "bge", true},  [IR_LE] = {"bge", "blt", true},
+[IR_GE] = {"bge", "blt", false}, [IR_EQ] = {"beq", "bne", false}, [IR_NE] = {"bne", "beq", false},
+[IR_NOT] = {"beq", "bne", false}, [IR_BR] = {"bne", "beq", false}};
+// clang-format on
+
+/* br on the result of the compare right before it branches on the compare's operands instead, a zero one
+   being x0; the compare is then usually left without readers for dropdead() */
+void lowerbranch(struct Ir *in, struct Block *b) {
+        struct Ir *c = b->head;
+        while (c != in && c->next != in) c = c->next;
+        enum IrOp op = IR_BR;
+        int x = in->a, y = 0;
+        if (c != in && c->dst == in->a && c->op >= IR_LT && c->op <= IR_NOT && c->dst != c->a && c->dst != c->b) {
+                op = c->op;
+                x = c->a;
+                y = c->op == IR_NOT ? 0 : c->b;
+        }
+        int64_t k;
+        if (constof(x, b, &k) && k == 0) x = 0;
+        if (constof(y, b, &k) && k == 0) y = 0;
+        if (cmps[op].swap) {
+                int t = x;
+                x = y;
+                y = t;
+        }
+        if (b->succ[0] == b->next) {
+                emitbranch(cmps[op].off, x, y, b->succ[1]->label);
+        } else {
+                emitbranch(cmps[op].on, x, y, b->succ[0]->label);
+                if (b->succ[1] != b->next) emitjump(b->succ[1]->label);
+        }
+}
+
+void lowerir(struct Ir *in, struct Block *b) {
+        switch (in->op) {
+                case IR_LI: emit(I_LI, "li", in->dst, -1, -1)->imm = in->imm; break;
+                case IR_MOV: emit(I_RR, "mv", in->dst, in->a, -1); break;
+                case IR_PARAM: emit(I_RR, "mv", in->dst, A0 + in->imm, -1); break;
+                case IR_CALL:
+                        for (int i = 0; i < in->nargs; i++) emit(I_RR, "mv", A0 + i, in->args[i], -1);
+                        emit(I_CALL, "call", -1, -1, -1)->label = in->name;
+                        emit(I_RR, "mv", in->dst, A0, -1);
+                        break;
+                // clang-format off
+                case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD: case IR_AND:
+                case IR_OR:  case IR_XOR: case IR_SHL: case IR_SHR: case IR_LT:
+                        if (!lowerconst(in, b)) emit(I_RRR, rvop[in->op], in->dst, in->a, in->b);
+                        break;
+                // clang-format on
+                case IR_GT: emit(I_RRR, "slt", in->dst, in->b, in->a); break;
+                case IR_LE:
+                case IR_GE:
+                        if (in->op == IR_LE)
+                                emit(I_RRR, "slt", in->dst, in->b, in->a);
+                        else
+                                emit(I_RRR, "slt", in->dst, in->a, in->b);
+                        emit(I_RRI, "xori", in->dst, in->dst, -1)->imm = 1; /* invert least significant bit */
+                        break;
+                case IR_EQ:
+                case IR_NE:
+                        emit(I_RRR, "xor", in->dst, in->a, in->b);
+                        emit(I_RR, in->op == IR_EQ ? "seqz" : "snez", in->dst, in->dst, -1);
+                        break;
+                case IR_NOT: emit(I_RR, "seqz", in->dst, in->a, -1); break;
+                case IR_COMPL: emit(I_RR, "not", in->dst, in->a, -1); break;
+                case IR_JMP:
+                        if (b->succ[0] != b->next) emitjump(b->succ[0]->label);
+                        break;
+                case IR_BR: lowerbranch(in, b); break;
+                case IR_RET:
+                        emit(I_RR, "mv", A0, in->a, -1);
+                        if (b->next != NULL) emitjump(current_end);
+                        break;
+                case IR_PHI: assert(0); /* taken out by fromssa() */
+        }
+}
+
+/* ----------------------------------------------------------------------------------------------------------- */
+/* ------------------------------------------------- REGALLOC ------------------------------------------------ */
+/* ----------------------------------------------------------------------------------------------------------- */
+/* linear scan (Poletto & Sarkar). liveness is solved per instruction over the branches of the function; the
+   instructions computing values nobody reads are dropped and the movs whose two sides can share a register
+   coalesced away first. the interval of a virtual register covers every instruction it is live at, position
+   2i being the uses and 2i+1 the definition of instruction i. values live across a call get callee-saved
+   registers, the others t0-t4 first. when no register is left, the interval ending last goes to a stack slot,
+   and its operands are reloaded into / stored from t5 and t6 around each instruction */
+struct Interval {
+        int start, end;
+        bool call; /* live across a call */
+        int hint;  /* virtual register it is copied from or to */
+        int reg;   /* -1 if spilled */
+        int slot;
+};
+
+// clang-format off
+static const int tregs[] = {5, 6, 7, 28, 29};                           /* t0-t4 */
+static const int sregs[] = {9, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27}; /* s1-s11 */
+// clang-format on
+#define NTREGS (int)(sizeof(tregs) / sizeof(tregs[0]))
+#define NSREGS (int)(sizeof(sregs) / sizeof(sregs[0]))
+
+static struct Interval *intervals; /* of virtual register r at r - NREGS */
+static int nslots;
+static bool savedused[NSREGS];
+
+bool isvreg(int r) { return r >= NREGS; }
+
+bool issaved(int r) {
+        for (int i = 0; i < NSREGS; i++)
+                if (sregs[i] == r) return true;
+        return false;
+}
+
+#define TEST(set, r) ((set)[((r)-NREGS) / 64] >> (((r)-NREGS) % 64) & 1)
+#define SET(set, r) ((set)[((r)-NREGS) / 64] |= 1ull << (((r)-NREGS) % 64))
+#define CLEAR(set, r) ((set)[((r)-NREGS) / 64] &= ~(1ull << (((r)-NREGS) % 64)))
+
+/* out = union of the live-in sets of the successors of instruction i */
+void liveout(int i, int *target, uint64_t *in, uint64_t *out, int nwords) {
+        memset(out, 0, nwords * sizeof(uint64_t));
+        enum InsnKind k = insns[i].kind;
+        if (k != I_J && k != I_RET && i + 1 < ninsns)
+                for (int w = 0; w < nwords; w++) out[w] |= in[(i + 1) * nwords + w];
+        if (k == I_J || k == I_BR)
+                for (int w = 0; w < nwords; w++) out[w] |= in[target[i] * nwords + w];
+}
+
+void extend(int r, int pos) {
+        struct Interval *it = &intervals[r - NREGS];
+        if (pos < it->start) it->start = pos;
+        if (pos > it->end) it->end = pos;
+}
+
+static int *target;       /* label index each jump or branch goes to */
+static uint64_t *livein;  /* registers live into instruction i, at i * nwords */
+static int nwords;
+
+void liveness(void) {
+        free(target);
+        free(livein);
+        nwords = (nvregs - NREGS + 63) / 64 + 1;
+        target = calloc(ninsns, sizeof(int));
+        for (int i = 0; i < ninsns; i++) {
+                if (insns[i].kind != I_J && insns[i].kind != I_BR) continue;
+                target[i] = -1;
+                for (int j = 0; j < ninsns; j++)
+                        if (insns[j].kind == I_LABEL && strcmp(insns[j].label, insns[i].label) == 0) target[i] = j;
+                assert(target[i] >= 0);
+        }
+
+        livein = calloc(ninsns * nwords, sizeof(uint64_t));
+        uint64_t *out = calloc(nwords, sizeof(uint64_t));
+        for (bool changed = true; changed;) {
+                changed = false;
+                for (int i = ninsns - 1; i >= 0; i--) {
+                        struct Insn *p = &insns[i];
+                        liveout(i, target, livein, out, nwords);
+                        if (isvreg(p->rd)) CLEAR(out, p->rd);
+                        if (isvreg(p->rs1)) SET(out, p->rs1);
+                        if (isvreg(p->rs2)) SET(out, p->rs2);
+                        if (memcmp(out, &livein[i * nwords], nwords * sizeof(uint64_t)) != 0) {
+                                memcpy(&livein[i * nwords], out, nwords * sizeof(uint64_t));
+                                changed = true;
+                        }
+                }
+        }
+        free(out);
+}
+
+/* drops the instructions whose result nothing reads, such as the li of a constant lowered into an immediate */
+bool dropdead(void) {
+        uint64_t *out = calloc(nwords, sizeof(uint64_t));
+        int n = 0;
+        for (int i = 0; i < ninsns; i++) {
+                struct Insn *p = &insns[i];
+                bool dead = false;
+                if (isvreg(p->rd) && p->kind != I_CALL) {
+                        liveout(i, target, livein, out, nwords);
+                        dead = !TEST(out, p->rd);
+                }
+                if (!dead) insns[n++] = *p;
+        }
+        free(out);
+        bool changed = n < ninsns;
+        ninsns = n;
+        return changed;
+}
+
+bool isvmv(struct Insn *p) { return p->kind == I_RR && strcmp(p->op, "mv") == 0 && isvreg(p->rd) && isvreg(p->rs1); }
+
+int alias(int *merged, int r) {
+        while (merged[r - NREGS] != r) r = merged[r - NREGS];
+        return r;
+}
+
+/* gives both sides of a mv the same virtual register wherever their values are never both live and different:
+   a register interferes with what is live past each of its definitions but the source of that definition if
+   it is a mv (Chaitin). the movs out of SSA form are mostly of this kind */
+bool coalesce(void) {
+        int n = nvregs - NREGS;
+        uint64_t *interferes = calloc((size_t)n * nwords, sizeof(uint64_t)); /* row of r at (r - NREGS) * nwords */
+        uint64_t *out = calloc(nwords, sizeof(uint64_t));
+        for (int i = 0; i < ninsns; i++) {
+                struct Insn *p = &insns[i];
+                if (!isvreg(p->rd)) continue;
+                liveout(i, target, livein, out, nwords);
+                for (int r = NREGS; r < nvregs; r++)
+                        if (TEST(out, r) && r != p->rd && !(isvmv(p) && r == p->rs1)) {
+                                SET(&interferes[(p->rd - NREGS) * nwords], r);
+                                SET(&interferes[(r - NREGS) * nwords], p->rd);
+                        }
+        }
+        free(out);
+
+        int *merged = malloc(n * sizeof(int));
+        for (int i = 0; i < n; i++) merged[i] = NREGS + i;
+        bool changed = false;
+        for (int i = 0; i < ninsns; i++) {
+                if (!isvmv(&insns[i])) continue;
+                int a = alias(merged, insns[i].rd), b = alias(merged, insns[i].rs1);
+                uint64_t *rowa = &interferes[(a - NREGS) * nwords], *rowb = &interferes[(b - NREGS) * nwords];
+                if (a == b || TEST(rowa, b)) continue;
+                merged[b - NREGS] = a;
+                for (int w = 0; w < nwords; w++) rowa[w] |= rowb[w];
+                for (int r = NREGS; r < nvregs; r++)
+                        if (TEST(rowb, r)) SET(&interferes[(r - NREGS) * nwords], a);
+                changed = true;
+        }
+        free(interferes);
+
+        int m = 0;
+        for (int i = 0; i < ninsns; i++) {
+                struct Insn *p = &insns[i];
+                if (isvreg(p->rd)) p->rd = alias(merged, p->rd);
+                if (isvreg(p->rs1)) p->rs1 = alias(merged, p->rs1);
+                if (isvreg(p->rs2)) p->rs2 = alias(merged, p->rs2);
+                if (!(isvmv(p) && p->rd == p->rs1)) insns[m++] = *p;
+        }
+        ninsns = m;
+        free(merged);
+        return changed;
+}
+
+void buildintervals(void) {
+        intervals = calloc(nvregs - NREGS, sizeof(struct Interval));
+        for (int r = NREGS; r < nvregs; r++) {
+                intervals[r - NREGS].start = 2 * ninsns;
+                intervals[r - NREGS].end = -1;
+                intervals[r - NREGS].hint = -1;
+        }
+        uint64_t *out = calloc(nwords, sizeof(uint64_t));
+        for (int i = 0; i < ninsns; i++) {
+                struct Insn *p = &insns[i];
+                liveout(i, target, livein, out, nwords);
+                for (int r = NREGS; r < nvregs; r++) {
+                        if (TEST(&livein[i * nwords], r)) extend(r, 2 * i);
+                        if (TEST(out, r)) {
+                                extend(r, 2 * i + 1);
+                                if (p->kind == I_CALL) intervals[r - NREGS].call = true;
+                        }
+                }
+                if (isvreg(p->rd)) extend(p->rd, 2 * i + 1);
+                if (isvmv(p)) {
+                        if (intervals[p->rd - NREGS].hint < 0) intervals[p->rd - NREGS].hint = p->rs1;
+                        if (intervals[p->rs1 - NREGS].hint < 0) intervals[p->rs1 - NREGS].hint = p->rd;
+                }
+        }
+        free(out);
+}
+
+int bystart(const void *a, const void *b) {
+        return intervals[*(const int *)a - NREGS].start - intervals[*(const int *)b - NREGS].start;
+}
+
+/* a free register for it, the one of its hint if possible */
+int pickreg(struct Interval *it, bool *busy) {
+        if (it->hint >= 0) {
+                int r = intervals[it->hint - NREGS].reg;
+                if (r >= 0 && !busy[r] && (!it->call || issaved(r))) return r;
+        }
+        if (!it->call)
+                for (int i = 0; i < NTREGS; i++)
+                        if (!busy[tregs[i]]) return tregs[i];
+        for (int i = 0; i < NSREGS; i++)
+                if (!busy[sregs[i]]) return sregs[i];
+        return -1;
+}
+
+void regalloc(void) {
+        liveness();
+        while (dropdead()) liveness();
+        if (coalesce()) {
+                tidyjumps();
+                liveness();
+        }
+        buildintervals();
+
+        int n = nvregs - NREGS;
+        int *order = malloc(n * sizeof(int));
+        for (int i = 0; i < n; i++) {
+                order[i] = NREGS + i;
+                intervals[i].reg = -1;
+        }
+        qsort(order, n, sizeof(int), bystart);
+
+        bool busy[NREGS] = {false};
+        int active[NREGS], nactive = 0;
+        nslots = 0;
+        for (int k = 0; k < n; k++) {
+                struct Interval *it = &intervals[order[k] - NREGS];
+                if (it->end < 0) continue; /* never used */
+
+                for (int a = 0; a < nactive; a++) {
+                        struct Interval *old = &intervals[active[a] - NREGS];
+                        if (old->end < it->start) {
+                                busy[old->reg] = false;
+                                active[a--] = active[--nactive];
+                        }
+                }
+
+                it->reg = pickreg(it, busy);
+                if (it->reg < 0) {
+                        int victim = -1;
+                        for (int a = 0; a < nactive; a++) {
+                                struct Interval *old = &intervals[active[a] - NREGS];
+                                if (it->call && !issaved(old->reg)) continue;
+                                if (victim < 0 || old->end > intervals[active[victim] - NREGS].end) victim = a;
+                        }
+                        if (victim >= 0 && intervals[active[victim] - NREGS].end > it->end) {
+                                struct Interval *old = &intervals[active[victim] - NREGS];
+                                it->reg = old->reg;
+                                old->reg = -1;
+                                old->slot = nslots++;
+                                active[victim] = active[--nactive];
+                        } else {
+                                it->slot = nslots++;
+                                continue;
+                        }
+                }
+                busy[it->reg] = true;
+                active[nactive++] = order[k];
+        }
+        free(order);
+
+        for (int i = 0; i < NSREGS; i++) savedused[i] = false;
+        for (int i = 0; i < n; i++)
+                for (int j = 0; j < NSREGS; j++)
+                        if (intervals[i].reg == sregs[j]) savedused[j] = true;
+}
+
+/* ----------------------------------------------------------------------------------------------------------- */
+/* --------------------------------------------------- EMIT -------------------------------------------------- */
+/* ----------------------------------------------------------------------------------------------------------- */
+/* frame: ra and s0 at the top, below them the callee-saved registers in use, then the spill slots */
+static int nsaved;
+
+int slotoffset(int slot) { return -16 - 8 * nsaved - 8 * (slot + 1); }
+
+/* machine register holding operand r, reloaded into scratch if spilled */
+int usereg(int r, int scratch) {
+        if (!isvreg(r)) return r;
+        struct Interval *it = &intervals[r - NREGS];
+        if (it->reg >= 0) return it->reg;
+        printf("  ld      %s,%d(s0)\n", xname[scratch], slotoffset(it->slot));
+        return scratch;
+}
+
+int defreg(int r) {
+        if (!isvreg(r)) return r;
+        return intervals[r - NREGS].reg >= 0 ? intervals[r - NREGS].reg : T5;
+}
+
+void emitfn(void) {
+        nsaved = 0;
+        for (int i = 0; i < NSREGS; i++) nsaved += savedused[i];
+        int frame = (16 + 8 * nsaved + 8 * nslots + 15) / 16 * 16;
+
+        printf("  .globl %s\n", current_fn->name);
+        printf("%s:\n", current_fn->name);
+
+        // prologue
+        printf("  addi    sp,sp,-%d\n", frame);
+        printf("  sd      ra,%d(sp)\n", frame - 8);
+        printf("  sd      s0,%d(sp)\n", frame - 16);
+        for (int i = 0, k = 0; i < NSREGS; i++)
+                if (savedused[i]) printf("  sd      %s,%d(sp)\n", xname[sregs[i]], frame - 24 - 8 * k++);
+        printf("  addi    s0,sp,%d\n", frame);
+
+        for (int i = 0; i < ninsns; i++) {
+                struct Insn *p = &insns[i];
+                int rs1 = usereg(p->rs1, T5);
+                int rs2 = usereg(p->rs2, T6);
+                int rd = defreg(p->rd);
+                switch (p->kind) {
+                        case I_RRR: printf("  %-8s%s,%s,%s\n", p->op, xname[rd], xname[rs1], xname[rs2]); break;
+                        case I_RRI: printf("  %-8s%s,%s,%ld\n", p->op, xname[rd], xname[rs1], (long)p->imm); break;
+                        case I_RR:
+                                if (strcmp(p->op, "mv") != 0 || rd != rs1)
+                                        printf("  %-8s%s,%s\n", p->op, xname[rd], xname[rs1]);
+                                break;
+                        case I_LI: printf("  li      %s,%ld\n", xname[rd], (long)p->imm); break;
+                        case I_BR: printf("  %-8s%s,%s,%s\n", p->op, xname[rs1], xname[rs2], p->label); break;
+                        case I_J: printf("  j       %s\n", p->label); break;
+                        case I_CALL: printf("  call    %s\n", p->label); break;
+                        case I_LABEL: printf("%s:\n", p->label); break;
+                        case I_RET:
+                                // epilogue
+                                for (int i = 0, k = 0; i < NSREGS; i++)
+                                        if (savedused[i])
+                                                printf("  ld      %s,%d(sp)\n", xname[sregs[i]], frame - 24 - 8 * k++);
+                                printf("  ld      ra,%d(sp)\n", frame - 8);
+                                printf("  ld      s0,%d(sp)\n", frame - 16);
+                                printf("  addi    sp,sp,%d\n", frame);
+                                printf("  jr      ra\n\n");
+                                break;
+                }
+                if (isvreg(p->rd) && intervals[p->rd - NREGS].reg < 0)
+                        printf("  sd      t5,%d(s0)\n", slotoffset(intervals[p->rd - NREGS].slot));
+        }
+        free(intervals);
+}
 /* ----------------------------------------------------------------------------------------------------------- */
 /* -------------------------------------------------- MAIN --------------------------------------------------- */
 /* ----------------------------------------------------------------------------------------------------------- */
 
 int main(int argc, char **argv) {
-        if (argc < 2) assert(0);
+        char *program = NULL;
+        bool dumpir = false; /* -ir: print the IR instead of assembly; -O0 (default), -O1, -O2: optimization level */
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "-ir") == 0)
+                        dumpir = true;
+                else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2')
+                        optlevel = argv[i][2] - '0';
+                else
+                        program = argv[i];
+        }
+        if (program == NULL) assert(0);
         struct Token *tokenlist = NULL;
-        scan(argv[1], &tokenlist);
+        scan(program, &tokenlist);
         struct Edecl *decllist = parse(tokenlist);
-        codegen(decllist);
+        codegen(decllist, dumpir);
         return 0;
 }
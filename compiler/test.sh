@@ -1,10 +1,19 @@
 #!/bin/bash
 
+# every program is checked at each optimization level
+if [ -z "$OPT" ]; then
+    for OPT in -O0 -O1 -O2; do
+        echo "== $OPT"
+        OPT=$OPT "$0" || exit 1
+    done
+    exit 0
+fi
+
 assert() {
     expected="$(( ($1 % 256 + 256) % 256 ))" # in C, main's return value range (0 - 255)
     input="$2"
 
-    ./build/ganymede "$input" > ./build/tmp.s || exit
+    ./build/ganymede "$OPT" "$input" > ./build/tmp.s || exit
     # ./build/ganymede "-s" "$input" -o ./build/tmp.s || exit
 
     # riscv64-linux-gnu-gcc -static -o ./build/tmp ./build/tmp.s
@@ -25,6 +34,24 @@ assert 17 "int sum(int ab, int ba, int ca) { return ab + ba + ca; } int main() {
 assert 13 "int sum(int ab, int ba) { return ab + ba; } int main() { int a = sum(4, 9); return a; }";
 assert 12 "int func(int ab) { return ab * 3; } int main() { int a = func(4); return a; }";
 
+assert 144 "int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { return fib(12); }";
+assert 114 "int gcd(int p, int q) { while (q != 0) { int t = p % q; p = q; q = t; } return p; } int main() { int s = 0; for (int i = 1; i < 40; i++) { s = s + gcd(i * 7, 84); } return s; }";
+assert 80 "int main() { int a = 1; int b = 2; int c = 3; int d = 4; int e = 5; int f = 6; int g = 7; int h = 8; int i = 9; int j = 10; int k = 11; int l = 12; int m = 13; int n = 14; int o = 15; int p = 16; int q = 17; int r = 18; int s = 19; int t = 20; int x = 0; while (x < 5) { a = a + b; b = b + c; c = c + d; d = d + e; e = e + f; f = f + g; g = g + h; h = h + i; i = i + j; j = j + k; k = k + l; l = l + m; m = m + n; n = n + o; o = o + p; p = p + q; q = q + r; r = r + s; s = s + t; t = t + a; x++; } return a + b * 3 + c + d + e + f + g + h + i + j + k + l + m + n + o + p + q + r + s + t; }";
+assert 222 "int id(int v) { return v; } int main() { int a = 1; int b = 2; int c = 3; int d = 4; int e = 5; int f = 6; int g = 7; int h = 8; int i = 9; int j = 10; int k = 11; int l = 12; int m = 13; int n = 14; int o = 15; int x = 0; while (x < 3) { a = id(a + b); b = id(b + c); c = c + d; d = d + e; e = id(e + f); f = f + g; g = g + h; h = h + i; i = i + j; j = id(j + k); k = k + l; l = l + m; m = m + n; n = n + o; o = id(o + a); x++; } return a + b + c + d + e + f + g + h + i + j + k + l + m + n + o; }";
+
+assert 235 "int main() { int a = 3; int b = 10; int n = 5; while (n > 0) { int t = a; a = b; b = t; n--; } return a * 100 + b; }";
+assert 100 "int main() { int x = 1; int y = 0; do { y = x; x = x + 1; } while (x < 10); return y * 10 + x; }";
+assert 140 "int g(int x) { return x; } int main() { int a = g(5); int b = g(7); int c = a * b + a * b; int d = 0; if (a < b) { d = a * b; } else { d = b * a; } return c + d + a * b; }";
+assert 96 "int main() { int a = 1; int b = 2; int c = 3; int i = 0; while (i < 7) { int t = a; a = b; b = c; c = t + a; i++; } return a + b * 2 + c * 3; }";
+
+assert 227982 "int f(int x) { int q = x / 7; int r = x % 7; int s = x / 16; int t = x % 16; int m = x * 9; int n = x / 1000; int k = x % 1000; return q + r + s + t + m + n + k; } int main() { int a = f(0 - 12345); int b = f(12345); int c = f(0 - 3); return a + b * 3 + c; }";
+assert 104 "int f(int x) { int c = 0 - 4; return x / c + x % c + x * c; } int main() { return f(0 - 13) + 50; }";
+
+assert 3 "int boom(int n) { return boom(n + 1); } int main() { int a = 0; if (a && boom(1)) return 1; if (a == 0 || boom(2)) return 3; return 2; }";
+assert 6 "int boom(int n) { return boom(n + 1); } int main() { int a = 4; int b = a > 5 && boom(a); int c = a < 5 || boom(a); int d = !a || a >= 4 && a <= 4; return b + c * 2 + d * 4; }";
+assert 21 "int main() { int a = 5; int b = 6; int s = 0; int i = 0; while (i < 10 && i != 7) { if (!a > b || i % 3 == 0) s = s + i; i++; } int c = a && b; int d = 0 || a; return s + c * 3 + d * 9; }";
+assert 33 "int main() { int n = 0; int i = 0; for (; i < 100; i++) { if (i > 10 && i <= 20 || i != i || i == 50) n = n + 3; } return n; }";
+
 assert 23 "int main() { int a = 23; if (a > 22) goto Lll; Lll: return a; return 0; }"
 assert 23 "int main() { int a = 23; goto Lll; Lll: return a; return 0; }"
 
@@ -38,8 +65,10 @@ assert 1 "int main() { int a = 1; switch (a) {} return a; }";
 assert 90 "int main() { int a = 1; switch (a) { case 1: a = a * 90; break; case 2: a = a * 7; break; default: a = a * 2;} return a; }";
 assert 40 "int main() { int a = 2; switch (a) { case 1: a = a * 90; break; case 2: a = a * 20; break; default: a = a * 2;} return a; }";
 assert 6 "int main() { int a = 3; switch (a) { case 1: a = a * 90; break; case 2: a = a * 7; break; default: a = a * 2;} return a; }";
+assert 404 "int main() { int s = 0; for (int i = 0; i < 6; i++) { switch (i) { default: s = s + 100; break; case 1: s = s + 1; break; case 3: s = s + 3; } } return s; }";
 assert 10 "int main() { int a = 1; do a++; while (a < 10); return a; }";
 assert 16 "int main() { int a = 1; do { a = a * 2; } while (a < 10); return a; }";
+assert 25 "int main() { int a = 0; int s = 0; do { a++; if (a % 2 == 0) continue; s = s + a; } while (a < 10); return s; }";
 assert 11 "int main() { int a = 1; int i = 0; for (; i < 10; i++) { a++; } return a; }";
 assert 10 "int main() { int a = 1; int i = 0; for (; i < 10; i++) { if (i == 3) continue; a++; } return a; }";
 assert 1 "int main() { int a = 1; int i = 0; for (; i < 10; i++) ; return a; }";
@@ -57,6 +86,7 @@ assert 23 "int main() { int a = 23; if (a) return 23; else return 0; }";
 assert 23 "int main() { int a = 24; if (a > 23) return 23; else if (a == 23) return 10; else return 0; }";
 assert 10 "int main() { int a = 23; if (a > 23) return 23; else if (a == 23) return 10; else return 0; }";
 assert 0 "int main() { int a = 22; if (a > 23) return 23; else if (a == 23) return 10; else return 0; }";
+assert 21 "int main() { int a = 5; int b = 0; if (a > 3) b = 1; else b = 2; if (a < 3) b = b + 10; else b = b + 20; return b; }";
 
 assert 23 "int main() { int a; a = 23; return a; }";
 assert 46 "int main() { int a; int b; a = 23; b = a * 2; return b; }";
@@ -80,6 +110,7 @@ assert 26 "int main() { int a = 23; a = a - 50; return ~a; }";
 assert 100 "int main() { int a = 23; a = a > 10 ? 100 : 1; return a; }";
 assert 1 "int main() { int a = 23; a = a < 10 ? 100 : 1; return a; }";
 assert 9 "int main() { int a = 23; a = a == 10 ? 100 : 1; return a * 9; }";
+assert 85 "int main() { int a = 0; int b = 0; int i = 0; while (i < 10) { int t = i % 2 ? a++ : b++; i++; } return a * 16 + b; }";
 
 assert 26 "int main() { int a = 23; a = a + 3; return a; }";
 assert 55 "int main() { int a = 23; int b = 32; a = a + b; return a; }";
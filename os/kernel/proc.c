@@ -79,6 +79,8 @@ found:
         } else {
                 memmove(mem, process2, sizeof(process2));
         }
+        // the code went out through the data cache
+        asm volatile("fence.i");
         p->sz = PGSIZE;
 
         // prepare for the first return from kernel
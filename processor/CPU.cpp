@@ -1,61 +1,1155 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "VCPU.h"
+#include "VCPU__Dpi.h"
+#include "VCPU___024root.h"
+#include "checkpoint.h"
+#include "commitlog.h"
+#include "iss.h"
+#include "loader.h"
+#include "memory.h"
+#include "profiler.h"
+#include "rvc.h"
 #include "verilated.h"
+#include "verilated_save.h"
+
+// TRACE and VPARAMS of this build; a checkpoint only restores the Verilator state of
+// a model built the same way
+#ifndef MODEL_CONFIG
+#define MODEL_CONFIG ""
+#endif
+// VPARAMS alone, which together with the memory timing decides the cycle counts
+#ifndef MODEL_PARAMS
+#define MODEL_PARAMS ""
+#endif
+// harts of this build (make HARTS=1|2); the harness follows hart 0, hart 1 only shows
+// in the coherence counters
+#ifndef HARTS
+#define HARTS 1
+#endif
+
+// the trace format is fixed when the model is verilated (make TRACE=off|vcd|fst)
+#if VM_TRACE_FST
+#include "verilated_fst_c.h"
+typedef VerilatedFstC TraceFile;
+static const char *traceExt = "fst";
+#elif VM_TRACE
 #include "verilated_vcd_c.h"
+typedef VerilatedVcdC TraceFile;
+static const char *traceExt = "vcd";
+#endif
 
-int main(int argc, char **argv) {
-        if (argc < 2) {
-                printf("Test name missing\n");
+static const uint64_t NEVER = UINT64_MAX;
+
+// hardware performance counters of the csrfile module in CPU.sv
+struct Counters {
+        uint64_t cycles;
+        uint64_t instret;
+        uint64_t loadStalls;  // load-use stall cycles
+        uint64_t branchStalls;  // cycles an early-resolved branch waited for its operands
+        uint64_t mdStalls;    // cycles EX waited for a multiply or divide
+        uint64_t icHits, icMisses;
+        uint64_t icStalls;    // bubbles fetched while the icache refilled
+        uint64_t dcHits, dcMisses, dcWritebacks;
+        uint64_t dcStalls;    // cycles the pipeline was frozen by dcache misses
+        uint64_t squashed;    // fetch slots squashed by mispredictions
+        uint64_t taken;       // taken conditional branches
+        uint64_t loads;
+        uint64_t stores;
+        uint64_t bubbles;  // cycles in which nothing retired
+        uint64_t bpHits;   // correctly predicted branches and jumps
+        uint64_t bpMisses;
+        uint64_t dual;     // cycles in which the second pipe retired as well
+        uint64_t compressed;  // RV64C instructions retired
+        uint64_t fused;       // fused ops retired, two instructions each
+        uint64_t itlbHits, itlbMisses;  // translated fetches; misses are page table walks
+        uint64_t dtlbHits, dtlbMisses;  // translated loads and stores
+        uint64_t walkCycles;  // cycles the page table walker was busy
+        uint64_t traps;       // exceptions and interrupts taken
+        uint64_t busTransactions;  // requests the dcache was granted on the snoop bus
+        uint64_t invalidated;      // dcache lines the other hart's requests invalidated
+        uint64_t scFailures;       // store-conditionals that failed
+};
+
+// snoop bus traffic of both harts together (HARTS=2), from the snoopbus module
+struct Coherence {
+        uint64_t reads, readExclusive, upgrades;  // requests granted
+        uint64_t flushes;        // dirty lines a snoop wrote back for the other hart
+        uint64_t invalidations;  // lines a snoop invalidated
+        uint64_t scFailures;     // of both harts
+        uint64_t hart1Instret;
+};
+
+struct Result {
+        bool finished;  // $finish or an HTIF exit was reached before the cycle limit
+        bool sampled;   // stopped after the --detail instructions
+        bool mismatch;  // the RTL diverged from the lockstep ISS
+        bool saved;     // stopped after writing the checkpoint
+        bool passed;    // exit code 0 through tohost, or a0 == 0 at an ecall without a
+                        // handler
+        uint64_t cycles;
+        Counters counters;
+        Coherence coherence;
+        uint64_t triggerCycle;  // first cycle the trace trigger fired in, or NEVER
+        uint64_t memBusy;       // cycles the backing memory spent transferring lines
+        size_t pages;           // 4 KiB pages of memory touched
+        uint64_t skipped;       // instructions fast-forwarded on the ISS
+        double issSeconds;
+        std::string console;
+        double seconds;
+};
+
+struct TraceOptions {
+        bool all = false;                        // --trace
+        uint64_t start = 0, end = NEVER;         // --trace-window START:END
+        bool pcTrigger = false;                  // --trace-pc LO:HI
+        uint64_t pcLo = 0, pcHi = 0;
+        int regTrigger = -1;                     // --trace-reg N
+        uint64_t before = 0, after = 1000;       // --trace-before/--trace-after, around a trigger
+        uint64_t onFail = 0;                     // --trace-on-fail N
+
+        bool trigger() const { return pcTrigger || regTrigger >= 0; }
+        bool any() const { return all || end != NEVER || trigger() || onFail; }
+};
+
+struct Options {
+        unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+        uint64_t maxCycles = 100000;
+        MemoryTiming memory;
+        bool echo = false;  // console output goes to stdout while running
+        uint64_t ffInsns = 0;                    // --ff N
+        uint64_t ffPc = NEVER;                   // --ff-pc ADDR
+        uint64_t detail = NEVER;                 // --detail N
+        bool lockstep = false;                   // --lockstep
+        std::string checkpoint;                  // --checkpoint FILE
+        uint64_t checkpointCycle = NEVER;        // --checkpoint-cycle N
+        uint64_t checkpointPc = NEVER;           // --checkpoint-pc ADDR
+        std::string restore;                     // --restore FILE
+        bool commits = false;                    // --commits
+        bool profile = false;                    // --profile
+        uint64_t profilePeriod = 1;              // --profile-period N
+        std::string results;                     // --results FILE
+        std::string baseline;                    // --baseline FILE
+        double regressThreshold = 2;             // --regress-threshold PCT
+        bool allowMissing = false;               // --allow-missing
+        TraceOptions trace;
+        std::vector<std::string> tests;
+};
+
+// cycles [start, end) of one run are dumped to file; with waitTrigger the window only
+// opens once the trigger fires
+struct TracePlan {
+        std::string file;
+        uint64_t start = 0, end = NEVER;
+        bool waitTrigger = false;
+};
+
+static Counters readCounters(VCPU *tb) {
+        const VCPU___024root *root = tb->rootp;
+        Counters c;
+        c.cycles = root->CPU__DOT__hart0__DOT__csr__DOT__mcycle;
+        c.instret = root->CPU__DOT__hart0__DOT__csr__DOT__minstret;
+        c.loadStalls = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_loadstall;
+        c.branchStalls = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_brstall;
+        c.mdStalls = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_mdstall;
+        c.icHits = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_ichit;
+        c.icMisses = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_icmiss;
+        c.icStalls = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_icstall;
+        c.dcHits = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dchit;
+        c.dcMisses = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dcmiss;
+        c.dcWritebacks = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dcwb;
+        c.dcStalls = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dcstall;
+        c.squashed = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_squash;
+        c.taken = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_taken;
+        c.loads = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_load;
+        c.stores = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_store;
+        c.bubbles = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_bubble;
+        c.bpHits = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_bphit;
+        c.bpMisses = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_bpmiss;
+        c.dual = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dual;
+        c.compressed = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_rvc;
+        c.fused = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_fused;
+        c.itlbHits = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_itlbhit;
+        c.itlbMisses = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_itlbmiss;
+        c.dtlbHits = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dtlbhit;
+        c.dtlbMisses = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_dtlbmiss;
+        c.walkCycles = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_walk;
+        c.traps = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_trap;
+        c.busTransactions = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_bus;
+        c.invalidated = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_inval;
+        c.scFailures = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_scfail;
+        return c;
+}
+
+static Coherence readCoherence(VCPU *tb) {
+        const VCPU___024root *root = tb->rootp;
+        Coherence c = {};
+        c.reads = root->CPU__DOT__bus__DOT__reads;
+        c.readExclusive = root->CPU__DOT__bus__DOT__readx;
+        c.upgrades = root->CPU__DOT__bus__DOT__upgrades;
+        c.flushes = root->CPU__DOT__bus__DOT__flushes;
+        c.invalidations = root->CPU__DOT__bus__DOT__invalidations;
+        c.scFailures = root->CPU__DOT__hart0__DOT__csr__DOT__hpm_scfail;
+#if HARTS > 1
+        c.scFailures += root->CPU__DOT__smp__DOT__hart1__DOT__csr__DOT__hpm_scfail;
+        c.hart1Instret = root->CPU__DOT__smp__DOT__hart1__DOT__csr__DOT__minstret;
+#endif
+        return c;
+}
+
+static bool triggered(VCPU *tb, const TraceOptions &opts) {
+        const VCPU___024root *root = tb->rootp;
+        if (opts.pcTrigger) {
+                uint64_t pc = root->CPU__DOT__hart0__DOT__wb_pc, pc1 = root->CPU__DOT__hart0__DOT__wb1_pc;
+                if (pc >= opts.pcLo && pc <= opts.pcHi) return true;
+                if (root->CPU__DOT__hart0__DOT__wb1_RegWrite && pc1 >= opts.pcLo && pc1 <= opts.pcHi)
+                        return true;
+        }
+        if (opts.regTrigger >= 0) {
+                if (root->CPU__DOT__hart0__DOT__wb_RegWrite &&
+                    root->CPU__DOT__hart0__DOT__wb_rd == opts.regTrigger)
+                        return true;
+                if (root->CPU__DOT__hart0__DOT__wb1_RegWrite &&
+                    root->CPU__DOT__hart0__DOT__wb1_rd == opts.regTrigger)
+                        return true;
+        }
+        return false;
+}
+
+// an instruction retiring this cycle
+struct Retired {
+        uint64_t pc;
+        uint64_t ppc;    // physical address of the instruction
+        int rd;          // 0 when it writes no register
+        uint64_t value;  // written to rd
+        bool shadowed;   // first half of a fused op: value is unknown, the second half
+                         // overwrites rd in the same cycle
+};
+
+// fills out with the instructions retiring this cycle, oldest first: the one in WB and,
+// on a dual-issue model, the younger half of its pair in the second pipe. A fused op
+// retires as its two instructions; the result in WB is the second one's, unless that is
+// the branch of a compare and branch.
+static int retiring(VCPU *tb, Memory &mem, Retired out[2]) {
+        const VCPU___024root *root = tb->rootp;
+        int n = 0;
+        if (root->CPU__DOT__hart0__DOT__wb_retire) {
+                uint64_t pc = root->CPU__DOT__hart0__DOT__wb_pc, ppc = root->CPU__DOT__hart0__DOT__wb_ppc;
+                int rd = root->CPU__DOT__hart0__DOT__wb_RegWrite ? root->CPU__DOT__hart0__DOT__wb_rd : 0;
+                uint64_t value = rd ? root->CPU__DOT__hart0__DOT__wb_data : 0;
+                if (root->CPU__DOT__hart0__DOT__wb_Fused) {
+                        unsigned bytes = instrBytes(mem.instruction(ppc));
+                        uint64_t second = pc + bytes, second_ppc = ppc + bytes;
+                        if ((expandCompressed(mem.instruction(second_ppc)) & 0x7f) == 0x63) {
+                                out[n++] = {pc, ppc, rd, value, false};
+                                out[n++] = {second, second_ppc, 0, 0, false};
+                        } else {
+                                out[n++] = {pc, ppc, rd, 0, true};
+                                out[n++] = {second, second_ppc, rd, value, false};
+                        }
+                } else {
+                        out[n++] = {pc, ppc, rd, value, false};
+                }
+        }
+        if (root->CPU__DOT__hart0__DOT__wb1_retire) {  // the pair never crosses a page
+                int rd = root->CPU__DOT__hart0__DOT__wb1_rd;
+                uint64_t pc = root->CPU__DOT__hart0__DOT__wb1_pc;
+                out[n++] = {pc,
+                            root->CPU__DOT__hart0__DOT__wb_ppc + (pc - root->CPU__DOT__hart0__DOT__wb_pc), rd,
+                            rd ? root->CPU__DOT__hart0__DOT__wb1_result : 0, false};
+        }
+        return n;
+}
+
+// the oldest stage holding an instruction has the first one that has not retired;
+// WB has already written its result to the register file
+static uint64_t resumePc(VCPU *tb) {
+        const VCPU___024root *root = tb->rootp;
+        if (root->CPU__DOT__hart0__DOT__mem_valid) return root->CPU__DOT__hart0__DOT__mem_pc;
+        if (root->CPU__DOT__hart0__DOT__ex_valid) return root->CPU__DOT__hart0__DOT__ex_pc;
+        if (root->CPU__DOT__hart0__DOT__id_valid) return root->CPU__DOT__hart0__DOT__id_pc;
+        return root->CPU__DOT__hart0__DOT__if_pc;
+}
+
+// the privileged state of the csrfile, which a checkpoint carries over and a run
+// restored or fast-forwarded on the ISS starts from
+static PrivState privState(VCPU *tb) {
+        const VCPU___024root *root = tb->rootp;
+        PrivState c;
+        c.priv = root->CPU__DOT__hart0__DOT__csr__DOT__priv;
+        c.mstatus = root->CPU__DOT__hart0__DOT__csr__DOT__mstatus;
+        c.medeleg = root->CPU__DOT__hart0__DOT__csr__DOT__medeleg;
+        c.mideleg = root->CPU__DOT__hart0__DOT__csr__DOT__mideleg;
+        c.mie = root->CPU__DOT__hart0__DOT__csr__DOT__mie;
+        c.mtvec = root->CPU__DOT__hart0__DOT__csr__DOT__mtvec;
+        c.mscratch = root->CPU__DOT__hart0__DOT__csr__DOT__mscratch;
+        c.mepc = root->CPU__DOT__hart0__DOT__csr__DOT__mepc;
+        c.mcause = root->CPU__DOT__hart0__DOT__csr__DOT__mcause;
+        c.mtval = root->CPU__DOT__hart0__DOT__csr__DOT__mtval;
+        c.mip = root->CPU__DOT__hart0__DOT__csr__DOT__mip;
+        c.stvec = root->CPU__DOT__hart0__DOT__csr__DOT__stvec;
+        c.sscratch = root->CPU__DOT__hart0__DOT__csr__DOT__sscratch;
+        c.sepc = root->CPU__DOT__hart0__DOT__csr__DOT__sepc;
+        c.scause = root->CPU__DOT__hart0__DOT__csr__DOT__scause;
+        c.stval = root->CPU__DOT__hart0__DOT__csr__DOT__stval;
+        c.satp = root->CPU__DOT__hart0__DOT__csr__DOT__satp;
+        return c;
+}
+
+static void setPrivState(VCPU *tb, const PrivState &c) {
+        VCPU___024root *root = tb->rootp;
+        root->CPU__DOT__hart0__DOT__csr__DOT__priv = c.priv;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mstatus = c.mstatus;
+        root->CPU__DOT__hart0__DOT__csr__DOT__medeleg = c.medeleg;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mideleg = c.mideleg;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mie = c.mie;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mtvec = c.mtvec;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mscratch = c.mscratch;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mepc = c.mepc;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mcause = c.mcause;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mtval = c.mtval;
+        root->CPU__DOT__hart0__DOT__csr__DOT__mip = c.mip;
+        root->CPU__DOT__hart0__DOT__csr__DOT__stvec = c.stvec;
+        root->CPU__DOT__hart0__DOT__csr__DOT__sscratch = c.sscratch;
+        root->CPU__DOT__hart0__DOT__csr__DOT__sepc = c.sepc;
+        root->CPU__DOT__hart0__DOT__csr__DOT__scause = c.scause;
+        root->CPU__DOT__hart0__DOT__csr__DOT__stval = c.stval;
+        root->CPU__DOT__hart0__DOT__csr__DOT__satp = c.satp;
+}
+
+// writes the Verilator state, then the architectural state and the memory image;
+// the run ends here, so leaving the written-back lines dirty in the dcache is harmless
+static void saveState(VCPU *tb, Memory &mem, uint64_t cycles, const std::string &path) {
+        {
+                VerilatedSave os;
+                os.open((path + ".model").c_str());
+                os << *tb;
+        }
+        svSetScope(svGetScopeFromName("TOP.CPU.hart0.dc"));
+        cache_writeback();
+#if HARTS > 1
+        svSetScope(svGetScopeFromName("TOP.CPU.smp.hart1.dc"));
+        cache_writeback();
+#endif
+
+        Checkpoint ck;
+        ck.config = MODEL_CONFIG;
+        ck.cycle = cycles;
+        ck.pc = resumePc(tb);
+        for (int r = 0; r < 32; r++) ck.x[r] = r ? tb->rootp->CPU__DOT__hart0__DOT__rf__DOT__REGS[r] : 0;
+        ck.csr = privState(tb);
+        std::string err;
+        if (!saveCheckpoint(path, ck, mem, err)) {
+                printf("Could not write checkpoint '%s': %s\n", path.c_str(), err.c_str());
                 exit(EXIT_FAILURE);
         }
-        std::string test = argv[1];
-        std::string isrcFilePath = "./test/mem_instr-rv64ui-p-";
-        std::string dsrcFilePath = "./test/mem_data-rv64ui-p-";
+        printf("checkpoint '%s' written at cycle %lu, resuming at pc 0x%lx\n", path.c_str(),
+               (unsigned long)cycles, (unsigned long)ck.pc);
+}
+
+// the stall and flush causes of this cycle as 1 << Stall bits, under the conditions the
+// hpm counters use
+static unsigned stallEvents(VCPU *tb) {
+        const VCPU___024root *root = tb->rootp;
+        bool stallEX = root->CPU__DOT__hart0__DOT__ex_stallEX;
+        unsigned events = 0;
+        if (root->CPU__DOT__hart0__DOT__ex_loadStall && !stallEX)
+                events |= 1 << LOAD_USE;
+        else if (root->CPU__DOT__hart0__DOT__ex_branchStall && !stallEX)
+                events |= 1 << BRANCH_OPERAND;
+        if (root->CPU__DOT__hart0__DOT__ex_mispredict || root->CPU__DOT__hart0__DOT__id_mispredict)
+                events |= 1 << FLUSH;
+        if (!root->CPU__DOT__hart0__DOT__if_hit && !root->CPU__DOT__hart0__DOT__ex_stallIF)
+                events |= 1 << (root->CPU__DOT__hart0__DOT__if_tlbwait ? TLB : ICACHE);
+        if (root->CPU__DOT__hart0__DOT__mem_stall)
+                events |= 1 << (root->CPU__DOT__hart0__DOT__mem_ptwwait ? TLB : DCACHE);
+        else if (root->CPU__DOT__hart0__DOT__ex_mdBusy)
+                events |= 1 << MULDIV;
+        return events;
+}
+
+// charges this cycle and its stall events; weight is 0 for the cycles a sampling profile
+// skips
+static void profileCycle(VCPU *tb, Profiler &profiler, unsigned events, uint64_t weight,
+                         const Retired *retired, int count) {
+        const VCPU___024root *root = tb->rootp;
+        if (weight) profiler.cycle(count ? retired[0].pc : resumePc(tb), weight);
+        for (int i = 0; i < count; i++) profiler.retire(retired[i].pc);
+
+        if (events & (1 << LOAD_USE)) profiler.stall(LOAD_USE, root->CPU__DOT__hart0__DOT__id_pc);
+        if (events & (1 << BRANCH_OPERAND)) profiler.stall(BRANCH_OPERAND, root->CPU__DOT__hart0__DOT__id_pc);
+        if (events & (1 << FLUSH)) {  // charged to the branch, with the slots it squashed
+                if (root->CPU__DOT__hart0__DOT__ex_mispredict)
+                        profiler.stall(FLUSH, root->CPU__DOT__hart0__DOT__ex_pc, 2);
+                else
+                        profiler.stall(FLUSH, root->CPU__DOT__hart0__DOT__id_pc, 1);
+        }
+        if (events & (1 << ICACHE)) profiler.stall(ICACHE, root->CPU__DOT__hart0__DOT__if_pc);
+        if (events & (1 << DCACHE)) profiler.stall(DCACHE, root->CPU__DOT__hart0__DOT__mem_pc);
+        if (events & (1 << MULDIV)) profiler.stall(MULDIV, root->CPU__DOT__hart0__DOT__ex_pc);
+        if (events & (1 << TLB))
+                profiler.stall(TLB, root->CPU__DOT__hart0__DOT__mem_ptwwait ? root->CPU__DOT__hart0__DOT__mem_pc
+                                                                            : root->CPU__DOT__hart0__DOT__if_pc);
+}
 
-        std::string ifileName = isrcFilePath + test;
-        std::ifstream isrc(ifileName, std::ios::binary);
-        std::ofstream idst("./test/mem_instr", std::ios::binary);
-        idst << isrc.rdbuf();
-        idst << '\n';
-        idst.close();
-        isrc.close();
+// Builds a commit record per retired instruction. WB does not keep the address and store
+// data of an access, so they are picked up as the instruction leaves MEM.
+struct CommitTracker {
+        unsigned stalls = 0;  // causes seen since the last retirement
+        bool access = false, store = false;
+        uint64_t addr = 0, data = 0;
 
-        std::string dfileName = dsrcFilePath + test;
-        std::ifstream dsrc(dfileName, std::ios::binary);
-        std::ofstream ddst("./test/mem_data", std::ios::binary);
-        ddst << dsrc.rdbuf();
-        ddst << '\n';
-        ddst.close();
-        dsrc.close();
+        void cycle(VCPU *tb, Memory &mem, CommitLogWriter &log, unsigned events, uint64_t cycle,
+                   const Retired *retired, int count) {
+                const VCPU___024root *root = tb->rootp;
+                stalls |= events;
+                for (int i = 0; i < count; i++) {  // the second pipe never accesses memory
+                        CommitRecord r;
+                        r.cycle = cycle;
+                        r.pc = retired[i].pc;
+                        r.instr = mem.instruction(retired[i].ppc);
+                        // the overwritten result of a fused op's first half is not logged
+                        r.rd = retired[i].shadowed ? 0 : retired[i].rd;
+                        r.value = retired[i].value;
+                        r.access = i == 0 && access;
+                        r.addr = r.access ? addr : 0;
+                        r.store = r.access && store;
+                        r.data = r.store ? data : 0;
+                        r.stalls = stalls;
+                        log.write(r);
+                        stalls = 0;
+                }
+                if (!root->CPU__DOT__hart0__DOT__mem_stall) {  // what enters WB at the next edge
+                        access = root->CPU__DOT__hart0__DOT__mem_valid &&
+                                 root->CPU__DOT__hart0__DOT__mem_access && !root->CPU__DOT__hart0__DOT__mem_trap;
+                        store = access && root->CPU__DOT__hart0__DOT__mem_MemWrite &&
+                                !root->CPU__DOT__hart0__DOT__mem_scfail;
+                        addr = root->CPU__DOT__hart0__DOT__mem_result;
+                        data = root->CPU__DOT__hart0__DOT__mem_wdata;
+                }
+        }
+};
 
-        Verilated::commandArgs(argc, argv);
+// reports the first instruction on which the RTL and the lockstep ISS disagree
+static bool checkCommit(const Retired &rtl, Iss &iss, const Program &prog) {
+        Iss::Commit c;
+        if (!iss.step(&c)) {
+                printf("%s: RTL retired pc 0x%lx after the ISS stopped at 0x%lx\n", prog.name.c_str(),
+                       (unsigned long)rtl.pc, (unsigned long)iss.pc);
+                return false;
+        }
+        uint64_t value = rtl.shadowed ? c.value : rtl.value;
+        if (c.csr && c.rd) {  // counters are cycle-accurate only in the RTL
+                iss.x[c.rd] = value;
+                c.value = value;
+        }
+        if (rtl.pc == c.pc && rtl.rd == c.rd && value == c.value) return true;
+        printf("%s: mismatch after %lu instructions at pc 0x%lx (0x%08x)\n"
+               "  RTL: pc 0x%lx x%d = 0x%lx\n  ISS: pc 0x%lx x%d = 0x%lx\n",
+               prog.name.c_str(), (unsigned long)iss.instret - 1, (unsigned long)c.pc, c.instr,
+               (unsigned long)rtl.pc, rtl.rd, (unsigned long)value, (unsigned long)c.pc, c.rd,
+               (unsigned long)c.value);
+        return false;
+}
 
-        VCPU *tb = new VCPU;
-        Verilated::traceEverOn(true);
+// runs prog to completion; the model only pays for tracing when plan is given
+static Result runTest(const Program &prog, const Options &opts, const TracePlan *plan) {
+        auto start = std::chrono::steady_clock::now();
+        Result result = {};
 
-        VerilatedVcdC *tfp = new VerilatedVcdC;
-        tb->trace(tfp, 99);
-        tfp->open("CPUtrace.vcd");
+        // the caches reach the memory through DPI calls made on this thread
+        Memory mem(opts.memory);
+        Checkpoint ck = {};
+        bool warm = false;  // the Verilator state comes from the checkpoint as well
+        if (!opts.restore.empty()) {
+                std::string err;
+                if (!loadCheckpoint(opts.restore, ck, mem, err)) {
+                        printf("Could not restore '%s': %s\n", opts.restore.c_str(), err.c_str());
+                        exit(EXIT_FAILURE);
+                }
+                std::string model = opts.restore + ".model";
+                warm = ck.config == MODEL_CONFIG && access(model.c_str(), R_OK) == 0;
+                if (!warm && HARTS > 1) {
+                        printf("'%s' was saved by a model built with '%s'; the architectural state "
+                               "only restores hart 0\n", opts.restore.c_str(), ck.config.c_str());
+                        exit(EXIT_FAILURE);
+                }
+                if (!warm && opts.echo)
+                        printf("'%s' was saved by a model built with '%s'; restoring the architectural "
+                               "state only\n", opts.restore.c_str(), ck.config.c_str());
+        } else {
+                mem.load(prog);
+                ck.pc = prog.entry;
+        }
+        mem.echo = opts.echo;
+        Memory::current = &mem;
 
-        tb->rst_i = 1;
+        // fast-forward on the ISS; the RTL continues from the state it leaves behind
+        Iss iss(mem);
+        iss.pc = ck.pc;
+        std::copy(ck.x, ck.x + 32, iss.x);
+        iss.csr = ck.csr;
+        if (opts.ffInsns || opts.ffPc != NEVER) {
+                result.skipped = iss.run(opts.ffInsns ? opts.ffInsns : NEVER, opts.ffPc);
+                result.issSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                                            .count();
+                if (iss.halted) {  // the whole program ran on the ISS
+                        result.finished = !iss.illegal;
+                        result.passed = mem.exited ? mem.exitCode == 0 : result.finished && iss.x[10] == 0;
+                        result.pages = mem.pageCount();
+                        result.console = mem.console;
+                        result.seconds = result.issSeconds;
+                        Memory::current = nullptr;
+                        return result;
+                }
+        }
 
-        int time = 0;
-        while (!Verilated::gotFinish() && time < 3000) {
-                tb->rst_i = 0;
+        // the checker follows the RTL on a private copy, so device writes happen once
+        std::unique_ptr<Memory> checkerMem;
+        std::unique_ptr<Iss> checker;
+        if (opts.lockstep) {
+                checkerMem.reset(new Memory(mem));
+                checkerMem->echo = false;
+                checker.reset(new Iss(*checkerMem));
+                checker->pc = iss.pc;
+                std::copy(iss.x, iss.x + 32, checker->x);
+                checker->instret = iss.instret;
+                checker->csr = iss.csr;
+                checker->interrupts = false;  // taken when the RTL takes them
+        }
+
+        std::unique_ptr<Profiler> profiler;
+        if (opts.profile) profiler.reset(new Profiler(prog, mem));
+        std::unique_ptr<CommitLogWriter> commitLog;
+        CommitTracker commitTracker;
+        std::string err;
+        if (opts.commits) {
+                commitLog.reset(new CommitLogWriter);
+                if (!commitLog->open("CPUcommits-" + prog.name + ".bin", err)) {
+                        printf("%s: %s\n", prog.name.c_str(), err.c_str());
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        std::unique_ptr<VerilatedContext> contextp{new VerilatedContext};
+        contextp->traceEverOn(plan != nullptr);
+        std::unique_ptr<VCPU> tb{new VCPU{contextp.get()}};
+        tb->boot_pc_i = iss.pc;
+        tb->tohost_i = prog.tohost;
+        tb->fromhost_i = prog.fromhost;
+
+#if VM_TRACE
+        uint64_t windowStart = plan && !plan->waitTrigger ? plan->start : NEVER;
+        uint64_t windowEnd = plan ? plan->end : NEVER;
+        std::unique_ptr<TraceFile> tfp;
+        if (plan) {
+                tfp.reset(new TraceFile);
+                tb->trace(tfp.get(), 99);
+        }
+#endif
+
+        uint64_t time = 0, cycles = ck.cycle;
+        auto tick = [&] {
                 tb->clk_i ^= 1;
                 tb->eval();
-                tfp->dump(time);
-                tfp->flush();
+#if VM_TRACE
+                if (tfp && cycles >= windowStart && cycles < windowEnd) {
+                        if (!tfp->isOpen()) tfp->open(plan->file.c_str());
+                        tfp->dump(time);
+                }
+#endif
                 time++;
+        };
+
+        if (warm) {
+                VerilatedRestore is;
+                is.open((opts.restore + ".model").c_str());
+                is >> *tb;
+        } else {
+                tb->clk_i = 0;
+                tb->rst_i = 1;
+                tick();
+                tick();
+                tb->rst_i = 0;
+                for (int r = 1; r < 32; r++) tb->rootp->CPU__DOT__hart0__DOT__rf__DOT__REGS[r] = iss.x[r];
+                setPrivState(tb.get(), iss.csr);
+        }
+
+        uint64_t triggerCycle = NEVER;
+        bool checkTrigger = opts.trace.trigger();
+        while (!contextp->gotFinish() && !mem.exited && cycles < opts.maxCycles) {
+                mem.now = cycles;
+                tick();
+                tick();
+                if (checkTrigger && triggered(tb.get(), opts.trace)) {
+                        triggerCycle = cycles;
+                        checkTrigger = false;
+#if VM_TRACE
+                        if (plan && plan->waitTrigger) {
+                                windowStart = cycles;
+                                windowEnd = cycles + opts.trace.after;
+                        }
+#endif
+                }
+                Retired retired[2];
+                int count = retiring(tb.get(), mem, retired);
+                for (int i = 0; checker && i < count && !result.mismatch; i++)
+                        result.mismatch = !checkCommit(retired[i], *checker, prog);
+                if (result.mismatch) break;
+                // an interrupt the RTL takes in MEM lands after everything older retired
+                if (checker && tb->rootp->CPU__DOT__hart0__DOT__mem_trap &&
+                    tb->rootp->CPU__DOT__hart0__DOT__mem_irq)
+                        checker->interrupt(tb->rootp->CPU__DOT__hart0__DOT__irq_code);
+                unsigned events = profiler || commitLog ? stallEvents(tb.get()) : 0;
+                if (profiler) {
+                        uint64_t weight = cycles % opts.profilePeriod ? 0 : opts.profilePeriod;
+                        profileCycle(tb.get(), *profiler, events, weight, retired, count);
+                }
+                if (commitLog)
+                        commitTracker.cycle(tb.get(), mem, *commitLog, events, cycles, retired, count);
+                bool checkpointPc = false;
+                for (int i = 0; i < count; i++) checkpointPc |= retired[i].pc == opts.checkpointPc;
+                cycles++;
+                if (!opts.checkpoint.empty() && (cycles == opts.checkpointCycle || checkpointPc)) {
+                        saveState(tb.get(), mem, cycles, opts.checkpoint);
+                        result.saved = true;
+                        break;
+                }
+                if (tb->rootp->CPU__DOT__hart0__DOT__csr__DOT__minstret >= opts.detail) {
+                        result.sampled = true;
+                        break;
+                }
+        }
+        tb->final();
+#if VM_TRACE
+        if (tfp && tfp->isOpen()) tfp->close();
+#endif
+        if (commitLog && !commitLog->close(err)) printf("%s: %s\n", prog.name.c_str(), err.c_str());
+        if (profiler && !profiler->write("CPUprofile-" + prog.name, opts.profilePeriod, err))
+                printf("%s: %s\n", prog.name.c_str(), err.c_str());
+
+        result.finished = contextp->gotFinish() || mem.exited;
+        if (result.mismatch)
+                result.passed = false;
+        else if (result.sampled || result.saved)
+                result.passed = true;
+        else if (mem.exited)
+                result.passed = mem.exitCode == 0;
+        else
+                result.passed = result.finished && tb->rootp->CPU__DOT__hart0__DOT__wb_Halt &&
+                                tb->rootp->CPU__DOT__hart0__DOT__rf__DOT__REGS[10] == 0;
+        result.cycles = cycles;
+        result.counters = readCounters(tb.get());
+        result.coherence = readCoherence(tb.get());
+        result.triggerCycle = triggerCycle;
+        result.memBusy = mem.busyCycles;
+        result.pages = mem.pageCount();
+        result.console = mem.console;
+        Memory::current = nullptr;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                                 .count();
+        return result;
+}
+
+// The simulation is deterministic, so dumping cycles that precede a trigger or a failure is
+// done by running the program untraced first and then replaying it with the window known.
+static Result runTraced(const Program &prog, const Options &opts, const std::string &file) {
+        const TraceOptions &trace = opts.trace;
+        if (!trace.any()) return runTest(prog, opts, nullptr);
+
+        TracePlan plan;
+        plan.file = file;
+        if (trace.all) return runTest(prog, opts, &plan);
+        if (trace.end != NEVER) {
+                plan.start = trace.start;
+                plan.end = trace.end;
+                return runTest(prog, opts, &plan);
         }
-        tfp->close();
-        delete tb;
-        delete tfp;
-        exit(EXIT_SUCCESS);
+        if (trace.trigger() && trace.before == 0) {
+                plan.waitTrigger = true;
+                return runTest(prog, opts, &plan);
+        }
+
+        Result result = runTest(prog, opts, nullptr);
+        if (trace.trigger() && result.triggerCycle != NEVER) {
+                uint64_t t = result.triggerCycle;
+                plan.start = t > trace.before ? t - trace.before : 0;
+                plan.end = t + trace.after;
+        } else if (trace.onFail && !result.passed) {
+                plan.start = result.cycles > trace.onFail ? result.cycles - trace.onFail : 0;
+        } else {
+                return result;
+        }
+        double seconds = result.seconds;
+        Options replay = opts;
+        // the first run has shown the console and written the profile and commit log
+        replay.echo = replay.profile = replay.commits = false;
+        result = runTest(prog, replay, &plan);
+        result.seconds += seconds;
+        return result;
+}
+
+static void usage(const char *prog) {
+        printf("usage: %s [options] elf...\n"
+               "  -j N                     run N tests in parallel (default: all cores)\n"
+               "  --max-cycles N           give up after N cycles (default: 100000)\n"
+               "  --mem-latency N          cycles until memory returns a line (default: 20)\n"
+               "  --mem-bandwidth N        memory bytes per cycle (default: 8)\n"
+               "  --ff N                   run the first N instructions on the ISS\n"
+               "  --ff-pc ADDR             run on the ISS until the pc reaches ADDR\n"
+               "  --detail N               stop after N instructions on the RTL\n"
+               "  --lockstep               check every retired instruction against the ISS\n"
+               "  --checkpoint FILE        save the run to FILE and stop, at:\n"
+               "  --checkpoint-cycle N       the end of cycle N\n"
+               "  --checkpoint-pc ADDR       the retirement of the instruction at ADDR\n"
+               "  --restore FILE           continue from a checkpoint instead of the ELF's entry\n"
+               "  --results FILE           write the results of every test to FILE as CSV\n"
+               "  --baseline FILE          fail tests that need more cycles than in FILE, an\n"
+               "                           earlier --results file\n"
+               "  --regress-threshold PCT  cycles a test may gain over the baseline (default: 2)\n"
+               "  --allow-missing          do not fail passing tests the baseline has no cycles\n"
+               "                           for, e.g. ones just added to the suite\n"
+               "  --commits                write a binary log of the retired instructions to\n"
+               "                           CPUcommits-<elf>.bin, for committool\n"
+               "  --profile                write a per-function and per-instruction cycle profile\n"
+               "                           and folded stacks to CPUprofile-<elf>.{txt,folded}\n"
+               "  --profile-period N       charge only every Nth cycle, N times (default: 1)\n"
+               "  --trace                  dump every cycle\n"
+               "  --trace-window S:E       dump cycles [S, E)\n"
+               "  --trace-pc LO:HI         dump around the first retired pc in [LO, HI]\n"
+               "  --trace-reg N            dump around the first write to xN\n"
+               "  --trace-before N         cycles kept before a trigger (default: 0)\n"
+               "  --trace-after N          cycles kept after a trigger (default: 1000)\n"
+               "  --trace-on-fail N        dump the last N cycles of failing tests\n",
+               prog);
+        exit(EXIT_FAILURE);
+}
+
+// parses "A:B" into a and b
+static bool parseRange(const char *arg, uint64_t &a, uint64_t &b) {
+        char *end;
+        a = strtoull(arg, &end, 0);
+        if (*end != ':') return false;
+        b = strtoull(end + 1, &end, 0);
+        return *end == '\0';
+}
+
+static Options parseArgs(int argc, char **argv) {
+        Options opts;
+        TraceOptions &trace = opts.trace;
+        for (int i = 1; i < argc; i++) {
+                const char *arg = argv[i];
+                bool hasValue = i + 1 < argc;
+                if (!strcmp(arg, "-j") && hasValue) {
+                        opts.jobs = std::max(1, atoi(argv[++i]));
+                } else if (!strcmp(arg, "--max-cycles") && hasValue) {
+                        opts.maxCycles = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--mem-latency") && hasValue) {
+                        opts.memory.latency = atoi(argv[++i]);
+                } else if (!strcmp(arg, "--mem-bandwidth") && hasValue) {
+                        opts.memory.bandwidth = std::max(1, atoi(argv[++i]));
+                } else if (!strcmp(arg, "--ff") && hasValue) {
+                        opts.ffInsns = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--ff-pc") && hasValue) {
+                        opts.ffPc = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--detail") && hasValue) {
+                        opts.detail = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--lockstep")) {
+                        opts.lockstep = true;
+                } else if (!strcmp(arg, "--checkpoint") && hasValue) {
+                        opts.checkpoint = argv[++i];
+                } else if (!strcmp(arg, "--checkpoint-cycle") && hasValue) {
+                        opts.checkpointCycle = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--checkpoint-pc") && hasValue) {
+                        opts.checkpointPc = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--restore") && hasValue) {
+                        opts.restore = argv[++i];
+                } else if (!strcmp(arg, "--results") && hasValue) {
+                        opts.results = argv[++i];
+                } else if (!strcmp(arg, "--baseline") && hasValue) {
+                        opts.baseline = argv[++i];
+                } else if (!strcmp(arg, "--regress-threshold") && hasValue) {
+                        opts.regressThreshold = atof(argv[++i]);
+                } else if (!strcmp(arg, "--allow-missing")) {
+                        opts.allowMissing = true;
+                } else if (!strcmp(arg, "--commits")) {
+                        opts.commits = true;
+                } else if (!strcmp(arg, "--profile")) {
+                        opts.profile = true;
+                } else if (!strcmp(arg, "--profile-period") && hasValue) {
+                        opts.profilePeriod = std::max(1ull, strtoull(argv[++i], NULL, 0));
+                } else if (!strcmp(arg, "--trace")) {
+                        trace.all = true;
+                } else if (!strcmp(arg, "--trace-window") && hasValue) {
+                        if (!parseRange(argv[++i], trace.start, trace.end)) usage(argv[0]);
+                } else if (!strcmp(arg, "--trace-pc") && hasValue) {
+                        if (!parseRange(argv[++i], trace.pcLo, trace.pcHi)) usage(argv[0]);
+                        trace.pcTrigger = true;
+                } else if (!strcmp(arg, "--trace-reg") && hasValue) {
+                        trace.regTrigger = atoi(argv[++i]);
+                        if (trace.regTrigger < 1 || trace.regTrigger > 31) usage(argv[0]);
+                } else if (!strcmp(arg, "--trace-before") && hasValue) {
+                        trace.before = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--trace-after") && hasValue) {
+                        trace.after = strtoull(argv[++i], NULL, 0);
+                } else if (!strcmp(arg, "--trace-on-fail") && hasValue) {
+                        trace.onFail = strtoull(argv[++i], NULL, 0);
+                } else if (arg[0] == '-' || arg[0] == '+') {
+                        usage(argv[0]);
+                } else {
+                        opts.tests.push_back(arg);
+                }
+        }
+        if (opts.tests.empty()) {
+                printf("Test name missing\n");
+                usage(argv[0]);
+        }
+        if ((!opts.checkpoint.empty() || !opts.restore.empty()) && opts.tests.size() != 1) {
+                printf("--checkpoint and --restore take a single program\n");
+                exit(EXIT_FAILURE);
+        }
+        if (!opts.restore.empty() && (opts.ffInsns || opts.ffPc != NEVER)) {
+                printf("--restore cannot be combined with --ff\n");
+                exit(EXIT_FAILURE);
+        }
+        // the ISS models hart 0 alone
+        if (HARTS > 1 && (opts.ffInsns || opts.ffPc != NEVER || opts.lockstep)) {
+                printf("--ff, --ff-pc and --lockstep need a model built with HARTS=1\n");
+                exit(EXIT_FAILURE);
+        }
+#if !VM_TRACE
+        if (trace.any()) {
+                printf("This model was built without tracing; rebuild with make TRACE=vcd or TRACE=fst\n");
+                exit(EXIT_FAILURE);
+        }
+#endif
+        return opts;
+}
+
+// a single program keeps the familiar CPUtrace name, a suite gets one file per test
+static std::string traceFile(const std::vector<Program> &programs, size_t t) {
+#if VM_TRACE
+        if (programs.size() == 1) return std::string("CPUtrace.") + traceExt;
+        return "CPUtrace-" + programs[t].name + "." + traceExt;
+#else
+        return "";
+#endif
+}
+
+static const char *status(const Result &r) {
+        return r.mismatch ? "MISMATCH" : r.sampled ? "sample" : r.saved ? "saved" :
+               r.passed   ? "pass"     : r.finished ? "FAIL" : "TIMEOUT";
+}
+
+// the configuration the cycle counts depend on, recorded in results and baselines
+static std::string resultsConfig(const Options &opts) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "# params: '%s' mem-latency %u mem-bandwidth %u", MODEL_PARAMS,
+                 opts.memory.latency, opts.memory.bandwidth);
+        return buf;
+}
+
+// one CSV line per test, for scripts and for the baseline
+static bool writeResults(const std::string &path, const Options &opts,
+                         const std::vector<Program> &programs, const std::vector<Result> &results) {
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        fprintf(f, "%s\n", resultsConfig(opts).c_str());
+        fprintf(f, "test,result,cycles,instret,cpi,ipc,dual,fused,rvc,ld_use,br_stall,md_stall,squashed,"
+                   "ic_stall,dc_stall,bubbles,bp_miss,itlb_miss,dtlb_miss,walk,traps,bus,invals,sc_fail,"
+                   "seconds,khz\n");
+        for (size_t t = 0; t < programs.size(); t++) {
+                const Result &r = results[t];
+                const Counters &c = r.counters;
+                fprintf(f, "%s,%s,%lu,%lu,%.4f,%.4f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,"
+                           "%lu,%lu,%lu,%.4f,%.1f\n",
+                        programs[t].name.c_str(), status(r), (unsigned long)c.cycles,
+                        (unsigned long)c.instret, c.instret ? (double)c.cycles / c.instret : 0.0,
+                        c.cycles ? (double)c.instret / c.cycles : 0.0, (unsigned long)c.dual,
+                        (unsigned long)c.fused, (unsigned long)c.compressed,
+                        (unsigned long)c.loadStalls, (unsigned long)c.branchStalls,
+                        (unsigned long)c.mdStalls, (unsigned long)c.squashed,
+                        (unsigned long)c.icStalls, (unsigned long)c.dcStalls,
+                        (unsigned long)c.bubbles, (unsigned long)c.bpMisses,
+                        (unsigned long)c.itlbMisses, (unsigned long)c.dtlbMisses,
+                        (unsigned long)c.walkCycles, (unsigned long)c.traps,
+                        (unsigned long)c.busTransactions, (unsigned long)c.invalidated,
+                        (unsigned long)c.scFailures, r.seconds,
+                        r.seconds > 0 ? r.cycles / r.seconds / 1e3 : 0.0);
+        }
+        bool ok = !ferror(f);
+        return fclose(f) == 0 && ok;
+}
+
+// Compares the cycles of the passing tests with a results file written earlier. Returns
+// the number of tests that got slower by more than the threshold or, unless --allow-missing,
+// have no cycles in the baseline; non-zero as well when the baseline was recorded with other
+// parameters, as nothing could be checked then. A baseline that does not exist yet or holds
+// no passing test checks nothing and fails nothing, until make baseline records one.
+static int compareBaseline(const Options &opts, const std::vector<Program> &programs,
+                           const std::vector<Result> &results) {
+        printf("\ncycles against %s, threshold %.1f%%:\n", opts.baseline.c_str(),
+               opts.regressThreshold);
+        FILE *f = fopen(opts.baseline.c_str(), "r");
+        if (!f) {
+                printf("  no baseline yet, not comparing; make baseline records one\n");
+                return 0;
+        }
+        std::string config;
+        std::vector<std::string> columns;
+        std::map<std::string, uint64_t> cycles;  // passing tests of the baseline
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+                std::string text(line, strcspn(line, "\r\n"));
+                if (text.compare(0, 10, "# params: ") == 0) config = text;
+                if (text.empty() || text[0] == '#') continue;
+                std::vector<std::string> fields;
+                for (size_t pos = 0;; pos++) {
+                        size_t comma = text.find(',', pos);
+                        fields.push_back(text.substr(pos, comma - pos));
+                        if (comma == std::string::npos) break;
+                        pos = comma;
+                }
+                if (columns.empty()) {
+                        columns = fields;
+                        continue;
+                }
+                std::map<std::string, std::string> row;
+                for (size_t i = 0; i < fields.size() && i < columns.size(); i++)
+                        row[columns[i]] = fields[i];
+                if (row["result"] == "pass")
+                        cycles[row["test"]] = strtoull(row["cycles"].c_str(), NULL, 10);
+        }
+        fclose(f);
+
+        if (cycles.empty()) {
+                printf("  the baseline has no passing tests yet, not comparing; make baseline records them\n");
+                return 0;
+        }
+        if (config != resultsConfig(opts)) {
+                printf("  the baseline was recorded with different parameters, not comparing\n"
+                       "  baseline: %s\n  this run: %s\n", config.c_str(), resultsConfig(opts).c_str());
+                return 1;
+        }
+        int regressed = 0, improved = 0, unknown = 0;
+        for (size_t t = 0; t < programs.size(); t++) {
+                const Result &r = results[t];
+                if (!r.passed) continue;  // already reported as failing
+                auto it = cycles.find(programs[t].name);
+                if (it == cycles.end()) {
+                        unknown++;
+                        continue;
+                }
+                uint64_t now = r.counters.cycles, before = it->second;
+                double change = before ? 100.0 * ((double)now / before - 1) : 0.0;
+                if (std::fabs(change) <= opts.regressThreshold) continue;
+                printf("  %-16s %9lu -> %9lu %+7.1f%%  %s\n", programs[t].name.c_str(),
+                       (unsigned long)before, (unsigned long)now, change,
+                       change > 0 ? "REGRESSION" : "improved");
+                if (change > 0)
+                        regressed++;
+                else
+                        improved++;
+        }
+        printf("  %d regressed, %d improved, %d without a baseline%s\n", regressed, improved, unknown,
+               improved || unknown ? "; make baseline records the new numbers" : "");
+        if (unknown && !opts.allowMissing)
+                printf("  tests without a baseline fail the run, unless --allow-missing\n");
+        return regressed + (opts.allowMissing ? 0 : unknown);
+}
+
+int main(int argc, char **argv) {
+        Options opts = parseArgs(argc, argv);
+
+        std::vector<Program> programs(opts.tests.size());
+        for (size_t t = 0; t < opts.tests.size(); t++) {
+                Program &prog = programs[t];
+                const std::string &path = opts.tests[t];
+                prog.name = path.substr(path.find_last_of('/') + 1);
+                std::string err;
+                if (!loadElf(path, prog, err)) {
+                        printf("Could not load '%s': %s\n", path.c_str(), err.c_str());
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        // a suite keeps the console output of each test until the end
+        opts.echo = programs.size() == 1;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Result> results(programs.size());
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        unsigned jobs = std::min<size_t>(opts.jobs, programs.size());
+        for (unsigned w = 0; w < jobs; w++) {
+                workers.emplace_back([&] {
+                        for (size_t t; (t = next++) < programs.size();)
+                                results[t] = runTraced(programs[t], opts, traceFile(programs, t));
+                });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // bubbles = load-use stalls + branch stalls + muldiv stalls + squashed slots
+        // + icache and dcache stalls + pipeline fill/drain;
+        // instret = cycles - bubbles + dual (cycles that retired a dual-issued pair)
+        // + fused (ops that retired two instructions); fused% is the share of instructions
+        // that retired in fused ops
+        int failed = 0;
+        printf("%-16s %-8s %9s %9s %6s %6s %8s %6s %8s %8s %8s %8s %8s %8s %8s %8s %7s %8s\n",
+               "test", "result", "cycles", "instret", "CPI", "IPC", "dual", "fused%", "ld-use", "br-stall", "md-stall", "squashed",
+               "taken", "loads", "stores", "bubbles", "bp-hit%", "time(s)");
+        for (size_t t = 0; t < programs.size(); t++) {
+                const Result &r = results[t];
+                const Counters &c = r.counters;
+                uint64_t predicted = c.bpHits + c.bpMisses;
+                printf("%-16s %-8s %9lu %9lu %6.3f %6.3f %8lu %6.1f %8lu %8lu %8lu %8lu %8lu %8lu %8lu %8lu %7.1f %8.3f\n",
+                       programs[t].name.c_str(),
+                       status(r),
+                       (unsigned long)c.cycles,
+                       (unsigned long)c.instret,
+                       c.instret ? (double)c.cycles / c.instret : 0.0,
+                       c.cycles ? (double)c.instret / c.cycles : 0.0,
+                       (unsigned long)c.dual,
+                       c.instret ? 100.0 * 2 * c.fused / c.instret : 0.0,
+                       (unsigned long)c.loadStalls,
+                       (unsigned long)c.branchStalls,
+                       (unsigned long)c.mdStalls,
+                       (unsigned long)c.squashed,
+                       (unsigned long)c.taken,
+                       (unsigned long)c.loads,
+                       (unsigned long)c.stores,
+                       (unsigned long)c.bubbles,
+                       predicted ? 100.0 * c.bpHits / predicted : 0.0,
+                       r.seconds);
+                if (!r.passed) failed++;
+        }
+
+        printf("\n%-16s %8s %8s %7s %8s %8s %8s %8s %7s %8s %8s %6s\n",
+               "test", "ic-hit", "ic-miss", "ic-hit%", "ic-stall", "dc-hit", "dc-miss", "dc-wb",
+               "dc-hit%", "dc-stall", "mem-busy", "pages");
+        for (size_t t = 0; t < programs.size(); t++) {
+                const Result &r = results[t];
+                const Counters &c = r.counters;
+                uint64_t fetches = c.icHits + c.icMisses, accesses = c.dcHits + c.dcMisses;
+                printf("%-16s %8lu %8lu %7.1f %8lu %8lu %8lu %8lu %7.1f %8lu %8lu %6zu\n",
+                       programs[t].name.c_str(),
+                       (unsigned long)c.icHits,
+                       (unsigned long)c.icMisses,
+                       fetches ? 100.0 * c.icHits / fetches : 0.0,
+                       (unsigned long)c.icStalls,
+                       (unsigned long)c.dcHits,
+                       (unsigned long)c.dcMisses,
+                       (unsigned long)c.dcWritebacks,
+                       accesses ? 100.0 * c.dcHits / accesses : 0.0,
+                       (unsigned long)c.dcStalls,
+                       (unsigned long)r.memBusy,
+                       r.pages);
+        }
+
+        // RV64C savings: static code size, and instruction bytes fetched for what retired,
+        // both against the same instructions all 4 bytes wide
+        bool rvc = false;
+        for (size_t t = 0; t < programs.size(); t++) rvc |= programs[t].compressed != 0;
+        if (rvc) {
+                printf("\n%-16s %9s %8s %7s %8s %12s %8s %7s\n", "test", "code", "insns", "rvc%",
+                       "saved%", "fetched", "rvc", "saved%");
+                for (size_t t = 0; t < programs.size(); t++) {
+                        const Program &prog = programs[t];
+                        const Counters &c = results[t].counters;
+                        uint64_t full = prog.codeBytes + 2 * prog.compressed;
+                        uint64_t fetched = 4 * c.instret - 2 * c.compressed;
+                        printf("%-16s %9lu %8lu %7.1f %8.1f %12lu %8lu %7.1f\n", prog.name.c_str(),
+                               (unsigned long)prog.codeBytes,
+                               (unsigned long)prog.instructions,
+                               prog.instructions ? 100.0 * prog.compressed / prog.instructions : 0.0,
+                               full ? 100.0 * 2 * prog.compressed / full : 0.0,
+                               (unsigned long)fetched,
+                               (unsigned long)c.compressed,
+                               c.instret ? 100.0 * 2 * c.compressed / (4 * c.instret) : 0.0);
+                }
+        }
+
+        // Sv39: hit rates of the TLBs and what the walks cost, once anything translated
+        bool translated = false;
+        for (const Result &r : results)
+                translated |= r.counters.itlbHits + r.counters.itlbMisses + r.counters.dtlbHits +
+                                      r.counters.dtlbMisses + r.counters.traps != 0;
+        if (translated) {
+                printf("\n%-16s %8s %8s %8s %8s %8s %8s %8s %8s\n", "test", "itlb-hit", "itlb-mis",
+                       "itlb%", "dtlb-hit", "dtlb-mis", "dtlb%", "walk", "traps");
+                for (size_t t = 0; t < programs.size(); t++) {
+                        const Counters &c = results[t].counters;
+                        uint64_t fetches = c.itlbHits + c.itlbMisses, accesses = c.dtlbHits + c.dtlbMisses;
+                        printf("%-16s %8lu %8lu %8.1f %8lu %8lu %8.1f %8lu %8lu\n", programs[t].name.c_str(),
+                               (unsigned long)c.itlbHits,
+                               (unsigned long)c.itlbMisses,
+                               fetches ? 100.0 * c.itlbHits / fetches : 0.0,
+                               (unsigned long)c.dtlbHits,
+                               (unsigned long)c.dtlbMisses,
+                               accesses ? 100.0 * c.dtlbHits / accesses : 0.0,
+                               (unsigned long)c.walkCycles,
+                               (unsigned long)c.traps);
+                }
+        }
+
+        // snoop bus traffic, on a model with two harts
+        if (HARTS > 1) {
+                printf("\n%-16s %9s %8s %8s %8s %8s %8s %8s %8s\n", "test", "h1-inst", "bus-rd",
+                       "bus-rdx", "bus-upg", "flushes", "invals", "h0-inval", "sc-fail");
+                for (size_t t = 0; t < programs.size(); t++) {
+                        const Coherence &c = results[t].coherence;
+                        printf("%-16s %9lu %8lu %8lu %8lu %8lu %8lu %8lu %8lu\n", programs[t].name.c_str(),
+                               (unsigned long)c.hart1Instret,
+                               (unsigned long)c.reads,
+                               (unsigned long)c.readExclusive,
+                               (unsigned long)c.upgrades,
+                               (unsigned long)c.flushes,
+                               (unsigned long)c.invalidations,
+                               (unsigned long)results[t].counters.invalidated,
+                               (unsigned long)c.scFailures);
+                }
+        }
+
+        for (size_t t = 0; t < programs.size(); t++) {
+                const Result &r = results[t];
+                if (!r.skipped) continue;
+                printf("%s: fast-forwarded %lu instructions in %.3fs (%.1f MIPS)\n", programs[t].name.c_str(),
+                       (unsigned long)r.skipped, r.issSeconds,
+                       r.issSeconds > 0 ? r.skipped / r.issSeconds / 1e6 : 0.0);
+        }
+
+        if (!opts.echo) {
+                for (size_t t = 0; t < programs.size(); t++) {
+                        if (results[t].console.empty()) continue;
+                        printf("\n--- %s console ---\n%s\n", programs[t].name.c_str(),
+                               results[t].console.c_str());
+                }
+        }
+        if (!opts.results.empty() && !writeResults(opts.results, opts, programs, results)) {
+                printf("Could not write results to '%s'\n", opts.results.c_str());
+                exit(EXIT_FAILURE);
+        }
+        int regressed = opts.baseline.empty() ? 0 : compareBaseline(opts, programs, results);
+
+        printf("%zu passed, %d failed, %.3fs wall time on %u threads\n",
+               programs.size() - failed,
+               failed,
+               seconds,
+               jobs);
+        exit(failed || regressed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -2,30 +2,477 @@
 /* verilator lint_off UNUSED */
 /* verilator lint_off WIDTH */
 
-module CPU(input    logic   clk_i,
-           input    logic   rst_i);
+// The system: one hart, or with HARTS = 2 two harts whose data caches are kept coherent
+// by snooping (MSI) on a shared bus. Both boot at the same pc, in M-mode, and tell
+// themselves apart by mhartid. The instruction caches are not snooped: code written at
+// run time needs a fence.i on the hart that runs it.
+module CPU #(parameter BPRED = 1,          // 0: static not-taken, 1: BTB + BHT + RAS
+             parameter BTB_ENTRIES = 16,
+             parameter BHT_ENTRIES = 256,   // gshare history is log2(BHT_ENTRIES) bits
+             parameter GSHARE = 1,          // 0: bimodal BHT indexed by pc only
+             parameter RAS_DEPTH = 4,
+             parameter EARLY_BRANCH = 0,    // 1: resolve conditional branches in ID
+             parameter MUL_STAGES = 1,      // pipeline registers behind the multiplier
+             parameter ICACHE_SIZE = 4096,  // bytes
+             parameter ICACHE_WAYS = 2,
+             parameter DCACHE_SIZE = 4096,
+             parameter DCACHE_WAYS = 2,
+             parameter LINE_SIZE = 32,      // bytes, both caches
+             parameter ISSUE_WIDTH = 1,     // 2: pair simple ALU ops into a second pipe
+             parameter FUSION = 0,          // 1: issue common instruction pairs as one op
+             parameter ITLB_ENTRIES = 8,    // Sv39 translations, fully associative
+             parameter DTLB_ENTRIES = 8,
+             parameter RAM_BASE = 64'h8000_0000, // loads and stores below go to devices
+             parameter HARTS = 1)           // 2: two harts with coherent data caches
+          (input    logic          clk_i,
+           input    logic          rst_i,
+           input    logic [63:0]   boot_pc_i,  // entry point of the loaded program
+           input    logic [63:0]   tohost_i,   // HTIF mailboxes of the loaded program,
+           input    logic [63:0]   fromhost_i);// accessed uncached like devices
+
+    logic [1:0]  bus_req, bus_gnt, bus_flush, snoop, snoop_flush, snoop_inval;
+    logic [1:0]  bus_op[2], snoop_op[2];
+    logic [63:0] bus_addr[2], snoop_addr[2];
+
+    core #(
+        .BPRED(BPRED),
+        .BTB_ENTRIES(BTB_ENTRIES),
+        .BHT_ENTRIES(BHT_ENTRIES),
+        .GSHARE(GSHARE),
+        .RAS_DEPTH(RAS_DEPTH),
+        .EARLY_BRANCH(EARLY_BRANCH),
+        .MUL_STAGES(MUL_STAGES),
+        .ICACHE_SIZE(ICACHE_SIZE),
+        .ICACHE_WAYS(ICACHE_WAYS),
+        .DCACHE_SIZE(DCACHE_SIZE),
+        .DCACHE_WAYS(DCACHE_WAYS),
+        .LINE_SIZE(LINE_SIZE),
+        .ISSUE_WIDTH(ISSUE_WIDTH),
+        .FUSION(FUSION),
+        .ITLB_ENTRIES(ITLB_ENTRIES),
+        .DTLB_ENTRIES(DTLB_ENTRIES),
+        .RAM_BASE(RAM_BASE),
+        .HARTID(0),
+        .COHERENT(HARTS > 1)
+    ) hart0(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .boot_pc_i(boot_pc_i),
+        .tohost_i(tohost_i),
+        .fromhost_i(fromhost_i),
+        .bus_req_o(bus_req[0]),
+        .bus_op_o(bus_op[0]),
+        .bus_addr_o(bus_addr[0]),
+        .bus_gnt_i(bus_gnt[0]),
+        .bus_flush_i(bus_flush[0]),
+        .snoop_i(snoop[0]),
+        .snoop_op_i(snoop_op[0]),
+        .snoop_addr_i(snoop_addr[0]),
+        .snoop_flush_o(snoop_flush[0]),
+        .snoop_inval_o(snoop_inval[0])
+    );
+
+    generate
+        if (HARTS > 1) begin : smp
+            core #(
+                .BPRED(BPRED),
+                .BTB_ENTRIES(BTB_ENTRIES),
+                .BHT_ENTRIES(BHT_ENTRIES),
+                .GSHARE(GSHARE),
+                .RAS_DEPTH(RAS_DEPTH),
+                .EARLY_BRANCH(EARLY_BRANCH),
+                .MUL_STAGES(MUL_STAGES),
+                .ICACHE_SIZE(ICACHE_SIZE),
+                .ICACHE_WAYS(ICACHE_WAYS),
+                .DCACHE_SIZE(DCACHE_SIZE),
+                .DCACHE_WAYS(DCACHE_WAYS),
+                .LINE_SIZE(LINE_SIZE),
+                .ISSUE_WIDTH(ISSUE_WIDTH),
+                .FUSION(FUSION),
+                .ITLB_ENTRIES(ITLB_ENTRIES),
+                .DTLB_ENTRIES(DTLB_ENTRIES),
+                .RAM_BASE(RAM_BASE),
+                .HARTID(1),
+                .COHERENT(1)
+            ) hart1(
+                .clk_i(clk_i),
+                .rst_i(rst_i),
+                .boot_pc_i(boot_pc_i),
+                .tohost_i(tohost_i),
+                .fromhost_i(fromhost_i),
+                .bus_req_o(bus_req[1]),
+                .bus_op_o(bus_op[1]),
+                .bus_addr_o(bus_addr[1]),
+                .bus_gnt_i(bus_gnt[1]),
+                .bus_flush_i(bus_flush[1]),
+                .snoop_i(snoop[1]),
+                .snoop_op_i(snoop_op[1]),
+                .snoop_addr_i(snoop_addr[1]),
+                .snoop_flush_o(snoop_flush[1]),
+                .snoop_inval_o(snoop_inval[1])
+            );
+        end
+        else begin : up
+            assign bus_req[1] = 0;
+            assign bus_op[1] = 0;
+            assign bus_addr[1] = 0;
+            assign snoop_flush[1] = 0;
+            assign snoop_inval[1] = 0;
+        end
+    endgenerate
+
+    snoopbus bus(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .req_i(bus_req),
+        .op_i(bus_op),
+        .addr_i(bus_addr),
+        .gnt_o(bus_gnt),
+        .flush_o(bus_flush),
+        .snoop_o(snoop),
+        .snoop_op_o(snoop_op),
+        .snoop_addr_o(snoop_addr),
+        .snoop_flush_i(snoop_flush),
+        .snoop_inval_i(snoop_inval)
+    );
+endmodule
+
+// One hart: the five-stage pipeline with its caches, TLBs and CSRs.
+module core #(parameter BPRED = 1,          // 0: static not-taken, 1: BTB + BHT + RAS
+             parameter BTB_ENTRIES = 16,
+             parameter BHT_ENTRIES = 256,   // gshare history is log2(BHT_ENTRIES) bits
+             parameter GSHARE = 1,          // 0: bimodal BHT indexed by pc only
+             parameter RAS_DEPTH = 4,
+             parameter EARLY_BRANCH = 0,    // 1: resolve conditional branches in ID
+             parameter MUL_STAGES = 1,      // pipeline registers behind the multiplier
+             parameter ICACHE_SIZE = 4096,  // bytes
+             parameter ICACHE_WAYS = 2,
+             parameter DCACHE_SIZE = 4096,
+             parameter DCACHE_WAYS = 2,
+             parameter LINE_SIZE = 32,      // bytes, both caches
+             parameter ISSUE_WIDTH = 1,     // 2: pair simple ALU ops into a second pipe
+             parameter FUSION = 0,          // 1: issue common instruction pairs as one op
+             parameter ITLB_ENTRIES = 8,    // Sv39 translations, fully associative
+             parameter DTLB_ENTRIES = 8,
+             parameter RAM_BASE = 64'h8000_0000, // loads and stores below go to devices
+             parameter HARTID = 0,          // mhartid, and the CLINT lines it gets
+             parameter COHERENT = 0)        // the dcache takes part in the snooping bus
+          (input    logic          clk_i,
+           input    logic          rst_i,
+           input    logic [63:0]   boot_pc_i,  // entry point of the loaded program
+           input    logic [63:0]   tohost_i,   // HTIF mailboxes of the loaded program,
+           input    logic [63:0]   fromhost_i, // accessed uncached like devices
+           // snooping bus of the dcache (COHERENT), see cache
+           output   logic          bus_req_o,
+           output   logic [1:0]    bus_op_o,
+           output   logic [63:0]   bus_addr_o,
+           input    logic          bus_gnt_i,
+           input    logic          bus_flush_i,
+           input    logic          snoop_i,
+           input    logic [1:0]    snoop_op_i,
+           input    logic [63:0]   snoop_addr_i,
+           output   logic          snoop_flush_o,
+           output   logic          snoop_inval_o);
+
+    localparam HBITS = $clog2(BHT_ENTRIES);
+    localparam RBITS = $clog2(RAS_DEPTH);
 
     ////////////////////
     // IF
     ////////////////////
 
     // IF STATE 
-    logic [63:0] if_pc, pcnext, if_pcplus4;
+    // the pcs and valid bits of all stages are public: a checkpoint resumes at the
+    // oldest instruction that has not retired
+    logic [63:0] if_pc /*verilator public*/;
+    logic [63:0] pcnext, if_pcplus; // pcplus: pc of the next instruction, +2 after a compressed
+                                    // one, past both halves of a fused pair
     logic [31:0] if_instr;
+    logic        if_hit /*verilator public*/;
+    logic        if_advance;
+    // an icache miss holds the pc, unless a redirect makes the missing fetch moot; a trap
+    // or xRET taken in MEM redirects a stalled IF as well
+    assign if_advance = mem_redirect || (!ex_stallIF && (if_hit || ex_mispredict || id_mispredict));
     always_ff @(posedge clk_i) begin
-        if (rst_i) if_pc <= 0;
+        if (rst_i) if_pc <= boot_pc_i;
         else  begin
-            if (!ex_stallIF) if_pc <= pcnext;
+            if (if_advance) if_pc <= pcnext;
         end
     end
 
-    assign if_pcplus4 = if_pc + 4;
-    assign pcnext = ex_pcsrc ? ex_pctarget : if_pcplus4;
+    assign if_pcplus = if_pc + (if_compressed ? 2 : 4) + (!if_fused ? 0 : if_compressed1 ? 2 : 4);
+    assign pcnext = mem_redirect  ? mem_target   :
+                    ex_mispredict ? ex_redirect  :
+                    id_mispredict ? id_redirect  :
+                    if_predtaken  ? if_predtarget :
+                    if_pair       ? if_pc + 8     : if_pcplus;
+
+    // BRANCH PREDICTION
+    // history and return stack are updated speculatively as fetch moves on; every
+    // instruction carries the snapshots it was predicted with so that the stage that
+    // detects a misprediction (EX, or ID for early-resolved branches) can repair them.
+    // A trap or xRET in MEM restores its instruction's snapshots, dropping what the
+    // squashed younger ones pushed and popped; that instruction itself is no branch, call
+    // or return, or, interrupted, runs again after the handler
+    logic             if_predtaken;
+    logic [63:0]      if_predtarget;
+    logic [HBITS-1:0] if_ghr;
+    logic [RBITS-1:0] if_rasptr;
+    generate
+        if (BPRED) begin : g_bpred
+            bpred #(.BTB_ENTRIES(BTB_ENTRIES), .BHT_ENTRIES(BHT_ENTRIES), .GSHARE(GSHARE),
+                    .RAS_DEPTH(RAS_DEPTH), .HBITS(HBITS), .RBITS(RBITS)) bp(
+                .clk_i(clk_i),
+                .rst_i(rst_i),
+                .pc_i(if_pc),
+                .pcplus_i(if_pcplus),
+                .advance_i(if_advance),
+                .taken_o(if_predtaken),
+                .target_o(if_predtarget),
+                .ghr_o(if_ghr),
+                .rasptr_o(if_rasptr),
+                .fix_i(mem_redirect || ex_mispredict || id_mispredict),
+                .fix_branch_i(!mem_redirect && (ex_mispredict ? ex_Branch[0] : 1'b1)),
+                .fix_call_i(!mem_redirect && ex_mispredict && ex_call),
+                .fix_return_i(!mem_redirect && ex_mispredict && ex_return),
+                .fix_taken_i(ex_mispredict ? ex_pcsrc : id_taken),
+                .fix_pcplus_i(ex_pcplus),
+                .fix_ghr_i(mem_redirect ? mem_ghr : ex_mispredict ? ex_ghr : id_ghr),
+                .fix_rasptr_i(mem_redirect ? mem_rasptr : ex_mispredict ? ex_rasptr : id_rasptr),
+                .ex_update_i((ex_Branch[0] || ex_Jump[0]) && !mem_stall && !mem_redirect),
+                .ex_branch_i(ex_Branch[0]),
+                .ex_call_i(ex_call),
+                .ex_return_i(ex_return),
+                .ex_taken_i(ex_pcsrc),
+                .ex_pc_i(ex_pc),
+                .ex_target_i(ex_pctarget),
+                .ex_ghr_i(ex_ghr)
+            );
+        end
+        else begin : g_static
+            assign if_predtaken = 0;
+            assign if_predtarget = 0;
+            assign if_ghr = 0;
+            assign if_rasptr = 0;
+        end
+    endgenerate
 
     // INSTRUCTION CACHE LOGIC
-    icache ic(
-        .address_i(if_pc[31:0]), .rd_o(if_instr)
+    // Instructions are 16-bit aligned (RV64C). A 32-bit one in the last halfword of a
+    // doubleword continues in the next doubleword. The fetch buffer keeps the last
+    // halfword of every doubleword read, so when sequential fetch reaches such an
+    // instruction the icache reads the next doubleword and the two halves are joined.
+    // After a jump to one, fetch spends a cycle filling the buffer first (if_split,
+    // a bubble like an icache miss). The buffer is dropped on traps, which may switch
+    // address spaces.
+    logic [63:0] if_line, if_addr;
+    logic        if_miss, ic_hit;
+    logic [15:0] fb_half;
+    logic [63:0] fb_pc;     // pc of the halfword in fb_half
+    logic        fb_valid, if_fbhit, if_split;
+    logic [31:0] if_raw;    // as fetched, compressed in the low half or not
+    logic        if_compressed;
+    assign if_fbhit = fb_valid && fb_pc == if_pc;
+    assign if_addr = if_fbhit ? if_pc + 2 : if_pc;
+
+    // FETCH TRANSLATION
+    // With Sv39 on (satp.MODE 8 below M-mode) the I-TLB translates the address the icache
+    // reads, in the same cycle. A miss holds fetch like an icache miss until the walker
+    // has refilled it. A page fault is fetched as a nop that carries the exception to MEM,
+    // where the trap is taken unless something older redirects first; fetch waits for
+    // that redirect (if_faulted). if_ppc, the physical pc, goes down the pipeline for the
+    // harness, which reads the retired instructions from memory; for an instruction that
+    // straddles two pages it is 2 below the physical address of its second half.
+    // pte_allows: whether the flags of a leaf PTE permit an access (0: fetch, 1: load,
+    // 2: store) in privilege mode m; V R W X U G A D are bits 0..7. S-mode reaches user
+    // pages only for loads and stores, with SUM; MXR makes executable pages readable.
+    function automatic logic pte_allows(input logic [7:0] f, input logic [1:0] access,
+                                        input logic [1:0] m, input logic s_um, input logic m_xr);
+        logic ok;
+        unique case (access)
+            2'd0: ok = f[3];
+            2'd1: ok = f[1] || (m_xr && f[3]);
+            default: ok = f[2];
+        endcase
+        if (m == 2'b00) ok = ok && f[4];
+        else if (f[4]) ok = ok && access != 2'd0 && s_um;
+        return ok;
+    endfunction
+
+    logic        if_translate, if_tlbhit, if_tlbok, if_fault, if_faulted;
+    logic        if_tlbwait /*verilator public*/;
+    logic [63:0] if_paddr, if_ppc;
+    logic [7:0]  if_pte;    // flags of the leaf PTE
+    assign if_translate = satp[63:60] == 4'h8 && priv != 2'b11;
+    tlb #(.ENTRIES(ITLB_ENTRIES)) itlb(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .va_i(if_addr),
+        .asid_i(satp[59:44]),
+        .hit_o(if_tlbhit),
+        .pa_o(if_paddr),
+        .flags_o(if_pte),
+        .fill_i(ptw_fill && !ptw_data),
+        .fill_vpn_i(ptw_va[38:12]),
+        .fill_asid_i(ptw_asid),
+        .fill_level_i(ptw_level),
+        .fill_pte_i(ptw_pte),
+        .flush_i(tlb_flush),
+        .flush_va_i(mem_SfenceSel[0]),
+        .flush_asid_i(mem_SfenceSel[1]),
+        .flush_addr_i(mem_result),
+        .flush_id_i(mem_rs2v[15:0])
     );
+    assign if_tlbok = !if_translate || (if_tlbhit && pte_allows(if_pte, 2'd0, priv, sum, mxr));
+    assign if_fault = if_translate && !if_faulted &&
+                      (if_addr[63:38] != {26{if_addr[38]}} ||
+                       (if_tlbhit && !if_tlbok) ||
+                       (!if_tlbhit && pf_valid && !pf_data && pf_vpn == if_addr[38:12]));
+    assign if_tlbwait = if_faulted || (!if_tlbok && !if_fault);
+    assign if_ppc = (if_translate ? if_paddr : if_addr) - (if_fbhit ? 64'd2 : 64'd0);
+    always_ff @(posedge clk_i) begin
+        if (rst_i || mem_redirect || ex_mispredict || id_mispredict) if_faulted <= 0;
+        else if (if_fault && if_advance) if_faulted <= 1;
+    end
+
+    cache #(.SIZE(ICACHE_SIZE), .WAYS(ICACHE_WAYS), .LINE(LINE_SIZE), .PORT(0)) ic(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .req_i(if_tlbok && !if_faulted),
+        .uncached_i(1'b0),
+        .address_i(if_translate ? if_paddr : if_addr),
+        .wd_i(64'b0),
+        .wm_i(8'b0),
+        .we_i(1'b0),
+        .clean_i(1'b0),
+        .inval_i(ic_inval),
+        .hit_o(ic_hit),
+        .rd_o(if_line),
+        .miss_o(if_miss),
+        .writeback_o(),
+        .bus_req_o(),
+        .bus_op_o(),
+        .bus_addr_o(),
+        .bus_gnt_i(1'b0),
+        .bus_flush_i(1'b0),
+        .snoop_i(1'b0),
+        .snoop_op_i(2'b0),
+        .snoop_addr_i(64'b0),
+        .snoop_flush_o(),
+        .snoop_inval_o()
+    );
+    always_comb begin
+        unique case (if_pc[2:1])
+            2'b00: if_raw = if_line[31:0];
+            2'b01: if_raw = if_line[47:16];
+            2'b10: if_raw = if_line[63:32];
+            2'b11: if_raw = if_fbhit ? {if_line[15:0], fb_half} : {16'b0, if_line[63:48]};
+            default: if_raw = 0;
+        endcase
+    end
+    assign if_compressed = if_raw[1:0] != 2'b11;
+    assign if_split = if_pc[2:1] == 2'b11 && !if_fbhit && !if_compressed;
+    assign if_hit = (ic_hit && if_tlbok && !if_faulted && !if_split) || if_fault;
+    always_ff @(posedge clk_i) begin
+        if (rst_i || mem_redirect) fb_valid <= 0;
+        else if (ic_hit && if_tlbok && !if_faulted) begin
+            fb_half <= if_line[63:48];
+            fb_pc <= {if_addr[63:3], 3'b110};
+            fb_valid <= 1;
+        end
+    end
+
+    // DECOMPRESSION
+    // ID only ever sees RV64I/M encodings. The instruction after if_instr is expanded as
+    // well when it lies within if_line, for pairing and fusion; if_end is the halfword of
+    // if_line it starts at.
+    logic [31:0] if_instr1, if_raw1;
+    logic [2:0]  if_end;
+    logic        if_compressed1, if_has1;
+    decompress rvc(
+        .instr_i(if_raw),
+        .instr_o(if_instr)
+    );
+    assign if_end = (if_fbhit ? 3'd0 : {1'b0, if_pc[2:1]} + 3'd1) + {2'b0, !if_compressed};
+    always_comb begin
+        unique case (if_end)
+            3'd0: if_raw1 = if_line[31:0];
+            3'd1: if_raw1 = if_line[47:16];
+            3'd2: if_raw1 = if_line[63:32];
+            3'd3: if_raw1 = {16'b0, if_line[63:48]};
+            default: if_raw1 = 0;
+        endcase
+    end
+    assign if_compressed1 = if_raw1[1:0] != 2'b11;
+    assign if_has1 = if_end < 3'd3 || (if_end == 3'd3 && if_compressed1);
+    decompress rvc1(
+        .instr_i(if_raw1),
+        .instr_o(if_instr1)
+    );
+
+    // PAIRING
+    // With ISSUE_WIDTH 2, a fetch from an aligned doubleword issues both of its
+    // instructions, when both are 32 bits wide and the second is a simple ALU op (RV64I OP,
+    // OP-IMM, their -32 forms, LUI, AUIPC) that neither reads nor overwrites the first one's rd, and fetch goes on past
+    // the first: it is no branch, jump, SYSTEM or MISC-MEM instruction and not predicted
+    // taken. fence.i refetches from the next pc, which would run the second op twice.
+    // The second pipe therefore never redirects, accesses memory or waits for muldiv on
+    // its own, and a pair has no hazard between its halves. Fused pairs are not paired.
+    logic [6:0]  if_op0, if_op1;
+    logic [4:0]  if_rd0;
+    logic        if_simple1, if_plain0, if_dep;
+    logic        if_pair;
+    assign if_op0 = if_instr[6:0];
+    assign if_op1 = if_instr1[6:0];
+    assign if_rd0 = if_instr[11:7];
+    // not M, Zba or Zbb: shifts have funct6 000000 or 010000 (sra), OP funct7 0000000 or
+    // 0100000 (sub, sra)
+    assign if_simple1 = ((if_op1 == 7'b0010011 || if_op1 == 7'b0011011) &&  // OP-IMM(-32)
+                         (if_instr1[13:12] != 2'b01 || if_instr1[31:26] == 6'b000000 ||
+                          (if_instr1[31:26] == 6'b010000 && if_instr1[14]))) ||
+                        ((if_op1 == 7'b0110011 || if_op1 == 7'b0111011) &&  // OP(-32)
+                         (if_instr1[31:25] == 7'b0000000 ||
+                          (if_instr1[31:25] == 7'b0100000 &&
+                           (if_instr1[14:12] == 3'b000 || if_instr1[14:12] == 3'b101)))) ||
+                        if_op1 == 7'b0110111 || if_op1 == 7'b0010111;       // LUI, AUIPC
+    assign if_plain0 = if_op0 != 7'b1100011 && if_op0 != 7'b1101111 &&
+                       if_op0 != 7'b1100111 && if_op0 != 7'b1110011 && if_op0 != 7'b0001111;
+    assign if_dep = if_rd0 != 0 && (if_instr1[11:7] == if_rd0 ||
+                    (!if_op1[2] && if_instr1[19:15] == if_rd0) ||             // rs1, unless U-type
+                    (if_op1[5] && !if_op1[2] && if_instr1[24:20] == if_rd0)); // rs2 of OP(-32)
+    assign if_pair = ISSUE_WIDTH == 2 && if_pc[2:1] == 2'b00 && !if_predtaken && !if_fault &&
+                     !if_compressed && !if_compressed1 && !if_fused &&
+                     if_simple1 && if_plain0 && !if_dep;
+
+    // FUSION
+    // With FUSION, pairs that compilers emit back to back issue as one op when fetch sees
+    // both instructions at once (if_has1):
+    //   lui rd + addi(w) rd, rd          a constant
+    //   auipc rd + jalr rd, rd           a call: a jal to pc + both offsets
+    //   slli rd + srli rd, rd, same n    zero extension: an and with ~0 >> n
+    //   slt(u) rd + beqz/bnez rd         a branch on the slt's operands that also writes rd
+    // The second instruction only reads the first one's rd and either overwrites it or
+    // writes nothing, so the op has the sources of the first and a single destination.
+    // Whether a pc starts a fused op depends on the code only, so the predictor always
+    // sees the same op there.
+    logic [4:0] if_rd1, if_rs11;
+    logic       if_fuse_li, if_fuse_call, if_fuse_zext, if_fuse_cmpbr;
+    logic       if_fused;
+    assign if_rd1 = if_instr1[11:7];
+    assign if_rs11 = if_instr1[19:15];
+    assign if_fuse_li = if_op0 == 7'b0110111 &&
+                        (if_op1 == 7'b0010011 || if_op1 == 7'b0011011) && if_instr1[14:12] == 3'b000 &&
+                        if_rd1 == if_rd0 && if_rs11 == if_rd0;
+    assign if_fuse_call = if_op0 == 7'b0010111 && if_op1 == 7'b1100111 &&
+                          if_rd1 == if_rd0 && if_rs11 == if_rd0;
+    assign if_fuse_zext = if_op0 == 7'b0010011 && if_instr[14:12] == 3'b001 && if_instr[31:26] == 0 &&
+                          if_op1 == 7'b0010011 && if_instr1[14:12] == 3'b101 && if_instr1[31:26] == 0 &&
+                          if_instr1[25:20] == if_instr[25:20] && if_rd1 == if_rd0 && if_rs11 == if_rd0;
+    assign if_fuse_cmpbr = if_op0 == 7'b0110011 && if_instr[14:13] == 2'b01 && if_instr[31:25] == 0 &&
+                           if_op1 == 7'b1100011 && if_instr1[14:13] == 2'b00 &&
+                           if_rs11 == if_rd0 && if_instr1[24:20] == 0;
+    assign if_fused = FUSION && if_has1 && if_rd0 != 0 && !if_fault &&
+                      (if_fuse_li || if_fuse_call || if_fuse_zext || if_fuse_cmpbr);
 
     ////////////////////
     // DE
@@ -33,31 +480,79 @@ module CPU(input    logic   clk_i,
 
     // DE STATE 
     logic [31:0] id_instr;
-    logic [63:0] id_pc, id_pcplus4;
+    logic [63:0] id_pc /*verilator public*/;
+    logic [63:0] id_pcplus;
+    logic        id_valid /*verilator public*/; // cleared for bubbles, used by the performance counters
+    logic             id_predtaken;
+    logic [63:0]      id_predtarget;
+    logic [HBITS-1:0] id_ghr;
+    logic [RBITS-1:0] id_rasptr;
+    logic [31:0] id1_instr; // the next instruction: second half of a pair or of a fused op
+    logic        id1_valid; // id1_instr issues to the second pipe
+    logic        id1_Compressed;
+    logic        id_Fused;  // id_instr and id1_instr issue as one op
+    logic        id_Compressed; // counted when it retires
+    logic        id_Exc;        // a fetch page fault, fetched as a nop (FETCH TRANSLATION)
+    logic [3:0]  id_Cause;
+    logic [63:0] id_tval, id_ppc;
     always_ff @(posedge clk_i) begin
-        if (rst_i || ex_flushID) begin
+        if (rst_i || ex_flushID || (!ex_stallID && !if_hit)) begin // bubble on an icache or I-TLB miss
             id_instr <= 0;
+            id1_instr <= 0;
+            id1_valid <= 0;
+            id1_Compressed <= 0;
+            id_Fused <= 0;
+            id_Compressed <= 0;
+            id_Exc <= 0;
+            id_Cause <= 0;
+            id_tval <= 0;
+            id_ppc <= 0;
             id_pc <= 0;
-            id_pcplus4 <= 0;
+            id_pcplus <= 0;
+            id_valid <= 0;
+            id_predtaken <= 0;
+            id_predtarget <= 0;
+            id_ghr <= 0;
+            id_rasptr <= 0;
         end
         else begin
             if (!ex_stallID) begin
-                id_instr <= if_instr;
+                id_instr <= if_fault ? 32'h00000013 : if_instr;
+                id1_instr <= if_instr1;
+                id1_valid <= if_pair;
+                id1_Compressed <= if_compressed1;
+                id_Fused <= if_fused;
+                id_Compressed <= if_compressed;
+                id_Exc <= if_fault;
+                id_Cause <= 4'd12;
+                id_tval <= if_addr;
+                id_ppc <= if_ppc;
                 id_pc <= if_pc;
-                id_pcplus4 <= if_pcplus4;
+                id_pcplus <= if_pcplus;
+                id_valid <= 1;
+                id_predtaken <= if_predtaken;
+                id_predtarget <= if_predtarget;
+                id_ghr <= if_ghr;
+                id_rasptr <= if_rasptr;
             end
         end
     end
 
     // REGISTER FILE LOGIC
-    logic [63:0] id_rs1v, id_rs2v;
+    // the second pair of read ports and the second write port belong to the second pipe
+    logic [63:0] id_rs1v, id_rs2v, id1_rs1v, id1_rs2v;
     registerfile rf(
                 .clk_i(clk_i),
                 .a1_i(id_rs1), .a2_i(id_rs2), .a3_i(wb_rd),
                 .we_i(wb_RegWrite),
                 .wd_i(wb_data), 
                 .rd1_o(id_rs1v),
-                .rd2_o(id_rs2v)
+                .rd2_o(id_rs2v),
+                .a4_i(id1_rs1), .a5_i(id1_rs2), .a6_i(wb1_rd),
+                .we2_i(wb1_RegWrite),
+                .wd2_i(wb1_result),
+                .rd3_o(id1_rs1v),
+                .rd4_o(id1_rs2v)
     );
 
     // CONTROL SIGNAL GENERATION 
@@ -84,7 +579,7 @@ module CPU(input    logic   clk_i,
     assign id_uimm = { id_instr[31:12], 12'b0 };
     assign id_jimm = { {11{id_instr[31]}}, id_instr[31], id_instr[19:12], id_instr[20], id_instr[30:21], 1'b0 };
 
-    logic [3:0] AluControl;
+    logic [4:0] AluControl;
     logic       RegWrite;
     logic       AluSrcB;
     logic [2:0] ImmSrc;
@@ -94,8 +589,40 @@ module CPU(input    logic   clk_i,
     logic       WriteBackSrc; // others vs load
     logic       MemWrite;
     logic       Word;
+    logic       Uw;    // Zba .uw forms: rs1 zero-extended from its low word
+    logic [2:0] CsrOp; // funct3 of a Zicsr instruction, 0 otherwise
+    assign CsrOp = id_opcode == 7'b1110011 ? id_funct3 : 3'b000;
+    logic       Atomic; // RV64A, see ATOMICS
+    logic [4:0] AmoOp;  // funct5
+    assign AmoOp = id_instr[31:27];
+
+    // PRIVILEGED INSTRUCTIONS
+    // Exceptions are raised in ID and taken in MEM, where nothing older can redirect any
+    // more: the instruction goes on as a nop that carries its cause (Exc, Cause). Sys marks
+    // the instructions that redirect from MEM once they complete: xRET, and those after
+    // which fetch has to start over, sfence.vma (the TLBs), fence.i (the icache) and CSR
+    // writes that can change translation (satp, mstatus, sstatus).
+    localparam SYS_MRET = 3'd1, SYS_SRET = 3'd2, SYS_SFENCE = 3'd3, SYS_FENCEI = 3'd4,
+               SYS_REFETCH = 3'd5;
+    logic       Illegal, Ecall, Ebreak, Exc;
+    logic [2:0] Sys;
+    logic [3:0] Cause;
+    logic       CsrWrite, CsrDenied;
+    assign Ecall = id_instr == 32'h00000073;
+    assign Ebreak = id_instr == 32'h00100073;
+    // csrrs/c with rs1 x0 and csrrsi/ci with a zero immediate only read
+    assign CsrWrite = id_funct3[1:0] == 2'b01 || id_rs1 != 0;
+    assign CsrDenied = id_instr[29:28] > priv || (id_instr[31:30] == 2'b11 && CsrWrite);
+    assign Exc = id_valid && (id_Exc || Illegal || Ecall || Ebreak);
+    assign Cause = id_Exc  ? id_Cause :
+                   Illegal ? 4'd2 :
+                   Ebreak  ? 4'd3 : {2'b10, priv}; // ecall from U, S or M
+
+    // RV64M; decodes like an R-type ALU op, the muldiv unit result replaces the ALU's
+    logic       MulDiv;
+    assign MulDiv = (id_opcode == 7'b0110011 || id_opcode == 7'b0111011) && id_funct7 == 7'b0000001;
     always_comb begin
-        AluControl = 4'bxxxx;
+        AluControl = 5'bxxxxx;
         RegWrite = 1'bx;
         AluSrcB = 1'bx; 
         ImmSrc = 3'bxxx;
@@ -105,25 +632,59 @@ module CPU(input    logic   clk_i,
         WriteBackSrc = 1'bx;
         MemWrite = 1'bx;
         Word = 1'bx;
+        Uw = 1'b0;
+        Illegal = 1'b0;
+        Sys = 3'b000;
+        Atomic = 1'b0;
         unique case (id_opcode)
             7'b0010011, 7'b0011011: begin // I-type
                 unique case (id_funct3)
-                    3'b000: AluControl = 4'b0000; // addi
-                    3'b001: AluControl = 4'b0010; // slli
-                    3'b010: AluControl = 4'b0011; // slti
-                    3'b011: AluControl = 4'b0100; // sltiu
-                    3'b100: AluControl = 4'b0101; // xori
+                    3'b000: AluControl = 5'b00000; // addi
+                    3'b001: begin
+                        unique casez (id_instr[31:20])
+                            12'b000000??????: AluControl = 5'b00010; // slli
+                            12'b000010??????: begin                  // slli.uw
+                                AluControl = 5'b00010;
+                                Uw = 1'b1;
+                            end
+                            12'h600: AluControl = 5'b10011;  // clz(w)
+                            12'h601: AluControl = 5'b10100;  // ctz(w)
+                            12'h602: AluControl = 5'b10101;  // cpop(w)
+                            12'h604: AluControl = 5'b10111;  // sext.b
+                            12'h605: AluControl = 5'b11000;  // sext.h
+                            default: begin                   // error
+                                AluControl = 5'bxxxxx;
+                                Illegal = 1'b1;
+                            end
+                        endcase
+                    end
+                    3'b010: AluControl = 5'b00011; // slti
+                    3'b011: AluControl = 5'b00100; // sltiu
+                    3'b100: AluControl = 5'b00101; // xori
                     3'b101: begin
-                        unique case (id_funct7[5])
-                            1'b0: AluControl = 4'b0110;     // srli
-                            1'b1: AluControl = 4'b0111;     // srai
-                            default: AluControl = 4'bxxxx;  // error
+                        unique casez (id_instr[31:20])
+                            12'b000000??????: AluControl = 5'b00110; // srli
+                            12'b010000??????: AluControl = 5'b00111; // srai
+                            12'b011000??????: AluControl = 5'b10110; // rori(w)
+                            12'h287: AluControl = 5'b11011;          // orc.b
+                            12'h6b8: AluControl = 5'b11010;          // rev8
+                            default: begin                           // error
+                                AluControl = 5'bxxxxx;
+                                Illegal = 1'b1;
+                            end
                         endcase
                     end
-                    3'b110: AluControl = 4'b1000; // ori
-                    3'b111: AluControl = 4'b1001; // andi
-                    default: AluControl = 4'bxxxx; // error
+                    3'b110: AluControl = 5'b01000; // ori
+                    3'b111: AluControl = 5'b01001; // andi
+                    default: begin                 // error
+                        AluControl = 5'bxxxxx;
+                        Illegal = 1'b1;
+                    end
                 endcase
+                // OP-IMM-32 has addiw and the shifts and counts only
+                if (id_opcode == 7'b0011011 && id_funct3 != 3'b000 && id_funct3 != 3'b001 &&
+                    id_funct3 != 3'b101)
+                    Illegal = 1'b1;
                 RegWrite = 1'b1;
                 AluSrcB = 1'b1; 
                 ImmSrc = 3'b000;
@@ -132,15 +693,15 @@ module CPU(input    logic   clk_i,
                 Jump = 2'b00;
                 WriteBackSrc = 1'b0;
                 MemWrite = 1'b0;
-                Word = id_opcode == 7'b0010011 ? 1'b0 : 1'b1;
+                Word = id_opcode == 7'b0011011 && !Uw;
             end
             7'b0010111, 7'b0110111: begin // auipc, lui U-type
                 if (id_opcode == 7'b0010111) begin 
-                    AluControl = 4'b0000; // auipc
+                    AluControl = 5'b00000; // auipc
                     AluResultSrc = 2'b01;
                 end
                 else begin 
-                    AluControl = 4'b1010; // lui
+                    AluControl = 5'b01010; // lui
                     AluResultSrc = 2'b00;
                 end
                 RegWrite = 1'b1;
@@ -153,19 +714,40 @@ module CPU(input    logic   clk_i,
                 Word = 1'b0;
             end
             7'b0110011, 7'b0111011: begin // R-type
-                unique case ({id_funct3, id_funct7[5]})
-                    4'b0000: AluControl = 4'b0000; // add
-                    4'b0001: AluControl = 4'b0001; // sub
-                    4'b0010: AluControl = 4'b0010; // sll
-                    4'b0100: AluControl = 4'b0011; // slt
-                    4'b0110: AluControl = 4'b0100; // sltu
-                    4'b1000: AluControl = 4'b0101; // xor
-                    4'b1010: AluControl = 4'b0110; // srl
-                    4'b1011: AluControl = 4'b0111; // sra
-                    4'b1100: AluControl = 4'b1000; // or
-                    4'b1110: AluControl = 4'b1001; // and
-                    default: AluControl = 4'bxxxx; // error
+                unique casez ({id_funct7, id_funct3})
+                    10'b0000000_000: AluControl = 5'b00000; // add
+                    10'b0100000_000: AluControl = 5'b00001; // sub
+                    10'b0000000_001: AluControl = 5'b00010; // sll
+                    10'b0000000_010: AluControl = 5'b00011; // slt
+                    10'b0000000_011: AluControl = 5'b00100; // sltu
+                    10'b0000000_100: AluControl = 5'b00101; // xor
+                    10'b0000000_101: AluControl = 5'b00110; // srl
+                    10'b0100000_101: AluControl = 5'b00111; // sra
+                    10'b0000000_110: AluControl = 5'b01000; // or
+                    10'b0000000_111: AluControl = 5'b01001; // and
+                    10'b0000001_???: AluControl = 5'b00000; // RV64M, see MulDiv
+                    10'b0100000_111: AluControl = 5'b01011; // andn
+                    10'b0100000_110: AluControl = 5'b01100; // orn
+                    10'b0100000_100: AluControl = 5'b01101; // xnor
+                    10'b0000101_100: AluControl = 5'b01110; // min
+                    10'b0000101_101: AluControl = 5'b10000; // minu
+                    10'b0000101_110: AluControl = 5'b01111; // max
+                    10'b0000101_111: AluControl = 5'b10001; // maxu
+                    10'b0110000_001: AluControl = 5'b10010; // rol(w)
+                    10'b0110000_101: AluControl = 5'b10110; // ror(w)
+                    10'b0010000_010: AluControl = 5'b11100; // sh1add(.uw)
+                    10'b0010000_100: AluControl = 5'b11101; // sh2add(.uw)
+                    10'b0010000_110: AluControl = 5'b11110; // sh3add(.uw)
+                    10'b0000100_000: AluControl = 5'b00000; // add.uw
+                    10'b0000100_100: AluControl = 5'b11001; // zext.h
+                    default: begin                          // error
+                        AluControl = 5'bxxxxx;
+                        Illegal = 1'b1;
+                    end
                 endcase
+                // add.uw and shNadd.uw are the OP-32 encodings of add and shNadd
+                Uw = id_opcode == 7'b0111011 &&
+                     ((id_funct7 == 7'b0000100 && id_funct3 == 3'b000) || id_funct7 == 7'b0010000);
                 RegWrite = 1'b1;
                 AluSrcB = 1'b0; 
                 ImmSrc = 3'bxxx;
@@ -174,14 +756,15 @@ module CPU(input    logic   clk_i,
                 Jump = 2'b00;
                 WriteBackSrc = 1'b0;
                 MemWrite = 1'b0;
-                Word = id_opcode == 7'b0110011 ? 1'b0 : 1'b1;
+                Word = id_opcode == 7'b0111011 && !Uw;
             end
             7'b1100011: begin // B-type
-                AluControl = 4'b0001;
+                AluControl = 5'b00001;
                 RegWrite = 1'b0;
                 AluSrcB = 1'b0; 
                 ImmSrc = 3'b010;
                 Branch = {id_funct3, 1'b1};
+                Illegal = id_funct3[2:1] == 2'b01;
                 AluResultSrc = 2'b00;
                 Jump = 2'b00;
                 WriteBackSrc = 1'b0;
@@ -189,7 +772,7 @@ module CPU(input    logic   clk_i,
                 Word = 1'b0;
             end
             7'b1101111, 7'b1100111: begin // J-type (jal) and I-type (jalr)
-                AluControl = 4'bxxxx;
+                AluControl = 5'bxxxxx;
                 RegWrite = 1'b1;
                 AluSrcB = 1'b0; 
                 Branch = 4'b0000;
@@ -207,7 +790,7 @@ module CPU(input    logic   clk_i,
                 Word = 1'b0;
             end
             7'b0000011: begin // I-type (loads)
-                AluControl = 4'b0000;
+                AluControl = 5'b00000;
                 RegWrite = 1'b1;
                 AluSrcB = 1'b1; 
                 ImmSrc = 3'b000;
@@ -217,9 +800,10 @@ module CPU(input    logic   clk_i,
                 WriteBackSrc = 1'b1;
                 MemWrite = 1'b0;
                 Word = 1'b0;
+                Illegal = id_funct3 == 3'b111;
             end
             7'b0100011: begin // S-type (stores)
-                AluControl = 4'b0000;
+                AluControl = 5'b00000;
                 RegWrite = 1'b0;
                 AluSrcB = 1'b1; 
                 ImmSrc = 3'b100;
@@ -229,13 +813,85 @@ module CPU(input    logic   clk_i,
                 WriteBackSrc = 1'b0;
                 MemWrite = 1'b1;
                 Word = 1'b0;
+                Illegal = id_funct3[2];
+            end
+            7'b1110011: begin // SYSTEM: Zicsr, the csr address rides in the I-immediate
+                AluControl = 5'b00000;
+                RegWrite = id_funct3 != 3'b000;
+                AluSrcB = 1'b0; 
+                ImmSrc = 3'b000;
+                Branch = 4'b0000;
+                AluResultSrc = 2'b10;
+                Jump = 2'b00;
+                WriteBackSrc = 1'b0;
+                MemWrite = 1'b0;
+                Word = 1'b0;
+                if (id_funct3 == 3'b000) begin
+                    // ecall and ebreak are exceptions (Exc); sfence.vma passes rs1 on as
+                    // its result, rs2 rides along like store data
+                    AluResultSrc = 2'b00;
+                    if (id_funct7 == 7'b0001001 && id_rd == 0) begin
+                        AluSrcB = 1'b1;
+                        ImmSrc = 3'b110;
+                        Sys = SYS_SFENCE;
+                        Illegal = priv == 2'b00;
+                    end
+                    else begin
+                        unique case (id_instr)
+                            32'h00000073, 32'h00100073: ;                  // ecall, ebreak
+                            32'h30200073: begin Sys = SYS_MRET; Illegal = priv != 2'b11; end
+                            32'h10200073: begin Sys = SYS_SRET; Illegal = priv == 2'b00; end
+                            32'h10500073: ;                                // wfi
+                            default: Illegal = 1'b1;
+                        endcase
+                    end
+                end
+                else begin
+                    Illegal = id_funct3 == 3'b100 || CsrDenied;
+                    if (CsrWrite && (id_instr[31:20] == 12'h180 || id_instr[31:20] == 12'h300 ||
+                                     id_instr[31:20] == 12'h100))
+                        Sys = SYS_REFETCH;
+                end
+            end
+            7'b0101111: begin // AMO: the address is rs1, the old value is loaded into rd
+                AluControl = 5'b00000;
+                RegWrite = 1'b1;
+                AluSrcB = 1'b1;
+                ImmSrc = 3'b110;
+                Branch = 4'b0000;
+                AluResultSrc = 2'b00;
+                Jump = 2'b00;
+                WriteBackSrc = 1'b1;
+                MemWrite = AmoOp != 5'b00010; // all but lr
+                Word = 1'b0;
+                Atomic = 1'b1;
+                unique case (AmoOp)
+                    5'b00010: Illegal = id_rs2 != 0;                    // lr
+                    5'b00011, 5'b00001, 5'b00000, 5'b00100, 5'b01100,   // sc, amoswap, amoadd, amoxor, amoand,
+                    5'b01000, 5'b10000, 5'b10100, 5'b11000, 5'b11100: ; // amoor, amomin(u), amomax(u)
+                    default: Illegal = 1'b1;
+                endcase
+                if (id_funct3 != 3'b010 && id_funct3 != 3'b011) Illegal = 1'b1;
+            end
+            7'b0001111: begin // MISC-MEM: fence is a nop in order, fence.i cleans the dcache
+                AluControl = 5'b00000;
+                RegWrite = 1'b0;
+                AluSrcB = 1'b0;
+                ImmSrc = 3'b000;
+                Branch = 4'b0000;
+                AluResultSrc = 2'b00;
+                Jump = 2'b00;
+                WriteBackSrc = 1'b0;
+                MemWrite = 1'b0;
+                Word = 1'b0;
+                Sys = id_funct3 == 3'b001 ? SYS_FENCEI : 3'b000;
             end
             default: begin
                 if (id_pc != 0 && id_rd == 0 && id_rs1 == 0 && id_rs2 == 0 && id_funct3 == 0 && id_funct7 == 0) begin
                     $display("RETURN VALUE: %d at PC:%h", ex_result, if_pc);
                     $finish;
                 end
-                AluControl = 4'b0000; 
+                AluControl = 5'b00000; 
                 RegWrite = 1'b0;
                 AluSrcB = 1'b0; 
                 ImmSrc = 3'b000;
@@ -245,8 +901,41 @@ module CPU(input    logic   clk_i,
                 WriteBackSrc = 1'b0;
                 MemWrite = 1'b0;
                 Word = 1'b0;
+                Illegal = 1'b1;
             end
         endcase
+
+        // a fused op decodes as its first instruction, except for (FUSION above)
+        if (id_Fused) begin
+            unique case (id_opcode)
+                7'b0110111: ImmSrc = 3'b101;  // lui + addi(w)
+                7'b0010111: begin             // auipc + jalr
+                    ImmSrc = 3'b101;
+                    Jump = 2'b01;
+                    AluResultSrc = 2'b11;
+                end
+                7'b0010011: begin             // slli + srli
+                    ImmSrc = 3'b101;
+                    AluControl = 5'b01001;
+                end
+                7'b0110011: begin             // slt(u) + beqz/bnez: bge(u)/blt(u)
+                    ImmSrc = 3'b101;
+                    Branch = {1'b1, id_funct3[0], !id1_funct3[0], 1'b1};
+                end
+                default: ;
+            endcase
+        end
+
+        // an exception makes a nop of the instruction (Exc)
+        if (id_Exc || Illegal || Ecall || Ebreak) begin
+            RegWrite = 1'b0;
+            Branch = 4'b0000;
+            Jump = 2'b00;
+            WriteBackSrc = 1'b0;
+            MemWrite = 1'b0;
+            Sys = 3'b000;
+            Atomic = 1'b0;
+        end
     end
 
     // ImmSrc mux
@@ -259,73 +948,159 @@ module CPU(input    logic   clk_i,
             3'b010: id_immext = {{32{id_bimm[31]}}, id_bimm};
             3'b011: id_immext = {{32{id_jimm[31]}}, id_jimm};
             3'b100: id_immext = {{32{id_simm[31]}}, id_simm};
-            3'b101: id_immext = {64{1'b0}};
+            3'b101: id_immext = id_fuseimm;
             3'b110: id_immext = {64{1'b0}};
             3'b111: id_immext = {64{1'b0}};
             default: id_immext = {64{1'b0}};
         endcase
     end
 
+    // SECOND PIPE DECODE
+    // only the instructions the pairing rules let through; AluControl as above
+    logic [6:0]  id1_opcode, id1_funct7;
+    logic [4:0]  id1_rd, id1_rs1, id1_rs2;
+    logic [2:0]  id1_funct3;
+    logic [4:0]  id1_AluControl;
+    logic        id1_AluSrcB, id1_Word, id1_Auipc;
+    logic [63:0] id1_immext;
+    assign id1_opcode = id1_instr[6:0];
+    assign id1_rd = id1_instr[11:7];
+    assign id1_rs1 = id1_instr[19:15];
+    assign id1_rs2 = id1_instr[24:20];
+    assign id1_funct3 = id1_instr[14:12];
+    assign id1_funct7 = id1_instr[31:25];
+    assign id1_AluSrcB = !id1_opcode[5] || id1_opcode[2];  // OP-IMM(-32), LUI, AUIPC
+    assign id1_Word = id1_opcode[3];                        // OP-32, OP-IMM-32
+    assign id1_Auipc = id1_opcode == 7'b0010111;
+    assign id1_immext = id1_opcode[2] ? {{32{id1_instr[31]}}, id1_instr[31:12], 12'b0} :
+                                        {{52{id1_instr[31]}}, id1_instr[31:20]};
+    always_comb begin
+        unique case (id1_funct3)
+            3'b000: id1_AluControl = id1_opcode[5] && id1_funct7[5] ? 5'b00001 : 5'b00000; // sub, add(i)
+            3'b001: id1_AluControl = 5'b00010; // sll(i)
+            3'b010: id1_AluControl = 5'b00011; // slt(i)
+            3'b011: id1_AluControl = 5'b00100; // slt(i)u
+            3'b100: id1_AluControl = 5'b00101; // xor(i)
+            3'b101: id1_AluControl = id1_funct7[5] ? 5'b00111 : 5'b00110; // sra(i), srl(i)
+            3'b110: id1_AluControl = 5'b01000; // or(i)
+            3'b111: id1_AluControl = 5'b01001; // and(i)
+            default: id1_AluControl = 5'bxxxxx;
+        endcase
+        if (id1_opcode == 7'b0110111) id1_AluControl = 5'b01010; // lui
+        if (id1_Auipc) id1_AluControl = 5'b00000;                // auipc adds to the pc
+    end
+
+    // FUSED OP IMMEDIATES
+    // the constant, the call offset (bit 0 cleared as jalr does), the zero-extension mask,
+    // and the branch offset from the first instruction's pc
+    logic [63:0] id_fuseimm, id_lipart;
+    logic [63:0] id1_iimm, id1_bimm;
+    assign id1_iimm = {{52{id1_instr[31]}}, id1_instr[31:20]};
+    assign id1_bimm = {{52{id1_instr[31]}}, id1_instr[7], id1_instr[30:25], id1_instr[11:8], 1'b0};
+    assign id_lipart = {{32{id_uimm[31]}}, id_uimm} + id1_iimm;
+    always_comb begin
+        unique case (id_opcode)
+            7'b0110111: id_fuseimm = id1_opcode[3] ? {{32{id_lipart[31]}}, id_lipart[31:0]} : id_lipart;
+            7'b0010111: id_fuseimm = id_lipart & ~64'b1;
+            7'b0010011: id_fuseimm = ~64'b0 >> id_instr[25:20];
+            7'b0110011: id_fuseimm = id1_bimm + (id_Compressed ? 2 : 4);
+            default: id_fuseimm = 0;
+        endcase
+    end
+
+    // EARLY BRANCH RESOLUTION
+    // With EARLY_BRANCH, conditional branches compare in ID and redirect fetch from
+    // here, which costs one bubble instead of two. Operands come from the register
+    // file (WB is written on the falling edge) or are forwarded from MEM; a producer
+    // still in EX, or a load in MEM, stalls the branch (ex_branchStall).
+    logic        id_taken, id_resolve;
+    logic        id_mispredict /*verilator public*/;
+    logic [63:0] id_brA, id_brB, id_brtarget, id_redirect;
+    always_comb begin
+        id_brA = (mem1_RegWrite && mem1_rd != 0 && mem1_rd == id_rs1) ? mem1_result :
+                 (mem_RegWrite && mem_rd != 0 && mem_rd == id_rs1)   ? mem_result  : id_rs1v;
+        id_brB = (mem1_RegWrite && mem1_rd != 0 && mem1_rd == id_rs2) ? mem1_result :
+                 (mem_RegWrite && mem_rd != 0 && mem_rd == id_rs2)   ? mem_result  : id_rs2v;
+    end
+    brcomp bc(
+        .a_i(id_brA),
+        .b_i(id_brB),
+        .BranchControl_i(Branch),
+        .branch_o(id_taken)
+    );
+    assign id_brtarget = id_pc + id_immext;
+    assign id_redirect = id_taken ? id_brtarget : id_pcplus;
+    assign id_resolve = EARLY_BRANCH && Branch[0] && !ex_branchStall && !ex_mispredict && !ex_stallEX &&
+                        !mem_redirect;
+    assign id_mispredict = id_resolve &&
+                           (id_taken != id_predtaken || (id_taken && id_predtarget != id_brtarget));
+
     ////////////////////
     // EX
     ////////////////////
 
     // HAZARD HANDLING
-    logic [1:0] ex_forwardA, ex_forwardB;
-    logic       ex_loadStall, ex_stallIF, ex_stallID, ex_flushEX, ex_flushID;
+    // forward(rs, v): the newest value of register rs for an EX operand that read v from
+    // the register file. MEM is newer than WB and, within a stage, the second pipe holds
+    // the younger instruction; the halves of a pair never write the same register.
+    function automatic logic [63:0] forward(input logic [4:0] rs, input logic [63:0] v);
+        if (rs == 0)                             return v;
+        else if (mem1_RegWrite && mem1_rd == rs) return mem1_result; // forward from mem stage
+        else if (mem_RegWrite && mem_rd == rs)   return mem_result;
+        else if (wb1_RegWrite && wb1_rd == rs)   return wb1_result;  // forward from wb stage
+        else if (wb_RegWrite && wb_rd == rs)     return wb_data;
+        else                                     return v;           // no forward
+    endfunction
+
+    // the stall and flush causes are public for the profiler of the harness
+    logic       ex_loadStall /*verilator public*/;
+    logic       ex_branchStall /*verilator public*/;
+    logic       ex_stallIF /*verilator public*/;
+    logic       ex_stallEX /*verilator public*/;
+    logic       ex_stallID, ex_flushEX, ex_flushID;
     always_comb begin
         /////////////
-        // RAW HAZARD
+        // LOAD HAZARD
         /////////////
-        ex_forwardA = 2'bxx;
-        if (((ex_rs1 == mem_rd) && mem_RegWrite) && (ex_rs1 != 0)) begin
-            // forward from mem stage
-            ex_forwardA = 2'b10;
-        end
-        else if (((ex_rs1 == wb_rd) && wb_RegWrite) && (ex_rs1 != 0)) begin
-            // forward from wb stage
-            ex_forwardA = 2'b11;
-        end
-        else begin
-            // no forward
-            ex_forwardA = 2'b00;
-        end
+        // if load is in EX stage and next instr uses to-be loaded value, stall
+        // (the second pipe never loads, but the second half of the pair in ID may use it)
+        ex_loadStall = ex_WriteBackSrc && ((id_rs1 == ex_rd) || (id_rs2 == ex_rd) ||
+                       (id1_valid && ((id1_rs1 == ex_rd) || (id1_rs2 == ex_rd))));
 
-        ex_forwardB = 2'bxx;
-        if (((ex_rs2 == mem_rd) && mem_RegWrite) && (ex_rs2 != 0)) begin
-            // forward from mem stage
-            ex_forwardB = 2'b10;
-        end
-        else if (((ex_rs2 == wb_rd) && wb_RegWrite) && (ex_rs2 != 0)) begin
-            // forward from wb stage
-            ex_forwardB = 2'b11;
-        end
-        else begin
-            // no forward
-            ex_forwardB = 2'b00;
-        end
+        /////////////
+        // EARLY BRANCH HAZARD
+        /////////////
+        // a branch resolved in ID waits for a result still in EX and for loads in MEM
+        ex_branchStall = EARLY_BRANCH && Branch[0] && (
+                         (ex_RegWrite && ex_rd != 0 && (id_rs1 == ex_rd || id_rs2 == ex_rd)) ||
+                         (ex1_RegWrite && ex1_rd != 0 && (id_rs1 == ex1_rd || id_rs2 == ex1_rd)) ||
+                         (mem_WriteBackSrc && mem_rd != 0 && (id_rs1 == mem_rd || id_rs2 == mem_rd)));
 
         /////////////
-        // LOAD HAZARD
+        // MULDIV
         /////////////
-        // if load is in EX stage and next instr uses to-be loaded value, stall
-        ex_loadStall = ex_WriteBackSrc && ((id_rs1 == ex_rd) || (id_rs2 == ex_rd));
-        ex_stallIF = ex_loadStall;
-        ex_stallID = ex_loadStall;
-        // ex_pcsrc is here to flush EX pipeline register when branch is taken, 
-        // since we predict branch not taken
-        ex_flushEX = ex_loadStall || ex_pcsrc;
+        // a multiply or divide holds EX, and everything behind it, until its result is ready;
+        // a dcache miss freezes the whole pipeline
+        ex_stallEX = ex_mdBusy || mem_stall;
+
+        // a redirect wins over the stall; the dependent instruction in ID is squashed
+        ex_stallIF = (ex_loadStall || ex_branchStall) && !ex_mispredict || ex_stallEX;
+        ex_stallID = (ex_loadStall || ex_branchStall) && !ex_mispredict || ex_stallEX;
+        // ex_mispredict is here to flush EX pipeline register when the fetch
+        // direction or target chosen in IF turns out wrong
+        ex_flushEX = ex_loadStall || ex_branchStall || ex_mispredict;
 
-        // flush ID pipeline register when branch is taken
-        ex_flushID = ex_pcsrc;
+        // flush ID pipeline register on a misprediction in EX or ID, or a trap or xRET in MEM
+        ex_flushID = ex_mispredict || id_mispredict || mem_redirect;
     end
 
     // EX STATE 
-    logic [63:0]  ex_pc, ex_pctarget, ex_pcplus4;
+    logic [63:0]  ex_pc /*verilator public*/;
+    logic [63:0]  ex_pctarget, ex_pcplus;
     logic [63:0]  ex_rs1v, ex_rs2v;
     logic [4:0]   ex_rd;
     logic [63:0]  ex_imm;
-    logic [3:0]   ex_AluControl;
+    logic [4:0]   ex_AluControl;
     logic         ex_RegWrite;
     logic         ex_AluSrcB;
     logic [3:0]   ex_Branch;
@@ -335,12 +1110,30 @@ module CPU(input    logic   clk_i,
     logic         ex_MemWrite;
     logic         ex_pcsrc;
     logic         ex_Word;
+    logic         ex_Uw;
+    logic [2:0]   ex_CsrOp;
+    logic         ex_Exc;
+    logic [3:0]   ex_Cause;
+    logic [63:0]  ex_tval, ex_ppc;
+    logic [2:0]   ex_Sys;
+    logic         ex_valid /*verilator public*/;
+    logic             ex_predtaken;
+    logic [63:0]      ex_predtarget;
+    logic [HBITS-1:0] ex_ghr;
+    logic [RBITS-1:0] ex_rasptr;
+    logic             ex_earlymiss; // mispredicted, but already repaired in ID
+    logic         ex_MulDiv;
+    logic [2:0]   ex_MulDivOp; // funct3
     logic [4:0] ex_rs1, ex_rs2; // for forwarding
     logic [2:0] ex_LoadStoreControl;
+    logic       ex_Atomic;
+    logic [4:0] ex_AmoOp;
+    logic [1:0] ex_Compressed; // compressed instructions in it
+    logic       ex_Fused;
     always_ff @(posedge clk_i) begin
-        if (rst_i || ex_flushEX) begin
+        if (rst_i || mem_redirect || (ex_flushEX && !ex_stallEX)) begin
             ex_pc <= 0;
-            ex_pcplus4 <= 0;
+            ex_pcplus <= 0;
             ex_rs1v <= 0;
             ex_rs2v <= 0;
             ex_rd <= 0;
@@ -356,11 +1149,30 @@ module CPU(input    logic   clk_i,
             ex_rs1 <= 0;
             ex_rs2 <= 0;
             ex_LoadStoreControl <= 0;
+            ex_Atomic <= 0;
+            ex_AmoOp <= 0;
             ex_Word <= 0;
+            ex_Uw <= 0;
+            ex_CsrOp <= 0;
+            ex_Exc <= 0;
+            ex_Cause <= 0;
+            ex_tval <= 0;
+            ex_ppc <= 0;
+            ex_Sys <= 0;
+            ex_valid <= 0;
+            ex_predtaken <= 0;
+            ex_predtarget <= 0;
+            ex_ghr <= 0;
+            ex_rasptr <= 0;
+            ex_earlymiss <= 0;
+            ex_MulDiv <= 0;
+            ex_MulDivOp <= 0;
+            ex_Compressed <= 0;
+            ex_Fused <= 0;
         end
-        else begin
+        else if (!ex_stallEX) begin
             ex_pc <= id_pc;
-            ex_pcplus4 <= id_pcplus4;
+            ex_pcplus <= id_pcplus;
             ex_rs1v <= id_rs1v;
             ex_rs2v <= id_rs2v;
             ex_rd <= id_rd;
@@ -376,7 +1188,28 @@ module CPU(input    logic   clk_i,
             ex_rs1 <= id_rs1;
             ex_rs2 <= id_rs2;
             ex_LoadStoreControl <= LoadStoreControl;
+            ex_Atomic <= Atomic;
+            ex_AmoOp <= AmoOp;
             ex_Word <= Word;
+            ex_Uw <= Uw;
+            ex_CsrOp <= Exc ? 3'b000 : CsrOp;
+            ex_Exc <= Exc;
+            ex_Cause <= Cause;
+            ex_tval <= id_tval;
+            ex_ppc <= id_ppc;
+            ex_Sys <= Sys;
+            ex_valid <= id_valid;
+            // a branch resolved in ID arrives with its outcome as the prediction,
+            // so EX agrees with it and does not redirect a second time
+            ex_predtaken <= id_resolve ? id_taken : id_predtaken;
+            ex_predtarget <= id_resolve ? id_brtarget : id_predtarget;
+            ex_ghr <= id_ghr;
+            ex_rasptr <= id_rasptr;
+            ex_earlymiss <= id_mispredict;
+            ex_MulDiv <= MulDiv && !Exc;
+            ex_MulDivOp <= id_funct3;
+            ex_Compressed <= {1'b0, id_Compressed} + {1'b0, id_Fused && id1_Compressed};
+            ex_Fused <= id_Fused;
         end
     end
 
@@ -386,23 +1219,23 @@ module CPU(input    logic   clk_i,
     // Target Address
     assign ex_pctarget = ex_Jump[1] ? ex_SrcA + ex_imm : ex_pc + ex_imm;
 
+    // Misprediction repair
+    // non-control instructions are never taken, so a stale prediction for one is repaired too
+    logic        ex_mispredict /*verilator public*/;
+    logic        ex_call, ex_return;
+    logic [63:0] ex_redirect;
+    assign ex_mispredict = !mem_stall && !mem_redirect &&
+                           (ex_predtaken != ex_pcsrc || (ex_pcsrc && ex_predtarget != ex_pctarget));
+    assign ex_redirect = ex_pcsrc ? ex_pctarget : ex_pcplus;
+    assign ex_call = ex_Jump[0] && (ex_rd == 1 || ex_rd == 5);
+    assign ex_return = ex_Jump == 2'b11 && (ex_rs1 == 1 || ex_rs1 == 5) && !ex_call;
+
     // AluSrc MUX
     logic [63:0] ex_SrcA, ex_SrcB, ex_rs2vf;
     always_comb begin
         // ex_SrcA
-        unique case (ex_forwardA)
-            2'b00: ex_SrcA = ex_rs1v;       // no forward
-            2'b10: ex_SrcA = mem_result;    // forward from mem stage
-            2'b11: ex_SrcA = wb_data;       // forward from wb stage
-            default: ex_SrcA = 0; 
-        endcase
-
-        unique case (ex_forwardB)
-            2'b00: ex_rs2vf = ex_rs2v;       // no forward
-            2'b10: ex_rs2vf = mem_result;    // forward from mem stage
-            2'b11: ex_rs2vf = wb_data;       // forward from wb stage
-            default: ex_rs2vf = 0; 
-        endcase
+        ex_SrcA = forward(ex_rs1, ex_rs1v);
+        ex_rs2vf = forward(ex_rs2, ex_rs2v);
 
         // ex_SrcB
         if (ex_AluSrcB) begin
@@ -421,63 +1254,532 @@ module CPU(input    logic   clk_i,
         .SrcB_i(ex_SrcB),
         .AluControl_i(ex_AluControl),
         .Word_i(ex_Word),
+        .Uw_i(ex_Uw),
         .BranchControl_i(ex_Branch),
         .branch_o(ex_alu_branch),
         .result_o(ex_alu_rs1_result)
     );
 
+    // CSR
+    // an instruction in EX is only squashed by a trap or xRET in MEM, so CSR writes take
+    // effect here, once the pipeline is not frozen and MEM does not redirect; the event
+    // inputs likewise count every instruction once
+    logic [63:0] ex_csr_src, ex_csr_rdata;
+    logic        ex_csr_write;
+    logic [1:0]  priv, dpriv;
+    logic [63:0] satp, trap_pc, mepc, sepc;
+    logic        sum, mxr, irq, mtip, msip;
+    logic [3:0]  irq_code /*verilator public*/; // for the harness to replay interrupts
+    assign ex_csr_src = ex_CsrOp[2] ? {59'b0, ex_rs1} : ex_SrcA; // uimm or rs1
+    assign ex_csr_write = ex_CsrOp[1:0] == 2'b01 || ex_rs1 != 0; // csrrs/c with x0/0 only read
+    csrfile #(.HARTID(HARTID)) csr(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .addr_i(ex_imm[11:0]),
+        .op_i(ex_CsrOp[1:0]),
+        .src_i(ex_csr_src),
+        .we_i(ex_CsrOp != 0 && ex_csr_write && !mem_stall && !mem_redirect),
+        .rd_o(ex_csr_rdata),
+        .trap_i(mem_trap),
+        .trap_irq_i(mem_irq),
+        .trap_cause_i(mem_cause),
+        .trap_epc_i(mem_pc),
+        .trap_tval_i(mem_trapval),
+        .trap_pc_o(trap_pc),
+        .mret_i(mem_xret && mem_Sys == SYS_MRET),
+        .sret_i(mem_xret && mem_Sys == SYS_SRET),
+        .mepc_o(mepc),
+        .sepc_o(sepc),
+        .mtip_i(mtip),
+        .msip_i(msip),
+        .irq_o(irq),
+        .irq_code_o(irq_code),
+        .priv_o(priv),
+        .dpriv_o(dpriv),
+        .satp_o(satp),
+        .sum_o(sum),
+        .mxr_o(mxr),
+        .retire_i({1'b0, wb_retire} + {1'b0, wb1_retire} + {1'b0, wb_retire && wb_Fused}),
+        .dual_i(wb1_retire),
+        .rvc_i(wb_retire ? wb_Compressed : 2'd0),
+        .fused_i(wb_retire && wb_Fused),
+        .loadstall_i(ex_loadStall && !ex_stallEX),
+        .branchstall_i(ex_branchStall && !ex_loadStall && !ex_stallEX),
+        .squash_i(mem_redirect ? 2'd3 : ex_mispredict ? 2'd2 : id_mispredict ? 2'd1 : 2'd0),
+        .taken_i(ex_Branch[0] && ex_alu_branch && !mem_stall),
+        .load_i(mem_valid && mem_WriteBackSrc && !mem_stall && !mem_fault),
+        .store_i(mem_valid && mem_MemWrite && !mem_stall && !mem_fault && !mem_scfail),
+        .bphit_i((ex_Branch[0] || ex_Jump[0]) && !ex_mispredict && !ex_earlymiss && !mem_stall),
+        .bpmiss_i(ex_mispredict || (ex_earlymiss && !mem_stall)),
+        .mdstall_i(ex_mdBusy && !mem_stall),
+        .ichit_i(if_hit && !if_fault && !ex_stallIF),
+        .icmiss_i(if_miss),
+        .icstall_i(!if_hit && !if_tlbwait && !ex_stallIF),
+        .dchit_i(mem_dcreq && dc_hit && !mem_uncached),
+        .dcmiss_i(dc_miss),
+        .dcwriteback_i(dc_writeback),
+        .dcstall_i(mem_stall && !mem_ptwwait),
+        .itlbhit_i(if_translate && if_tlbhit && if_advance && !mem_redirect),
+        .itlbmiss_i(ptw_start_i),
+        .dtlbhit_i(mem_translate && mem_dcreq && !mem_stall),
+        .dtlbmiss_i(ptw_start_d),
+        .walk_i(ptw_busy),
+        .bus_i(bus_req_o && bus_gnt_i),
+        .inval_i(snoop_inval_o),
+        .scfail_i(mem_valid && mem_scfail && !mem_stall && !mem_fault)
+    );
+
+    // the CLINT of the harness raises the machine timer and software interrupts
+    import "DPI-C" function byte clint_irq(input int hart);  // bit 1: MTIP, bit 0: MSIP
+    logic [7:0] clint_lines;
+    always_ff @(posedge clk_i) clint_lines <= rst_i ? 8'b0 : clint_irq(HARTID);
+    assign mtip = clint_lines[1];
+    assign msip = clint_lines[0];
+
+    // MULTIPLY/DIVIDE
+    // operands are captured in the first cycle, while forwarding still sees their producers
+    logic        ex_mdBusy /*verilator public*/;
+    logic [63:0] ex_md_result;
+    muldiv #(.MUL_STAGES(MUL_STAGES)) md(
+        .clk_i(clk_i),
+        .rst_i(rst_i || mem_redirect),
+        .req_i(ex_MulDiv),
+        .hold_i(mem_stall),
+        .op_i(ex_MulDivOp),
+        .word_i(ex_Word),
+        .a_i(ex_SrcA),
+        .b_i(ex_SrcB),
+        .busy_o(ex_mdBusy),
+        .result_o(ex_md_result)
+    );
+
     // ALU result mux
     logic [63:0] ex_result;
     always_comb begin
         unique case (ex_AluResultSrc)
-            2'b00: ex_result = ex_alu_rs1_result;
+            2'b00: ex_result = ex_MulDiv ? ex_md_result : ex_alu_rs1_result;
             2'b01: ex_result = ex_pctarget; // auipc
-            2'b11: ex_result = ex_pcplus4; // jal, jalr
+            2'b10: ex_result = ex_csr_rdata; // csrr*
+            2'b11: ex_result = ex_pcplus; // jal, jalr
             default: ex_result = 0;
         endcase
     end
 
+    // SECOND PIPE
+    // moves in step with the first: stalled, flushed and turned into a bubble with it
+    logic [63:0] ex1_pc;
+    logic [63:0] ex1_rs1v, ex1_rs2v, ex1_imm;
+    logic [4:0]  ex1_rd, ex1_rs1, ex1_rs2;
+    logic [4:0]  ex1_AluControl;
+    logic        ex1_RegWrite, ex1_AluSrcB, ex1_Word, ex1_Auipc;
+    always_ff @(posedge clk_i) begin
+        if (rst_i || mem_redirect || (ex_flushEX && !ex_stallEX)) begin
+            ex1_pc <= 0;
+            ex1_rs1v <= 0;
+            ex1_rs2v <= 0;
+            ex1_imm <= 0;
+            ex1_rd <= 0;
+            ex1_rs1 <= 0;
+            ex1_rs2 <= 0;
+            ex1_AluControl <= 0;
+            ex1_RegWrite <= 0;
+            ex1_AluSrcB <= 0;
+            ex1_Word <= 0;
+            ex1_Auipc <= 0;
+        end
+        else if (!ex_stallEX) begin
+            ex1_pc <= id_pcplus;
+            ex1_rs1v <= id1_rs1v;
+            ex1_rs2v <= id1_rs2v;
+            ex1_imm <= id1_immext;
+            ex1_rd <= id1_rd;
+            ex1_rs1 <= id1_rs1;
+            ex1_rs2 <= id1_rs2;
+            ex1_AluControl <= id1_AluControl;
+            ex1_RegWrite <= id1_valid && !Exc; // every op it takes writes rd
+            ex1_AluSrcB <= id1_AluSrcB;
+            ex1_Word <= id1_Word;
+            ex1_Auipc <= id1_Auipc;
+        end
+        else if (!mem_stall) begin
+            // waiting for a multiply or divide in the first pipe, while the producers of
+            // the operands drain from MEM and WB: keep what they forward
+            ex1_rs1v <= forward(ex1_rs1, ex1_rs1v);
+            ex1_rs2v <= forward(ex1_rs2, ex1_rs2v);
+        end
+    end
+
+    logic [63:0] ex1_SrcA, ex1_SrcB, ex1_result;
+    assign ex1_SrcA = ex1_Auipc ? ex1_pc : forward(ex1_rs1, ex1_rs1v);
+    assign ex1_SrcB = ex1_AluSrcB ? ex1_imm : forward(ex1_rs2, ex1_rs2v);
+    alu alu1(
+        .SrcA_i(ex1_SrcA),
+        .SrcB_i(ex1_SrcB),
+        .AluControl_i(ex1_AluControl),
+        .Word_i(ex1_Word),
+        .Uw_i(1'b0),
+        .BranchControl_i(4'b0000),
+        .branch_o(),
+        .result_o(ex1_result)
+    );
+
     ////////////////////
     // MEM
     ////////////////////
 
     // MEM STATE 
     logic [4:0]  mem_rd;
-    logic        mem_RegWrite, mem_WriteBackSrc, mem_MemWrite;
-    logic [63:0] mem_result, mem_rs2v;
+    logic [63:0] mem_pc /*verilator public*/;
+    logic        mem_valid /*verilator public*/;
+    logic        mem_RegWrite, mem_WriteBackSrc, mem_Fused;
+    logic [1:0]  mem_Compressed;
+    // the address and store data are public for the commit log of the harness
+    logic        mem_MemWrite /*verilator public*/;
+    logic [63:0] mem_result /*verilator public*/;
+    logic [63:0] mem_rs2v /*verilator public*/;
     logic [2:0]  mem_LoadStoreControl;
+    logic        mem_Atomic;
+    logic [4:0]  mem_AmoOp;
+    logic        mem_Exc, mem_Csr;
+    logic [3:0]  mem_Cause;
+    logic [63:0] mem_tval, mem_pcplus, mem_ppc;
+    logic [2:0]  mem_Sys;
+    logic [1:0]  mem_SfenceSel; // sfence.vma rs1 != x0, rs2 != x0
+    logic [HBITS-1:0] mem_ghr;
+    logic [RBITS-1:0] mem_rasptr;
     always_ff @(posedge clk_i) begin
-        if (rst_i) begin
+        if (rst_i || mem_redirect || (ex_mdBusy && !mem_stall)) begin // bubble while EX waits for muldiv
             mem_rd <= 0;
+            mem_pc <= 0;
             mem_RegWrite <= 0;
             mem_result <= 0;
             mem_WriteBackSrc <= 0;
             mem_MemWrite <= 0;
             mem_rs2v <= 0;
             mem_LoadStoreControl <= 0;
+            mem_Atomic <= 0;
+            mem_AmoOp <= 0;
+            mem_Exc <= 0;
+            mem_Cause <= 0;
+            mem_tval <= 0;
+            mem_pcplus <= 0;
+            mem_ppc <= 0;
+            mem_Sys <= 0;
+            mem_Csr <= 0;
+            mem_SfenceSel <= 0;
+            mem_Compressed <= 0;
+            mem_Fused <= 0;
+            mem_ghr <= 0;
+            mem_rasptr <= 0;
+            mem_valid <= 0;
         end
-        else begin
+        else if (!mem_stall) begin
             mem_rd <= ex_rd;
+            mem_pc <= ex_pc;
             mem_RegWrite <= ex_RegWrite;
             mem_result <= ex_result;
             mem_WriteBackSrc <= ex_WriteBackSrc;
             mem_MemWrite <= ex_MemWrite;
             mem_rs2v <= ex_rs2vf;
             mem_LoadStoreControl <= ex_LoadStoreControl;
+            mem_Atomic <= ex_Atomic;
+            mem_AmoOp <= ex_AmoOp;
+            mem_Exc <= ex_Exc;
+            mem_Cause <= ex_Cause;
+            mem_tval <= ex_tval;
+            mem_pcplus <= ex_pcplus;
+            mem_ppc <= ex_ppc;
+            mem_Sys <= ex_Sys;
+            mem_Csr <= ex_CsrOp != 0;
+            mem_SfenceSel <= {ex_rs2 != 0, ex_rs1 != 0};
+            mem_Compressed <= ex_Compressed;
+            mem_Fused <= ex_Fused;
+            mem_ghr <= ex_ghr;
+            mem_rasptr <= ex_rasptr;
+            mem_valid <= ex_valid;
         end
     end
 
+    // the second pipe only carries its result through MEM
+    logic [4:0]  mem1_rd;
+    logic [63:0] mem1_pc, mem1_result;
+    logic        mem1_RegWrite;
+    always_ff @(posedge clk_i) begin
+        if (rst_i || mem_redirect || (ex_mdBusy && !mem_stall)) begin
+            mem1_rd <= 0;
+            mem1_pc <= 0;
+            mem1_result <= 0;
+            mem1_RegWrite <= 0;
+        end
+        else if (!mem_stall) begin
+            mem1_rd <= ex1_rd;
+            mem1_pc <= ex1_pc;
+            mem1_result <= ex1_result;
+            mem1_RegWrite <= ex1_RegWrite;
+        end
+    end
+
+    // DATA TRANSLATION
+    // Loads and stores translate their address in MEM through the D-TLB, with the
+    // privilege after MPRV. A miss holds MEM, like a dcache miss, while the walker
+    // refills the D-TLB through the dcache; a page fault turns the access into a trap.
+    logic        mem_translate, mem_tlbhit, mem_tlbok, mem_pagefault, mem_fault;
+    logic        mem_ptwwait /*verilator public*/;
+    logic [63:0] mem_tpaddr, mem_paddr;
+    logic [7:0]  mem_pte;
+    assign mem_translate = satp[63:60] == 4'h8 && dpriv != 2'b11;
+    tlb #(.ENTRIES(DTLB_ENTRIES)) dtlb(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .va_i(mem_result),
+        .asid_i(satp[59:44]),
+        .hit_o(mem_tlbhit),
+        .pa_o(mem_tpaddr),
+        .flags_o(mem_pte),
+        .fill_i(ptw_fill && ptw_data),
+        .fill_vpn_i(ptw_va[38:12]),
+        .fill_asid_i(ptw_asid),
+        .fill_level_i(ptw_level),
+        .fill_pte_i(ptw_pte),
+        .flush_i(tlb_flush),
+        .flush_va_i(mem_SfenceSel[0]),
+        .flush_asid_i(mem_SfenceSel[1]),
+        .flush_addr_i(mem_result),
+        .flush_id_i(mem_rs2v[15:0])
+    );
+    assign mem_tlbok = !mem_translate ||
+                       (mem_tlbhit && pte_allows(mem_pte, mem_MemWrite ? 2'd2 : 2'd1, dpriv, sum, mxr) &&
+                        (!mem_MemWrite || mem_pte[7]));
+    assign mem_pagefault = mem_translate && mem_access &&
+                       (mem_result[63:38] != {26{mem_result[38]}} ||
+                        (mem_tlbhit && !pte_allows(mem_pte, mem_MemWrite ? 2'd2 : 2'd1, dpriv, sum, mxr)) ||
+                        (!mem_tlbok && pf_valid && pf_data && pf_vpn == mem_result[38:12]));
+    assign mem_paddr = mem_translate ? mem_tpaddr : mem_result;
+    // atomics only work on cacheable memory
+    assign mem_fault = mem_pagefault || (mem_Atomic && mem_access && mem_tlbok && mem_uncached);
+
     // DATA CACHE LOGIC
+    // a miss freezes every stage, WB included, so that forwarding still sees the
+    // producers of the instructions held in EX once the line arrives. The walker
+    // shares the port, and fence.i waits in MEM for the dcache to write back its
+    // dirty lines.
     logic [63:0] load_data;
-    dcache dc(
-        .clk(clk_i), 
-        .address(mem_result),
-        .wd(store_data),
-        .wm(store_mask),
-        .we(mem_MemWrite),
-        .rd(load_data)
+    logic        mem_stall /*verilator public*/;
+    logic        mem_access /*verilator public*/;
+    logic        mem_uncached, mem_dcreq, mem_usesdc, mem_fencei, dc_hit, dc_miss, dc_writeback;
+    assign mem_access = mem_WriteBackSrc || mem_MemWrite;
+    assign mem_fencei = mem_valid && mem_Sys == SYS_FENCEI;
+    assign mem_usesdc = mem_access || mem_fencei;
+    assign mem_dcreq = mem_access && mem_tlbok && !mem_fault && !mem_scfail && !ptw_busy;
+    assign mem_uncached = mem_paddr < RAM_BASE ||
+                          mem_paddr[63:3] == tohost_i[63:3] || mem_paddr[63:3] == fromhost_i[63:3];
+    assign mem_ptwwait = mem_access && !mem_fault && (!mem_tlbok || ptw_busy);
+    assign mem_stall = mem_ptwwait || (mem_access && !mem_fault && !mem_scfail && !dc_hit) ||
+                       (mem_fencei && (ptw_busy || !dc_hit));
+    cache #(.SIZE(DCACHE_SIZE), .WAYS(DCACHE_WAYS), .LINE(LINE_SIZE), .PORT(1), .COHERENT(COHERENT)) dc(
+        .clk_i(clk_i),
+        .rst_i(rst_i),
+        .req_i(ptw_busy ? ptw_dcreq : mem_dcreq),
+        .uncached_i(ptw_busy ? 1'b0 : mem_uncached),
+        .address_i(ptw_busy ? ptw_addr : mem_paddr),
+        .wd_i(ptw_busy ? ptw_wd : store_data),
+        .wm_i(ptw_busy ? 8'hff : store_mask),
+        .we_i(ptw_busy ? ptw_we : mem_MemWrite),
+        .clean_i(mem_fencei && !ptw_busy),
+        .inval_i(1'b0),
+        .hit_o(dc_hit),
+        .rd_o(load_data),
+        .miss_o(dc_miss),
+        .writeback_o(dc_writeback),
+        .bus_req_o(bus_req_o),
+        .bus_op_o(bus_op_o),
+        .bus_addr_o(bus_addr_o),
+        .bus_gnt_i(bus_gnt_i),
+        .bus_flush_i(bus_flush_i),
+        .snoop_i(snoop_i),
+        .snoop_op_i(snoop_op_i),
+        .snoop_addr_i(snoop_addr_i),
+        .snoop_flush_o(snoop_flush_o),
+        .snoop_inval_o(snoop_inval_o)
     );
 
+    // ATOMICS
+    // An AMO is a load and a store in the same dcache access: the old value goes to rd
+    // and the store writes the AMO ALU's result computed from it, with the line held
+    // exclusively. lr leaves a reservation on its physical address that sc needs; a trap,
+    // any sc and a write of another hart to the line (seen as a snoop) take it away.
+    // A failed sc does not access the dcache and writes 1 to rd. aq/rl need nothing in
+    // order with blocking caches.
+    logic        mem_lr, mem_sc, resv_valid;
+    logic        mem_scfail /*verilator public*/;
+    logic [63:0] mem_wdata /*verilator public*/; // what a store writes, for the commit log
+    logic [63:0] resv_addr, amo_b, amo_result;
+    logic        amo_lt, amo_ltu;
+    assign mem_lr = mem_Atomic && !mem_MemWrite;
+    assign mem_sc = mem_Atomic && mem_AmoOp == 5'b00011;
+    assign mem_scfail = mem_sc && !(resv_valid && resv_addr == mem_paddr);
+    always_ff @(posedge clk_i) begin
+        if (rst_i || mem_takes) resv_valid <= 0;
+        else begin
+            if (snoop_i && snoop_op_i != 2'd0 && snoop_addr_i / LINE_SIZE == resv_addr / LINE_SIZE)
+                resv_valid <= 0;
+            if (mem_valid && mem_lr && !mem_stall) begin
+                resv_valid <= 1;
+                resv_addr <= mem_paddr;
+            end
+            if (mem_valid && mem_sc && !mem_stall) resv_valid <= 0;
+        end
+    end
+
+    // the old value of a .w is sign-extended, which keeps the unsigned order too
+    assign amo_b = mem_LoadStoreControl[1:0] == 2'b01 ? {{32{mem_rs2v[31]}}, mem_rs2v[31:0]} : mem_rs2v;
+    assign amo_lt = $signed(mem_load_data) < $signed(amo_b);
+    assign amo_ltu = mem_load_data < amo_b;
+    always_comb begin
+        unique case (mem_AmoOp)
+            5'b00001: amo_result = amo_b;                               // amoswap
+            5'b00000: amo_result = mem_load_data + amo_b;               // amoadd
+            5'b00100: amo_result = mem_load_data ^ amo_b;               // amoxor
+            5'b01100: amo_result = mem_load_data & amo_b;               // amoand
+            5'b01000: amo_result = mem_load_data | amo_b;               // amoor
+            5'b10000: amo_result = amo_lt ? mem_load_data : amo_b;      // amomin
+            5'b10100: amo_result = amo_lt ? amo_b : mem_load_data;      // amomax
+            5'b11000: amo_result = amo_ltu ? mem_load_data : amo_b;     // amominu
+            5'b11100: amo_result = amo_ltu ? amo_b : mem_load_data;     // amomaxu
+            default:  amo_result = mem_rs2v;                            // sc
+        endcase
+    end
+    assign mem_wdata = mem_Atomic ? amo_result : mem_rs2v;
+
+    // TRAPS
+    // an exception raised earlier, a page fault of the access here, or an interrupt
+    // taken in front of an instruction that has no side effects yet (no access, CSR or
+    // Sys) is taken once MEM is not stalled; the instruction does not retire and
+    // everything younger is squashed. Sys instructions redirect fetch to the next
+    // instruction (or xEPC) when they complete. An ecall without a handler (mtvec 0)
+    // ends the simulation, as it did before traps existed.
+    logic        mem_irq /*verilator public*/;
+    logic        mem_trap /*verilator public*/;
+    logic        mem_takes, mem_halt, mem_xret, mem_refetch, mem_redirect;
+    logic [3:0]  mem_cause;
+    logic [63:0] mem_trapval, mem_target;
+    assign mem_irq = irq && mem_valid && !mem_access && mem_Sys == 0 && !mem_Csr;
+    assign mem_cause = mem_irq ? irq_code : mem_Exc ? mem_Cause :
+                       mem_pagefault ? (mem_MemWrite ? 4'd15 : 4'd13) : (mem_MemWrite ? 4'd7 : 4'd5);
+    assign mem_trapval = mem_irq ? 64'b0 : mem_Exc ? mem_tval : mem_result;
+    assign mem_takes = mem_valid && !mem_stall && (mem_irq || mem_Exc || mem_fault);
+    assign mem_halt = mem_takes && !mem_irq && mem_Exc &&
+                      (mem_Cause == 4'd8 || mem_Cause == 4'd9 || mem_Cause == 4'd11) && trap_pc == 0;
+    assign mem_trap = mem_takes && !mem_halt;
+    assign mem_xret = mem_valid && !mem_stall && !mem_takes &&
+                      (mem_Sys == SYS_MRET || mem_Sys == SYS_SRET);
+    assign mem_refetch = mem_valid && !mem_stall && !mem_takes &&
+                         (mem_Sys == SYS_SFENCE || mem_Sys == SYS_FENCEI || mem_Sys == SYS_REFETCH);
+    assign mem_redirect = mem_trap || mem_xret || mem_refetch;
+    assign mem_target = mem_trap ? trap_pc : mem_xret ? (mem_Sys == SYS_MRET ? mepc : sepc) : mem_pcplus;
+    assign tlb_flush = mem_refetch && mem_Sys == SYS_SFENCE;
+    assign ic_inval = mem_refetch && mem_Sys == SYS_FENCEI;
+
+    // PAGE TABLE WALKER
+    // Refills the TLBs from the Sv39 tables in memory, reading one PTE per level through
+    // the dcache. MEM goes first: a fetch walk only starts while MEM leaves the dcache
+    // alone. A leaf without A, or without D for a store, is written back with them set,
+    // so the TLBs only ever hold accessed (and, for writes, dirty) pages. A fault is kept
+    // in pf_* for the requester to pick up until the next walk or redirect. A walk that a
+    // redirect overtakes (an sfence.vma, a satp write, a trap) fills nothing.
+    localparam W_IDLE = 2'd0, W_READ = 2'd1, W_UPDATE = 2'd2, W_DONE = 2'd3;
+    logic [1:0]  ptw_state;
+    logic        ptw_busy, ptw_start_i, ptw_start_d, ptw_fill, tlb_flush, ic_inval;
+    logic        ptw_data, ptw_store, ptw_fault, ptw_stale, ptw_sum, ptw_mxr;
+    logic [1:0]  ptw_level, ptw_priv;
+    logic [63:0] ptw_va, ptw_table, ptw_pte, ptw_addr, ptw_wd;
+    logic [15:0] ptw_asid;
+    logic        ptw_dcreq, ptw_we;
+    logic        pf_valid, pf_data;
+    logic [26:0] pf_vpn;
+    logic        d_need, i_need, ptw_leaf, ptw_bad;
+    logic [8:0]  ptw_vpn;
+    assign d_need = mem_translate && mem_access && mem_result[63:38] == {26{mem_result[38]}} &&
+                    (!mem_tlbhit || (mem_MemWrite && !mem_pte[7] && !mem_fault)) &&
+                    !(pf_valid && pf_data && pf_vpn == mem_result[38:12]);
+    assign i_need = if_translate && !if_faulted && if_addr[63:38] == {26{if_addr[38]}} && !if_tlbhit &&
+                    !(pf_valid && !pf_data && pf_vpn == if_addr[38:12]);
+    assign ptw_busy = ptw_state != W_IDLE;
+    assign ptw_start_d = !ptw_busy && d_need;
+    assign ptw_start_i = !ptw_busy && !d_need && i_need && !mem_usesdc;
+    assign ptw_vpn = ptw_level == 2 ? ptw_va[38:30] : ptw_level == 1 ? ptw_va[29:21] : ptw_va[20:12];
+    assign ptw_addr = ptw_state == W_UPDATE ? ptw_table : ptw_table + {52'b0, ptw_vpn, 3'b000};
+    assign ptw_dcreq = ptw_state == W_READ || ptw_state == W_UPDATE;
+    assign ptw_we = ptw_state == W_UPDATE;
+    assign ptw_fill = ptw_state == W_DONE && !ptw_fault && !ptw_stale && !mem_redirect;
+    // the PTE read this cycle: a leaf, and whether it faults
+    assign ptw_leaf = load_data[1] || load_data[3];
+    assign ptw_bad = !load_data[0] || (load_data[2] && !load_data[1]) ||
+                     (!ptw_leaf && ptw_level == 0) ||
+                     (ptw_leaf && ptw_level == 2 && load_data[27:10] != 0) ||
+                     (ptw_leaf && ptw_level == 1 && load_data[18:10] != 0) ||
+                     (ptw_leaf && !pte_allows(load_data[7:0], ptw_data ? (ptw_store ? 2'd2 : 2'd1) : 2'd0,
+                                              ptw_priv, ptw_sum, ptw_mxr));
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            ptw_state <= W_IDLE;
+            pf_valid <= 0;
+        end
+        else begin
+            if (mem_redirect) ptw_stale <= 1;
+            unique case (ptw_state)
+                W_IDLE: begin
+                    if (mem_redirect) pf_valid <= 0;
+                    if (ptw_start_d || ptw_start_i) begin
+                        ptw_state <= W_READ;
+                        ptw_data <= ptw_start_d;
+                        ptw_store <= ptw_start_d && mem_MemWrite;
+                        ptw_va <= ptw_start_d ? mem_result : if_addr;
+                        ptw_priv <= ptw_start_d ? dpriv : priv;
+                        ptw_sum <= sum;
+                        ptw_mxr <= mxr;
+                        ptw_asid <= satp[59:44];
+                        ptw_table <= {8'b0, satp[43:0], 12'b0};
+                        ptw_level <= 2;
+                        ptw_fault <= 0;
+                        ptw_stale <= mem_redirect;
+                        pf_valid <= 0;
+                    end
+                end
+                W_READ: if (dc_hit) begin
+                    ptw_pte <= load_data;
+                    if (ptw_bad) begin
+                        ptw_fault <= 1;
+                        ptw_state <= W_DONE;
+                    end
+                    else if (!ptw_leaf) begin
+                        ptw_table <= {8'b0, load_data[53:10], 12'b0};
+                        ptw_level <= ptw_level - 1;
+                    end
+                    else if (!load_data[6] || (ptw_store && !load_data[7])) begin
+                        ptw_table <= ptw_addr;
+                        ptw_wd <= load_data | (ptw_store ? 64'hc0 : 64'h40);
+                        ptw_state <= W_UPDATE;
+                    end
+                    else ptw_state <= W_DONE;
+                end
+                W_UPDATE: if (dc_hit) begin
+                    ptw_pte <= ptw_wd;
+                    ptw_state <= W_DONE;
+                end
+                W_DONE: begin
+                    if (ptw_fault && !ptw_stale && !mem_redirect) begin
+                        pf_valid <= 1;
+                        pf_data <= ptw_data;
+                        pf_vpn <= ptw_va[38:12];
+                    end
+                    ptw_state <= W_IDLE;
+                end
+                default: ptw_state <= W_IDLE;
+            endcase
+        end
+    end
+
     // STORES
     logic [63:0] store_data;
     logic [7:0]  store_mask;
@@ -486,35 +1788,35 @@ module CPU(input    logic   clk_i,
         store_mask = 8'b00000000;
         if (mem_LoadStoreControl[1:0] == 2'b11) begin // byte
             unique case (mem_result[2:0])
-                3'b000: begin store_data = {{56{1'b0}}, mem_rs2v[7:0]};              store_mask = 8'b00000001; end
-                3'b001: begin store_data = {{48{1'b0}}, mem_rs2v[7:0], {8{1'b0}}};   store_mask = 8'b00000010; end
-                3'b010: begin store_data = {{40{1'b0}}, mem_rs2v[7:0], {16{1'b0}}};  store_mask = 8'b00000100; end
-                3'b011: begin store_data = {{32{1'b0}}, mem_rs2v[7:0], {24{1'b0}}};  store_mask = 8'b00001000; end
-                3'b100: begin store_data = {{24{1'b0}}, mem_rs2v[7:0], {32{1'b0}}};  store_mask = 8'b00010000; end
-                3'b101: begin store_data = {{16{1'b0}}, mem_rs2v[7:0], {40{1'b0}}};  store_mask = 8'b00100000; end
-                3'b110: begin store_data = {{8{1'b0}},  mem_rs2v[7:0], {48{1'b0}}};  store_mask = 8'b01000000; end
-                3'b111: begin store_data = {mem_rs2v[7:0], {56{1'b0}}};              store_mask = 8'b10000000; end
+                3'b000: begin store_data = {{56{1'b0}}, mem_wdata[7:0]};              store_mask = 8'b00000001; end
+                3'b001: begin store_data = {{48{1'b0}}, mem_wdata[7:0], {8{1'b0}}};   store_mask = 8'b00000010; end
+                3'b010: begin store_data = {{40{1'b0}}, mem_wdata[7:0], {16{1'b0}}};  store_mask = 8'b00000100; end
+                3'b011: begin store_data = {{32{1'b0}}, mem_wdata[7:0], {24{1'b0}}};  store_mask = 8'b00001000; end
+                3'b100: begin store_data = {{24{1'b0}}, mem_wdata[7:0], {32{1'b0}}};  store_mask = 8'b00010000; end
+                3'b101: begin store_data = {{16{1'b0}}, mem_wdata[7:0], {40{1'b0}}};  store_mask = 8'b00100000; end
+                3'b110: begin store_data = {{8{1'b0}},  mem_wdata[7:0], {48{1'b0}}};  store_mask = 8'b01000000; end
+                3'b111: begin store_data = {mem_wdata[7:0], {56{1'b0}}};              store_mask = 8'b10000000; end
                 default:begin store_data = {64{1'b0}};                               store_mask = 8'b00000000; end
             endcase
         end
         else if (mem_LoadStoreControl[1:0] == 2'b10) begin // halfword
             unique case (mem_result[2:0])
-                3'b000: begin store_data = {{48{1'b0}}, mem_rs2v[15:0]};              store_mask = 8'b00000011; end
-                3'b010: begin store_data = {{32{1'b0}}, mem_rs2v[15:0], {16{1'b0}}};  store_mask = 8'b00001100; end
-                3'b100: begin store_data = {{16{1'b0}}, mem_rs2v[15:0], {32{1'b0}}};  store_mask = 8'b00110000; end
-                3'b110: begin store_data = {mem_rs2v[15:0], {48{1'b0}}};              store_mask = 8'b11000000; end
+                3'b000: begin store_data = {{48{1'b0}}, mem_wdata[15:0]};              store_mask = 8'b00000011; end
+                3'b010: begin store_data = {{32{1'b0}}, mem_wdata[15:0], {16{1'b0}}};  store_mask = 8'b00001100; end
+                3'b100: begin store_data = {{16{1'b0}}, mem_wdata[15:0], {32{1'b0}}};  store_mask = 8'b00110000; end
+                3'b110: begin store_data = {mem_wdata[15:0], {48{1'b0}}};              store_mask = 8'b11000000; end
                 default:begin store_data = {64{1'b0}};                                store_mask = 8'b00000000; end
             endcase
         end
         else if (mem_LoadStoreControl[1:0] == 2'b01) begin // word
             unique case (mem_result[2:0])
-                3'b000: begin store_data = {{32{1'b0}}, mem_rs2v[31:0]};  store_mask = 8'b00001111; end
-                3'b100: begin store_data = {mem_rs2v[31:0], {32{1'b0}}};  store_mask = 8'b11110000; end
+                3'b000: begin store_data = {{32{1'b0}}, mem_wdata[31:0]};  store_mask = 8'b00001111; end
+                3'b100: begin store_data = {mem_wdata[31:0], {32{1'b0}}};  store_mask = 8'b11110000; end
                 default:begin store_data = {64{1'b0}};                    store_mask = 8'b00000000; end
             endcase
         end
         else begin // doubleword
-            store_data = mem_rs2v;
+            store_data = mem_wdata;
             store_mask = 8'b11111111;
         end
     end
@@ -533,7 +1835,8 @@ module CPU(input    logic   clk_i,
                                                                                     load_word[31]);
     
     logic [63:0] mem_load_data;
-    assign mem_load_data = mem_LoadStoreControl[1:0] == 2'b11 ? {{56{load_sign}}, load_byte}        :
+    assign mem_load_data = mem_sc                               ? {63'b0, mem_scfail}               :
+                           mem_LoadStoreControl[1:0] == 2'b11 ? {{56{load_sign}}, load_byte}        :
                            mem_LoadStoreControl[1:0] == 2'b10 ? {{48{load_sign}}, load_halfword}    :
                            mem_LoadStoreControl[1:0] == 2'b01 ? {{32{load_sign}}, load_word}        :
                                                               load_data;
@@ -543,128 +1846,1432 @@ module CPU(input    logic   clk_i,
     ////////////////////
 
     // WB STATE 
-    logic [4:0]  wb_rd;
-    logic        wb_RegWrite, wb_WriteBackSrc;
+    // wb_pc is 0 for bubbles; the harness watches these for trace triggers
+    logic [4:0]  wb_rd /*verilator public*/;
+    logic [63:0] wb_pc /*verilator public*/;
+    logic        wb_RegWrite /*verilator public*/;
+    logic        wb_WriteBackSrc;
+    logic        wb_Halt /*verilator public*/;   // an ecall without a handler
+    logic [63:0] wb_ppc /*verilator public*/;    // physical pc, for the harness to read it
+    logic        wb_valid;
+    logic [1:0]  wb_Compressed;
+    // the harness retires a fused op as its two instructions
+    logic        wb_Fused /*verilator public*/;
     logic [63:0] wb_result, wb_load_data;
     always_ff @(posedge clk_i) begin
         if (rst_i) begin
             wb_rd <= 0;
+            wb_pc <= 0;
             wb_RegWrite <= 0;
             wb_result <= 0;
             wb_load_data <= 0;
             wb_WriteBackSrc <= 0;
+            wb_Halt <= 0;
+            wb_ppc <= 0;
+            wb_Compressed <= 0;
+            wb_Fused <= 0;
+            wb_valid <= 0;
         end
-        else begin
+        else if (!mem_stall) begin
             wb_rd <= mem_rd;
-            wb_RegWrite <= mem_RegWrite;
+            wb_pc <= mem_pc;
+            wb_RegWrite <= mem_RegWrite && !mem_takes;
             wb_result <= mem_result;
             wb_load_data <= mem_load_data;
             wb_WriteBackSrc <= mem_WriteBackSrc;
+            wb_Halt <= mem_halt;
+            wb_ppc <= mem_ppc;
+            wb_Compressed <= mem_Compressed;
+            wb_Fused <= mem_Fused;
+            wb_valid <= mem_valid && !mem_takes;
+        end
+    end
+
+    // the second pipe retires right after the first; it is public like WB above
+    logic [4:0]  wb1_rd /*verilator public*/;
+    logic [63:0] wb1_pc /*verilator public*/;
+    logic [63:0] wb1_result /*verilator public*/;
+    logic        wb1_RegWrite /*verilator public*/;
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            wb1_rd <= 0;
+            wb1_pc <= 0;
+            wb1_result <= 0;
+            wb1_RegWrite <= 0;
+        end
+        else if (!mem_stall) begin
+            wb1_rd <= mem1_rd;
+            wb1_pc <= mem1_pc;
+            wb1_result <= mem1_result;
+            wb1_RegWrite <= mem1_RegWrite && !mem_takes && !mem_redirect; // fetched again after it
         end
     end
 
     // Write Back data mux
-    logic [63:0] wb_data;
+    logic [63:0] wb_data /*verilator public*/;
     assign wb_data = wb_WriteBackSrc ? wb_load_data : wb_result;
 
+    // WB holds its instruction while a dcache miss freezes the pipeline; it retires
+    // in the cycle it moves on. The harness checks retiring instructions against the ISS.
+    logic        wb_retire /*verilator public*/;
+    logic        wb1_retire /*verilator public*/;
+    assign wb_retire = wb_valid && !mem_stall;
+    assign wb1_retire = wb1_RegWrite && !mem_stall;
+
+    // all older instructions have written back by the time a halting ecall reaches WB,
+    // so the harness can read a0 to tell whether the program passed
+    always_comb begin
+        if (wb_Halt) $finish;
+    end
+
 endmodule
 
-module icache(input     logic [31:0] address_i, 
-              output    logic [31:0] rd_o
+// Set-associative write-back, write-allocate cache with LRU replacement in front of
+// the backing memory of the harness (memory.cpp). Lookups hit in the same cycle;
+// a miss writes the dirty victim back, refills the line and then hits. The backing
+// memory decides how many cycles every line transfer takes. Uncached accesses go
+// straight to the devices of the harness: stores in the cycle they arrive, loads
+// one cycle later. For fence.i the data cache writes all dirty lines back (clean_i,
+// done once it hits) and the instruction cache drops all of its lines (inval_i).
+//
+// With COHERENT the lines are Modified (EXCL and DIRTY), Shared or Invalid, MSI over the
+// snoopbus: a miss waits for the bus (BUS) and asks for the line to read (BUS_READ) or to
+// write it (BUS_READX), a store to a shared line asks for ownership (BUS_UPGRADE). The
+// other cache snoops every granted request in that cycle; when it holds the line dirty
+// it writes it to the backing memory (snoop_flush_o), which then supplies the refill,
+// and it drops the line unless the request only reads it (snoop_inval_o). Write-backs
+// of victims do not use the bus.
+module cache #(parameter SIZE = 4096,   // bytes
+               parameter WAYS = 2,
+               parameter LINE = 32,     // bytes
+               parameter PORT = 0,      // backing-memory port, 0: fetch, 1: data
+               parameter COHERENT = 0)
+             (input     logic           clk_i,
+              input     logic           rst_i,
+              input     logic           req_i,
+              input     logic           uncached_i,
+              input     logic [63:0]    address_i,
+              input     logic [63:0]    wd_i,   // data
+              input     logic [7:0]     wm_i,   // bytes accessed
+              input     logic           we_i,   // enable
+              input     logic           clean_i,
+              input     logic           inval_i,
+              output    logic           hit_o,  // rd_o is valid, a store is done at the posedge
+              output    logic [63:0]    rd_o,
+              output    logic           miss_o, // a refill starts
+              output    logic           writeback_o,
+              output    logic           bus_req_o,
+              output    logic [1:0]     bus_op_o,
+              output    logic [63:0]    bus_addr_o,
+              input     logic           bus_gnt_i,
+              input     logic           bus_flush_i,    // the granted request was snooped dirty
+              input     logic           snoop_i,        // the other cache's request, granted
+              input     logic [1:0]     snoop_op_i,
+              input     logic [63:0]    snoop_addr_i,
+              output    logic           snoop_flush_o,
+              output    logic           snoop_inval_o
 );
-    logic [31:0] ICACHE[4096:0];
-    initial begin 
-        $readmemh("./test/mem_instr", ICACHE);
+    import "DPI-C" function longint mem_read(input longint addr);
+    import "DPI-C" function void mem_write(input longint addr, input longint data);
+    import "DPI-C" function int mem_request(input int port, input longint addr, input int bytes,
+                                            input bit write);
+    import "DPI-C" function longint mem_io_load(input longint addr, input byte mask);
+    import "DPI-C" function void mem_io_store(input longint addr, input longint data, input byte mask);
+
+    // writes every dirty line to the backing memory and leaves the cache as it is, so
+    // that the harness can snapshot memory; called from C++ in the scope of an instance
+    export "DPI-C" function cache_writeback;
+
+    localparam WORDS = LINE / 8;
+    localparam SETS = SIZE / (LINE * WAYS);
+    localparam LBITS = $clog2(SETS * LINE);
+    localparam TBITS = 64 - LBITS;
+    localparam ABITS = WAYS > 1 ? $clog2(WAYS) : 1;
+
+    localparam IDLE = 3'd0, WRITEBACK = 3'd1, REFILL = 3'd2, IO = 3'd3, CLEAN = 3'd4, BUS = 3'd5;
+    logic [2:0] state;
+
+    localparam BUS_READ = 2'd0, BUS_READX = 2'd1, BUS_UPGRADE = 2'd2;
+
+    logic [63:0]      DATA[SETS*WAYS*WORDS-1:0];
+    logic [TBITS-1:0] TAG[SETS*WAYS-1:0];
+    logic             VALID[SETS*WAYS-1:0];
+    logic             DIRTY[SETS*WAYS-1:0];
+    logic [ABITS-1:0] AGE[SETS*WAYS-1:0]; // 0: most recently used
+    logic             EXCL[SETS*WAYS-1:0];  // COHERENT: no other cache holds the line
+
+    // LOOKUP
+    logic [63:0]      line;
+    logic [31:0]      set, word;
+    logic [TBITS-1:0] tag;
+    assign line = address_i / LINE;
+    assign set = line % SETS;
+    assign word = address_i[31:3] % WORDS;
+    assign tag = address_i >> LBITS;
+
+    logic             hit;
+    logic [ABITS-1:0] hitway, victim;
+    always_comb begin
+        hit = 0;
+        hitway = 0;
+        for (int w = 0; w < WAYS; w++) begin
+            if (VALID[set*WAYS + w] && TAG[set*WAYS + w] == tag) begin
+                hit = 1;
+                hitway = w;
+            end
+        end
+
+        // least recently used way, an invalid one first
+        victim = 0;
+        for (int w = 0; w < WAYS; w++) if (AGE[set*WAYS + w] == WAYS - 1) victim = w;
+        for (int w = WAYS - 1; w >= 0; w--) if (!VALID[set*WAYS + w]) victim = w;
+    end
+
+    logic writable;
+    assign writable = !COHERENT || EXCL[set*WAYS + hitway];
+
+    // SNOOP
+    logic [63:0]      sline;
+    logic [31:0]      sset, sslot;
+    logic             shit, snooped;
+    assign sline = snoop_addr_i / LINE;
+    assign sset = sline % SETS;
+    always_comb begin
+        shit = 0;
+        sslot = 0;
+        for (int w = 0; w < WAYS; w++) begin
+            if (VALID[sset*WAYS + w] && TAG[sset*WAYS + w] == snoop_addr_i >> LBITS) begin
+                shit = 1;
+                sslot = sset*WAYS + w;
+            end
+        end
+    end
+    // an access to the snooped line waits a cycle, for the snoop to take effect
+    assign snooped = COHERENT && snoop_i && sline == line;
+    assign snoop_flush_o = COHERENT && snoop_i && shit && DIRTY[sslot];
+    assign snoop_inval_o = COHERENT && snoop_i && shit && snoop_op_i != BUS_READ;
+
+    // the first dirty line, for clean_i
+    logic        dirty_any;
+    logic [31:0] dirty_slot;
+    always_comb begin
+        dirty_any = 0;
+        dirty_slot = 0;
+        for (int i = SETS*WAYS - 1; i >= 0; i--) begin
+            if (VALID[i] && DIRTY[i]) begin
+                dirty_any = 1;
+                dirty_slot = i;
+            end
+        end
+    end
+
+    logic [63:0] io_data;
+    assign hit_o = state == IDLE && (clean_i ? !dirty_any
+                                            : uncached_i ? we_i : hit && !snooped && (!we_i || writable))
+                   || state == IO;
+    assign rd_o = state == IO ? io_data : DATA[(set*WAYS + hitway)*WORDS + word];
+    assign miss_o = state == IDLE && req_i && !uncached_i && !hit && !snooped;
+    assign writeback_o = miss_o && VALID[set*WAYS + victim] && DIRTY[set*WAYS + victim];
+
+    // MISS HANDLING
+    logic [31:0] count;     // cycles left in the current line transfer
+    logic [31:0] fill_slot; // set*WAYS + way being refilled
+    logic [63:0] fill_addr, victim_addr;
+    logic [1:0]  fill_op;
+    assign victim_addr = {TAG[set*WAYS + victim], {LBITS{1'b0}}} | set * LINE;
+
+    // the bus stays requested through the refill, see snoopbus; an upgrade is given up
+    // once a snoop took the line away, the store then misses
+    logic upgrade_lost;
+    assign upgrade_lost = fill_op == BUS_UPGRADE && !(VALID[fill_slot] && TAG[fill_slot] == fill_addr >> LBITS);
+    assign bus_req_o = state == BUS && !upgrade_lost || COHERENT && state == REFILL;
+    assign bus_op_o = fill_op;
+    assign bus_addr_o = fill_addr;
+
+    function void cache_writeback();
+        for (int i = 0; i < SETS*WAYS; i++)
+            if (VALID[i] && DIRTY[i])
+                for (int j = 0; j < WORDS; j++)
+                    mem_write({TAG[i], {LBITS{1'b0}}} | (i / WAYS) * LINE + j*8, DATA[i*WORDS + j]);
+    endfunction
+
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            state <= IDLE;
+            for (int i = 0; i < SETS*WAYS; i++) begin
+                VALID[i] <= 0;
+                DIRTY[i] <= 0;
+                EXCL[i] <= 0;
+                AGE[i] <= i % WAYS;
+            end
+        end
+        else begin
+            unique case (state)
+                IDLE: if (clean_i) begin
+                    if (dirty_any) begin
+                        for (int j = 0; j < WORDS; j++)
+                            mem_write({TAG[dirty_slot], {LBITS{1'b0}}} | (dirty_slot / WAYS) * LINE + j*8,
+                                      DATA[dirty_slot*WORDS + j]);
+                        count <= mem_request(PORT, {TAG[dirty_slot], {LBITS{1'b0}}} | (dirty_slot / WAYS) * LINE,
+                                             LINE, 1);
+                        DIRTY[dirty_slot] <= 0;
+                        state <= CLEAN;
+                    end
+                end
+                else if (req_i) begin
+                    if (uncached_i) begin
+                        if (we_i) mem_io_store(address_i, wd_i, wm_i);
+                        else begin
+                            io_data <= mem_io_load(address_i, wm_i);
+                            state <= IO;
+                        end
+                    end
+                    else if (snooped) begin
+                        // retried next cycle
+                    end
+                    else if (hit && (!we_i || writable)) begin
+                        if (we_i) begin
+                            for (int b = 0; b < 8; b++)
+                                if (wm_i[b]) DATA[(set*WAYS + hitway)*WORDS + word][b*8 +: 8] <= wd_i[b*8 +: 8];
+                            DIRTY[set*WAYS + hitway] <= 1;
+                        end
+                        for (int w = 0; w < WAYS; w++)
+                            if (AGE[set*WAYS + w] < AGE[set*WAYS + hitway]) AGE[set*WAYS + w] <= AGE[set*WAYS + w] + 1;
+                        AGE[set*WAYS + hitway] <= 0;
+                    end
+                    else if (hit) begin
+                        // store to a shared line
+                        fill_slot <= set*WAYS + hitway;
+                        fill_addr <= line * LINE;
+                        fill_op <= BUS_UPGRADE;
+                        state <= BUS;
+                    end
+                    else begin
+                        fill_slot <= set*WAYS + victim;
+                        fill_addr <= line * LINE;
+                        fill_op <= we_i ? BUS_READX : BUS_READ;
+                        if (writeback_o) begin
+                            for (int i = 0; i < WORDS; i++)
+                                mem_write(victim_addr + i*8, DATA[(set*WAYS + victim)*WORDS + i]);
+                            count <= mem_request(PORT, victim_addr, LINE, 1);
+                            state <= WRITEBACK;
+                        end
+                        else if (COHERENT) state <= BUS;
+                        else begin
+                            count <= mem_request(PORT, line * LINE, LINE, 0);
+                            state <= REFILL;
+                        end
+                    end
+                end
+                WRITEBACK: begin
+                    if (count > 1) count <= count - 1;
+                    else if (COHERENT) state <= BUS;
+                    else begin
+                        count <= mem_request(PORT, fill_addr, LINE, 0);
+                        state <= REFILL;
+                    end
+                end
+                BUS: begin
+                    if (upgrade_lost) state <= IDLE;
+                    else if (bus_gnt_i && fill_op == BUS_UPGRADE) begin
+                        EXCL[fill_slot] <= 1;
+                        state <= IDLE;
+                    end
+                    else if (bus_gnt_i) begin
+                        if (bus_flush_i) void'(mem_request(PORT, fill_addr, LINE, 1));
+                        count <= mem_request(PORT, fill_addr, LINE, 0);
+                        state <= REFILL;
+                    end
+                end
+                REFILL: begin
+                    if (count > 1) count <= count - 1;
+                    else begin
+                        for (int i = 0; i < WORDS; i++)
+                            DATA[fill_slot*WORDS + i] <= mem_read(fill_addr + i*8);
+                        TAG[fill_slot] <= fill_addr >> LBITS;
+                        VALID[fill_slot] <= 1;
+                        DIRTY[fill_slot] <= 0;
+                        EXCL[fill_slot] <= !COHERENT || fill_op == BUS_READX;
+                        state <= IDLE;
+                    end
+                end
+                CLEAN: begin
+                    if (count > 1) count <= count - 1;
+                    else state <= IDLE;
+                end
+                IO: state <= IDLE; // the load leaves MEM
+                default: state <= IDLE;
+            endcase
+            if (snoop_flush_o) begin
+                for (int j = 0; j < WORDS; j++)
+                    mem_write({TAG[sslot], {LBITS{1'b0}}} | (sslot / WAYS) * LINE + j*8, DATA[sslot*WORDS + j]);
+                DIRTY[sslot] <= 0;
+            end
+            if (snoop_inval_o) VALID[sslot] <= 0;
+            else if (COHERENT && snoop_i && shit) EXCL[sslot] <= 0;
+            if (inval_i)
+                for (int i = 0; i < SETS*WAYS; i++) VALID[i] <= 0;
+        end
+    end
+endmodule
+
+// Snoop bus between the data caches of two harts. It grants one request at a time,
+// round robin when both wait; in the cycle of the grant the other cache snoops it. The
+// bus then stays taken until the owner stops requesting (its refill is done) and one
+// cycle more, in which the owner makes the access it missed on, so that a line is used
+// at least once before the other hart can take it away again.
+module snoopbus(input   logic           clk_i,
+                input   logic           rst_i,
+                input   logic [1:0]     req_i,
+                input   logic [1:0]     op_i[2],
+                input   logic [63:0]    addr_i[2],
+                output  logic [1:0]     gnt_o,
+                output  logic [1:0]     flush_o,        // the other cache supplied the line
+                output  logic [1:0]     snoop_o,
+                output  logic [1:0]     snoop_op_o[2],
+                output  logic [63:0]    snoop_addr_o[2],
+                input   logic [1:0]     snoop_flush_i,
+                input   logic [1:0]     snoop_inval_i
+);
+    localparam BUS_READ = 2'd0, BUS_READX = 2'd1, BUS_UPGRADE = 2'd2;
+
+    logic [63:0] reads          /*verilator public*/;   // BUS_READ granted
+    logic [63:0] readx          /*verilator public*/;   // BUS_READX granted
+    logic [63:0] upgrades       /*verilator public*/;   // BUS_UPGRADE granted
+    logic [63:0] flushes        /*verilator public*/;   // dirty lines written back by a snoop
+    logic [63:0] invalidations  /*verilator public*/;   // lines dropped by a snoop
+
+    logic busy, owner, last, win;
+    assign win = req_i == 2'b11 ? !last : req_i[1];
+    assign gnt_o = !busy && req_i != 0 ? 2'b01 << win : 2'b00;
+
+    // each cache snoops the other one
+    assign snoop_o = {gnt_o[0], gnt_o[1]};
+    assign snoop_op_o[0] = op_i[1];
+    assign snoop_op_o[1] = op_i[0];
+    assign snoop_addr_o[0] = addr_i[1];
+    assign snoop_addr_o[1] = addr_i[0];
+    assign flush_o = {snoop_flush_i[0], snoop_flush_i[1]};
+
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            busy <= 0;
+            owner <= 0;
+            last <= 1;
+            reads <= 0;
+            readx <= 0;
+            upgrades <= 0;
+            flushes <= 0;
+            invalidations <= 0;
+        end
+        else begin
+            if (gnt_o != 0) begin
+                busy <= 1;
+                owner <= win;
+                last <= win;
+                reads <= reads + (op_i[win] == BUS_READ);
+                readx <= readx + (op_i[win] == BUS_READX);
+                upgrades <= upgrades + (op_i[win] == BUS_UPGRADE);
+            end
+            else if (busy && !req_i[owner]) busy <= 0;
+            flushes <= flushes + (snoop_flush_i != 0);
+            invalidations <= invalidations + (snoop_inval_i != 0);
+        end
+    end
+endmodule
+
+// Fully associative Sv39 TLB with round-robin replacement. Entries are tagged with the
+// ASID, unless global, and map 4 KiB pages or 2 MiB / 1 GiB superpages (LEVEL 0, 1, 2).
+// Lookups are combinational; the walker fills it and sfence.vma flushes it, all of it
+// or the entries matching an address and/or an ASID (global entries stay when only an
+// ASID is given).
+module tlb #(parameter ENTRIES = 8)
+           (input   logic           clk_i,
+            input   logic           rst_i,
+            input   logic [63:0]    va_i,
+            input   logic [15:0]    asid_i,
+            output  logic           hit_o,
+            output  logic [63:0]    pa_o,
+            output  logic [7:0]     flags_o,    // of the leaf PTE
+            input   logic           fill_i,
+            input   logic [26:0]    fill_vpn_i,
+            input   logic [15:0]    fill_asid_i,
+            input   logic [1:0]     fill_level_i,
+            input   logic [63:0]    fill_pte_i,
+            input   logic           flush_i,
+            input   logic           flush_va_i,   // only the entry that maps flush_addr_i
+            input   logic           flush_asid_i, // only non-global entries of flush_id_i
+            input   logic [63:0]    flush_addr_i,
+            input   logic [15:0]    flush_id_i
+);
+    localparam IBITS = ENTRIES > 1 ? $clog2(ENTRIES) : 1;
+
+    logic        VALID[ENTRIES-1:0];
+    logic [26:0] VPN[ENTRIES-1:0];
+    logic [15:0] ASID[ENTRIES-1:0];
+    logic [1:0]  LEVEL[ENTRIES-1:0];
+    logic [43:0] PPN[ENTRIES-1:0];
+    logic [7:0]  FLAGS[ENTRIES-1:0];
+    logic [IBITS-1:0] next;  // round-robin victim
+
+    // whether entry e maps the page of vpn: a superpage ignores the low VPN fields
+    function automatic logic covers(input int e, input logic [26:0] vpn);
+        unique case (LEVEL[e])
+            2'd0: return VPN[e] == vpn;
+            2'd1: return VPN[e][26:9] == vpn[26:9];
+            default: return VPN[e][26:18] == vpn[26:18];
+        endcase
+    endfunction
+
+    // LOOKUP
+    logic [IBITS-1:0] hitidx;
+    always_comb begin
+        hit_o = 0;
+        hitidx = 0;
+        for (int e = 0; e < ENTRIES; e++) begin
+            if (VALID[e] && (FLAGS[e][5] || ASID[e] == asid_i) && covers(e, va_i[38:12])) begin
+                hit_o = 1;
+                hitidx = e;
+            end
+        end
+        flags_o = FLAGS[hitidx];
+        unique case (LEVEL[hitidx])
+            2'd0: pa_o = {8'b0, PPN[hitidx], va_i[11:0]};
+            2'd1: pa_o = {8'b0, PPN[hitidx][43:9], va_i[20:0]};
+            default: pa_o = {8'b0, PPN[hitidx][43:18], va_i[29:0]};
+        endcase
+    end
+
+    // FILL AND FLUSH
+    // a refill of a page already present (to set D) replaces its entry
+    logic             present;
+    logic [IBITS-1:0] slot;
+    always_comb begin
+        present = 0;
+        slot = next;
+        for (int e = 0; e < ENTRIES; e++) begin
+            if (VALID[e] && VPN[e] == fill_vpn_i && ASID[e] == fill_asid_i && LEVEL[e] == fill_level_i) begin
+                present = 1;
+                slot = e;
+            end
+        end
+    end
+
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            for (int e = 0; e < ENTRIES; e++) VALID[e] <= 0;
+            next <= 0;
+        end
+        else if (flush_i) begin
+            for (int e = 0; e < ENTRIES; e++) begin
+                if ((!flush_va_i || covers(e, flush_addr_i[38:12])) &&
+                    (!flush_asid_i || (!FLAGS[e][5] && ASID[e] == flush_id_i)))
+                    VALID[e] <= 0;
+            end
+        end
+        else if (fill_i) begin
+            VALID[slot] <= 1;
+            VPN[slot] <= fill_vpn_i;
+            ASID[slot] <= fill_asid_i;
+            LEVEL[slot] <= fill_level_i;
+            PPN[slot] <= fill_pte_i[53:10];
+            FLAGS[slot] <= fill_pte_i[7:0];
+            if (!present) next <= next == IBITS'(ENTRIES - 1) ? 0 : next + 1;
+        end
+    end
+endmodule
+
+// Zicsr registers and the privilege mode (M, S and U). mcycle/minstret and the event
+// counters in mhpmcounter3..31 are writable from M-mode and readable through their
+// user-mode shadows. The machine and supervisor trap CSRs, satp and the read-only
+// machine information registers are implemented as far as Sv39 and a kernel need them;
+// any other CSR reads as zero and ignores writes. ID checks the privilege of an access,
+// this file only performs it. The harness reads the counters directly and saves and
+// restores the privileged state.
+module csrfile #(parameter HARTID = 0)
+              (input    logic           clk_i,
+               input    logic           rst_i,
+               input    logic [11:0]    addr_i,
+               input    logic [1:0]     op_i,    // 01: write, 10: set, 11: clear
+               input    logic [63:0]    src_i,
+               input    logic           we_i,
+               output   logic [63:0]    rd_o,
+               // traps and xRET, from MEM
+               input    logic           trap_i,
+               input    logic           trap_irq_i,   // an interrupt rather than an exception
+               input    logic [3:0]     trap_cause_i,
+               input    logic [63:0]    trap_epc_i,
+               input    logic [63:0]    trap_tval_i,
+               output   logic [63:0]    trap_pc_o,    // handler of the trap on the inputs
+               input    logic           mret_i,
+               input    logic           sret_i,
+               output   logic [63:0]    mepc_o,
+               output   logic [63:0]    sepc_o,
+               // interrupts; the CLINT sets the machine timer and software bits
+               input    logic           mtip_i,
+               input    logic           msip_i,
+               output   logic           irq_o,        // an enabled interrupt is pending
+               output   logic [3:0]     irq_code_o,
+               // translation
+               output   logic [1:0]     priv_o,
+               output   logic [1:0]     dpriv_o,      // of loads and stores, after MPRV
+               output   logic [63:0]    satp_o,
+               output   logic           sum_o,
+               output   logic           mxr_o,
+               // events counted every cycle
+               input    logic [1:0]     retire_i, // instructions retiring
+               input    logic           loadstall_i,
+               input    logic           branchstall_i,
+               input    logic [1:0]     squash_i, // slots squashed by a redirect this cycle
+               input    logic           taken_i,
+               input    logic           load_i,
+               input    logic           store_i,
+               input    logic           bphit_i,
+               input    logic           bpmiss_i,
+               input    logic           mdstall_i,
+               input    logic           ichit_i,
+               input    logic           icmiss_i,
+               input    logic           icstall_i,
+               input    logic           dchit_i,
+               input    logic           dcmiss_i,
+               input    logic           dcwriteback_i,
+               input    logic           dcstall_i,
+               input    logic           dual_i,   // the second pipe retires
+               input    logic [1:0]     rvc_i,    // compressed instructions retiring
+               input    logic           fused_i,  // a fused op retires
+               input    logic           itlbhit_i,
+               input    logic           itlbmiss_i,
+               input    logic           dtlbhit_i,
+               input    logic           dtlbmiss_i,
+               input    logic           walk_i,   // the page table walker is busy
+               input    logic           bus_i,    // the dcache is granted the snoop bus
+               input    logic           inval_i,  // a snoop invalidates a dcache line
+               input    logic           scfail_i
+);
+    logic [63:0] mcycle         /*verilator public*/;   // b00
+    logic [63:0] minstret       /*verilator public*/;   // b02
+    logic [63:0] hpm_loadstall  /*verilator public*/;   // b03: load-use stall cycles
+    logic [63:0] hpm_squash     /*verilator public*/;   // b04: slots squashed by mispredictions
+    logic [63:0] hpm_taken      /*verilator public*/;   // b05: taken conditional branches
+    logic [63:0] hpm_load       /*verilator public*/;   // b06: loads
+    logic [63:0] hpm_store      /*verilator public*/;   // b07: stores
+    logic [63:0] hpm_bubble     /*verilator public*/;   // b08: cycles without a retiring instruction
+    logic [63:0] hpm_bphit      /*verilator public*/;   // b09: correctly predicted branches and jumps
+    logic [63:0] hpm_bpmiss     /*verilator public*/;   // b0a: mispredicted instructions
+    logic [63:0] hpm_brstall    /*verilator public*/;   // b0b: early-branch operand stall cycles
+    logic [63:0] hpm_mdstall    /*verilator public*/;   // b0c: cycles EX waited for muldiv
+    logic [63:0] hpm_ichit      /*verilator public*/;   // b0d: fetches that hit in the icache
+    logic [63:0] hpm_icmiss     /*verilator public*/;   // b0e: icache refills
+    logic [63:0] hpm_icstall    /*verilator public*/;   // b0f: bubbles fetched because of icache misses and split fetches
+    logic [63:0] hpm_dchit      /*verilator public*/;   // b10: loads and stores that hit in the dcache
+    logic [63:0] hpm_dcmiss     /*verilator public*/;   // b11: dcache refills
+    logic [63:0] hpm_dcwb       /*verilator public*/;   // b12: dirty lines written back
+    logic [63:0] hpm_dcstall    /*verilator public*/;   // b13: cycles frozen by dcache misses
+    logic [63:0] hpm_dual       /*verilator public*/;   // b14: cycles retiring a dual-issued pair
+    logic [63:0] hpm_rvc        /*verilator public*/;   // b15: compressed instructions retired
+    logic [63:0] hpm_fused      /*verilator public*/;   // b16: fused ops retired (two instructions each)
+    logic [63:0] hpm_itlbhit    /*verilator public*/;   // b17: translated fetches that hit in the I-TLB
+    logic [63:0] hpm_itlbmiss   /*verilator public*/;   // b18: page table walks for fetches
+    logic [63:0] hpm_dtlbhit    /*verilator public*/;   // b19: translated loads and stores that hit in the D-TLB
+    logic [63:0] hpm_dtlbmiss   /*verilator public*/;   // b1a: page table walks for loads and stores
+    logic [63:0] hpm_walk       /*verilator public*/;   // b1b: cycles the page table walker was busy
+    logic [63:0] hpm_trap       /*verilator public*/;   // b1c: exceptions and interrupts taken
+    logic [63:0] hpm_bus        /*verilator public*/;   // b1d: coherence transactions of the dcache
+    logic [63:0] hpm_inval      /*verilator public*/;   // b1e: dcache lines invalidated by the other hart
+    logic [63:0] hpm_scfail     /*verilator public*/;   // b1f: failed store-conditionals
+
+    // privileged state; mip holds the bits software may write, MTIP and MSIP come
+    // from the CLINT
+    logic [1:0]  priv       /*verilator public*/;
+    logic [63:0] mstatus    /*verilator public*/;   // 300, without the fixed UXL/SXL
+    logic [63:0] medeleg    /*verilator public*/;   // 302
+    logic [63:0] mideleg    /*verilator public*/;   // 303
+    logic [63:0] mie        /*verilator public*/;   // 304
+    logic [63:0] mtvec      /*verilator public*/;   // 305
+    logic [63:0] mscratch   /*verilator public*/;   // 340
+    logic [63:0] mepc       /*verilator public*/;   // 341
+    logic [63:0] mcause     /*verilator public*/;   // 342
+    logic [63:0] mtval      /*verilator public*/;   // 343
+    logic [63:0] mip        /*verilator public*/;   // 344
+    logic [63:0] stvec      /*verilator public*/;   // 105
+    logic [63:0] sscratch   /*verilator public*/;   // 140
+    logic [63:0] sepc       /*verilator public*/;   // 141
+    logic [63:0] scause     /*verilator public*/;   // 142
+    logic [63:0] stval      /*verilator public*/;   // 143
+    logic [63:0] satp       /*verilator public*/;   // 180
+
+    localparam MSTATUS_MASK = 64'h0000_0000_000e_19aa; // SIE MIE SPIE MPIE SPP MPP MPRV SUM MXR
+    localparam SSTATUS_MASK = 64'h0000_0003_000c_0122; // SIE SPIE SPP SUM MXR UXL
+    localparam XLEN_FIELDS  = 64'h0000_000a_0000_0000; // UXL = SXL = 2
+    localparam MISA         = 64'h8000_0000_0014_1105; // RV64 I M A C S U
+    localparam SIP_MASK     = 64'h222;                 // SSIP STIP SEIP
+
+    logic [63:0] mip_all, status;
+    assign mip_all = mip | {56'b0, mtip_i, 3'b0, msip_i, 3'b0};
+    assign status = mstatus | XLEN_FIELDS;
+
+    // read; the user-mode shadows (c00..) alias the machine counters (b00..)
+    always_comb begin
+        rd_o = 0;
+        if (addr_i[11:8] == 4'hb || addr_i[11:8] == 4'hc) begin
+            unique case (addr_i[7:0])
+                8'h00: rd_o = mcycle;
+                8'h02: rd_o = minstret;
+                8'h03: rd_o = hpm_loadstall;
+                8'h04: rd_o = hpm_squash;
+                8'h05: rd_o = hpm_taken;
+                8'h06: rd_o = hpm_load;
+                8'h07: rd_o = hpm_store;
+                8'h08: rd_o = hpm_bubble;
+                8'h09: rd_o = hpm_bphit;
+                8'h0a: rd_o = hpm_bpmiss;
+                8'h0b: rd_o = hpm_brstall;
+                8'h0c: rd_o = hpm_mdstall;
+                8'h0d: rd_o = hpm_ichit;
+                8'h0e: rd_o = hpm_icmiss;
+                8'h0f: rd_o = hpm_icstall;
+                8'h10: rd_o = hpm_dchit;
+                8'h11: rd_o = hpm_dcmiss;
+                8'h12: rd_o = hpm_dcwb;
+                8'h13: rd_o = hpm_dcstall;
+                8'h14: rd_o = hpm_dual;
+                8'h15: rd_o = hpm_rvc;
+                8'h16: rd_o = hpm_fused;
+                8'h17: rd_o = hpm_itlbhit;
+                8'h18: rd_o = hpm_itlbmiss;
+                8'h19: rd_o = hpm_dtlbhit;
+                8'h1a: rd_o = hpm_dtlbmiss;
+                8'h1b: rd_o = hpm_walk;
+                8'h1c: rd_o = hpm_trap;
+                8'h1d: rd_o = hpm_bus;
+                8'h1e: rd_o = hpm_inval;
+                8'h1f: rd_o = hpm_scfail;
+                default: rd_o = 0;
+            endcase
+        end
+        else begin
+            unique case (addr_i)
+                12'h100: rd_o = status & SSTATUS_MASK;
+                12'h104: rd_o = mie & mideleg;
+                12'h105: rd_o = stvec;
+                12'h140: rd_o = sscratch;
+                12'h141: rd_o = sepc;
+                12'h142: rd_o = scause;
+                12'h143: rd_o = stval;
+                12'h144: rd_o = mip_all & mideleg;
+                12'h180: rd_o = satp;
+                12'h300: rd_o = status;
+                12'h301: rd_o = MISA;
+                12'h302: rd_o = medeleg;
+                12'h303: rd_o = mideleg;
+                12'h304: rd_o = mie;
+                12'h305: rd_o = mtvec;
+                12'h340: rd_o = mscratch;
+                12'h341: rd_o = mepc;
+                12'h342: rd_o = mcause;
+                12'h343: rd_o = mtval;
+                12'h344: rd_o = mip_all;
+                12'hf14: rd_o = HARTID;
+                default: rd_o = 0;
+            endcase
+        end
+    end
+
+    logic [63:0] wd;
+    always_comb begin
+        unique case (op_i)
+            2'b01: wd = src_i;
+            2'b10: wd = rd_o | src_i;
+            2'b11: wd = rd_o & ~src_i;
+            default: wd = rd_o;
+        endcase
+    end
+
+    // mstatus as written through mstatus or sstatus; MPP has no encoding 2 (no H-mode)
+    logic [63:0] status_wd;
+    always_comb begin
+        status_wd = addr_i == 12'h100 ? (mstatus & ~SSTATUS_MASK) | (wd & SSTATUS_MASK & MSTATUS_MASK) :
+                                        wd & MSTATUS_MASK;
+        if (status_wd[12:11] == 2'b10) status_wd[12:11] = mstatus[12:11];
+    end
+
+    // TRAPS
+    // exceptions and interrupts from S and U go to S-mode when delegated; vectored
+    // tvecs (mode 1) send interrupts to base + 4 * cause
+    logic       deleg;
+    logic [63:0] tvec;
+    assign deleg = priv != 2'b11 && (trap_irq_i ? mideleg[trap_cause_i] : medeleg[trap_cause_i]);
+    assign tvec = deleg ? stvec : mtvec;
+    assign trap_pc_o = {tvec[63:2], 2'b00} + (tvec[0] && trap_irq_i ? {58'b0, trap_cause_i, 2'b00} : 64'b0);
+    assign mepc_o = mepc;
+    assign sepc_o = sepc;
+
+    // machine interrupts are taken below M-mode or with MIE set, delegated ones in U-mode
+    // or in S-mode with SIE set; priority MEI, MSI, MTI, SEI, SSI, STI
+    logic [63:0] pending, enabled;
+    assign pending = mip_all & mie;
+    assign enabled = (pending & ~mideleg & {64{priv != 2'b11 || mstatus[3]}}) |
+                     (pending & mideleg & {64{priv == 2'b00 || (priv == 2'b01 && mstatus[1])}});
+    assign irq_o = enabled[11] || enabled[3] || enabled[7] || enabled[9] || enabled[1] || enabled[5];
+    assign irq_code_o = enabled[11] ? 4'd11 : enabled[3] ? 4'd3 : enabled[7] ? 4'd7 :
+                        enabled[9]  ? 4'd9  : enabled[1] ? 4'd1 : 4'd5;
+
+    assign priv_o = priv;
+    assign dpriv_o = mstatus[17] ? mstatus[12:11] : priv;
+    assign satp_o = satp;
+    assign sum_o = mstatus[18];
+    assign mxr_o = mstatus[19];
+
+    // only the machine-mode counter addresses are writable
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            mcycle <= 0;
+            minstret <= 0;
+            hpm_loadstall <= 0;
+            hpm_squash <= 0;
+            hpm_taken <= 0;
+            hpm_load <= 0;
+            hpm_store <= 0;
+            hpm_bubble <= 0;
+            hpm_bphit <= 0;
+            hpm_bpmiss <= 0;
+            hpm_brstall <= 0;
+            hpm_mdstall <= 0;
+            hpm_ichit <= 0;
+            hpm_icmiss <= 0;
+            hpm_icstall <= 0;
+            hpm_dchit <= 0;
+            hpm_dcmiss <= 0;
+            hpm_dcwb <= 0;
+            hpm_dcstall <= 0;
+            hpm_dual <= 0;
+            hpm_rvc <= 0;
+            hpm_fused <= 0;
+            hpm_itlbhit <= 0;
+            hpm_itlbmiss <= 0;
+            hpm_dtlbhit <= 0;
+            hpm_dtlbmiss <= 0;
+            hpm_walk <= 0;
+            hpm_trap <= 0;
+            hpm_bus <= 0;
+            hpm_inval <= 0;
+            hpm_scfail <= 0;
+        end
+        else begin
+            mcycle <= we_i && addr_i == 12'hb00 ? wd : mcycle + 1;
+            minstret <= we_i && addr_i == 12'hb02 ? wd : minstret + retire_i;
+            hpm_loadstall <= we_i && addr_i == 12'hb03 ? wd : hpm_loadstall + loadstall_i;
+            hpm_squash <= we_i && addr_i == 12'hb04 ? wd : hpm_squash + squash_i;
+            hpm_taken <= we_i && addr_i == 12'hb05 ? wd : hpm_taken + taken_i;
+            hpm_load <= we_i && addr_i == 12'hb06 ? wd : hpm_load + load_i;
+            hpm_store <= we_i && addr_i == 12'hb07 ? wd : hpm_store + store_i;
+            hpm_bubble <= we_i && addr_i == 12'hb08 ? wd : hpm_bubble + (retire_i == 0);
+            hpm_bphit <= we_i && addr_i == 12'hb09 ? wd : hpm_bphit + bphit_i;
+            hpm_bpmiss <= we_i && addr_i == 12'hb0a ? wd : hpm_bpmiss + bpmiss_i;
+            hpm_brstall <= we_i && addr_i == 12'hb0b ? wd : hpm_brstall + branchstall_i;
+            hpm_mdstall <= we_i && addr_i == 12'hb0c ? wd : hpm_mdstall + mdstall_i;
+            hpm_ichit <= we_i && addr_i == 12'hb0d ? wd : hpm_ichit + ichit_i;
+            hpm_icmiss <= we_i && addr_i == 12'hb0e ? wd : hpm_icmiss + icmiss_i;
+            hpm_icstall <= we_i && addr_i == 12'hb0f ? wd : hpm_icstall + icstall_i;
+            hpm_dchit <= we_i && addr_i == 12'hb10 ? wd : hpm_dchit + dchit_i;
+            hpm_dcmiss <= we_i && addr_i == 12'hb11 ? wd : hpm_dcmiss + dcmiss_i;
+            hpm_dcwb <= we_i && addr_i == 12'hb12 ? wd : hpm_dcwb + dcwriteback_i;
+            hpm_dcstall <= we_i && addr_i == 12'hb13 ? wd : hpm_dcstall + dcstall_i;
+            hpm_dual <= we_i && addr_i == 12'hb14 ? wd : hpm_dual + dual_i;
+            hpm_rvc <= we_i && addr_i == 12'hb15 ? wd : hpm_rvc + rvc_i;
+            hpm_fused <= we_i && addr_i == 12'hb16 ? wd : hpm_fused + fused_i;
+            hpm_itlbhit <= we_i && addr_i == 12'hb17 ? wd : hpm_itlbhit + itlbhit_i;
+            hpm_itlbmiss <= we_i && addr_i == 12'hb18 ? wd : hpm_itlbmiss + itlbmiss_i;
+            hpm_dtlbhit <= we_i && addr_i == 12'hb19 ? wd : hpm_dtlbhit + dtlbhit_i;
+            hpm_dtlbmiss <= we_i && addr_i == 12'hb1a ? wd : hpm_dtlbmiss + dtlbmiss_i;
+            hpm_walk <= we_i && addr_i == 12'hb1b ? wd : hpm_walk + walk_i;
+            hpm_trap <= we_i && addr_i == 12'hb1c ? wd : hpm_trap + trap_i;
+            hpm_bus <= we_i && addr_i == 12'hb1d ? wd : hpm_bus + bus_i;
+            hpm_inval <= we_i && addr_i == 12'hb1e ? wd : hpm_inval + inval_i;
+            hpm_scfail <= we_i && addr_i == 12'hb1f ? wd : hpm_scfail + scfail_i;
+        end
+    end
+
+    // privileged state; CSR writes, traps and xRET never happen in the same cycle
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            priv <= 2'b11;
+            mstatus <= 0;
+            medeleg <= 0;
+            mideleg <= 0;
+            mie <= 0;
+            mtvec <= 0;
+            mscratch <= 0;
+            mepc <= 0;
+            mcause <= 0;
+            mtval <= 0;
+            mip <= 0;
+            stvec <= 0;
+            sscratch <= 0;
+            sepc <= 0;
+            scause <= 0;
+            stval <= 0;
+            satp <= 0;
+        end
+        else if (trap_i) begin
+            if (deleg) begin
+                scause <= {trap_irq_i, 59'b0, trap_cause_i};
+                sepc <= trap_epc_i;
+                stval <= trap_tval_i;
+                mstatus[5] <= mstatus[1];   // SPIE = SIE
+                mstatus[1] <= 0;
+                mstatus[8] <= priv[0];      // SPP
+                priv <= 2'b01;
+            end
+            else begin
+                mcause <= {trap_irq_i, 59'b0, trap_cause_i};
+                mepc <= trap_epc_i;
+                mtval <= trap_tval_i;
+                mstatus[7] <= mstatus[3];   // MPIE = MIE
+                mstatus[3] <= 0;
+                mstatus[12:11] <= priv;     // MPP
+                priv <= 2'b11;
+            end
+        end
+        else if (mret_i) begin
+            priv <= mstatus[12:11];
+            mstatus[3] <= mstatus[7];
+            mstatus[7] <= 1;
+            mstatus[12:11] <= 2'b00;
+            if (mstatus[12:11] != 2'b11) mstatus[17] <= 0;  // MPRV
+        end
+        else if (sret_i) begin
+            priv <= {1'b0, mstatus[8]};
+            mstatus[1] <= mstatus[5];
+            mstatus[5] <= 1;
+            mstatus[8] <= 0;
+            mstatus[17] <= 0;
+        end
+        else if (we_i) begin
+            unique case (addr_i)
+                12'h100, 12'h300: mstatus <= status_wd;
+                12'h104: mie <= (mie & ~mideleg) | (wd & mideleg & 64'haaa);
+                12'h105: stvec <= {wd[63:2], 1'b0, wd[0]};
+                12'h140: sscratch <= wd;
+                12'h141: sepc <= {wd[63:1], 1'b0};
+                12'h142: scause <= wd;
+                12'h143: stval <= wd;
+                12'h144: mip <= (mip & ~(mideleg & 64'h2)) | (wd & mideleg & 64'h2);
+                12'h180: if (wd[63:60] == 4'h0 || wd[63:60] == 4'h8) satp <= wd;
+                12'h302: medeleg <= wd & 64'hb3ff;
+                12'h303: mideleg <= wd & SIP_MASK;
+                12'h304: mie <= wd & 64'haaa;
+                12'h305: mtvec <= {wd[63:2], 1'b0, wd[0]};
+                12'h340: mscratch <= wd;
+                12'h341: mepc <= {wd[63:1], 1'b0};
+                12'h342: mcause <= wd;
+                12'h343: mtval <= wd;
+                12'h344: mip <= wd & SIP_MASK;
+                default: ;
+            endcase
+        end
+    end
+endmodule
+
+// Branch target buffer, 2-bit direction counters and return address stack.
+// BTB entries are allocated for taken branches and jumps only; a hit on a return
+// takes its target from the RAS instead of the BTB.
+module bpred #(parameter BTB_ENTRIES = 16,
+               parameter BHT_ENTRIES = 256,
+               parameter GSHARE = 1,
+               parameter RAS_DEPTH = 4,
+               parameter HBITS = 8,
+               parameter RBITS = 2)
+             (input     logic               clk_i,
+              input     logic               rst_i,
+              // prediction for the instruction being fetched
+              input     logic [63:0]        pc_i,
+              input     logic [63:0]        pcplus_i,  // return address, should it be a call
+              input     logic               advance_i, // fetch moves on; commit speculative updates
+              output    logic               taken_o,
+              output    logic [63:0]        target_o,
+              output    logic [HBITS-1:0]   ghr_o,
+              output    logic [RBITS-1:0]   rasptr_o,
+              // repair after a misprediction or a redirect from MEM, from the snapshots of
+              // that instruction
+              input     logic               fix_i,
+              input     logic               fix_branch_i,
+              input     logic               fix_call_i,
+              input     logic               fix_return_i,
+              input     logic               fix_taken_i,
+              input     logic [63:0]        fix_pcplus_i,
+              input     logic [HBITS-1:0]   fix_ghr_i,
+              input     logic [RBITS-1:0]   fix_rasptr_i,
+              // training with the resolved instruction in EX
+              input     logic               ex_update_i, // branch or jump
+              input     logic               ex_branch_i,
+              input     logic               ex_call_i,
+              input     logic               ex_return_i,
+              input     logic               ex_taken_i,
+              input     logic [63:0]        ex_pc_i,
+              input     logic [63:0]        ex_target_i,
+              input     logic [HBITS-1:0]   ex_ghr_i
+);
+    localparam BBITS = $clog2(BTB_ENTRIES);
+    localparam TBITS = 63 - BBITS;
+
+    // BTB entry kinds
+    localparam BRANCH = 2'b00, JUMP = 2'b01, CALL = 2'b10, RETURN = 2'b11;
+
+    logic             btb_valid[BTB_ENTRIES-1:0];
+    logic [TBITS-1:0] btb_tag[BTB_ENTRIES-1:0];
+    logic [63:0]      btb_target[BTB_ENTRIES-1:0];
+    logic [1:0]       btb_kind[BTB_ENTRIES-1:0];
+    logic [1:0]       bht[BHT_ENTRIES-1:0];
+    logic [63:0]      ras[RAS_DEPTH-1:0];
+    logic [HBITS-1:0] ghr;
+    logic [RBITS-1:0] rasptr; // top of stack
+
+    assign ghr_o = ghr;
+    assign rasptr_o = rasptr;
+
+    // LOOKUP
+    logic [BBITS-1:0] bidx;
+    logic [HBITS-1:0] hidx;
+    logic             hit;
+    // indexed from pc bit 1 on, as compressed instructions are 16-bit aligned
+    assign bidx = pc_i[BBITS:1];
+    assign hidx = GSHARE ? pc_i[HBITS:1] ^ ghr : pc_i[HBITS:1];
+    assign hit = btb_valid[bidx] && btb_tag[bidx] == pc_i[63:BBITS+1];
+
+    always_comb begin
+        taken_o = 0;
+        target_o = btb_target[bidx];
+        if (hit) begin
+            unique case (btb_kind[bidx])
+                BRANCH: taken_o = bht[hidx][1];
+                JUMP, CALL: taken_o = 1;
+                RETURN: begin taken_o = 1; target_o = ras[rasptr]; end
+                default: taken_o = 0;
+            endcase
+        end
+    end
+
+    // UPDATE
+    logic [BBITS-1:0] ex_bidx;
+    logic [HBITS-1:0] ex_hidx;
+    assign ex_bidx = ex_pc_i[BBITS:1];
+    assign ex_hidx = GSHARE ? ex_pc_i[HBITS:1] ^ ex_ghr_i : ex_pc_i[HBITS:1];
+
+    always_ff @(posedge clk_i) begin
+        if (rst_i) begin
+            ghr <= 0;
+            rasptr <= 0;
+            for (int i = 0; i < BTB_ENTRIES; i++) btb_valid[i] <= 0;
+            for (int i = 0; i < BHT_ENTRIES; i++) bht[i] <= 2'b01; // weakly not taken
+        end
+        else begin
+            // speculative state: repair from the mispredicted instruction's snapshot,
+            // otherwise follow the prediction just made
+            if (fix_i) begin
+                ghr <= fix_branch_i ? {fix_ghr_i[HBITS-2:0], fix_taken_i} : fix_ghr_i;
+                if (fix_call_i) begin
+                    ras[fix_rasptr_i + 1'b1] <= fix_pcplus_i;
+                    rasptr <= fix_rasptr_i + 1'b1;
+                end
+                else if (fix_return_i) rasptr <= fix_rasptr_i - 1'b1;
+                else rasptr <= fix_rasptr_i;
+            end
+            else if (advance_i && hit) begin
+                if (btb_kind[bidx] == BRANCH) ghr <= {ghr[HBITS-2:0], taken_o};
+                if (btb_kind[bidx] == CALL) begin
+                    ras[rasptr + 1'b1] <= pcplus_i;
+                    rasptr <= rasptr + 1'b1;
+                end
+                if (btb_kind[bidx] == RETURN) rasptr <= rasptr - 1'b1;
+            end
+
+            // training on the resolved outcome
+            if (ex_update_i) begin
+                if (ex_branch_i) begin
+                    if (ex_taken_i && bht[ex_hidx] != 2'b11) bht[ex_hidx] <= bht[ex_hidx] + 1;
+                    if (!ex_taken_i && bht[ex_hidx] != 2'b00) bht[ex_hidx] <= bht[ex_hidx] - 1;
+                end
+                if (ex_taken_i) begin
+                    btb_valid[ex_bidx] <= 1;
+                    btb_tag[ex_bidx] <= ex_pc_i[63:BBITS+1];
+                    btb_target[ex_bidx] <= ex_target_i;
+                    btb_kind[ex_bidx] <= ex_branch_i ? BRANCH :
+                                         ex_call_i   ? CALL   :
+                                         ex_return_i ? RETURN : JUMP;
+                end
+            end
+        end
+    end
+endmodule
+
+// RV64M unit. Multiplies go through MUL_STAGES pipeline registers behind the
+// multiplier array. Divides use a restoring divider retiring two quotient bits
+// per cycle; the dividend is pre-normalized so that small operands finish early,
+// and division by zero finishes right away.
+module muldiv #(parameter MUL_STAGES = 1)
+             (input     logic           clk_i,
+              input     logic           rst_i,
+              input     logic           req_i,   // M instruction in EX
+              input     logic           hold_i,  // pipeline frozen; keep the result
+              input     logic [2:0]     op_i,    // funct3
+              input     logic           word_i,  // *W variant
+              input     logic [63:0]    a_i,
+              input     logic [63:0]    b_i,
+              output    logic           busy_o,  // holds EX until the result is ready
+              output    logic [63:0]    result_o
+);
+    localparam IDLE = 2'b00, MUL = 2'b01, DIV = 2'b10, DONE = 2'b11;
+    logic [1:0] state;
+
+    // operands; W variants work on the sign- or zero-extended low words
+    logic        div_signed;
+    logic [63:0] a, b;
+    assign div_signed = !op_i[0]; // div, rem, divw, remw
+    always_comb begin
+        if (word_i) begin
+            a = op_i[2] && !div_signed ? {32'b0, a_i[31:0]} : {{32{a_i[31]}}, a_i[31:0]};
+            b = op_i[2] && !div_signed ? {32'b0, b_i[31:0]} : {{32{b_i[31]}}, b_i[31:0]};
+        end
+        else begin
+            a = a_i;
+            b = b_i;
+        end
+    end
+
+    // MULTIPLY
+    logic         a_signed, b_signed;
+    logic [129:0] product;
+    logic [63:0]  mul_result;
+    logic [63:0]  mul_pipe[MUL_STAGES-1:0];
+    assign a_signed = op_i == 3'b001 || op_i == 3'b010; // mulh, mulhsu
+    assign b_signed = op_i == 3'b001;                   // mulh
+    assign product = $signed({a_signed & a[63], a}) * $signed({b_signed & b[63], b});
+    assign mul_result = op_i[1:0] == 2'b00 ? product[63:0] : product[127:64];
+
+    // DIVIDE
+    logic        neg_a, neg_b;
+    logic [63:0] abs_a, abs_b;
+    logic [6:0]  lz; // leading zeros of abs_a, rounded down to even
+    assign neg_a = div_signed && a[63];
+    assign neg_b = div_signed && b[63];
+    assign abs_a = neg_a ? -a : a;
+    assign abs_b = neg_b ? -b : b;
+    always_comb begin
+        lz = 64;
+        for (int i = 0; i < 64; i++) if (abs_a[i]) lz = 63 - i;
+        lz[0] = 0;
+    end
+
+    logic [64:0] rem, rem1, rem2; // one bit wider than the divisor
+    logic [63:0] quo, quo1, quo2, divisor;
+    logic [5:0]  iter;            // remaining pairs of quotient bits
+    logic        neg_q, neg_r;
+    always_comb begin
+        {rem1, quo1} = {rem[63:0], quo, 1'b0};
+        if (rem1 >= {1'b0, divisor}) begin rem1 = rem1 - {1'b0, divisor}; quo1[0] = 1; end
+        {rem2, quo2} = {rem1[63:0], quo1, 1'b0};
+        if (rem2 >= {1'b0, divisor}) begin rem2 = rem2 - {1'b0, divisor}; quo2[0] = 1; end
+    end
+
+    logic [63:0] div_result, result, result_q;
+    assign div_result = op_i[1] ? (neg_r ? -rem[63:0] : rem[63:0]) : // rem
+                                  (neg_q ? -quo : quo);              // div
+
+    logic [5:0] count;
+    logic       ready;
+    always_comb begin
+        ready = (state == MUL && count == 0) || state == DONE;
+        result = state == MUL ? mul_pipe[MUL_STAGES-1] : result_q;
+        result_o = word_i ? {{32{result[31]}}, result[31:0]} : result;
+        busy_o = req_i && !ready;
+    end
+
+    always_ff @(posedge clk_i) begin
+        if (rst_i) state <= IDLE;
+        else begin
+            for (int i = 1; i < MUL_STAGES; i++) mul_pipe[i] <= mul_pipe[i-1];
+            unique case (state)
+                IDLE: if (req_i) begin
+                    if (!op_i[2]) begin
+                        mul_pipe[0] <= mul_result;
+                        count <= MUL_STAGES - 1;
+                        state <= MUL;
+                    end
+                    else if (b == 0) begin
+                        result_q <= op_i[1] ? a : {64{1'b1}};
+                        state <= DONE;
+                    end
+                    else begin
+                        rem <= 0;
+                        quo <= abs_a << lz;
+                        divisor <= abs_b;
+                        iter <= (64 - lz) >> 1;
+                        neg_q <= neg_a ^ neg_b;
+                        neg_r <= neg_a;
+                        state <= DIV;
+                    end
+                end
+                MUL: begin
+                    if (count != 0) count <= count - 1;
+                    else if (req_i && !hold_i) state <= IDLE; // consumed
+                end
+                DIV: begin
+                    if (iter != 0) begin
+                        rem <= rem2;
+                        quo <= quo2;
+                        iter <= iter - 1;
+                    end
+                    else begin
+                        result_q <= div_result;
+                        state <= DONE;
+                    end
+                end
+                DONE: if (req_i && !hold_i) state <= IDLE;
+                default: state <= IDLE;
+            endcase
+        end
     end
-    assign rd_o = ICACHE[address_i[31:2]];
 endmodule
 
-module dcache(input     logic        clk,
-              input     logic [63:0] address, 
-              input     logic [63:0] wd, // data
-              input     logic [7:0]  wm, // mask
-              input     logic        we, // enable
-              output    logic [63:0] rd
+// branch condition, encoded like the BranchControl_i input of the alu
+module brcomp(input     logic [63:0]   a_i,
+              input     logic [63:0]   b_i,
+              input     logic [3:0]    BranchControl_i,
+              output    logic          branch_o
 );
-    logic [63:0] DCACHE[100:0];
-    initial begin 
-        $readmemh("./test/mem_data", DCACHE);
+    logic eq_flag, lt_flag, ltu_flag;
+    always_comb begin
+        eq_flag  = a_i == b_i;
+        lt_flag  = $signed(a_i) < $signed(b_i);
+        ltu_flag = a_i < b_i;
+        unique case (BranchControl_i)
+            4'b0001: branch_o = eq_flag;
+            4'b0011: branch_o = !eq_flag;
+            4'b1001: branch_o = lt_flag;
+            4'b1011: branch_o = !lt_flag;
+            4'b1101: branch_o = ltu_flag;
+            4'b1111: branch_o = !ltu_flag;
+            default: branch_o = 1'b0;
+        endcase
     end
+endmodule
+
+// RV64C: expands a compressed instruction into the RV64I one it stands for; 32-bit
+// instructions pass through. Reserved encodings and the floating-point loads and stores
+// become 0, like the all-zero halfword, which is defined to be illegal.
+module decompress(input    logic [31:0]   instr_i,
+                  output   logic [31:0]   instr_o
+);
+    localparam LOAD = 7'b0000011, STORE = 7'b0100011, OP_IMM = 7'b0010011, OP_IMM32 = 7'b0011011,
+               OP = 7'b0110011, OP32 = 7'b0111011, LUI = 7'b0110111, BRANCH = 7'b1100011,
+               JAL = 7'b1101111, JALR = 7'b1100111;
 
-    // recalculate address for testing purposes
-    logic [63:0] maddress;
-    assign maddress = ({address[63:3], 3'b000} - {{48{1'b0}}, 16'h2000})/8;
+    logic [15:0] c;
+    logic [4:0]  rd, rs2;        // full register fields
+    logic [4:0]  rs1p, rs2p;     // 3-bit fields naming x8..x15
+    assign c = instr_i[15:0];
+    assign rd = c[11:7];
+    assign rs2 = c[6:2];
+    assign rs1p = {2'b01, c[9:7]};
+    assign rs2p = {2'b01, c[4:2]};
 
-    assign rd = DCACHE[maddress];
-    always_ff @(posedge clk) begin
-        if (we) begin
-            if(wm[0]) DCACHE[maddress][ 7:0 ] <= wd[ 7:0 ];
-            if(wm[1]) DCACHE[maddress][15:8 ] <= wd[15:8 ];
-            if(wm[2]) DCACHE[maddress][23:16] <= wd[23:16];
-            if(wm[3]) DCACHE[maddress][31:24] <= wd[31:24];
-            if(wm[4]) DCACHE[maddress][39:32] <= wd[39:32];
-            if(wm[5]) DCACHE[maddress][47:40] <= wd[47:40];
-            if(wm[6]) DCACHE[maddress][55:48] <= wd[55:48];
-            if(wm[7]) DCACHE[maddress][63:56] <= wd[63:56];
+    // immediates, scattered over the instruction as the formats place them
+    logic [11:0] ciimm, addi4spn, lwimm, ldimm, addi16sp, lwsp, ldsp, swsp, sdsp;
+    logic [20:0] jimm;
+    logic [12:0] bimm;
+    assign ciimm    = {{7{c[12]}}, c[6:2]};
+    assign addi4spn = {2'b0, c[10:7], c[12:11], c[5], c[6], 2'b0};
+    assign lwimm    = {5'b0, c[5], c[12:10], c[6], 2'b0};
+    assign ldimm    = {4'b0, c[6:5], c[12:10], 3'b0};
+    assign addi16sp = {{3{c[12]}}, c[4:3], c[5], c[2], c[6], 4'b0};
+    assign lwsp     = {4'b0, c[3:2], c[12], c[6:4], 2'b0};
+    assign ldsp     = {3'b0, c[4:2], c[12], c[6:5], 3'b0};
+    assign swsp     = {4'b0, c[8:7], c[12:9], 2'b0};
+    assign sdsp     = {3'b0, c[9:7], c[12:10], 3'b0};
+    assign jimm     = {{10{c[12]}}, c[8], c[10:9], c[6], c[7], c[2], c[11], c[5:3], 1'b0};
+    assign bimm     = {{5{c[12]}}, c[6:5], c[2], c[11:10], c[4:3], 1'b0};
+
+    always_comb begin
+        instr_o = 0;
+        if (instr_i[1:0] == 2'b11) instr_o = instr_i;
+        else begin
+            unique case ({c[15:13], c[1:0]})
+                // quadrant 0
+                5'b000_00: if (addi4spn != 0) instr_o = {addi4spn, 5'd2, 3'b000, rs2p, OP_IMM};   // c.addi4spn
+                5'b010_00: instr_o = {lwimm, rs1p, 3'b010, rs2p, LOAD};                           // c.lw
+                5'b011_00: instr_o = {ldimm, rs1p, 3'b011, rs2p, LOAD};                           // c.ld
+                5'b110_00: instr_o = {lwimm[11:5], rs2p, rs1p, 3'b010, lwimm[4:0], STORE};        // c.sw
+                5'b111_00: instr_o = {ldimm[11:5], rs2p, rs1p, 3'b011, ldimm[4:0], STORE};        // c.sd
+                // quadrant 1
+                5'b000_01: instr_o = {ciimm, rd, 3'b000, rd, OP_IMM};                             // c.addi, c.nop
+                5'b001_01: if (rd != 0) instr_o = {ciimm, rd, 3'b000, rd, OP_IMM32};              // c.addiw
+                5'b010_01: instr_o = {ciimm, 5'd0, 3'b000, rd, OP_IMM};                           // c.li
+                5'b011_01: begin
+                    if (rd == 2) begin
+                        if (addi16sp != 0) instr_o = {addi16sp, 5'd2, 3'b000, 5'd2, OP_IMM};     // c.addi16sp
+                    end
+                    else if (ciimm != 0) instr_o = {{15{c[12]}}, c[6:2], rd, LUI};               // c.lui
+                end
+                5'b100_01: begin
+                    unique case (c[11:10])
+                        2'b00: instr_o = {6'b000000, c[12], c[6:2], rs1p, 3'b101, rs1p, OP_IMM}; // c.srli
+                        2'b01: instr_o = {6'b010000, c[12], c[6:2], rs1p, 3'b101, rs1p, OP_IMM}; // c.srai
+                        2'b10: instr_o = {ciimm, rs1p, 3'b111, rs1p, OP_IMM};                    // c.andi
+                        2'b11: begin
+                            unique case ({c[12], c[6:5]})
+                                3'b000: instr_o = {7'b0100000, rs2p, rs1p, 3'b000, rs1p, OP};    // c.sub
+                                3'b001: instr_o = {7'b0000000, rs2p, rs1p, 3'b100, rs1p, OP};    // c.xor
+                                3'b010: instr_o = {7'b0000000, rs2p, rs1p, 3'b110, rs1p, OP};    // c.or
+                                3'b011: instr_o = {7'b0000000, rs2p, rs1p, 3'b111, rs1p, OP};    // c.and
+                                3'b100: instr_o = {7'b0100000, rs2p, rs1p, 3'b000, rs1p, OP32};  // c.subw
+                                3'b101: instr_o = {7'b0000000, rs2p, rs1p, 3'b000, rs1p, OP32};  // c.addw
+                                default: instr_o = 0;
+                            endcase
+                        end
+                        default: instr_o = 0;
+                    endcase
+                end
+                5'b101_01: instr_o = {jimm[20], jimm[10:1], jimm[11], jimm[19:12], 5'd0, JAL};   // c.j
+                5'b110_01: instr_o = {bimm[12], bimm[10:5], 5'd0, rs1p, 3'b000, bimm[4:1], bimm[11], BRANCH}; // c.beqz
+                5'b111_01: instr_o = {bimm[12], bimm[10:5], 5'd0, rs1p, 3'b001, bimm[4:1], bimm[11], BRANCH}; // c.bnez
+                // quadrant 2
+                5'b000_10: instr_o = {6'b000000, c[12], c[6:2], rd, 3'b001, rd, OP_IMM};         // c.slli
+                5'b010_10: if (rd != 0) instr_o = {lwsp, 5'd2, 3'b010, rd, LOAD};                // c.lwsp
+                5'b011_10: if (rd != 0) instr_o = {ldsp, 5'd2, 3'b011, rd, LOAD};                // c.ldsp
+                5'b100_10: begin
+                    if (!c[12]) begin
+                        if (rs2 != 0) instr_o = {7'b0, rs2, 5'd0, 3'b000, rd, OP};               // c.mv
+                        else if (rd != 0) instr_o = {12'b0, rd, 3'b000, 5'd0, JALR};             // c.jr
+                    end
+                    else begin
+                        if (rs2 != 0) instr_o = {7'b0, rs2, rd, 3'b000, rd, OP};                 // c.add
+                        else if (rd != 0) instr_o = {12'b0, rd, 3'b000, 5'd1, JALR};             // c.jalr
+                        else instr_o = 32'h00100073;                                             // c.ebreak
+                    end
+                end
+                5'b110_10: instr_o = {swsp[11:5], rs2, 5'd2, 3'b010, swsp[4:0], STORE};          // c.swsp
+                5'b111_10: instr_o = {sdsp[11:5], rs2, 5'd2, 3'b011, sdsp[4:0], STORE};          // c.sdsp
+                default: instr_o = 0;
+            endcase
         end
     end
 endmodule
 
+// 4 read and 2 write ports; a4/a5/a6 serve the second pipe, whose write is the younger
+// one when both ports write the same register
 module registerfile(input   logic           clk_i,
                     input   logic [4:0]     a1_i, a2_i, a3_i,
                     input   logic           we_i,
                     input   logic [63:0]    wd_i,
                     output  logic [63:0]    rd1_o,
-                    output  logic [63:0]    rd2_o
+                    output  logic [63:0]    rd2_o,
+                    input   logic [4:0]     a4_i, a5_i, a6_i,
+                    input   logic           we2_i,
+                    input   logic [63:0]    wd2_i,
+                    output  logic [63:0]    rd3_o,
+                    output  logic [63:0]    rd4_o
 );
-    logic [63:0] REGS[31:0];
+    logic [63:0] REGS[31:0] /*verilator public*/;
 
     assign rd1_o = (a1_i != 0) ? REGS[a1_i] : 0;
     assign rd2_o = (a2_i != 0) ? REGS[a2_i] : 0;
+    assign rd3_o = (a4_i != 0) ? REGS[a4_i] : 0;
+    assign rd4_o = (a5_i != 0) ? REGS[a5_i] : 0;
 
     always_ff @(negedge clk_i) begin
         if (we_i) REGS[a3_i] <= wd_i;
+        if (we2_i) REGS[a6_i] <= wd2_i;
     end
 endmodule
 
+// AluControl: 00000-01010 the RV64I ops, then Zbb's andn/orn/xnor, min/max(u),
+// rol/ror, the counts, sext/zext, rev8 and orc.b, and Zba's shNadd. Uw_i zero-extends
+// SrcA's low word first (the .uw forms).
 module alu(input    logic [63:0]   SrcA_i,
            input    logic [63:0]   SrcB_i,
-           input    logic [3:0]    AluControl_i,
+           input    logic [4:0]    AluControl_i,
            input    logic          Word_i,
+           input    logic          Uw_i,
            input    logic [3:0]    BranchControl_i,
            output   logic          branch_o,
            output   logic [63:0]   result_o
 );
+    logic [63:0] a;
+    assign a = Uw_i ? {32'b0, SrcA_i[31:0]} : SrcA_i;
+
     logic [63:0] difference;
-    assign difference = SrcA_i - SrcB_i;
+    assign difference = a - SrcB_i;
 
     logic [63:0] shift_result;
     shifter sh(
-        .a_i(SrcA_i),
+        .a_i(a),
         .b_i(SrcB_i),
         .aluControl_i(AluControl_i),
         .word_i(Word_i),
         .result_o(shift_result)
     );
 
+    // bit counts; the word forms count in the low word only
+    logic [63:0] clz_src, ctz_src;
+    logic [6:0]  clz, ctz, cpop;
+    always_comb begin
+        clz_src = Word_i ? {a[31:0], 32'hffffffff} : a;
+        ctz_src = Word_i ? {32'h00000001, a[31:0]} : a;
+        clz = 64;
+        for (int i = 0; i < 64; i++) if (clz_src[i]) clz = 63 - i;
+        ctz = 64;
+        for (int i = 63; i >= 0; i--) if (ctz_src[i]) ctz = i;
+        cpop = 0;
+        for (int i = 0; i < 64; i++) cpop = cpop + {6'b0, a[i] && !(Word_i && i >= 32)};
+    end
+
+    logic [63:0] rev8, orcb;
+    always_comb begin
+        for (int i = 0; i < 8; i++) begin
+            rev8[8*i +: 8] = a[8*(7-i) +: 8];
+            orcb[8*i +: 8] = {8{|a[8*i +: 8]}};
+        end
+    end
+
     logic [63:0] alu_result;
     logic lt_flag, ltu_flag, eq_flag;
     always_comb begin
-        eq_flag  = SrcA_i == SrcB_i;
-        lt_flag  = SrcA_i[63] == SrcB_i[63] ? difference[63] : SrcA_i[63];
-        ltu_flag = SrcA_i[63] == SrcB_i[63] ? difference[63] : SrcB_i[63];
+        eq_flag  = a == SrcB_i;
+        lt_flag  = a[63] == SrcB_i[63] ? difference[63] : a[63];
+        ltu_flag = a[63] == SrcB_i[63] ? difference[63] : SrcB_i[63];
         unique case (AluControl_i)
-            4'b0000: alu_result = SrcA_i + SrcB_i;      // add
-            4'b0001: alu_result = difference;           // sub
-            4'b0010: alu_result = shift_result;         // sll
-            4'b0011: alu_result = {63'b0, lt_flag};     // slt
-            4'b0100: alu_result = {63'b0, ltu_flag};    // sltu
-            4'b0101: alu_result = SrcA_i ^ SrcB_i;      // xor
-            4'b0110: alu_result = shift_result;         // srl
-            4'b0111: alu_result = shift_result;         // sra
-            4'b1000: alu_result = SrcA_i | SrcB_i;      // or
-            4'b1001: alu_result = SrcA_i & SrcB_i;      // and
-            4'b1010: alu_result = SrcB_i;               // lui
+            5'b00000: alu_result = a + SrcB_i;          // add
+            5'b00001: alu_result = difference;          // sub
+            5'b00010: alu_result = shift_result;        // sll
+            5'b00011: alu_result = {63'b0, lt_flag};    // slt
+            5'b00100: alu_result = {63'b0, ltu_flag};   // sltu
+            5'b00101: alu_result = a ^ SrcB_i;          // xor
+            5'b00110: alu_result = shift_result;        // srl
+            5'b00111: alu_result = shift_result;        // sra
+            5'b01000: alu_result = a | SrcB_i;          // or
+            5'b01001: alu_result = a & SrcB_i;          // and
+            5'b01010: alu_result = SrcB_i;              // lui
+            5'b01011: alu_result = a & ~SrcB_i;         // andn
+            5'b01100: alu_result = a | ~SrcB_i;         // orn
+            5'b01101: alu_result = ~(a ^ SrcB_i);       // xnor
+            5'b01110: alu_result = lt_flag ? a : SrcB_i;    // min
+            5'b01111: alu_result = lt_flag ? SrcB_i : a;    // max
+            5'b10000: alu_result = ltu_flag ? a : SrcB_i;   // minu
+            5'b10001: alu_result = ltu_flag ? SrcB_i : a;   // maxu
+            5'b10010: alu_result = shift_result;        // rol
+            5'b10011: alu_result = {57'b0, clz};        // clz
+            5'b10100: alu_result = {57'b0, ctz};        // ctz
+            5'b10101: alu_result = {57'b0, cpop};       // cpop
+            5'b10110: alu_result = shift_result;        // ror
+            5'b10111: alu_result = {{56{a[7]}}, a[7:0]};    // sext.b
+            5'b11000: alu_result = {{48{a[15]}}, a[15:0]};  // sext.h
+            5'b11001: alu_result = {48'b0, a[15:0]};        // zext.h
+            5'b11010: alu_result = rev8;                // rev8
+            5'b11011: alu_result = orcb;                // orc.b
+            5'b11100: alu_result = {a[62:0], 1'b0} + SrcB_i;    // sh1add
+            5'b11101: alu_result = {a[61:0], 2'b0} + SrcB_i;    // sh2add
+            5'b11110: alu_result = {a[60:0], 3'b0} + SrcB_i;    // sh3add
             default: alu_result = {64{1'bx}};
         endcase
         result_o = Word_i ? {{32{alu_result[31]}}, alu_result[31:0]} : alu_result;
@@ -681,39 +3288,46 @@ module alu(input    logic [63:0]   SrcA_i,
     end
 endmodule
 
+// One right shifter for shifts and rotates: left ones bit-reverse the operand and the
+// result, and a rotate shifts the operand in above itself instead of the fill bit. The word
+// forms work in the upper half (right) or on the reversed low word (left); a word rotate
+// doubles the low word so that its own bits come in.
 module shifter(input    logic [63:0] a_i,
                input    logic [63:0] b_i,
-               input    logic [3:0]  aluControl_i,
+               input    logic [4:0]  aluControl_i,
                input    logic        word_i,
                output   logic [63:0] result_o
 );
-    logic [63:0] shift_operand;
+    logic        rotate;
+    logic [63:0] source, shift_operand;
     logic shift_fill_bit;
     logic [5:0] shamt;
-    logic [64:0] shift_operand_ext;
+    logic [127:0] shift_operand_ext;
     logic [63:0] shift_result;
 
     always_comb begin
+        rotate = aluControl_i[4];
+        source = word_i && rotate ? {a_i[31:0], a_i[31:0]} : a_i;
         shift_operand = 'x;
         unique casez ({word_i, aluControl_i[2:1]})
             // left
-            3'b?01: for (int i = 0; i < 64; i++) shift_operand[i] = a_i[63 - i]; 
+            3'b?01: for (int i = 0; i < 64; i++) shift_operand[i] = source[63 - i];
             // right
-            3'b011: shift_operand = a_i; 
-            3'b111: shift_operand = {a_i[31:0], 32'dx};
+            3'b011: shift_operand = source;
+            3'b111: shift_operand = rotate ? source : {a_i[31:0], 32'dx};
             default: ;
         endcase
 
-        shift_fill_bit = aluControl_i == 4'b0111 && shift_operand[63];
+        shift_fill_bit = aluControl_i == 5'b00111 && shift_operand[63];
         shamt = word_i ? {1'b0, b_i[4:0]} : b_i[5:0];
 
-        shift_operand_ext = {shift_fill_bit, shift_operand};
-        shift_result = signed'(shift_operand_ext) >>> shamt;
+        shift_operand_ext = {rotate ? shift_operand : {64{shift_fill_bit}}, shift_operand};
+        shift_result = shift_operand_ext >> shamt;
 
         result_o = 'x;
         unique casez ({word_i, aluControl_i[2:1]})
             // left
-            3'b?01: for (int i = 0; i < 64; i++) result_o[i] = shift_result[63 - i]; 
+            3'b?01: for (int i = 0; i < 64; i++) result_o[i] = shift_result[63 - i];
             // right
             3'b011: result_o = shift_result;
             3'b111: result_o = {32'dx, shift_result[63:32]};
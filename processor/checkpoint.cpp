@@ -0,0 +1,43 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char MAGIC[8] = {'B', 'K', 'L', 'C', 'K', 'P', 'T', '3'};
+
+bool saveCheckpoint(const std::string &path, const Checkpoint &ck, const Memory &mem, std::string &err) {
+        FILE *f = fopen(path.c_str(), "wb");
+        if (!f) {
+                err = "cannot create file";
+                return false;
+        }
+        uint64_t size = ck.config.size();
+        bool ok = fwrite(MAGIC, sizeof(MAGIC), 1, f) == 1 && fwrite(&size, 8, 1, f) == 1 &&
+                  fwrite(ck.config.data(), 1, size, f) == size && fwrite(&ck.cycle, 8, 1, f) == 1 &&
+                  fwrite(&ck.pc, 8, 1, f) == 1 && fwrite(ck.x, 8, 32, f) == 32 &&
+                  fwrite(&ck.csr, sizeof(ck.csr), 1, f) == 1 && mem.save(f);
+        ok = fclose(f) == 0 && ok;
+        if (!ok) err = "write failed";
+        return ok;
+}
+
+bool loadCheckpoint(const std::string &path, Checkpoint &ck, Memory &mem, std::string &err) {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f) {
+                err = "cannot read file";
+                return false;
+        }
+        char magic[sizeof(MAGIC)];
+        uint64_t size = 0;
+        bool ok = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, MAGIC, sizeof(MAGIC)) &&
+                  fread(&size, 8, 1, f) == 1 && size < 4096;
+        if (ok) {
+                ck.config.resize(size);
+                ok = fread(&ck.config[0], 1, size, f) == size && fread(&ck.cycle, 8, 1, f) == 1 &&
+                     fread(&ck.pc, 8, 1, f) == 1 && fread(ck.x, 8, 32, f) == 32 &&
+                     fread(&ck.csr, sizeof(ck.csr), 1, f) == 1 && mem.restore(f);
+        }
+        fclose(f);
+        if (!ok) err = "not a checkpoint or truncated";
+        return ok;
+}
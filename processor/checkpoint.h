@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "iss.h"
+#include "memory.h"
+
+// A checkpoint is the architectural state of a run plus the memory image, with every
+// dirty dcache line written back. That is enough to continue on any build of the model,
+// with cold caches and predictors. When the model was built --savable, the Verilator
+// state of the whole design is saved next to it as <path>.model; a model built with the
+// same configuration restores that instead and continues exactly where the run stopped.
+struct Checkpoint {
+        std::string config;  // model configuration of <path>.model
+        uint64_t cycle;      // cycles simulated before the checkpoint
+        uint64_t pc;         // oldest instruction that has not retired
+        uint64_t x[32];
+        PrivState csr;       // privilege mode and CSRs, the TLBs start empty
+};
+
+bool saveCheckpoint(const std::string &path, const Checkpoint &ck, const Memory &mem, std::string &err);
+bool loadCheckpoint(const std::string &path, Checkpoint &ck, Memory &mem, std::string &err);
@@ -0,0 +1,215 @@
+#include "commitlog.h"
+
+#include <string.h>
+
+#include "rvc.h"
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t v) {
+        while (v >= 0x80) {
+                out.push_back((uint8_t)v | 0x80);
+                v >>= 7;
+        }
+        out.push_back((uint8_t)v);
+}
+
+static bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+                uint8_t b = *p++;
+                v |= (uint64_t)(b & 0x7f) << shift;
+                if (!(b & 0x80)) return true;
+        }
+        return false;
+}
+
+static uint64_t zigzag(uint64_t delta) { return delta << 1 ^ (uint64_t)((int64_t)delta >> 63); }
+static uint64_t unzigzag(uint64_t v) { return v >> 1 ^ -(v & 1); }
+
+void CommitCodec::encode(const CommitRecord &r, std::vector<uint8_t> &out) {
+        uint8_t flags = 0;
+        if (r.pc != pc + length) flags |= JUMP;
+        if (r.cycle != cycle + 1) flags |= CYCLES;
+        auto it = instrs.find(r.pc);
+        if (it == instrs.end() || it->second != r.instr) {
+                flags |= INSTR;
+                instrs[r.pc] = r.instr;
+        }
+        if (r.rd) flags |= RD;
+        if (r.access) flags |= ADDR;
+        if (r.access && r.store) flags |= STORE;
+        if (r.stalls) flags |= STALLED;
+
+        out.push_back(flags);
+        if (flags & JUMP) putVarint(out, zigzag(r.pc - (pc + length)));
+        if (flags & CYCLES) putVarint(out, r.cycle - cycle);
+        if (flags & INSTR)
+                for (int i = 0; i < 4; i++) out.push_back(r.instr >> i * 8);
+        if (flags & RD) {
+                out.push_back(r.rd);
+                putVarint(out, zigzag(r.value - regs[r.rd]));
+                regs[r.rd] = r.value;
+        }
+        if (flags & ADDR) {
+                putVarint(out, zigzag(r.addr - addr));
+                addr = r.addr;
+        }
+        if (flags & STORE) putVarint(out, r.data);
+        if (flags & STALLED) out.push_back(r.stalls);
+        pc = r.pc;
+        length = instrBytes(r.instr);
+        cycle = r.cycle;
+}
+
+bool CommitCodec::decode(const uint8_t *&p, const uint8_t *end, CommitRecord &r) {
+        if (p >= end) return false;
+        uint8_t flags = *p++;
+        if (flags & ~(JUMP | CYCLES | INSTR | RD | ADDR | STORE | STALLED) ||
+            (flags & STORE && !(flags & ADDR)))
+                return false;
+        uint64_t v = 0;
+        r.pc = pc + length;
+        if (flags & JUMP) {
+                if (!getVarint(p, end, v)) return false;
+                r.pc += unzigzag(v);
+        }
+        r.cycle = cycle + 1;
+        if (flags & CYCLES) {
+                if (!getVarint(p, end, v)) return false;
+                r.cycle = cycle + v;
+        }
+        if (flags & INSTR) {
+                if (end - p < 4) return false;
+                r.instr = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+                p += 4;
+                instrs[r.pc] = r.instr;
+        } else {
+                auto it = instrs.find(r.pc);
+                if (it == instrs.end()) return false;
+                r.instr = it->second;
+        }
+        r.rd = 0;
+        r.value = 0;
+        if (flags & RD) {
+                if (p >= end || *p == 0 || *p >= 32) return false;
+                r.rd = *p++;
+                if (!getVarint(p, end, v)) return false;
+                r.value = regs[r.rd] += unzigzag(v);
+        }
+        r.access = flags & ADDR;
+        r.addr = 0;
+        if (r.access) {
+                if (!getVarint(p, end, v)) return false;
+                r.addr = addr += unzigzag(v);
+        }
+        r.store = flags & STORE;
+        r.data = 0;
+        if (r.store && !getVarint(p, end, r.data)) return false;
+        r.stalls = 0;
+        if (flags & STALLED) {
+                if (p >= end) return false;
+                r.stalls = *p++;
+        }
+        pc = r.pc;
+        length = instrBytes(r.instr);
+        cycle = r.cycle;
+        return true;
+}
+
+CommitLogWriter::~CommitLogWriter() {
+        std::string err;
+        if (file) close(err);
+}
+
+bool CommitLogWriter::open(const std::string &path, std::string &err) {
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+                err = "cannot write " + path;
+                return false;
+        }
+        buffer.reserve(BUFFER_BYTES + CommitCodec::MAX_RECORD);
+        buffer.insert(buffer.end(), COMMIT_MAGIC, COMMIT_MAGIC + sizeof(COMMIT_MAGIC));
+        thread = std::thread(&CommitLogWriter::run, this);
+        return true;
+}
+
+void CommitLogWriter::flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [&] { return queue.size() < MAX_QUEUED; });
+        queue.push_back(std::move(buffer));
+        ready.notify_one();
+        lock.unlock();
+        buffer = std::vector<uint8_t>();
+        buffer.reserve(BUFFER_BYTES + CommitCodec::MAX_RECORD);
+}
+
+void CommitLogWriter::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+                ready.wait(lock, [&] { return done || !queue.empty(); });
+                if (queue.empty()) return;
+                std::vector<uint8_t> chunk = std::move(queue.front());
+                queue.pop_front();
+                space.notify_one();
+                lock.unlock();
+                bool ok = fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+                lock.lock();
+                failed |= !ok;
+        }
+}
+
+bool CommitLogWriter::close(std::string &err) {
+        if (!buffer.empty()) flush();
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+        }
+        ready.notify_one();
+        thread.join();
+        bool ok = !failed;
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        if (!ok) err = "error writing the commit log";
+        return ok;
+}
+
+CommitLogReader::~CommitLogReader() {
+        if (file) fclose(file);
+}
+
+bool CommitLogReader::open(const std::string &path, std::string &err) {
+        file = fopen(path.c_str(), "rb");
+        char magic[sizeof(COMMIT_MAGIC)];
+        if (!file) {
+                err = "cannot read " + path;
+                return false;
+        }
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+            memcmp(magic, COMMIT_MAGIC, sizeof(magic))) {
+                err = path + " is not a commit log";
+                return false;
+        }
+        return true;
+}
+
+bool CommitLogReader::next(CommitRecord &r, std::string &err) {
+        // keep at least one whole record in the buffer
+        if (buffer.size() - pos < CommitCodec::MAX_RECORD && !eof) {
+                buffer.erase(buffer.begin(), buffer.begin() + pos);
+                pos = 0;
+                size_t have = buffer.size();
+                buffer.resize(have + (1 << 20));
+                size_t got = fread(buffer.data() + have, 1, buffer.size() - have, file);
+                buffer.resize(have + got);
+                eof = got == 0;
+        }
+        if (pos == buffer.size()) return false;
+        const uint8_t *p = buffer.data() + pos;
+        if (!codec.decode(p, buffer.data() + buffer.size(), r)) {
+                err = "malformed record at byte " + std::to_string(consumed);
+                return false;
+        }
+        size_t used = p - (buffer.data() + pos);
+        pos += used;
+        consumed += used;
+        return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "stalls.h"
+
+// one retired instruction
+struct CommitRecord {
+        uint64_t cycle;
+        uint64_t pc;
+        uint32_t instr;     // as encoded, in the low half when compressed
+        int rd;             // 0 when it writes no register
+        uint64_t value;     // written to rd
+        bool access;        // a load or store, at addr
+        uint64_t addr;
+        bool store;         // a store of data, before it is shifted into its bytes
+        uint64_t data;
+        uint8_t stalls;     // 1 << Stall bits of the causes seen since the previous retirement
+};
+
+// Records are delta-encoded against the ones before them. Each starts with a flags byte
+// selecting the fields that follow, in this order:
+//   JUMP    zigzag varint of pc - next sequential pc         absent: sequential
+//   CYCLES  varint of cycle - previous cycle                 absent: 1
+//   INSTR   the 4 instruction bytes                          absent: as last seen at pc
+//   RD      rd byte, zigzag varint of value - previous rd    absent: no register written
+//   ADDR    zigzag varint of addr - previous addr            absent: no memory access
+//   STORE   varint of the store data                         absent: not a store
+//   STALLED the stalls byte                                  absent: 0
+// A straight-line ALU instruction takes 3 or 4 bytes. The file starts with COMMIT_MAGIC.
+class CommitCodec {
+public:
+        static const size_t MAX_RECORD = 1 + 10 + 10 + 4 + 1 + 10 + 10 + 10 + 1;
+
+        void encode(const CommitRecord &r, std::vector<uint8_t> &out);
+        // returns false on a truncated or malformed record
+        bool decode(const uint8_t *&p, const uint8_t *end, CommitRecord &r);
+
+private:
+        enum { JUMP = 1, CYCLES = 2, INSTR = 4, RD = 8, ADDR = 16, STORE = 32, STALLED = 64 };
+        uint64_t pc = 0, cycle = 0, addr = 0;
+        int length = 4;  // bytes of the previous instruction
+        uint64_t regs[32] = {};
+        std::unordered_map<uint64_t, uint32_t> instrs;
+};
+
+static const char COMMIT_MAGIC[8] = {'B', 'K', 'L', 'C', 'M', 'T', '0', '1'};
+
+// Writes a commit log from the simulation thread; the file is written by a thread of its
+// own, which takes full buffers off a short queue.
+class CommitLogWriter {
+public:
+        ~CommitLogWriter();
+        bool open(const std::string &path, std::string &err);
+        void write(const CommitRecord &r) {
+                codec.encode(r, buffer);
+                if (buffer.size() >= BUFFER_BYTES) flush();
+        }
+        bool close(std::string &err);  // waits for the file to be complete
+
+private:
+        static const size_t BUFFER_BYTES = 1 << 20;
+        static const size_t MAX_QUEUED = 4;  // the simulation waits when the disk falls behind
+        void flush();
+        void run();
+
+        CommitCodec codec;
+        std::vector<uint8_t> buffer;
+        FILE *file = nullptr;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable ready, space;
+        std::deque<std::vector<uint8_t>> queue;
+        bool done = false, failed = false;
+};
+
+class CommitLogReader {
+public:
+        ~CommitLogReader();
+        bool open(const std::string &path, std::string &err);
+        // false at the end of the log; err is set when that end is a malformed record
+        bool next(CommitRecord &r, std::string &err);
+        uint64_t bytes() const { return consumed; }  // size of the records read so far
+
+private:
+        CommitCodec codec;
+        FILE *file = nullptr;
+        std::vector<uint8_t> buffer;
+        size_t pos = 0;
+        uint64_t consumed = sizeof(COMMIT_MAGIC);
+        bool eof = false;
+};
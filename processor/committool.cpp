@@ -0,0 +1,160 @@
+// Decodes the commit logs written by ./CPU --commits.
+//
+//   committool LOG           one line per instruction, with its cycle and stall causes
+//   committool --spike LOG   Spike's --log-commits format, to diff against Spike
+//   committool --stats LOG   instruction mix, CPI and the cycles lost to each cause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "commitlog.h"
+#include "rvc.h"
+
+static void usage(const char *prog) {
+        printf("usage: %s [--spike | --stats] log\n", prog);
+        exit(EXIT_FAILURE);
+}
+
+// bytes a store writes, from funct3
+static int storeBytes(uint32_t instr) { return 1 << (expandCompressed(instr) >> 12 & 3); }
+
+static void printRecord(const CommitRecord &r, bool spike) {
+        if (spike)
+                printf("core   0: 3 0x%016lx (0x%08x)", (unsigned long)r.pc, r.instr);
+        else if (isCompressed(r.instr))
+                printf("%10lu  0x%016lx (0x%04x)    ", (unsigned long)r.cycle, (unsigned long)r.pc,
+                       r.instr);
+        else
+                printf("%10lu  0x%016lx (0x%08x)", (unsigned long)r.cycle, (unsigned long)r.pc,
+                       r.instr);
+        if (r.rd) printf(" x%-2d 0x%016lx", r.rd, (unsigned long)r.value);
+        if (r.access) printf(" mem 0x%016lx", (unsigned long)r.addr);
+        if (r.store) {
+                int bytes = storeBytes(r.instr);
+                uint64_t data = bytes == 8 ? r.data : r.data & ((1ull << bytes * 8) - 1);
+                printf(" 0x%0*lx", bytes * 2, (unsigned long)data);
+        }
+        if (!spike && r.stalls) {
+                const char *sep = "  [";
+                for (int k = 0; k < STALLS; k++)
+                        if (r.stalls >> k & 1) {
+                                printf("%s%s", sep, STALL_NAMES[k]);
+                                sep = ",";
+                        }
+                printf("]");
+        }
+        printf("\n");
+}
+
+struct Stats {
+        uint64_t instructions = 0, firstCycle = 0, lastCycle = 0;
+        uint64_t loads = 0, stores = 0, branches = 0, jumps = 0, muldiv = 0, system = 0;
+        uint64_t compressed = 0;
+        // instructions that waited for a cause, and the extra cycles they waited
+        uint64_t stalled[STALLS] = {}, lost[STALLS] = {};
+        std::unordered_map<uint64_t, uint64_t> waitByPc;  // extra cycles before each pc retired
+
+        void add(const CommitRecord &r, uint64_t previousCycle) {
+                if (instructions++ == 0) firstCycle = r.cycle;
+                // the younger half of a dual-issued pair retires in the same cycle
+                uint64_t wait =
+                        instructions > 1 && r.cycle > previousCycle ? r.cycle - previousCycle - 1 : 0;
+                lastCycle = r.cycle;
+                compressed += isCompressed(r.instr);
+                uint32_t instr = expandCompressed(r.instr);
+                switch (instr & 0x7f) {
+                case 0x03: loads++; break;
+                case 0x23: stores++; break;
+                case 0x63: branches++; break;
+                case 0x67: case 0x6f: jumps++; break;
+                case 0x33: case 0x3b: muldiv += instr >> 25 == 1; break;
+                case 0x73: system++; break;
+                }
+                for (int k = 0; k < STALLS; k++)
+                        if (r.stalls >> k & 1) {
+                                stalled[k]++;
+                                lost[k] += wait;
+                        }
+                if (wait) waitByPc[r.pc] += wait;
+        }
+
+        void print(uint64_t bytes) const {
+                uint64_t cycles = instructions ? lastCycle - firstCycle + 1 : 0;
+                auto per = [&](double n) { return instructions ? n / instructions : 0.0; };
+                auto pct = [&](uint64_t n) { return 100 * per(n); };
+                printf("instructions  %12lu   %.2f bytes each in the log\n",
+                       (unsigned long)instructions, per(bytes));
+                printf("cycles        %12lu   first to last retirement\n", (unsigned long)cycles);
+                printf("CPI           %12.3f\n\n", per(cycles));
+                printf("loads         %12lu  %6.2f%%\n", (unsigned long)loads, pct(loads));
+                printf("stores        %12lu  %6.2f%%\n", (unsigned long)stores, pct(stores));
+                printf("branches      %12lu  %6.2f%%\n", (unsigned long)branches, pct(branches));
+                printf("jumps         %12lu  %6.2f%%\n", (unsigned long)jumps, pct(jumps));
+                printf("mul/div       %12lu  %6.2f%%\n", (unsigned long)muldiv, pct(muldiv));
+                printf("system        %12lu  %6.2f%%\n", (unsigned long)system, pct(system));
+                // fetch bandwidth: instruction bytes retired, against 4 bytes each without RV64C
+                printf("compressed    %12lu  %6.2f%%   %.1f%% fewer instruction bytes fetched\n\n",
+                       (unsigned long)compressed, pct(compressed), pct(compressed) / 2);
+
+                // an instruction that waited for several causes counts for each of them
+                printf("cause           instructions  cycles waited\n");
+                for (int k = 0; k < STALLS; k++)
+                        printf("%-14s  %12lu  %13lu\n", STALL_NAMES[k], (unsigned long)stalled[k],
+                               (unsigned long)lost[k]);
+
+                std::vector<std::pair<uint64_t, uint64_t>> top(waitByPc.begin(), waitByPc.end());
+                std::sort(top.begin(), top.end(), [](const std::pair<uint64_t, uint64_t> &a,
+                                                     const std::pair<uint64_t, uint64_t> &b) {
+                        return a.second != b.second ? a.second > b.second : a.first < b.first;
+                });
+                if (top.size() > 10) top.resize(10);
+                printf("\npc                  cycles waited\n");
+                for (const auto &t : top)
+                        printf("0x%016lx  %13lu\n", (unsigned long)t.first, (unsigned long)t.second);
+        }
+};
+
+int main(int argc, char **argv) {
+        bool spike = false, stats = false;
+        const char *path = nullptr;
+        for (int i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "--spike"))
+                        spike = true;
+                else if (!strcmp(argv[i], "--stats"))
+                        stats = true;
+                else if (argv[i][0] == '-' || path)
+                        usage(argv[0]);
+                else
+                        path = argv[i];
+        }
+        if (!path || (spike && stats)) usage(argv[0]);
+
+        CommitLogReader reader;
+        std::string err;
+        if (!reader.open(path, err)) {
+                printf("%s\n", err.c_str());
+                return EXIT_FAILURE;
+        }
+        CommitRecord r;
+        Stats s;
+        uint64_t previousCycle = 0;
+        while (reader.next(r, err)) {
+                if (stats)
+                        s.add(r, previousCycle);
+                else
+                        printRecord(r, spike);
+                previousCycle = r.cycle;
+        }
+        if (stats) s.print(reader.bytes());
+        if (!err.empty()) {
+                fprintf(stderr, "%s: %s\n", path, err.c_str());
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
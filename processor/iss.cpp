@@ -0,0 +1,674 @@
+#include "iss.h"
+
+#include <string.h>
+
+#include "rvc.h"
+
+Iss::Iss(Memory &mem) : mem(mem) {}
+
+uint8_t *Iss::host(uint64_t addr, bool write) {
+        uint64_t number = addr >> Memory::PAGE_BITS;
+        TlbEntry &e = tlb[number % TLB_ENTRIES];
+        if (e.number != number) {
+                uint64_t *page = mem.page(addr, write);
+                if (!page) return nullptr;  // never written, reads as zero
+                e.number = number;
+                e.page = (uint8_t *)page;
+        }
+        return e.page + (addr & ((1 << Memory::PAGE_BITS) - 1));
+}
+
+// instructions always come from memory, like the icache refills of the RTL, one
+// physical halfword at a time since a 32-bit one may cross a page
+uint16_t Iss::fetch(uint64_t addr) {
+        uint16_t half = 0;
+        if (uint8_t *p = host(addr, false)) memcpy(&half, p, 2);
+        return half;
+}
+
+// PRIVILEGED ARCHITECTURE
+// mirrors the csrfile and the page table walker of CPU.sv
+
+static const uint64_t MSTATUS_MASK = 0xe19aa;      // SIE MIE SPIE MPIE SPP MPP MPRV SUM MXR
+static const uint64_t SSTATUS_MASK = 0x3000c0122;  // SIE SPIE SPP SUM MXR UXL
+static const uint64_t XLEN_FIELDS = 0xa00000000;   // UXL = SXL = 2
+static const uint64_t MISA = 0x8000000000141105;   // RV64 I M A C S U
+static const uint64_t MSTATUS_SIE = 1 << 1, MSTATUS_MIE = 1 << 3, MSTATUS_SPIE = 1 << 5,
+                      MSTATUS_MPIE = 1 << 7, MSTATUS_SPP = 1 << 8, MSTATUS_MPRV = 1 << 17,
+                      MSTATUS_SUM = 1 << 18, MSTATUS_MXR = 1 << 19;
+static const int MSTATUS_MPP_SHIFT = 11;
+
+static const uint64_t PTE_V = 1, PTE_R = 2, PTE_W = 4, PTE_X = 8, PTE_U = 16, PTE_A = 64, PTE_D = 128;
+
+// whether the flags of a leaf PTE permit access in privilege mode priv
+static bool pteAllows(uint64_t pte, int access, uint64_t priv, bool sum, bool mxr) {
+        bool ok = access == 0 ? pte & PTE_X : access == 1 ? (pte & PTE_R) || (mxr && (pte & PTE_X)) : pte & PTE_W;
+        if (priv == 0) return ok && (pte & PTE_U);
+        if (pte & PTE_U) return ok && access != 0 && sum;
+        return ok;
+}
+
+// Sv39 translation; sets A, and D for a store, in the leaf PTE as the walker does.
+// Loads and stores use the privilege after MPRV. False on a page fault.
+bool Iss::translate(uint64_t va, Access access, uint64_t &pa) {
+        uint64_t priv = csr.priv;
+        if (access != FETCH && (csr.mstatus & MSTATUS_MPRV)) priv = csr.mstatus >> MSTATUS_MPP_SHIFT & 3;
+        if (csr.satp >> 60 != 8 || priv == 3) {
+                pa = va;
+                return true;
+        }
+        if ((uint64_t)((int64_t)(va << 25) >> 25) != va) return false;
+        bool sum = csr.mstatus & MSTATUS_SUM, mxr = csr.mstatus & MSTATUS_MXR;
+        uint64_t vpn = va >> 12 & ((1ull << 27) - 1);
+        XlateEntry &e = xlate[access != FETCH][vpn % XLATE_ENTRIES];
+        if (e.vpn == vpn && pteAllows(e.pte, access, priv, sum, mxr) && (access != STORE || (e.pte & PTE_D))) {
+                pa = e.ppn << 12 | (va & 0xfff);
+                return true;
+        }
+        uint64_t table = (csr.satp & ((1ull << 44) - 1)) << 12;
+        for (int level = 2; level >= 0; level--) {
+                uint64_t addr = table + (va >> (12 + 9 * level) & 511) * 8;
+                uint64_t pte = mem.read(addr), ppn = pte >> 10 & ((1ull << 44) - 1);
+                if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R))) return false;
+                if (!(pte & (PTE_R | PTE_X))) {  // pointer to the next level
+                        table = ppn << 12;
+                        continue;
+                }
+                if (ppn & ((1ull << 9 * level) - 1)) return false;  // misaligned superpage
+                if (!pteAllows(pte, access, priv, sum, mxr)) return false;
+                uint64_t updated = pte | PTE_A | (access == STORE ? PTE_D : 0);
+                if (updated != pte) mem.write(addr, updated);
+                pa = ppn << 12 | (va & ((1ull << (12 + 9 * level)) - 1));
+                e = {vpn, updated, pa >> 12};
+                return true;
+        }
+        return false;  // a pointer at level 0
+}
+
+void Iss::flushTranslations() {
+        for (auto &set : xlate)
+                for (XlateEntry &e : set) e.vpn = ~0ull;
+}
+
+// the handler address of a trap, delegated to S-mode below M-mode as medeleg/mideleg say
+uint64_t Iss::handler(uint64_t cause) const {
+        bool irq = cause >> 63;
+        uint64_t code = cause & 15;
+        bool deleg = csr.priv != 3 && ((irq ? csr.mideleg : csr.medeleg) >> code & 1);
+        uint64_t tvec = deleg ? csr.stvec : csr.mtvec;
+        return (tvec & ~3ull) + ((tvec & 1) && irq ? 4 * code : 0);
+}
+
+void Iss::trap(uint64_t cause, uint64_t tval) {
+        bool irq = cause >> 63;
+        uint64_t target = handler(cause);
+        PrivState &c = csr;
+        reserved = false;
+        if (c.priv != 3 && ((irq ? c.mideleg : c.medeleg) >> (cause & 15) & 1)) {
+                c.scause = cause;
+                c.sepc = pc;
+                c.stval = tval;
+                c.mstatus = (c.mstatus & ~(MSTATUS_SPIE | MSTATUS_SIE | MSTATUS_SPP)) |
+                            (c.mstatus & MSTATUS_SIE ? MSTATUS_SPIE : 0) | (c.priv & 1 ? MSTATUS_SPP : 0);
+                c.priv = 1;
+        } else {
+                c.mcause = cause;
+                c.mepc = pc;
+                c.mtval = tval;
+                c.mstatus = (c.mstatus & ~(MSTATUS_MPIE | MSTATUS_MIE | 3ull << MSTATUS_MPP_SHIFT)) |
+                            (c.mstatus & MSTATUS_MIE ? MSTATUS_MPIE : 0) | c.priv << MSTATUS_MPP_SHIFT;
+                c.priv = 3;
+        }
+        pc = target;
+}
+
+void Iss::interrupt(int cause) { trap(1ull << 63 | cause, 0); }
+
+// the enabled interrupt with the highest priority (MEI, MSI, MTI, SEI, SSI, STI), or -1
+int Iss::pendingInterrupt() const {
+        uint8_t lines = mem.clintLines(0);
+        uint64_t pending = (csr.mip | (uint64_t)(lines >> 1 & 1) << 7 | (uint64_t)(lines & 1) << 3) & csr.mie;
+        bool mEnabled = csr.priv != 3 || (csr.mstatus & MSTATUS_MIE);
+        bool sEnabled = csr.priv == 0 || (csr.priv == 1 && (csr.mstatus & MSTATUS_SIE));
+        uint64_t enabled = (pending & ~csr.mideleg & (mEnabled ? ~0ull : 0)) |
+                           (pending & csr.mideleg & (sEnabled ? ~0ull : 0));
+        for (int code : {11, 3, 7, 9, 1, 5})
+                if (enabled >> code & 1) return code;
+        return -1;
+}
+
+// timing is set for values that only the RTL knows: the counters and the CLINT bits
+void Iss::readCsr(int addr, uint64_t &value, bool &timing) {
+        const PrivState &c = csr;
+        uint8_t lines = mem.clintLines(0);
+        uint64_t mip = c.mip | (uint64_t)(lines >> 1 & 1) << 7 | (uint64_t)(lines & 1) << 3;
+        timing = false;
+        if (addr >> 8 == 0xb || addr >> 8 == 0xc) {
+                int n = addr & 0xff;
+                value = n == 0 || n == 2 ? instret : 0;
+                timing = true;
+                return;
+        }
+        switch (addr) {
+        case 0x100: value = (c.mstatus | XLEN_FIELDS) & SSTATUS_MASK; break;
+        case 0x104: value = c.mie & c.mideleg; break;
+        case 0x105: value = c.stvec; break;
+        case 0x140: value = c.sscratch; break;
+        case 0x141: value = c.sepc; break;
+        case 0x142: value = c.scause; break;
+        case 0x143: value = c.stval; break;
+        case 0x144: value = mip & c.mideleg; timing = true; break;
+        case 0x180: value = c.satp; break;
+        case 0x300: value = c.mstatus | XLEN_FIELDS; break;
+        case 0x301: value = MISA; break;
+        case 0x302: value = c.medeleg; break;
+        case 0x303: value = c.mideleg; break;
+        case 0x304: value = c.mie; break;
+        case 0x305: value = c.mtvec; break;
+        case 0x340: value = c.mscratch; break;
+        case 0x341: value = c.mepc; break;
+        case 0x342: value = c.mcause; break;
+        case 0x343: value = c.mtval; break;
+        case 0x344: value = mip; timing = true; break;
+        default: value = 0; break;  // mhartid and the rest
+        }
+}
+
+// the counters are not writable here; they are not modelled
+void Iss::writeCsr(int addr, uint64_t wd) {
+        PrivState &c = csr;
+        switch (addr) {
+        case 0x100:
+        case 0x300: {
+                uint64_t status = addr == 0x100 ? (c.mstatus & ~SSTATUS_MASK) | (wd & SSTATUS_MASK & MSTATUS_MASK)
+                                                : wd & MSTATUS_MASK;
+                if ((status >> MSTATUS_MPP_SHIFT & 3) == 2)  // no H-mode
+                        status = (status & ~(3ull << MSTATUS_MPP_SHIFT)) | (c.mstatus & 3ull << MSTATUS_MPP_SHIFT);
+                c.mstatus = status;
+                flushTranslations();
+                break;
+        }
+        case 0x104: c.mie = (c.mie & ~c.mideleg) | (wd & c.mideleg & 0xaaa); break;
+        case 0x105: c.stvec = wd & ~2ull; break;
+        case 0x140: c.sscratch = wd; break;
+        case 0x141: c.sepc = wd & ~1ull; break;
+        case 0x142: c.scause = wd; break;
+        case 0x143: c.stval = wd; break;
+        case 0x144: c.mip = (c.mip & ~(c.mideleg & 2)) | (wd & c.mideleg & 2); break;
+        case 0x180:
+                if (wd >> 60 == 0 || wd >> 60 == 8) c.satp = wd;
+                flushTranslations();
+                break;
+        case 0x302: c.medeleg = wd & 0xb3ff; break;
+        case 0x303: c.mideleg = wd & 0x222; break;
+        case 0x304: c.mie = wd & 0xaaa; break;
+        case 0x305: c.mtvec = wd & ~2ull; break;
+        case 0x340: c.mscratch = wd; break;
+        case 0x341: c.mepc = wd & ~1ull; break;
+        case 0x342: c.mcause = wd; break;
+        case 0x343: c.mtval = wd; break;
+        case 0x344: c.mip = wd & 0x222; break;
+        default: break;
+        }
+}
+
+template <typename T> T Iss::load(uint64_t addr) {
+        int offset = addr & 7;
+        if (mem.uncached(addr)) {
+                uint8_t mask = ((1u << sizeof(T)) - 1) << offset;
+                return (T)(mem.ioLoad(addr, mask) >> offset * 8);
+        }
+        uint64_t inPage = addr & ((1 << Memory::PAGE_BITS) - 1);
+        if (inPage + sizeof(T) > (1 << Memory::PAGE_BITS)) {
+                uint64_t value = 0;
+                for (size_t i = 0; i < sizeof(T); i++) value |= (uint64_t)load<uint8_t>(addr + i) << i * 8;
+                return (T)value;
+        }
+        T value = 0;
+        if (uint8_t *p = host(addr, false)) memcpy(&value, p, sizeof(T));
+        return value;
+}
+
+template <typename T> void Iss::store(uint64_t addr, T value) {
+        int offset = addr & 7;
+        if (mem.uncached(addr)) {
+                uint8_t mask = ((1u << sizeof(T)) - 1) << offset;
+                mem.ioStore(addr, (uint64_t)value << offset * 8, mask);
+                return;
+        }
+        uint64_t inPage = addr & ((1 << Memory::PAGE_BITS) - 1);
+        if (inPage + sizeof(T) > (1 << Memory::PAGE_BITS)) {
+                for (size_t i = 0; i < sizeof(T); i++) store<uint8_t>(addr + i, (uint64_t)value >> i * 8);
+                return;
+        }
+        memcpy(host(addr, true), &value, sizeof(T));
+}
+
+static inline int64_t sext32(uint64_t v) { return (int32_t)v; }
+
+// RV64M division semantics, including division by zero and overflow
+static uint64_t divide(int funct3, uint64_t a, uint64_t b, bool word) {
+        if (word) {
+                int32_t sa = a, sb = b;
+                uint32_t ua = a, ub = b;
+                switch (funct3) {
+                case 4: return sb == 0 ? ~0ull : (sa == INT32_MIN && sb == -1) ? sext32(sa) : sext32(sa / sb);
+                case 5: return ub == 0 ? ~0ull : sext32(ua / ub);
+                case 6: return sb == 0 ? sext32(sa) : (sa == INT32_MIN && sb == -1) ? 0 : sext32(sa % sb);
+                default: return ub == 0 ? sext32(ua) : sext32(ua % ub);
+                }
+        }
+        int64_t sa = a, sb = b;
+        switch (funct3) {
+        case 4: return b == 0 ? ~0ull : (sa == INT64_MIN && sb == -1) ? a : (uint64_t)(sa / sb);
+        case 5: return b == 0 ? ~0ull : a / b;
+        case 6: return b == 0 ? a : (sa == INT64_MIN && sb == -1) ? 0 : (uint64_t)(sa % sb);
+        default: return b == 0 ? a : a % b;
+        }
+}
+
+static uint64_t rotateRight(uint64_t v, int n, int bits) {
+        uint64_t mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+        v &= mask;
+        return n ? (v >> n | v << (bits - n)) & mask : v;
+}
+
+// Zbb instructions encoded in the I-immediate of OP-IMM(-32) with funct3 1; false if imm
+// is none of them
+static bool bitmanipUnary(uint32_t imm, uint64_t a, bool word, uint64_t &value) {
+        uint64_t v = word ? (uint32_t)a : a;
+        int bits = word ? 32 : 64;
+        switch (imm) {
+        case 0x600: value = v ? __builtin_clzll(v) - (64 - bits) : bits; return true;  // clz(w)
+        case 0x601: value = v ? __builtin_ctzll(v) : bits; return true;                // ctz(w)
+        case 0x602: value = __builtin_popcountll(v); return true;                      // cpop(w)
+        case 0x604: value = (int8_t)a; return !word;                                   // sext.b
+        case 0x605: value = (int16_t)a; return !word;                                  // sext.h
+        default: return false;
+        }
+}
+
+// Zba and Zbb register-register instructions of OP and OP-32; false if funct7/funct3 is
+// none of them
+static bool bitmanip(uint32_t funct7, uint32_t funct3, uint64_t a, uint64_t b, bool word,
+                     uint64_t &value) {
+        if (!word) {
+                switch (funct7 << 3 | funct3) {
+                case 0x20 << 3 | 4: value = ~(a ^ b); return true;  // xnor
+                case 0x20 << 3 | 6: value = a | ~b; return true;    // orn
+                case 0x20 << 3 | 7: value = a & ~b; return true;    // andn
+                case 0x05 << 3 | 4: value = (int64_t)a < (int64_t)b ? a : b; return true;  // min
+                case 0x05 << 3 | 5: value = a < b ? a : b; return true;                    // minu
+                case 0x05 << 3 | 6: value = (int64_t)a < (int64_t)b ? b : a; return true;  // max
+                case 0x05 << 3 | 7: value = a < b ? b : a; return true;                    // maxu
+                case 0x30 << 3 | 1: value = rotateRight(a, -b & 63, 64); return true;  // rol
+                case 0x30 << 3 | 5: value = rotateRight(a, b & 63, 64); return true;   // ror
+                case 0x10 << 3 | 2: case 0x10 << 3 | 4: case 0x10 << 3 | 6:         // shNadd
+                        value = (a << funct3 / 2) + b;
+                        return true;
+                default: return false;
+                }
+        }
+        switch (funct7 << 3 | funct3) {
+        case 0x04 << 3 | 0: value = (uint32_t)a + b; return true;  // add.uw
+        case 0x04 << 3 | 4: value = (uint16_t)a; return true;      // zext.h (rs2 is 0)
+        case 0x30 << 3 | 1: value = sext32(rotateRight(a, -b & 31, 32)); return true;  // rolw
+        case 0x30 << 3 | 5: value = sext32(rotateRight(a, b & 31, 32)); return true;   // rorw
+        case 0x10 << 3 | 2: case 0x10 << 3 | 4: case 0x10 << 3 | 6:  // shNadd.uw
+                value = ((uint64_t)(uint32_t)a << funct3 / 2) + b;
+                return true;
+        default: return false;
+        }
+}
+
+static uint64_t multiply(int funct3, uint64_t a, uint64_t b) {
+        switch (funct3) {
+        case 0: return a * b;
+        case 1: return (unsigned __int128)((__int128)(int64_t)a * (int64_t)b) >> 64;
+        case 2: return (unsigned __int128)((__int128)(int64_t)a * (unsigned __int128)b) >> 64;
+        default: return ((unsigned __int128)a * b) >> 64;
+        }
+}
+
+// one instruction at pc; false with the cause and tval of an exception instead
+bool Iss::execute(Commit *commit, uint64_t &cause, uint64_t &tval) {
+        uint64_t ppc, ppc2;
+        if (!translate(pc, FETCH, ppc)) {
+                cause = 12;
+                tval = pc;
+                return false;
+        }
+        uint32_t raw = fetch(ppc);
+        if (!isCompressed(raw)) {
+                ppc2 = ppc + 2;
+                if (((pc + 2) & 0xfff) == 0 && !translate(pc + 2, FETCH, ppc2)) {
+                        cause = 12;
+                        tval = pc + 2;
+                        return false;
+                }
+                raw |= (uint32_t)fetch(ppc2) << 16;
+        }
+        uint32_t instr = expandCompressed(raw);
+        uint32_t opcode = instr & 0x7f, funct3 = instr >> 12 & 7, funct7 = instr >> 25;
+        int rd = instr >> 7 & 31;
+        uint64_t a = x[instr >> 15 & 31], b = x[instr >> 20 & 31];
+        int64_t iimm = (int32_t)instr >> 20;
+        int64_t simm = (int32_t)(((int32_t)instr >> 25 << 5) | (instr >> 7 & 31));
+        int64_t bimm = (int32_t)(((int32_t)instr >> 31 << 12) | (instr << 4 & 0x800) |
+                                 (instr >> 20 & 0x7e0) | (instr >> 7 & 0x1e));
+        int64_t jimm = (int32_t)(((int32_t)instr >> 31 << 20) | (instr & 0xff000) |
+                                 (instr >> 9 & 0x800) | (instr >> 20 & 0x7fe));
+        int64_t uimm = (int32_t)(instr & 0xfffff000);
+
+        uint64_t next = pc + instrBytes(raw), value = 0;
+        bool writes = true, timing = false, invalid = false;
+        switch (opcode) {
+        case 0x37: value = uimm; break;       // lui
+        case 0x17: value = pc + uimm; break;  // auipc
+        case 0x6f:                            // jal
+                value = next;
+                next = pc + jimm;
+                break;
+        case 0x67:  // jalr
+                value = next;
+                next = (a + iimm) & ~1ull;
+                break;
+        case 0x63: {  // branches
+                bool taken = false;
+                switch (funct3) {
+                case 0: taken = a == b; break;
+                case 1: taken = a != b; break;
+                case 4: taken = (int64_t)a < (int64_t)b; break;
+                case 5: taken = (int64_t)a >= (int64_t)b; break;
+                case 6: taken = a < b; break;
+                case 7: taken = a >= b; break;
+                default: invalid = true; break;
+                }
+                if (!invalid && taken) next = pc + bimm;
+                writes = false;
+                break;
+        }
+        case 0x03: {  // loads
+                uint64_t addr = a + iimm;
+                if (funct3 == 7) {
+                        invalid = true;
+                        break;
+                }
+                if (!translate(addr, LOAD, addr)) {
+                        cause = 13;
+                        tval = a + iimm;
+                        return false;
+                }
+                timing = addr >> 3 == CLINT_MTIME >> 3;
+                switch (funct3) {
+                case 0: value = (int8_t)load<uint8_t>(addr); break;
+                case 1: value = (int16_t)load<uint16_t>(addr); break;
+                case 2: value = (int32_t)load<uint32_t>(addr); break;
+                case 3: value = load<uint64_t>(addr); break;
+                case 4: value = load<uint8_t>(addr); break;
+                case 5: value = load<uint16_t>(addr); break;
+                case 6: value = load<uint32_t>(addr); break;
+                default: invalid = true; break;
+                }
+                break;
+        }
+        case 0x23: {  // stores
+                uint64_t addr = a + simm;
+                if (funct3 >= 4) {
+                        invalid = true;
+                        break;
+                }
+                if (!translate(addr, STORE, addr)) {
+                        cause = 15;
+                        tval = a + simm;
+                        return false;
+                }
+                switch (funct3) {
+                case 0: store<uint8_t>(addr, b); break;
+                case 1: store<uint16_t>(addr, b); break;
+                case 2: store<uint32_t>(addr, b); break;
+                case 3: store<uint64_t>(addr, b); break;
+                default: invalid = true; break;
+                }
+                writes = false;
+                break;
+        }
+        case 0x2f: {  // RV64A, mirrors ATOMICS in CPU.sv
+                int funct5 = instr >> 27;
+                bool lr = funct5 == 2, sc = funct5 == 3;
+                bool known = funct5 <= 4 || funct5 == 0x08 || funct5 == 0x0c || (funct5 >= 0x10 && funct5 % 4 == 0);
+                if (!known || (funct3 != 2 && funct3 != 3) || (lr && (instr >> 20 & 31) != 0)) {
+                        invalid = true;
+                        break;
+                }
+                uint64_t addr = a;
+                if (!translate(addr, lr ? LOAD : STORE, addr)) {
+                        cause = lr ? 13 : 15;
+                        tval = a;
+                        return false;
+                }
+                if (mem.uncached(addr)) {
+                        cause = lr ? 5 : 7;
+                        tval = a;
+                        return false;
+                }
+                bool word = funct3 == 2;
+                uint64_t old = word ? sext32(load<uint32_t>(addr)) : load<uint64_t>(addr);
+                uint64_t src = word ? sext32(b) : b, result;
+                switch (funct5) {
+                case 0x02: result = old; break;                                         // lr
+                case 0x03: result = src; break;                                         // sc
+                case 0x01: result = src; break;                                         // amoswap
+                case 0x00: result = old + src; break;                                   // amoadd
+                case 0x04: result = old ^ src; break;                                   // amoxor
+                case 0x0c: result = old & src; break;                                   // amoand
+                case 0x08: result = old | src; break;                                   // amoor
+                case 0x10: result = (int64_t)old < (int64_t)src ? old : src; break;     // amomin
+                case 0x14: result = (int64_t)old < (int64_t)src ? src : old; break;     // amomax
+                case 0x18: result = old < src ? old : src; break;                       // amominu
+                default: result = old < src ? src : old; break;                         // amomaxu
+                }
+                value = old;
+                bool ok = !lr;
+                if (lr) {
+                        reserved = true;
+                        reservation = addr;
+                } else if (sc) {
+                        ok = reserved && reservation == addr;
+                        value = !ok;
+                        reserved = false;
+                }
+                if (ok && word) store<uint32_t>(addr, result);
+                else if (ok) store<uint64_t>(addr, result);
+                break;
+        }
+        case 0x13: {  // op-imm
+                int shamt = instr >> 20 & 63, funct6 = instr >> 26;
+                switch (funct3) {
+                case 0: value = a + iimm; break;
+                case 1:
+                        if (funct6 == 0) value = a << shamt;
+                        else invalid = !bitmanipUnary(instr >> 20, a, false, value);
+                        break;
+                case 2: value = (int64_t)a < iimm; break;
+                case 3: value = a < (uint64_t)iimm; break;
+                case 4: value = a ^ iimm; break;
+                case 5:
+                        if (funct6 == 0x18) value = rotateRight(a, shamt, 64);        // rori
+                        else if (instr >> 20 == 0x287) {                            // orc.b
+                                value = 0;
+                                for (int i = 0; i < 64; i += 8)
+                                        if (a >> i & 0xff) value |= 0xffull << i;
+                        } else if (instr >> 20 == 0x6b8) value = __builtin_bswap64(a);  // rev8
+                        else value = instr >> 30 & 1 ? (uint64_t)((int64_t)a >> shamt) : a >> shamt;
+                        break;
+                case 6: value = a | iimm; break;
+                default: value = a & iimm; break;
+                }
+                break;
+        }
+        case 0x1b: {  // op-imm-32
+                int shamt = instr >> 20 & 31;
+                switch (funct3) {
+                case 0: value = sext32(a + iimm); break;
+                case 1:
+                        if (funct7 == 0) value = sext32(a << shamt);
+                        else if (instr >> 26 == 2) value = (uint64_t)(uint32_t)a << (instr >> 20 & 63);  // slli.uw
+                        else invalid = !bitmanipUnary(instr >> 20, a, true, value);
+                        break;
+                case 5:
+                        if (funct7 == 0x30) value = sext32(rotateRight(a, shamt, 32));  // roriw
+                        else value = instr >> 30 & 1 ? sext32((int32_t)a >> shamt) : sext32((uint32_t)a >> shamt);
+                        break;
+                default: invalid = true; break;
+                }
+                break;
+        }
+        case 0x33:  // op
+                if (funct7 == 1) {
+                        value = funct3 < 4 ? multiply(funct3, a, b) : divide(funct3, a, b, false);
+                        break;
+                }
+                if (funct7 != 0 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5))) {
+                        invalid = !bitmanip(funct7, funct3, a, b, false, value);
+                        break;
+                }
+                switch (funct3) {
+                case 0: value = funct7 & 0x20 ? a - b : a + b; break;
+                case 1: value = a << (b & 63); break;
+                case 2: value = (int64_t)a < (int64_t)b; break;
+                case 3: value = a < b; break;
+                case 4: value = a ^ b; break;
+                case 5: value = funct7 & 0x20 ? (uint64_t)((int64_t)a >> (b & 63)) : a >> (b & 63); break;
+                case 6: value = a | b; break;
+                default: value = a & b; break;
+                }
+                break;
+        case 0x3b:  // op-32
+                if (funct7 == 1) {
+                        if (funct3 == 0) value = sext32(a * b);
+                        else if (funct3 >= 4) value = divide(funct3, a, b, true);
+                        else invalid = true;
+                        break;
+                }
+                if (funct7 != 0 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5))) {
+                        invalid = !bitmanip(funct7, funct3, a, b, true, value);
+                        break;
+                }
+                switch (funct3) {
+                case 0: value = sext32(funct7 & 0x20 ? a - b : a + b); break;
+                case 1: value = sext32((uint32_t)a << (b & 31)); break;
+                case 5: value = funct7 & 0x20 ? sext32((int32_t)a >> (b & 31)) : sext32((uint32_t)a >> (b & 31)); break;
+                default: invalid = true; break;
+                }
+                break;
+        case 0x0f: writes = false; break;  // fence, fence.i
+        case 0x73: {
+                if (funct3 == 0) {
+                        writes = false;
+                        if (funct7 == 0x09 && rd == 0) {  // sfence.vma
+                                invalid = csr.priv == 0;
+                                if (!invalid) flushTranslations();
+                                break;
+                        }
+                        switch (instr) {
+                        case 0x00000073:  // ecall
+                                cause = 8 + csr.priv;
+                                tval = 0;
+                                return false;
+                        case 0x00100073:  // ebreak
+                                cause = 3;
+                                tval = 0;
+                                return false;
+                        case 0x30200073: {  // mret
+                                if (csr.priv != 3) {
+                                        invalid = true;
+                                        break;
+                                }
+                                uint64_t mpp = csr.mstatus >> MSTATUS_MPP_SHIFT & 3;
+                                uint64_t status = csr.mstatus & ~(MSTATUS_MIE | 3ull << MSTATUS_MPP_SHIFT);
+                                status |= (csr.mstatus & MSTATUS_MPIE ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+                                if (mpp != 3) status &= ~MSTATUS_MPRV;
+                                csr.mstatus = status;
+                                csr.priv = mpp;
+                                next = csr.mepc;
+                                break;
+                        }
+                        case 0x10200073: {  // sret
+                                if (csr.priv == 0) {
+                                        invalid = true;
+                                        break;
+                                }
+                                uint64_t status = csr.mstatus & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV);
+                                status |= (csr.mstatus & MSTATUS_SPIE ? MSTATUS_SIE : 0) | MSTATUS_SPIE;
+                                csr.priv = csr.mstatus & MSTATUS_SPP ? 1 : 0;
+                                csr.mstatus = status;
+                                next = csr.sepc;
+                                break;
+                        }
+                        case 0x10500073: break;  // wfi
+                        default: invalid = true; break;
+                        }
+                        break;
+                }
+                // Zicsr; csrrs/c with rs1 x0 and csrrsi/ci with a zero immediate only read
+                int addr = instr >> 20, rs1 = instr >> 15 & 31;
+                bool write = (funct3 & 3) == 1 || rs1 != 0;
+                if (funct3 == 4 || (uint64_t)(addr >> 8 & 3) > csr.priv || (addr >> 10 == 3 && write)) {
+                        invalid = true;
+                        break;
+                }
+                uint64_t src = funct3 & 4 ? rs1 : a;
+                readCsr(addr, value, timing);
+                if (write) writeCsr(addr, (funct3 & 3) == 1 ? src : (funct3 & 3) == 2 ? value | src : value & ~src);
+                break;
+        }
+        default: invalid = true; break;
+        }
+
+        if (invalid) {
+                cause = 2;
+                tval = 0;
+                return false;
+        }
+        if (writes && rd != 0) x[rd] = value;
+        if (commit) {
+                commit->pc = pc;
+                commit->instr = raw;
+                commit->rd = writes ? rd : 0;
+                commit->value = writes && rd ? value : 0;
+                commit->csr = timing;
+        }
+        pc = next;
+        return true;
+}
+
+// Traps as many times as it takes to execute an instruction. A handler that traps again
+// right away, or none at all (a zero tvec), halts; an ecall without a handler is how bare
+// programs end, anything else counts as illegal.
+bool Iss::step(Commit *commit) {
+        for (int traps = 0; !halted; traps++) {
+                uint64_t cause, tval = 0;
+                int irq = interrupts ? pendingInterrupt() : -1;
+                if (irq >= 0) {
+                        cause = 1ull << 63 | irq;
+                } else if (execute(commit, cause, tval)) {
+                        instret++;
+                        if (mem.exited) halted = true;
+                        return true;
+                }
+                if (handler(cause) == 0 || traps == 8) {
+                        halted = true;
+                        illegal = cause < 8 || cause > 11;
+                        return false;
+                }
+                trap(cause, tval);
+        }
+        return false;
+}
+
+uint64_t Iss::run(uint64_t n, uint64_t stopPc) {
+        uint64_t count = 0;
+        while (count < n && pc != stopPc && step()) count++;
+        return count;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "memory.h"
+
+// privileged state of the hart, as in the csrfile of CPU.sv; mip holds the bits software
+// may write, MTIP and MSIP come from the CLINT of Memory
+struct PrivState {
+        uint64_t priv = 3;  // 0: U, 1: S, 3: M
+        uint64_t mstatus = 0, medeleg = 0, mideleg = 0, mie = 0, mtvec = 0, mscratch = 0;
+        uint64_t mepc = 0, mcause = 0, mtval = 0, mip = 0;
+        uint64_t stvec = 0, sscratch = 0, sepc = 0, scause = 0, stval = 0, satp = 0;
+};
+
+// Functional RV64IMAC_Zba_Zbb model of hart 0, with M, S and U mode and Sv39. It works on
+// the same Memory as the RTL, so a program can be fast-forwarded here and continued on the
+// VCPU model from the state left behind, and it can follow the RTL instruction by
+// instruction as a checker. Traps go to mtvec/stvec like in the RTL; an ecall without a
+// handler stops it, and so does any other exception without one. CSR reads of the
+// counters return instret or zero.
+class Iss {
+public:
+        explicit Iss(Memory &mem);
+
+        // what one instruction did; rd is 0 when it writes no register
+        struct Commit {
+                uint64_t pc;
+                uint32_t instr;  // as encoded, in the low half when compressed
+                int rd;
+                uint64_t value;
+                bool csr;  // the value depends on microarchitectural counters or timing
+        };
+
+        // executes one instruction unless halted; commit, when given, receives its effects.
+        // Traps on the way retire nothing: the instruction is the first one of the handler.
+        bool step(Commit *commit = nullptr);
+
+        // runs until halted, n instructions have executed or the next pc is stopPc;
+        // returns the number executed
+        uint64_t run(uint64_t n, uint64_t stopPc = ~0ull);
+
+        // takes interrupt cause at pc, for a checker that follows the interrupts the RTL took
+        void interrupt(int cause);
+
+        uint64_t pc = 0;
+        uint64_t x[32] = {};
+        uint64_t instret = 0;
+        PrivState csr;
+        bool interrupts = true;  // takes pending interrupts itself before every instruction
+        bool halted = false;     // ecall, an HTIF exit or an exception without a handler
+        bool illegal = false;    // pc points at the offending instruction
+
+private:
+        enum Access { FETCH, LOAD, STORE };
+
+        bool execute(Commit *commit, uint64_t &cause, uint64_t &tval);
+        bool translate(uint64_t va, Access access, uint64_t &pa);
+        void flushTranslations();
+        uint64_t handler(uint64_t cause) const;
+        void trap(uint64_t cause, uint64_t tval);
+        int pendingInterrupt() const;
+        void readCsr(int addr, uint64_t &value, bool &timing);
+        void writeCsr(int addr, uint64_t value);
+
+        template <typename T> T load(uint64_t addr);
+        template <typename T> void store(uint64_t addr, T value);
+        uint8_t *host(uint64_t addr, bool write);
+        uint16_t fetch(uint64_t addr);
+
+        Memory &mem;
+
+        // of lr, for sc; a trap or any sc clears it
+        bool reserved = false;
+        uint64_t reservation = 0;
+
+        // recent Sv39 translations by VPN, superpages one 4 KiB page at a time, in front of
+        // the page table walk; one set for fetches and one for loads and stores, like the
+        // ITLB and DTLB. Each keeps its leaf PTE, so a hit checks the permissions under the
+        // current privilege, SUM and MXR again, and a store to a page without D walks to set
+        // it. sfence.vma and writes to satp and mstatus/sstatus flush them all.
+        static const int XLATE_ENTRIES = 256;
+        struct XlateEntry {
+                uint64_t vpn = ~0ull;
+                uint64_t pte = 0;  // the leaf, with the A and D bits written back
+                uint64_t ppn = 0;  // of the 4 KiB page
+        } xlate[2][XLATE_ENTRIES];
+
+        // page pointers of recent accesses, in front of the page map of Memory
+        static const int TLB_ENTRIES = 64;
+        struct TlbEntry {
+                uint64_t number = ~0ull;
+                uint8_t *page = nullptr;
+        } tlb[TLB_ENTRIES];
+};
@@ -0,0 +1,166 @@
+#include "loader.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "rvc.h"
+
+static bool readFile(const std::string &path, std::vector<uint8_t> &buf) {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        buf.resize(size > 0 ? size : 0);
+        bool ok = size >= 0 && fread(buf.data(), 1, buf.size(), f) == buf.size();
+        fclose(f);
+        return ok;
+}
+
+// the section headers, empty when the table is missing or malformed
+static std::vector<Elf64_Shdr> readSections(const std::vector<uint8_t> &file, const Elf64_Ehdr &ehdr) {
+        if (ehdr.e_shentsize != sizeof(Elf64_Shdr) ||
+            ehdr.e_shoff + (uint64_t)ehdr.e_shnum * sizeof(Elf64_Shdr) > file.size())
+                return {};
+        std::vector<Elf64_Shdr> shdrs(ehdr.e_shnum);
+        memcpy(shdrs.data(), file.data() + ehdr.e_shoff, shdrs.size() * sizeof(Elf64_Shdr));
+        return shdrs;
+}
+
+// sizes the code of the executable sections, walking them one instruction at a time
+static void measureCode(const std::vector<uint8_t> &file, const std::vector<Elf64_Shdr> &shdrs,
+                        Program &prog) {
+        prog.codeBytes = prog.instructions = prog.compressed = 0;
+        for (const Elf64_Shdr &section : shdrs) {
+                if (section.sh_type != SHT_PROGBITS || !(section.sh_flags & SHF_EXECINSTR) ||
+                    section.sh_offset + section.sh_size > file.size())
+                        continue;
+                const uint8_t *code = file.data() + section.sh_offset;
+                for (uint64_t off = 0; off + 2 <= section.sh_size;) {
+                        int bytes = instrBytes(code[off]);
+                        prog.instructions++;
+                        prog.compressed += bytes == 2;
+                        off += bytes;
+                }
+                prog.codeBytes += section.sh_size;
+        }
+}
+
+// picks up the tohost/fromhost mailboxes and the symbols in executable sections;
+// stripped or malformed symbol tables are ignored
+static void readSymbols(const std::vector<uint8_t> &file, const std::vector<Elf64_Shdr> &shdrs,
+                        Program &prog) {
+        // functions win over labels and globals over locals at the same address
+        struct Candidate {
+                Symbol sym;
+                int rank;
+                uint64_t sectionEnd;
+        };
+        std::vector<Candidate> found;
+        for (const Elf64_Shdr &symtab : shdrs) {
+                if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= shdrs.size()) continue;
+                const Elf64_Shdr &strtab = shdrs[symtab.sh_link];
+                if (symtab.sh_offset + symtab.sh_size > file.size() ||
+                    strtab.sh_offset + strtab.sh_size > file.size())
+                        continue;
+                for (uint64_t off = 0; off + sizeof(Elf64_Sym) <= symtab.sh_size; off += sizeof(Elf64_Sym)) {
+                        Elf64_Sym sym;
+                        memcpy(&sym, file.data() + symtab.sh_offset + off, sizeof(sym));
+                        if (sym.st_name >= strtab.sh_size) continue;
+                        const char *str = (const char *)file.data() + strtab.sh_offset + sym.st_name;
+                        std::string name(str, strnlen(str, strtab.sh_size - sym.st_name));
+                        if (name == "tohost") prog.tohost = sym.st_value;
+                        if (name == "fromhost") prog.fromhost = sym.st_value;
+
+                        int type = ELF64_ST_TYPE(sym.st_info);
+                        if ((type != STT_FUNC && type != STT_NOTYPE) || sym.st_shndx == SHN_UNDEF ||
+                            sym.st_shndx >= shdrs.size() || !(shdrs[sym.st_shndx].sh_flags & SHF_EXECINSTR))
+                                continue;
+                        // mapping symbols ($x, $d) and assembler-local labels
+                        if (name.empty() || name[0] == '$' || name.compare(0, 2, ".L") == 0) continue;
+                        const Elf64_Shdr &section = shdrs[sym.st_shndx];
+                        int rank = (type == STT_FUNC) * 2 + (ELF64_ST_BIND(sym.st_info) != STB_LOCAL);
+                        found.push_back({{name, sym.st_value, sym.st_size}, rank, section.sh_addr + section.sh_size});
+                }
+        }
+
+        std::sort(found.begin(), found.end(), [](const Candidate &a, const Candidate &b) {
+                return a.sym.addr != b.sym.addr ? a.sym.addr < b.sym.addr : a.rank > b.rank;
+        });
+        prog.symbols.clear();
+        for (size_t i = 0; i < found.size(); i++) {
+                if (i && found[i].sym.addr == found[i - 1].sym.addr) continue;
+                Symbol sym = found[i].sym;
+                if (sym.size == 0) {
+                        uint64_t end = found[i].sectionEnd;
+                        for (size_t j = i + 1; j < found.size(); j++)
+                                if (found[j].sym.addr != sym.addr) {
+                                        end = std::min(end, found[j].sym.addr);
+                                        break;
+                                }
+                        sym.size = end > sym.addr ? end - sym.addr : 0;
+                }
+                prog.symbols.push_back(std::move(sym));
+        }
+}
+
+bool loadElf(const std::string &path, Program &prog, std::string &err) {
+        std::vector<uint8_t> file;
+        if (!readFile(path, file)) {
+                err = "cannot read file";
+                return false;
+        }
+
+        Elf64_Ehdr ehdr;
+        if (file.size() < sizeof(ehdr) || memcmp(file.data(), ELFMAG, SELFMAG) != 0) {
+                err = "not an ELF file";
+                return false;
+        }
+        memcpy(&ehdr, file.data(), sizeof(ehdr));
+        if (ehdr.e_ident[EI_CLASS] != ELFCLASS64 || ehdr.e_ident[EI_DATA] != ELFDATA2LSB ||
+            ehdr.e_machine != EM_RISCV) {
+                err = "not a little-endian RV64 executable";
+                return false;
+        }
+        if (ehdr.e_phentsize != sizeof(Elf64_Phdr) ||
+            ehdr.e_phoff + (uint64_t)ehdr.e_phnum * sizeof(Elf64_Phdr) > file.size()) {
+                err = "truncated program header table";
+                return false;
+        }
+
+        prog.entry = ehdr.e_entry;
+        prog.segments.clear();
+        for (int i = 0; i < ehdr.e_phnum; i++) {
+                Elf64_Phdr phdr;
+                memcpy(&phdr, file.data() + ehdr.e_phoff + i * sizeof(phdr), sizeof(phdr));
+                if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0) continue;
+                if (phdr.p_filesz > phdr.p_memsz || phdr.p_offset + phdr.p_filesz > file.size()) {
+                        err = "segment lies outside the file";
+                        return false;
+                }
+                Segment seg;
+                seg.addr = phdr.p_paddr;
+                seg.size = phdr.p_memsz;
+                seg.bytes.assign(file.data() + phdr.p_offset, file.data() + phdr.p_offset + phdr.p_filesz);
+                prog.segments.push_back(std::move(seg));
+        }
+        if (prog.segments.empty()) {
+                err = "no loadable segments";
+                return false;
+        }
+        std::vector<Elf64_Shdr> shdrs = readSections(file, ehdr);
+        readSymbols(file, shdrs, prog);
+        measureCode(file, shdrs, prog);
+        return true;
+}
+
+const Symbol *findSymbol(const Program &prog, uint64_t addr) {
+        auto it = std::upper_bound(prog.symbols.begin(), prog.symbols.end(), addr,
+                                   [](uint64_t a, const Symbol &s) { return a < s.addr; });
+        if (it == prog.symbols.begin()) return nullptr;
+        --it;
+        return addr - it->addr < it->size ? &*it : nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// one PT_LOAD segment of p_memsz bytes; bytes holds the p_filesz of them in the file, the
+// rest (.bss) reads as zero
+struct Segment {
+        uint64_t addr, size;
+        std::vector<uint8_t> bytes;
+};
+
+// a code symbol; labels without a size extend to the next symbol or the end of the section
+struct Symbol {
+        std::string name;
+        uint64_t addr, size;
+};
+
+struct Program {
+        std::string name;
+        uint64_t entry;
+        std::vector<Segment> segments;
+        uint64_t tohost = 0, fromhost = 0;  // HTIF mailboxes, 0 when the symbols are missing
+        std::vector<Symbol> symbols;         // sorted by address, empty when stripped
+        // executable sections: bytes, instructions and how many of them are compressed
+        uint64_t codeBytes = 0, instructions = 0, compressed = 0;
+};
+
+// reads a little-endian RV64 executable; on failure returns false and explains why in err
+bool loadElf(const std::string &path, Program &prog, std::string &err);
+
+// the symbol whose code contains addr, nullptr when there is none
+const Symbol *findSymbol(const Program &prog, uint64_t addr);
@@ -0,0 +1,198 @@
+#include "memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "VCPU__Dpi.h"
+#include "rvc.h"
+
+thread_local Memory *Memory::current = nullptr;
+
+Memory::Memory(const MemoryTiming &timing) : timing(timing) {}
+
+Memory::Memory(const Memory &other)
+        : now(other.now), busyCycles(other.busyCycles), exited(other.exited),
+          exitCode(other.exitCode), console(other.console), tohost(other.tohost),
+          fromhost(other.fromhost), uartDlab(other.uartDlab), timing(other.timing),
+          channelFree(other.channelFree) {
+        memcpy(mtimecmp, other.mtimecmp, sizeof(mtimecmp));
+        memcpy(msip, other.msip, sizeof(msip));
+        for (const auto &p : other.pages) {
+                uint64_t *copy = new uint64_t[PAGE_WORDS];
+                memcpy(copy, p.second.get(), PAGE_WORDS * 8);
+                pages.emplace(p.first, std::unique_ptr<uint64_t[]>(copy));
+        }
+}
+
+void Memory::load(const Program &prog) {
+        auto setByte = [](uint64_t *p, uint64_t addr, uint8_t byte) {
+                int shift = (addr & 7) * 8;
+                uint64_t &word = p[(addr >> 3) % PAGE_WORDS];
+                word = (word & ~(0xffull << shift)) | ((uint64_t)byte << shift);
+        };
+        for (const Segment &seg : prog.segments) {
+                uint64_t addr = seg.addr;
+                for (size_t i = 0; i < seg.bytes.size(); i++, addr++) setByte(page(addr, true), addr, seg.bytes[i]);
+                // .bss: pages nothing was written to read as zero already, so only the ones
+                // that exist are cleared and the rest stay unallocated
+                for (uint64_t end = seg.addr + seg.size; addr < end;) {
+                        uint64_t next = std::min<uint64_t>(end, (addr | ((1 << PAGE_BITS) - 1)) + 1);
+                        if (uint64_t *p = page(addr, false))
+                                for (; addr < next; addr++) setByte(p, addr, 0);
+                        addr = next;
+                }
+        }
+        tohost = prog.tohost;
+        fromhost = prog.fromhost;
+}
+
+template <typename T> static bool put(FILE *f, const T &v) { return fwrite(&v, sizeof(v), 1, f) == 1; }
+template <typename T> static bool get(FILE *f, T &v) { return fread(&v, sizeof(v), 1, f) == 1; }
+
+bool Memory::save(FILE *f) const {
+        bool ok = put(f, now) && put(f, busyCycles) && put(f, channelFree) && put(f, tohost) &&
+                  put(f, fromhost) && put(f, uartDlab) && put(f, mtimecmp) && put(f, msip) &&
+                  put(f, exited) && put(f, exitCode) && put(f, (uint64_t)console.size()) &&
+                  fwrite(console.data(), 1, console.size(), f) == console.size() &&
+                  put(f, (uint64_t)pages.size());
+        for (auto it = pages.begin(); ok && it != pages.end(); ++it)
+                ok = put(f, it->first) && fwrite(it->second.get(), 8, PAGE_WORDS, f) == PAGE_WORDS;
+        return ok;
+}
+
+bool Memory::restore(FILE *f) {
+        uint64_t size, count;
+        if (!(get(f, now) && get(f, busyCycles) && get(f, channelFree) && get(f, tohost) &&
+              get(f, fromhost) && get(f, uartDlab) && get(f, mtimecmp) && get(f, msip) && get(f, exited) &&
+              get(f, exitCode) && get(f, size)))
+                return false;
+        console.resize(size);
+        if (fread(&console[0], 1, size, f) != size || !get(f, count)) return false;
+        pages.clear();
+        lastNumber = ~0ull;
+        lastPage = nullptr;
+        for (uint64_t i = 0; i < count; i++) {
+                uint64_t number;
+                if (!get(f, number)) return false;
+                uint64_t *p = page(number << PAGE_BITS, true);
+                if (fread(p, 8, PAGE_WORDS, f) != PAGE_WORDS) return false;
+        }
+        return true;
+}
+
+uint64_t *Memory::page(uint64_t addr, bool allocate) {
+        uint64_t number = addr >> PAGE_BITS;
+        if (number == lastNumber) return lastPage;
+        auto it = pages.find(number);
+        if (it == pages.end()) {
+                if (!allocate) return nullptr;
+                it = pages.emplace(number, std::unique_ptr<uint64_t[]>(new uint64_t[PAGE_WORDS]())).first;
+        }
+        lastNumber = number;
+        lastPage = it->second.get();
+        return lastPage;
+}
+
+uint64_t Memory::read(uint64_t addr) {
+        uint64_t *p = page(addr, false);
+        return p ? p[(addr >> 3) % PAGE_WORDS] : 0;
+}
+
+void Memory::write(uint64_t addr, uint64_t data) {
+        page(addr, true)[(addr >> 3) % PAGE_WORDS] = data;
+}
+
+uint32_t Memory::instruction(uint64_t pc) {
+        uint32_t lo = read(pc) >> (pc & 6) * 8 & 0xffff;
+        if (isCompressed(lo)) return lo;
+        uint64_t next = pc + 2;
+        return lo | (uint32_t)(read(next) >> (next & 6) * 8 & 0xffff) << 16;
+}
+
+void Memory::putchar(char c) {
+        console += c;
+        if (echo) {
+                fputc(c, stdout);
+                fflush(stdout);
+        }
+}
+
+// Only the registers a polled driver needs: the transmitter is always empty and
+// nothing is ever received. The CLINT has msip and mtimecmp of two harts, and mtime.
+uint64_t Memory::ioLoad(uint64_t addr, uint8_t mask) {
+        addr &= ~7ull;
+        if (addr == tohost || addr == fromhost) return read(addr);
+        if (addr == UART_BASE && (mask & 0x20)) return 0x60ull << 40;  // LSR: THR and TSR empty
+        if (addr == CLINT_BASE) return (uint64_t)msip[1] << 32 | msip[0];
+        if (addr >= CLINT_MTIMECMP && addr < CLINT_MTIMECMP + 8 * CLINT_HARTS) return mtimecmp[(addr - CLINT_MTIMECMP) / 8];
+        if (addr == CLINT_MTIME) return now;
+        return 0;
+}
+
+void Memory::ioStore(uint64_t addr, uint64_t data, uint8_t mask) {
+        addr &= ~7ull;
+        uint64_t word = read(addr);
+        for (int b = 0; b < 8; b++)
+                if (mask >> b & 1) word = (word & ~(0xffull << b * 8)) | (data & 0xffull << b * 8);
+
+        if (addr && addr == fromhost) {
+                write(addr, word);
+        } else if (addr && addr == tohost) {
+                // HTIF: device in bits 63:56, command in 55:48
+                uint64_t device = word >> 56, command = word >> 48 & 0xff;
+                if (device == 0 && (word & 1)) {
+                        exited = true;
+                        exitCode = word >> 1;
+                } else if (device == 1 && command == 1) {
+                        putchar(word & 0xff);
+                        write(fromhost, device << 56 | command << 48);
+                } else {
+                        // syscall proxying would need the dirty lines of the dcache
+                        printf("unsupported HTIF request 0x%lx\n", (unsigned long)word);
+                        write(fromhost, 1);
+                }
+        } else if (addr == UART_BASE) {
+                if (mask & 0x08) uartDlab = data >> 31 & 1;                // LCR
+                if ((mask & 0x01) && !uartDlab) putchar(data & 0xff);     // THR
+        } else if (addr == CLINT_BASE || (addr >= CLINT_MTIMECMP && addr < CLINT_MTIMECMP + 8 * CLINT_HARTS)) {
+                uint64_t reg = ioLoad(addr, 0xff);
+                for (int b = 0; b < 8; b++)
+                        if (mask >> b & 1) reg = (reg & ~(0xffull << b * 8)) | (data & 0xffull << b * 8);
+                if (addr == CLINT_BASE) {
+                        msip[0] = reg & 1;
+                        msip[1] = reg >> 32 & 1;
+                } else {
+                        mtimecmp[(addr - CLINT_MTIMECMP) / 8] = reg;
+                }
+        }
+}
+
+unsigned Memory::request(int, uint64_t, unsigned bytes, bool) {
+        uint64_t start = std::max(now, channelFree);
+        uint64_t transfer = (bytes + timing.bandwidth - 1) / timing.bandwidth;
+        channelFree = start + transfer;
+        busyCycles += transfer;
+        return start - now + timing.latency + transfer;
+}
+
+// DPI imports of the cache module in CPU.sv
+
+long long mem_read(long long addr) { return Memory::current->read(addr); }
+
+void mem_write(long long addr, long long data) { Memory::current->write(addr, data); }
+
+int mem_request(int port, long long addr, int bytes, svBit write) {
+        return Memory::current->request(port, addr, bytes, write);
+}
+
+long long mem_io_load(long long addr, char mask) { return Memory::current->ioLoad(addr, mask); }
+
+void mem_io_store(long long addr, long long data, char mask) {
+        Memory::current->ioStore(addr, data, mask);
+}
+
+// DPI import of the CPU module
+
+char clint_irq(int hart) { return Memory::current->clintLines(hart); }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "loader.h"
+
+// physical address map; RAM is everything at or above IO_LIMIT (RAM_BASE in CPU.sv)
+static const uint64_t UART_BASE = 0x10000000;  // 16550-style console, byte registers
+static const uint64_t CLINT_BASE = 0x2000000;  // msip of hart h at + 4 * h
+static const uint64_t CLINT_MTIMECMP = CLINT_BASE + 0x4000;  // of hart h at + 8 * h
+static const uint64_t CLINT_MTIME = CLINT_BASE + 0xbff8;  // counts cycles
+static const uint64_t IO_LIMIT = 0x80000000;   // the dcache does not cache anything below
+
+// timing of the backing memory behind the caches of CPU.sv
+struct MemoryTiming {
+        unsigned latency = 20;   // cycles until the first byte of a transfer
+        unsigned bandwidth = 8;  // bytes per cycle, shared by both ports
+};
+
+// Main memory and devices of one simulation. The caches reach it through the DPI
+// functions in memory.cpp, which use the instance bound to the calling thread; every
+// worker thread runs its own model, so each one binds its own memory.
+//
+// RAM covers the whole 64-bit physical address space. It is kept in 4 KiB pages that
+// are allocated on the first write, so a program only pays for what it touches;
+// untouched memory reads as zero.
+class Memory {
+public:
+        explicit Memory(const MemoryTiming &timing);
+        Memory(const Memory &other);  // deep copy of the pages, for a lockstep checker
+
+        // pages, device and channel state, for checkpoints; the timing is not part of it
+        bool save(FILE *f) const;
+        bool restore(FILE *f);
+
+        void load(const Program &prog);  // also picks up the HTIF mailboxes
+
+        // aligned doublewords, for line transfers
+        uint64_t read(uint64_t addr);
+        void write(uint64_t addr, uint64_t data);
+        // the instruction at pc as encoded, a compressed one in the low half
+        uint32_t instruction(uint64_t pc);
+
+        // the page holding addr; nullptr for a page never written unless allocate is set.
+        // Pages never move, so callers may keep the pointer.
+        uint64_t *page(uint64_t addr, bool allocate);
+
+        // uncached accesses of the dcache: devices below IO_LIMIT and the HTIF
+        // tohost/fromhost mailboxes; mask selects the bytes of the aligned doubleword
+        bool uncached(uint64_t addr) const {
+                addr &= ~7ull;
+                return addr < IO_LIMIT || (tohost && addr == tohost) || (fromhost && addr == fromhost);
+        }
+        uint64_t ioLoad(uint64_t addr, uint8_t mask);
+        void ioStore(uint64_t addr, uint64_t data, uint8_t mask);
+
+        // cycles until a line transfer issued now completes; transfers queue up on the
+        // one channel, each one occupying it for bytes / bandwidth cycles
+        unsigned request(int port, uint64_t addr, unsigned bytes, bool write);
+
+        // the CLINT interrupt lines of a hart: bit 1 MTIP (mtime >= mtimecmp), bit 0 MSIP
+        static const int CLINT_HARTS = 2;
+        uint8_t clintLines(int hart) const { return (now >= mtimecmp[hart]) << 1 | msip[hart]; }
+
+        uint64_t now = 0;         // current cycle, kept up to date by the harness
+        uint64_t busyCycles = 0;  // cycles the channel spent transferring lines
+        size_t pageCount() const { return pages.size(); }
+
+        bool exited = false;  // the program wrote (code << 1) | 1 to tohost
+        uint64_t exitCode = 0;
+        bool echo = false;    // copy console output to stdout as it is written
+        std::string console;  // everything written to the UART or the HTIF console
+
+        static thread_local Memory *current;
+
+        static const int PAGE_BITS = 12;
+        static const size_t PAGE_WORDS = (1 << PAGE_BITS) / 8;
+
+private:
+        void putchar(char c);
+
+        std::unordered_map<uint64_t, std::unique_ptr<uint64_t[]>> pages;
+        uint64_t lastNumber = ~0ull;  // most recently used page, which most accesses hit
+        uint64_t *lastPage = nullptr;
+
+        uint64_t tohost = 0, fromhost = 0;
+        bool uartDlab = false;  // LCR bit 7: offsets 0/1 address the divisor latch
+        uint64_t mtimecmp[CLINT_HARTS] = {~0ull, ~0ull};
+        bool msip[CLINT_HARTS] = {};
+
+        MemoryTiming timing;
+        uint64_t channelFree = 0;  // first cycle the channel is idle again
+};
@@ -0,0 +1,183 @@
+#include "profiler.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "rvc.h"
+
+Profiler::Profiler(const Program &prog, Memory &mem) : prog(prog), mem(mem) { enterStack(); }
+
+Profiler::PcStats &Profiler::at(uint64_t pc) {
+        if (pc == lastPc) return *last;
+        auto it = pcs.find(pc);
+        if (it == pcs.end()) {
+                it = pcs.emplace(pc, PcStats()).first;
+                if (const Symbol *sym = findSymbol(prog, pc))
+                        it->second.function = sym - prog.symbols.data();
+        }
+        lastPc = pc;
+        last = &it->second;  // elements of an unordered_map never move
+        return *last;
+}
+
+void Profiler::enterStack() {
+        auto it = stackIds.find(stack);
+        if (it == stackIds.end()) {
+                it = stackIds.emplace(stack, stacks.size()).first;
+                stacks.push_back(stack);
+        }
+        stackId = it->second;
+}
+
+void Profiler::cycle(uint64_t pc, uint64_t weight) {
+        PcStats &s = at(pc);
+        s.cycles += weight;
+        folded[(uint64_t)stackId << 32 | (uint32_t)(s.function + 1)] += weight;
+}
+
+void Profiler::stall(Stall kind, uint64_t pc, uint64_t count) { at(pc).stalls[kind] += count; }
+
+// calls and returns by the RISC-V psABI hints: jal/jalr linking through ra or t0, and
+// jalr x0 through one of them
+void Profiler::retire(uint64_t pc) {
+        PcStats &s = at(pc);
+        s.retired++;
+        uint32_t instr = expandCompressed(mem.instruction(pc));
+        uint32_t opcode = instr & 0x7f, rd = instr >> 7 & 31, rs1 = instr >> 15 & 31;
+        auto link = [](uint32_t r) { return r == 1 || r == 5; };
+        bool call = (opcode == 0x6f || opcode == 0x67) && link(rd);
+        // a jalr linking through one of them and jumping through the other swaps coroutines
+        bool ret = opcode == 0x67 && link(rs1) && (!link(rd) || rs1 != rd);
+        if (!call && !ret) return;
+        if (ret && !stack.empty()) stack.pop_back();
+        if (call && stack.size() < MAX_DEPTH) stack.push_back(s.function);
+        enterStack();
+}
+
+std::string Profiler::functionName(int function) const {
+        return function < 0 ? "[unknown]" : prog.symbols[function].name;
+}
+
+static void printStallHeader(FILE *f) {
+        for (int k = 0; k < STALLS; k++) fprintf(f, "%*s", k ? 10 : 8, STALL_NAMES[k]);
+}
+
+static void printStalls(FILE *f, const uint64_t *stalls) {
+        for (int k = 0; k < STALLS; k++) fprintf(f, "%*lu", k ? 10 : 8, (unsigned long)stalls[k]);
+}
+
+bool Profiler::write(const std::string &base, uint64_t period, std::string &err) const {
+        struct Row {
+                uint64_t cycles = 0, retired = 0;
+                uint64_t stalls[STALLS] = {};
+        };
+        std::vector<Row> functions(prog.symbols.size() + 1);  // the last one is [unknown]
+        Row total;
+        for (const auto &p : pcs) {
+                const PcStats &s = p.second;
+                Row &r = functions[s.function < 0 ? prog.symbols.size() : s.function];
+                for (Row *row : {&r, &total}) {
+                        row->cycles += s.cycles;
+                        row->retired += s.retired;
+                        for (int k = 0; k < STALLS; k++) row->stalls[k] += s.stalls[k];
+                }
+        }
+        auto percent = [&](uint64_t cycles) {
+                return total.cycles ? 100.0 * cycles / total.cycles : 0.0;
+        };
+        auto cpi = [](const Row &r) { return r.retired ? (double)r.cycles / r.retired : 0.0; };
+
+        std::string path = base + ".txt";
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f) {
+                err = "cannot write " + path;
+                return false;
+        }
+        fprintf(f, "%s: %lu cycles, %lu instructions, CPI %.3f", prog.name.c_str(),
+                (unsigned long)total.cycles, (unsigned long)total.retired, cpi(total));
+        if (period > 1) fprintf(f, ", cycles sampled every %lu", (unsigned long)period);
+        fprintf(f, "\n\nEach cycle goes to the instruction retiring in it, or else to the oldest one\n"
+                   "in flight. Stall columns are the cycles (flush: squashed slots) caused by the\n"
+                   "instructions of a row.\n\n");
+
+        std::vector<size_t> order;
+        for (size_t i = 0; i < functions.size(); i++)
+                if (functions[i].cycles || functions[i].retired) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return functions[a].cycles > functions[b].cycles;
+        });
+        fprintf(f, "      cycles       %%    cum%%        insns     CPI  ");
+        printStallHeader(f);
+        fprintf(f, "  function\n");
+        double cumulative = 0;
+        for (size_t i : order) {
+                const Row &r = functions[i];
+                cumulative += percent(r.cycles);
+                fprintf(f, "%12lu  %6.2f  %6.2f  %11lu  %6.2f  ", (unsigned long)r.cycles,
+                        percent(r.cycles), cumulative, (unsigned long)r.retired, cpi(r));
+                printStalls(f, r.stalls);
+                fprintf(f, "  %s\n", functionName(i < prog.symbols.size() ? (int)i : -1).c_str());
+        }
+
+        // the instructions that take the most cycles, or cause the most stalls
+        static const size_t HOTTEST = 50;
+        std::vector<std::pair<uint64_t, const PcStats *>> hot;
+        for (const auto &p : pcs) hot.push_back({p.first, &p.second});
+        auto weight = [](const PcStats *s) {
+                uint64_t w = s->cycles;
+                for (int k = 0; k < STALLS; k++) w += s->stalls[k];
+                return w;
+        };
+        std::sort(hot.begin(), hot.end(), [&](const std::pair<uint64_t, const PcStats *> &a,
+                                              const std::pair<uint64_t, const PcStats *> &b) {
+                uint64_t wa = weight(a.second), wb = weight(b.second);
+                return wa != wb ? wa > wb : a.first < b.first;
+        });
+        if (hot.size() > HOTTEST) hot.resize(HOTTEST);
+        std::sort(hot.begin(), hot.end());
+        fprintf(f, "\nHottest instructions, by address:\n"
+                   "                pc     instr      cycles       %%        insns     CPI  ");
+        printStallHeader(f);
+        fprintf(f, "  location\n");
+        for (const auto &h : hot) {
+                const PcStats &s = *h.second;
+                uint32_t instr = mem.read(h.first) >> (h.first & 4) * 8;
+                fprintf(f, "%18lx  %08x  %10lu  %6.2f  %11lu  %6.2f  ", (unsigned long)h.first,
+                        instr, (unsigned long)s.cycles, percent(s.cycles), (unsigned long)s.retired,
+                        s.retired ? (double)s.cycles / s.retired : 0.0);
+                printStalls(f, s.stalls);
+                if (s.function < 0)
+                        fprintf(f, "  [unknown]\n");
+                else
+                        fprintf(f, "  %s+0x%lx\n", prog.symbols[s.function].name.c_str(),
+                                (unsigned long)(h.first - prog.symbols[s.function].addr));
+        }
+        bool ok = !ferror(f);
+        if (!(fclose(f) == 0 && ok)) {
+                err = "error writing " + path;
+                return false;
+        }
+
+        // folded stacks, outermost caller first
+        path = base + ".folded";
+        FILE *g = fopen(path.c_str(), "w");
+        if (!g) {
+                err = "cannot write " + path;
+                return false;
+        }
+        std::vector<std::pair<std::string, uint64_t>> lines;
+        for (const auto &p : folded) {
+                std::string line;
+                for (int function : stacks[p.first >> 32]) line += functionName(function) + ";";
+                line += functionName((int)(uint32_t)p.first - 1);
+                lines.push_back({line, p.second});
+        }
+        std::sort(lines.begin(), lines.end());
+        for (const auto &l : lines)
+                fprintf(g, "%s %lu\n", l.first.c_str(), (unsigned long)l.second);
+        ok = !ferror(g);
+        ok = fclose(g) == 0 && ok;
+        if (!ok) err = "error writing " + path;
+        return ok;
+}
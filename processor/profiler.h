@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "loader.h"
+#include "memory.h"
+#include "stalls.h"
+
+// Per-pc cycle accounting of one RTL run. Every cycle is charged to the instruction
+// retiring in it or, when nothing retires, to the oldest instruction still in flight,
+// the one the pipeline is waiting for; the charges add up to the cycles of the run.
+// Stall and flush events are counted separately, on the instruction that caused them;
+// a flush counts the slots it squashed.
+//
+// A shadow call stack, kept from the calls and returns that retire, turns the cycles
+// into folded stacks ("main;foo;bar 1234") for flamegraph.pl and similar tools.
+class Profiler {
+public:
+        Profiler(const Program &prog, Memory &mem);
+
+        // charges weight cycles to pc; weight is the sampling period
+        void cycle(uint64_t pc, uint64_t weight);
+        // an instruction at pc retired; calls and returns move the shadow stack
+        void retire(uint64_t pc);
+        void stall(Stall kind, uint64_t pc, uint64_t count = 1);
+
+        // writes the flat profile to base.txt and the folded stacks to base.folded
+        bool write(const std::string &base, uint64_t period, std::string &err) const;
+
+private:
+        struct PcStats {
+                uint64_t cycles = 0, retired = 0;
+                uint64_t stalls[STALLS] = {};
+                int function = -1;  // index into prog.symbols, -1 outside every symbol
+        };
+        PcStats &at(uint64_t pc);
+        std::string functionName(int function) const;
+
+        const Program &prog;
+        Memory &mem;
+        std::unordered_map<uint64_t, PcStats> pcs;
+        uint64_t lastPc = ~0ull;  // consecutive cycles mostly charge the same instruction
+        PcStats *last = nullptr;
+
+        // call stacks are interned, so each cycle only bumps a (stack, leaf) counter
+        static const size_t MAX_DEPTH = 256;
+        std::vector<int> stack;  // functions of the calls that have not returned
+        std::map<std::vector<int>, uint32_t> stackIds;
+        std::vector<std::vector<int>> stacks;
+        uint32_t stackId = 0;
+        std::unordered_map<uint64_t, uint64_t> folded;  // stack id << 32 | leaf function + 1
+        void enterStack();
+};
@@ -0,0 +1,109 @@
+#include "rvc.h"
+
+// bits hi..lo of c, moved to bit lo of the result
+static inline uint32_t field(uint32_t c, int hi, int lo) { return c >> lo & ((1u << (hi - lo + 1)) - 1); }
+
+// sign-extends the low bits of v
+static inline uint32_t sext(uint32_t v, int bits) { return (uint32_t)((int32_t)(v << (32 - bits)) >> (32 - bits)); }
+
+enum {
+        LOAD = 0x03, STORE = 0x23, OP_IMM = 0x13, OP_IMM32 = 0x1b, OP = 0x33, OP32 = 0x3b, LUI = 0x37,
+        BRANCH = 0x63, JAL = 0x6f, JALR = 0x67
+};
+
+static uint32_t itype(uint32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
+        return (imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t stype(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3) {
+        return (imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 31) << 7 | STORE;
+}
+
+static uint32_t rtype(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd,
+                      uint32_t opcode) {
+        return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t btype(uint32_t imm, uint32_t rs1, uint32_t funct3) {
+        return (imm >> 12 & 1) << 31 | (imm >> 5 & 0x3f) << 25 | rs1 << 15 | funct3 << 12 |
+               (imm >> 1 & 15) << 8 | (imm >> 11 & 1) << 7 | BRANCH;
+}
+
+static uint32_t jtype(uint32_t imm, uint32_t rd) {
+        return (imm >> 20 & 1) << 31 | (imm >> 1 & 0x3ff) << 21 | (imm >> 11 & 1) << 20 |
+               (imm >> 12 & 0xff) << 12 | rd << 7 | JAL;
+}
+
+uint32_t expandCompressed(uint32_t instr) {
+        if (!isCompressed(instr)) return instr;
+        uint32_t c = instr & 0xffff;
+        uint32_t rd = field(c, 11, 7), rs2 = field(c, 6, 2);
+        uint32_t rs1p = 8 + field(c, 9, 7), rs2p = 8 + field(c, 4, 2);
+
+        uint32_t ciimm = sext(field(c, 12, 12) << 5 | field(c, 6, 2), 6);
+        uint32_t shamt = field(c, 12, 12) << 5 | field(c, 6, 2);
+        uint32_t addi4spn = field(c, 10, 7) << 6 | field(c, 12, 11) << 4 | field(c, 5, 5) << 3 |
+                            field(c, 6, 6) << 2;
+        uint32_t lwimm = field(c, 5, 5) << 6 | field(c, 12, 10) << 3 | field(c, 6, 6) << 2;
+        uint32_t ldimm = field(c, 6, 5) << 6 | field(c, 12, 10) << 3;
+        uint32_t addi16sp = sext(field(c, 12, 12) << 9 | field(c, 4, 3) << 7 | field(c, 5, 5) << 6 |
+                                 field(c, 2, 2) << 5 | field(c, 6, 6) << 4, 10);
+        uint32_t lwsp = field(c, 3, 2) << 6 | field(c, 12, 12) << 5 | field(c, 6, 4) << 2;
+        uint32_t ldsp = field(c, 4, 2) << 6 | field(c, 12, 12) << 5 | field(c, 6, 5) << 3;
+        uint32_t swsp = field(c, 8, 7) << 6 | field(c, 12, 9) << 2;
+        uint32_t sdsp = field(c, 9, 7) << 6 | field(c, 12, 10) << 3;
+        uint32_t jimm = sext(field(c, 12, 12) << 11 | field(c, 8, 8) << 10 | field(c, 10, 9) << 8 |
+                             field(c, 6, 6) << 7 | field(c, 7, 7) << 6 | field(c, 2, 2) << 5 |
+                             field(c, 11, 11) << 4 | field(c, 5, 3) << 1, 12);
+        uint32_t bimm = sext(field(c, 12, 12) << 8 | field(c, 6, 5) << 6 | field(c, 2, 2) << 5 |
+                             field(c, 11, 10) << 3 | field(c, 4, 3) << 1, 9);
+
+        switch (field(c, 15, 13) << 2 | field(c, 1, 0)) {
+        // quadrant 0
+        case 0x00: return addi4spn ? itype(addi4spn, 2, 0, rs2p, OP_IMM) : 0;  // c.addi4spn
+        case 0x08: return itype(lwimm, rs1p, 2, rs2p, LOAD);                   // c.lw
+        case 0x0c: return itype(ldimm, rs1p, 3, rs2p, LOAD);                   // c.ld
+        case 0x18: return stype(lwimm, rs2p, rs1p, 2);                         // c.sw
+        case 0x1c: return stype(ldimm, rs2p, rs1p, 3);                         // c.sd
+        // quadrant 1
+        case 0x01: return itype(ciimm, rd, 0, rd, OP_IMM);                      // c.addi, c.nop
+        case 0x05: return rd ? itype(ciimm, rd, 0, rd, OP_IMM32) : 0;           // c.addiw
+        case 0x09: return itype(ciimm, 0, 0, rd, OP_IMM);                       // c.li
+        case 0x0d:
+                if (rd == 2) return addi16sp ? itype(addi16sp, 2, 0, 2, OP_IMM) : 0;  // c.addi16sp
+                return ciimm ? ciimm << 12 | rd << 7 | LUI : 0;                       // c.lui
+        case 0x11:
+                switch (field(c, 11, 10)) {
+                case 0: return itype(shamt, rs1p, 5, rs1p, OP_IMM);             // c.srli
+                case 1: return itype(0x400 | shamt, rs1p, 5, rs1p, OP_IMM);     // c.srai
+                case 2: return itype(ciimm, rs1p, 7, rs1p, OP_IMM);             // c.andi
+                default:
+                        switch (field(c, 12, 12) << 2 | field(c, 6, 5)) {
+                        case 0: return rtype(0x20, rs2p, rs1p, 0, rs1p, OP);    // c.sub
+                        case 1: return rtype(0, rs2p, rs1p, 4, rs1p, OP);       // c.xor
+                        case 2: return rtype(0, rs2p, rs1p, 6, rs1p, OP);       // c.or
+                        case 3: return rtype(0, rs2p, rs1p, 7, rs1p, OP);       // c.and
+                        case 4: return rtype(0x20, rs2p, rs1p, 0, rs1p, OP32);  // c.subw
+                        case 5: return rtype(0, rs2p, rs1p, 0, rs1p, OP32);     // c.addw
+                        default: return 0;
+                        }
+                }
+        case 0x15: return jtype(jimm, 0);                                       // c.j
+        case 0x19: return btype(bimm, rs1p, 0);                                 // c.beqz
+        case 0x1d: return btype(bimm, rs1p, 1);                                 // c.bnez
+        // quadrant 2
+        case 0x02: return itype(shamt, rd, 1, rd, OP_IMM);                      // c.slli
+        case 0x0a: return rd ? itype(lwsp, 2, 2, rd, LOAD) : 0;                 // c.lwsp
+        case 0x0e: return rd ? itype(ldsp, 2, 3, rd, LOAD) : 0;                 // c.ldsp
+        case 0x12:
+                if (!field(c, 12, 12)) {
+                        if (rs2) return rtype(0, rs2, 0, 0, rd, OP);            // c.mv
+                        return rd ? itype(0, rd, 0, 0, JALR) : 0;               // c.jr
+                }
+                if (rs2) return rtype(0, rs2, rd, 0, rd, OP);                   // c.add
+                return rd ? itype(0, rd, 0, 1, JALR) : 0x00100073;              // c.jalr, c.ebreak
+        case 0x1a: return stype(swsp, rs2, 2, 2);                               // c.swsp
+        case 0x1e: return stype(sdsp, rs2, 2, 3);                               // c.sdsp
+        default: return 0;
+        }
+}
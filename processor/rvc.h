@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// RV64C, as the decompress module of CPU.sv expands it
+
+// the low two bits of every 32-bit instruction are 11
+static inline bool isCompressed(uint32_t instr) { return (instr & 3) != 3; }
+static inline int instrBytes(uint32_t instr) { return isCompressed(instr) ? 2 : 4; }
+
+// the RV64I instruction a compressed one stands for; 32-bit instructions come back
+// unchanged, reserved and floating-point encodings as 0
+uint32_t expandCompressed(uint32_t instr);
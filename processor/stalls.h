@@ -0,0 +1,19 @@
+#pragma once
+
+// Stall and flush causes, under the same conditions as the hpm counters of CPU.sv. The
+// profiler charges them to the instructions causing them; the commit log records the ones
+// each instruction waited for.
+enum Stall {
+        LOAD_USE,        // consumer of a load still in EX
+        BRANCH_OPERAND,  // early branch waiting for its operands
+        FLUSH,           // slots squashed by a misprediction
+        ICACHE,          // bubbles fetched behind an icache miss
+        DCACHE,          // cycles frozen by a dcache miss
+        MULDIV,          // cycles EX waited for the multiply/divide unit
+        TLB,             // fetch or an access waiting for a page table walk
+        STALLS
+};
+
+static const char *const STALL_NAMES[STALLS] = {"load-use", "br-opnd",  "flush",
+                                                "ic-stall", "dc-stall", "md-stall",
+                                                "tlb-stall"};